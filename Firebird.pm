@@ -23,11 +23,12 @@ $VERSION = '1.39';
 
 bootstrap DBD::Firebird $VERSION;
 
-use vars qw($VERSION $err $errstr $drh);
+use vars qw($VERSION $err $errstr $drh $methods_installed);
 
 $err = 0;
 $errstr = "";
 $drh = undef;
+$methods_installed = 0;
 
 sub CLONE
 {
@@ -47,6 +48,18 @@ sub driver
                                   'Err'    => \$DBD::Firebird::err,
                                   'Errstr' => \$DBD::Firebird::errstr,
                                   'Attribution' => 'DBD::Firebird by Edwin Pratomo and Daniel Ritz'});
+
+    unless ($methods_installed++) {
+        DBD::Firebird::db->install_method($_)
+            for qw(ib_txn ib_define_tx_profile ib_use_tx_profile
+                   ib_async_fd ib_cancel ib_cancel_after ib_parallel_select
+                   ib_bulk_load ib_bulk_load_begin ib_bulk_load_end);
+        DBD::Firebird::st->install_method($_)
+            for qw(ib_fetch_into_hash ib_execute_async ib_fetch_async
+                   ib_async_result ib_export ib_fetch_arrow
+                   ib_fetchall_mmap ib_fetch_lazy);
+    }
+
     $drh;
 }
 
@@ -194,10 +207,51 @@ sub prepare
     $sth;
 }
 
+# catalog data kept for ib_cache_metadata, per database identity
+my %meta_cache;
+
+sub _cached_info
+{
+    my ($dbh, $what, $key, $build) = @_;
+
+    return $build->() unless $dbh->{ib_cache_metadata};
+
+    my ($db, $generation) = DBD::Firebird::db::_db_cache_tag($dbh);
+    return $build->() unless defined $db;
+
+    # committed DDL moves the generation on and drops what we had
+    my $c = $meta_cache{$db};
+    $c = $meta_cache{$db} = { generation => $generation, info => {} }
+        if !$c or $c->{generation} != $generation;
+
+    my $info = $c->{info}{$key};
+    unless ($info) {
+        my $sth = $build->() or return undef;
+        my $rows = $sth->fetchall_arrayref;
+        return undef if $sth->err;
+        $info = $c->{info}{$key} = { NAME => [ @{ $sth->{NAME} } ], rows => $rows };
+    }
+
+    require DBD::Firebird::TableInfo::Basic;
+    DBD::Firebird::TableInfo::Basic->sponge($dbh, $what, {
+        NAME => [ @{ $info->{NAME} } ],
+        rows => [ map { [@$_] } @{ $info->{rows} } ],
+    });
+}
+
 sub primary_key_info
 {
     my ($dbh, undef, undef, $tbl) = @_;
 
+    no warnings 'uninitialized';
+    _cached_info($dbh, 'primary_key_info', "pk\0$tbl",
+        sub { _primary_key_info($dbh, $tbl) });
+}
+
+sub _primary_key_info
+{
+    my ($dbh, $tbl) = @_;
+
     my $sth = $dbh->prepare(<<'__eosql');
     SELECT CAST(NULL AS CHAR(1))       AS TABLE_CAT,
            CAST(NULL AS CHAR(1))       AS TABLE_SCHEM,
@@ -248,7 +302,8 @@ sub table_info
         my @types = grep { length and not $seen{$_}++ }
                         map { s/'//g; s/^\s+//; s/\s+$//; uc }
                             split(',' => $type);
-        return $ti->list_tables($self, $name, @types);
+        return _cached_info($self, 'table_info', join("\0", 'tables', $name, @types),
+            sub { $ti->list_tables($self, $name, @types) });
     }
 }
 
@@ -263,6 +318,308 @@ sub ping
     return $ret;
 }
 
+sub ib_define_tx_profile
+{
+    my ($dbh, %profiles) = @_;
+
+    while (my ($name, $p) = each %profiles) {
+        ref($p) eq 'HASH'
+            or croak "Transaction profile '$name' must be a hash ref";
+
+        # the shortcuts set what the plain keys set
+        croak "Transaction profile '$name': lock_timeout conflicts with lock_resolution"
+            if exists $p->{lock_timeout} and exists $p->{lock_resolution};
+        croak "Transaction profile '$name': read_consistency conflicts with isolation_level"
+            if exists $p->{read_consistency} and exists $p->{isolation_level};
+
+        my %param = map { ("-$_" => $p->{$_}) }
+            grep { $_ ne 'lock_timeout' and $_ ne 'read_consistency' } keys %$p;
+
+        $param{-lock_resolution} = { wait => $p->{lock_timeout} }
+            if $p->{lock_timeout};
+
+        $param{-isolation_level} = [ 'read_committed', 'read_consistency' ]
+            if $p->{read_consistency};
+
+        DBD::Firebird::db::_define_tx_profile($dbh, $name, %param)
+            or return undef;
+    }
+
+    return 1;
+}
+
+sub begin_work
+{
+    my ($dbh, $attr) = @_;
+
+    return $dbh->set_err($DBI::stderr, "Already in a transaction")
+        unless $dbh->FETCH('AutoCommit');
+
+    if ($attr and defined $attr->{ib_profile}) {
+        DBD::Firebird::db::_begin_tx_profile($dbh, $attr->{ib_profile})
+            or return undef;
+    }
+
+    return $dbh->SUPER::begin_work;
+}
+
+sub ib_txn
+{
+    my ($dbh, $code, %opt) = @_;
+
+    ref($code) eq 'CODE'
+        or croak 'Usage: $dbh->ib_txn(sub { ... }, retries => N, backoff => ...)';
+
+    require Time::HiRes;
+
+    my $retries = defined $opt{retries}     ? $opt{retries}     : 3;
+    my $backoff = defined $opt{backoff}     ? $opt{backoff}     : 0.05;
+    my $max     = defined $opt{backoff_max} ? $opt{backoff_max} : 2;
+    my $want    = wantarray;
+
+    # a rollback on conflict would throw away the caller's work too
+    return $dbh->set_err($DBI::stderr,
+        'ib_txn: AutoCommit is off, a transaction may be open already')
+        unless $dbh->FETCH('AutoCommit');
+
+    # the code gets the handle the caller has, not DBI's inner one
+    my $outer = (DBI::_handles($dbh))[0];
+
+    for (my $attempt = 1; ; $attempt++)
+    {
+        my $started = Time::HiRes::time();
+        my @result;
+
+        # forget conflicts not raised by this transaction
+        DBD::Firebird::db::_txn_conflict($dbh);
+
+        my $ok = eval {
+            local $dbh->{RaiseError} = 1;
+            $dbh->begin_work;
+
+            if ($want) { @result = $code->($outer) }
+            elsif (defined $want) { $result[0] = $code->($outer) }
+            else { $code->($outer) }
+
+            $dbh->commit;
+            1;
+        };
+        return $want ? @result : $result[0] if $ok;
+
+        my $error    = $@;
+        my $conflict = DBD::Firebird::db::_txn_conflict($dbh);
+
+        {
+            local $@;
+            local $dbh->{RaiseError} = 0;
+            local $dbh->{PrintError} = 0;
+            $dbh->rollback unless $dbh->{AutoCommit};
+        }
+
+        my $retry = $conflict && $attempt <= $retries;
+
+        # equal jitter: sleep half the exponential delay and a random part
+        # of the other half, so that the competing transactions do not
+        # collide again
+        my $delay = 0;
+        if ($retry) {
+            if (ref($backoff) eq 'CODE') {
+                $delay = $backoff->($attempt, $conflict);
+            } else {
+                $delay = $backoff * 2 ** ($attempt - 1);
+                $delay = $max if $delay > $max;
+                $delay = $delay / 2 + rand($delay / 2);
+            }
+            Time::HiRes::sleep($delay) if $delay > 0;
+        }
+
+        die $error unless $retry;
+
+        # only the attempts thrown away for another run count as wasted
+        DBD::Firebird::db::_txn_wasted($dbh, Time::HiRes::time() - $started);
+    }
+}
+
+sub ib_parallel_select
+{
+    my ($dbh, $sql, %opt) = @_;
+
+    require DBD::Firebird::ParallelSelect;
+    my $it = DBD::Firebird::ParallelSelect->new($dbh, $sql, %opt)
+        or return undef;
+
+    return $opt{on_row} ? $it->run($opt{on_row}) : $it;
+}
+
+sub ib_bulk_load_begin
+{
+    my ($dbh, $table, %opt) = @_;
+
+    defined $table
+        or croak 'Usage: $dbh->ib_bulk_load_begin($table, %options)';
+
+    return $dbh->set_err($DBI::stderr, "A bulk load is already in progress on this connection")
+        if $dbh->{private_ib_bulk_load};
+    return $dbh->set_err($DBI::stderr, "ib_bulk_load_begin needs AutoCommit")
+        unless $dbh->FETCH('AutoCommit');
+
+    require Time::HiRes;
+
+    my $started = Time::HiRes::time();
+    my $s = {
+        table    => $table =~ /^"(.*)"$/ ? $1 : uc($table),
+        indexes  => [],
+        triggers => [],
+        times    => {},
+    };
+
+    # connect before changing anything, this is the step most likely to fail
+    if ($opt{no_db_triggers}) {
+        $s->{loader} = $dbh->clone({ ib_db_triggers => 0 })
+            or return $dbh->set_err($DBI::stderr, "ib_bulk_load_begin: $DBI::errstr");
+    }
+
+    my $ok = eval {
+        local $dbh->{RaiseError} = 1;
+        local $dbh->{PrintError} = 0;
+
+        # indexes backing a constraint cannot be deactivated
+        my $indexes = $dbh->selectcol_arrayref(<<'SQL', undef, $s->{table});
+SELECT I.RDB$INDEX_NAME FROM RDB$INDICES I
+WHERE I.RDB$RELATION_NAME = ?
+  AND COALESCE(I.RDB$INDEX_INACTIVE, 0) = 0
+  AND COALESCE(I.RDB$SYSTEM_FLAG, 0) = 0
+  AND NOT EXISTS (SELECT 1 FROM RDB$RELATION_CONSTRAINTS C
+                  WHERE C.RDB$INDEX_NAME = I.RDB$INDEX_NAME)
+SQL
+        for my $name (@$indexes) {
+            $name =~ s/\s+\z//;
+            $dbh->do(qq{ALTER INDEX "$name" INACTIVE});
+            push @{ $s->{indexes} }, $name;
+        }
+
+        if (defined $opt{triggers} and !$opt{triggers}) {
+            my $triggers = $dbh->selectcol_arrayref(<<'SQL', undef, $s->{table});
+SELECT RDB$TRIGGER_NAME FROM RDB$TRIGGERS
+WHERE RDB$RELATION_NAME = ?
+  AND COALESCE(RDB$TRIGGER_INACTIVE, 0) = 0
+  AND COALESCE(RDB$SYSTEM_FLAG, 0) = 0
+SQL
+            for my $name (@$triggers) {
+                $name =~ s/\s+\z//;
+                $dbh->do(qq{ALTER TRIGGER "$name" INACTIVE});
+                push @{ $s->{triggers} }, $name;
+            }
+        }
+        1;
+    };
+
+    unless ($ok) {
+        my $error = $@;
+        _bulk_load_restore($dbh, $s);
+        $s->{loader}->disconnect if $s->{loader};
+        return $dbh->set_err($DBI::stderr, "ib_bulk_load_begin: $error");
+    }
+
+    $s->{load_started} = Time::HiRes::time();
+    $s->{times}{deactivate} = $s->{load_started} - $started;
+    $dbh->{private_ib_bulk_load} = $s;
+
+    return $s->{loader} || (DBI::_handles($dbh))[0];
+}
+
+sub ib_bulk_load_end
+{
+    my ($dbh) = @_;
+
+    my $s = $dbh->{private_ib_bulk_load}
+        or return $dbh->set_err($DBI::stderr, "No bulk load in progress on this connection");
+    $dbh->{private_ib_bulk_load} = undef;
+
+    $s->{times}{load} = Time::HiRes::time() - $s->{load_started};
+
+    if (my $loader = delete $s->{loader}) {
+        local $@;
+        eval { $loader->disconnect };
+    }
+
+    my @errors = _bulk_load_restore($dbh, $s);
+
+    # recompute the selectivity of all the indexes of the table
+    my $started = Time::HiRes::time();
+    my $ok = eval {
+        local $dbh->{RaiseError} = 1;
+        local $dbh->{PrintError} = 0;
+
+        my $indexes = $dbh->selectcol_arrayref(<<'SQL', undef, $s->{table});
+SELECT RDB$INDEX_NAME FROM RDB$INDICES
+WHERE RDB$RELATION_NAME = ? AND COALESCE(RDB$INDEX_INACTIVE, 0) = 0
+SQL
+        for my $name (@$indexes) {
+            $name =~ s/\s+\z//;
+            $dbh->do(qq{SET STATISTICS INDEX "$name"});
+        }
+        1;
+    };
+    push @errors, $@ unless $ok;
+    $s->{times}{statistics} = Time::HiRes::time() - $started;
+
+    if (@errors) {
+        chomp @errors;
+        return $dbh->set_err($DBI::stderr,
+            join("\n", "ib_bulk_load_end:", @errors));
+    }
+
+    return {
+        %{ $s->{times} },
+        indexes  => $s->{indexes},
+        triggers => $s->{triggers},
+    };
+}
+
+# ib_bulk_load_begin, the code, and ib_bulk_load_end however the code ends
+sub ib_bulk_load
+{
+    my ($dbh, $table, $code, %opt) = @_;
+
+    defined $table and ref($code) eq 'CODE'
+        or croak 'Usage: $dbh->ib_bulk_load($table, sub { ... }, %options)';
+
+    my $load = ib_bulk_load_begin($dbh, $table, %opt)
+        or return;
+
+    my $ok = eval { $code->($load); 1 };
+    my $error = $@;
+    my $times = ib_bulk_load_end($dbh);
+
+    die $error unless $ok;
+    return $times;
+}
+
+# Reactivates what ib_bulk_load_begin deactivated. An index failing to come
+# back (a unique index on duplicate keys) does not keep the others inactive.
+sub _bulk_load_restore
+{
+    my ($dbh, $s) = @_;
+    my @errors;
+
+    my $started = Time::HiRes::time();
+    local $dbh->{RaiseError} = 1;
+    local $dbh->{PrintError} = 0;
+
+    for my $name (@{ $s->{indexes} }) {
+        eval { $dbh->do(qq{ALTER INDEX "$name" ACTIVE}); 1 }
+            or push @errors, $@;
+    }
+    for my $name (@{ $s->{triggers} }) {
+        eval { $dbh->do(qq{ALTER TRIGGER "$name" ACTIVE}); 1 }
+            or push @errors, $@;
+    }
+    $s->{times}{activate} = Time::HiRes::time() - $started;
+
+    return @errors;
+}
+
 # The get_info function was automatically generated by
 # DBI::DBD::Metadata::write_getinfo_pm v1.05.
 
@@ -315,6 +672,28 @@ sub bind_param_array {
     1;
 }
 
+sub ib_fetchall_mmap
+{
+    my ($sth, %opt) = @_;
+
+    for (keys %opt) {
+        Carp::croak "ib_fetchall_mmap: unknown option $_"
+            unless $_ eq 'path' or $_ eq 'keep';
+    }
+
+    require DBD::Firebird::Spill;
+    return $sth->_ib_spill((DBI::_handles($sth))[0], $opt{path},
+        $opt{keep} ? 1 : 0);
+}
+
+sub ib_fetch_lazy
+{
+    my $sth = shift;
+
+    require DBD::Firebird::Row;
+    return $sth->_ib_fetch_lazy((DBI::_handles($sth))[0]);
+}
+
 1;
 
 __END__
@@ -553,6 +932,10 @@ Implemented by DBI, no driver-specific impact.
 
 Supported by the driver as proposed by DBI. 
 
+Without it, a C<CHAR(n)> value in C<UTF8> or C<UNICODE_FSS> is returned as
+exactly I<n> characters, its text followed by blanks, whatever the number of
+bytes per character.
+
 =item B<LongReadLen> (integer, inherited)
 
 Supported by the driver as proposed by DBI.The default value is 80 bytes. 
@@ -760,6 +1143,23 @@ statement handles under AutoCommit on.
 Switching the attribute's value from TRUE to FALSE will force hard commit thus
 closing the current transaction. 
 
+=item B<ib_softcommit_max_commits>  (driver-specific, integer)
+
+=item B<ib_softcommit_max_age>  (driver-specific, integer, seconds)
+
+A transaction kept open by soft commits holds back the oldest interesting
+transaction, which stops garbage collection on a busy database. With these
+set, C<commit> does a hard commit instead of a soft one once the transaction
+has seen the given number of commits, or has been open for the given number
+of seconds. The next statement then starts a fresh transaction.
+
+The hard commit is delayed while any statement of the handle still has an
+open cursor. Both default to 0, which disables the limit.
+
+ $dbh->{ib_softcommit} = 1;
+ $dbh->{ib_softcommit_max_commits} = 1000;
+ $dbh->{ib_softcommit_max_age}     = 300;
+
 =item B<ib_enable_utf8>  (driver-specific, boolean)
 
 Setting this attribute to TRUE will cause any Perl Unicode strings supplied as
@@ -769,15 +1169,95 @@ to Firebird.
 Also, any character data retrieved from the database (CHAR, VARCHAR, BLOB
 sub_type TEXT) will be upgraded to Perl Unicode strings.
 
-B<Caveat>: Currently this is supported only if the B<ib_charset> DSN parameter
-is C<UTF8>. In the future, encoding and decoding to/from arbitrary character
-set may be implemented.
+B<Caveat>: This is supported only if the B<ib_charset> DSN parameter is
+C<UTF8>, C<WIN1251> or C<ISO8859_1>.
+
+With C<WIN1251> or C<ISO8859_1> the server sends one byte per character and
+the driver converts through lookup tables: fetched text in the connection
+character set is decoded to Perl Unicode strings, and Unicode strings bound to
+text parameters are encoded back. A character with no equivalent in the
+connection character set is an error (C<Cannot transliterate character>).
+Byte strings are sent unchanged, so data already encoded in the connection
+character set still works. Buffers stay at one byte per character, where a
+C<UTF8> connection needs four.
 
 Example:
 
     $dbh = DBI->connect( 'dbi:Firebird:db=database.fdb;ib_charset=UTF8',
         { ib_enable_utf8 => 1 } );
 
+Fetched values are flagged only when they are well-formed UTF-8 and not plain
+ASCII. The check skips ASCII runs a vector register at a time where the
+compiler targets SSE2 or AVX2.
+
+=item B<ib_trust_utf8>  (driver-specific, boolean)
+
+With B<ib_enable_utf8> on, flags values of C<CHARACTER SET UTF8> columns as
+Perl Unicode strings without checking them first, since the server only
+stores well-formed UTF-8. Plain ASCII values are flagged too. Columns in
+other character sets, like C<OCTETS> or C<NONE>, are still checked. Requires
+B<ib_charset> C<UTF8>, like B<ib_enable_utf8>. Off by default.
+
+=item B<ib_cache_metadata>  (driver-specific, boolean)
+
+Keeps the results of C<primary_key_info> and C<table_info> in a cache shared
+by every connection of the process to the same database, so pre-forked or
+pooled workers query the catalog once. A database is recognized by its
+server-side identity and creation time, not by the DSN. Committed DDL from
+any connection of this process empties the cache. DDL from other processes
+is not noticed, so leave this off if the schema changes under running
+clients. Off by default.
+
+The character set table the driver needs for C<CHAR> columns is always shared
+this way, since it never changes.
+
+=item B<ib_tz_epoch>  (driver-specific, boolean)
+
+Fetch C<TIMESTAMP WITH TIME ZONE> and C<TIME WITH TIME ZONE> values as UTC
+epoch seconds. See L</ib_tz_epoch>.
+
+=item B<ib_bind_epoch>  (driver-specific, boolean)
+
+Bind numbers given for date and time parameters as seconds since the
+epoch. Off by default, when they are passed to the server as text like
+other strings the driver does not parse. See
+L</DATE, TIME, and TIMESTAMP FORMATTING SUPPORT>.
+
+=item B<ib_exact_numeric>  (driver-specific)
+
+How scaled C<NUMERIC> and C<DECIMAL> values are fetched. By default those
+stored as C<SMALLINT> or C<INTEGER> (up to 9 digits), and dialect 1 ones
+stored as C<DOUBLE PRECISION>, come as Perl numbers, which cannot hold most
+decimal fractions exactly. Set to a true value to get exact strings with
+every decimal of the column's scale instead, as for wider columns:
+
+  $dbh->{ib_exact_numeric} = 1;       # NUMERIC(9,2) 12.3 is "12.30"
+
+Set to C<minor> to get integers counted in units of the scale, like cents
+for a C<NUMERIC(x,2)> column:
+
+  $dbh->{ib_exact_numeric} = 'minor'; # NUMERIC(9,2) 12.3 is 1230
+
+In C<minor> mode this applies to C<BIGINT> and C<INT128> based columns too.
+Values of dialect 1 columns are rounded to the column's scale in both modes.
+Off by default.
+
+=item B<ib_fast_int>  (driver-specific, boolean)
+
+Fetch whole C<INT128> and C<DECFLOAT> values that fit as Perl integers, and
+bind Perl integers to C<INT128> columns directly. On by default. See
+L</INT128 and DECFLOAT (Firebird 4.0+)>.
+
+=item B<ib_timeout_ms>  (driver-specific)
+
+  $dbh->{ib_timeout_ms} = 30_000;
+
+Time limit in milliseconds for every statement executed on the connection,
+including its fetches. A statement that runs out of time fails with
+C<< $h->state >> set to C<HYT00>, and the handle stays usable. 0 means no
+limit, which is the default; the server's C<StatementTimeout> setting still
+applies. Needs Firebird 4.0 or newer client and server.
+
 =back
 
 =head1 STATEMENT HANDLE OBJECTS
@@ -824,6 +1304,181 @@ Supported by the driver as proposed by DBI.
 
 Supported by the driver as proposed by DBI. 
 
+The column names are kept as shared hash keys for the life of the
+statement, so building the row hash does not hash them again.
+
+=item B<ib_fetch_into_hash>
+
+  my %row;
+  while ($sth->ib_fetch_into_hash(\%row)) {
+      print "$row{ID}: $row{NAME}\n";
+  }
+
+Fetches the next row into an existing hash, overwriting the value of each
+column in place instead of building a new hash per row. Keys follow
+B<FetchHashKeyName>, as with B<fetchrow_hashref>; other keys in the hash
+are left alone. Returns the hash reference, or C<undef> when there are no
+more rows.
+
+=item B<ib_export>
+
+  $sth->execute;
+  open my $fh, '>', 'orders.csv' or die $!;
+  my $rows = $sth->ib_export(fh => $fh, format => 'csv');
+
+Writes the remaining rows of an executed statement to a file handle, and
+returns the number of rows written (C<0E0> for none) or C<undef> on error.
+The rows are formatted from the fetch buffers and written in large chunks,
+without a Perl value per column, which makes it a good deal faster than
+fetching and printing the rows in Perl. The options are:
+
+=over 4
+
+=item C<fh>
+
+The file handle to write to (required). CSV and TSV text is written as the
+server sends it, in the connection character set, and JSON text in UTF-8;
+give the handle a C<:raw> or C<:bytes> layer.
+
+=item C<format>
+
+C<csv> (the default), C<tsv>, or C<jsonl> for one JSON object per row.
+CSV fields are quoted when they hold the separator, quotes or line breaks,
+and an empty string is always quoted. TSV escapes tabs, line breaks and
+backslashes as C<\t>, C<\n>, C<\r> and C<\\>. JSON keys follow
+B<FetchHashKeyName>. As JSON is UTF-8, C<jsonl> needs a C<UTF8>
+connection character set, or one of the single-byte ones the driver
+transcodes (C<WIN1251>, C<ISO8859_1>, see B<ib_enable_utf8>); it is refused
+for others, C<NONE> included.
+
+=item C<header>
+
+Whether a first line gives the column names, in CSV and TSV. On by default.
+
+=item C<sep_char>
+
+The CSV field separator, C<,> by default.
+
+=item C<null>
+
+How NULL is written in CSV and TSV: an empty field in CSV and C<\N> in TSV
+by default, which is how L<DBD::Firebird::BulkLoader> reads them back. JSON
+has C<null>.
+
+=item C<buffer_size>
+
+The size of the output buffer, 1MB by default.
+
+=back
+
+Numbers are written exactly, whatever B<ib_exact_numeric> says; dates and
+times in ISO 8601 with four fractional digits, followed by the offset or
+the zone name for the time zone types. BLOBs are written whole, regardless
+of B<LongReadLen>; binary ones become hex strings in JSON. C<ChopBlanks>
+applies to C<CHAR> columns as with fetch. Array columns are written as
+NULL.
+
+=item B<ib_fetch_arrow>
+
+  $sth->execute;
+  open my $fh, '>:raw', 'orders.arrow' or die $!;
+  my $rows = $sth->ib_fetch_arrow($fh, batch_rows => 100_000);
+
+Writes the remaining rows of an executed statement to a file handle as an
+Apache Arrow IPC stream, which DuckDB, pandas (through pyarrow) and the
+other Arrow readers load directly. Each batch of C<batch_rows> rows
+(65536 by default) becomes one record batch, built column by column from
+the fetch buffers. Returns the number of rows written (C<0E0> for none) or
+C<undef> on error.
+
+The column types are:
+
+  SMALLINT, INTEGER, BIGINT      int16, int32, int64
+  NUMERIC, DECIMAL, INT128       decimal128
+  FLOAT, DOUBLE PRECISION        float, double
+  BOOLEAN                        bool
+  CHAR, VARCHAR, text BLOB       utf8
+  OCTETS, binary BLOB            binary
+  DATE                           date32
+  TIME                           time64[us]
+  TIMESTAMP                      timestamp[us]
+  TIMESTAMP WITH TIME ZONE       timestamp[us, tz=UTC]
+  TIME WITH TIME ZONE, DECFLOAT  utf8, as fetch gives them
+  ARRAY                          null
+
+Text is written in the connection character set, which must be C<UTF8>
+for the Arrow readers to accept non-ASCII text. C<CHAR> columns follow
+C<ChopBlanks>, and BLOBs are read whole, regardless of B<LongReadLen>.
+Time zone values keep their instant but not their zone, as an Arrow
+column has a single time zone. Column names follow B<FetchHashKeyName>.
+
+=item B<ib_fetchall_mmap>
+
+  $sth->execute;
+  my $rows = $sth->ib_fetchall_mmap;
+  for my $i (0 .. $rows->rows - 1) {
+      my $amount = $rows->cell($i, 2);
+      ...
+  }
+  print $rows->[-1][0];
+
+Fetches the remaining rows of an executed statement into a file, the way
+B<fetchall_arrayref> would into memory, and returns an object reading
+them back. The rows are written from the fetch buffers in a compact binary
+form, without a Perl value per column; values become Perl scalars only when
+they are read, decoded as fetch decodes them (with B<ChopBlanks>,
+B<ib_enable_utf8>, B<ib_exact_numeric> and the types of B<bind_col>). The
+file is memory-mapped where the system allows it, so a result far larger
+than the memory of the process can be walked at random. Returns C<undef>
+on error.
+
+The file is an unnamed temporary file, or C<path> when given, which is
+removed when the object goes away unless C<keep> is true:
+
+  my $rows = $sth->ib_fetchall_mmap(path => '/var/tmp/orders.rows', keep => 1);
+
+The object has these methods:
+
+  $rows->rows         number of rows
+  $rows->row($i)      the row $i as a new array ref, undef out of range
+  $rows->cell($i, $j) column $j of row $i
+  $rows->names        the column names, as $sth->{NAME}
+  $rows->sth          the statement
+
+and is also an array ref of the rows, read only. The statement must be
+kept prepared while the rows are read: it is referenced by the object, and
+it can be executed again meanwhile. Reading errors return C<undef> and are
+reported by the statement. BLOBs are stored whole, regardless of
+B<LongReadLen>; array columns are read as with fetch.
+
+=item B<ib_fetch_lazy>
+
+  $sth->execute;
+  while (my $row = $sth->ib_fetch_lazy) {
+      print $row->get('NAME'), ' ', $row->[0], ' ', $row->{AMOUNT}, "\n";
+  }
+
+Fetches the next row like B<fetch>, but returns an object holding a copy
+of the fetch buffers instead of Perl values. A column is decoded the first
+time it is read, as fetch would decode it, and the value is kept for later
+reads; for a wide table of which only a few columns are used, the date
+formatting, numeric scaling and BLOB reads of the other columns never
+happen. Returns C<undef> at the end of the rows or on error.
+
+The row has these methods:
+
+  $row->col($i)       column $i, negative from the end
+  $row->get($name)    column $name, as in $sth->{NAME} or in upper case
+  $row->count         number of columns
+  $row->names         the column names, as $sth->{NAME}
+  $row->sth           the statement
+
+and is also an array ref of the values and a hash ref keyed by column
+name, both read only. Columns bound with B<bind_col> are not set. The
+statement must stay prepared while its rows are read; BLOB columns are
+read from the server when they are decoded, so they must be read before
+the transaction that fetched them ends.
+
 =item B<fetchall_arrayref>
 
   $tbl_ary_ref = $sth->fetchall_arrayref;
@@ -848,7 +1503,27 @@ it returns -1 (unknown number of affected rows).
 
   $rc = $sth->bind_col($column_number, \$var_to_bind, \%attr);
 
-Supported by the driver as proposed by DBI. 
+Supported by the driver as proposed by DBI. Fetched values are written
+straight into the bound variable, in the form the C<TYPE> attribute asks
+for:
+
+  $sth->bind_col(1, \$id,    { TYPE => SQL_INTEGER });   # IV
+  $sth->bind_col(2, \$price, { TYPE => SQL_DOUBLE });    # NV
+  $sth->bind_col(3, \$code,  { TYPE => SQL_VARCHAR });   # string
+  $sth->bind_col(4, \$data,  { TYPE => SQL_VARBINARY }); # bytes
+
+C<SQL_INTEGER>, C<SQL_SMALLINT>, C<SQL_TINYINT> and C<SQL_BIGINT> give an
+integer and C<SQL_DOUBLE>, C<SQL_FLOAT> and C<SQL_REAL> a floating point
+number, taken directly from numeric columns without formatting them as text
+first. The integer types only take integral values that fit an IV: as
+with DBI's sql_type_cast(), a fraction (C<12.75>), a value out of range
+(C<1e300>), Inf or NaN is fetched as if no C<TYPE> was given. C<SQL_CHAR>,
+C<SQL_VARCHAR> and C<SQL_LONGVARCHAR> give a plain string.
+C<SQL_BINARY>, C<SQL_VARBINARY>, C<SQL_LONGVARBINARY> and C<SQL_BLOB> give
+text columns as the bytes the server sent, without the decoding of
+B<ib_enable_utf8>. Other types leave the value as it is.
+
+See B<ib_bound_only> for leaving out the columns that are not bound.
 
 =item B<bind_columns>
 
@@ -923,6 +1598,44 @@ Not supported by the driver.
 
 Supported by the driver as proposed by DBI.
 
+=item B<ib_bound_only>  (driver-specific, boolean)
+
+  $sth = $dbh->prepare('SELECT * FROM wide_table', { ib_bound_only => 1 });
+  $sth->execute;
+  $sth->bind_columns(\my ($id, $name));
+  while ($sth->fetch) { ... }
+
+Decodes only the columns bound with C<bind_col> or C<bind_columns>. The
+others are fetched as C<undef>, and their C<BLOB>s are not read at all, so a
+C<SELECT *> only costs the columns that are used. Can be given to C<prepare>
+or set on the statement handle. Off by default.
+
+=item B<ib_timeout_ms>  (driver-specific)
+
+  $sth = $dbh->prepare($sql, { ib_timeout_ms => 5000 });
+
+Time limit in milliseconds for this statement, instead of the one of the
+database handle. Setting it to C<undef> goes back to the database handle's
+value.
+
+=item B<ib_pipeline>  (driver-specific)
+
+  $sth = $dbh->prepare('SELECT * FROM big_table', { ib_pipeline => 1000 });
+
+Reads up to this many rows ahead on a thread of the statement while the
+rows already fetched are converted, so waiting for the network overlaps
+with building Perl values. Worth it for large result sets over a network;
+every execute starts a thread. Takes effect from the next C<execute>, for
+C<SELECT> statements without C<FOR UPDATE>. Rows and errors come in the
+same order as without it. 0, the default, turns it off. Not available on
+Windows.
+
+=item B<ib_pipeline_bytes>  (driver-specific)
+
+Caps the memory of the rows read ahead by B<ib_pipeline>, 4 MiB by
+default. Each row takes its full declared size, so wide C<VARCHAR> columns
+fit fewer rows.
+
 =back
 
 =head1 TRANSACTION SUPPORT
@@ -1028,9 +1741,123 @@ transaction parameters (as with C<AutoCommit> off), but also commits the
 current transaction. The new transaction parameters will be used in
 any newly started transaction. 
 
+C<-at_snapshot_number> (Firebird 4.0) starts the transaction in the snapshot
+of another one, as given by its C<snapshot_number> in C<ib_tx_info>, so that
+several attachments see the same data. It implies the C<snapshot> isolation
+level.
+
 C<ib_set_tx_param()> can also be invoked with no parameter in which it resets
 transaction parameters to the default value.
 
+=item B<ib_define_tx_profile>
+
+ $dbh->ib_define_tx_profile(
+     report => {
+         access_mode      => 'read_only',
+         isolation_level  => ['read_committed', 'record_version'],
+     },
+     booking => {
+         access_mode      => 'read_write',
+         isolation_level  => 'snapshot',
+         lock_timeout     => 5,
+     },
+ );
+
+Compiles named sets of transaction parameters once, so that switching between
+them later costs no parsing. The keys are those of C<ib_set_tx_param()>
+without the leading dash (C<access_mode>, C<isolation_level>,
+C<lock_resolution>, C<reserving>), plus:
+
+=over 4
+
+=item C<lock_timeout>
+
+Seconds to wait for a lock, the same as C<< lock_resolution => { wait => N } >>.
+
+=item C<read_consistency>
+
+If true, use Firebird 4.0's C<READ COMMITTED READ CONSISTENCY> isolation.
+C<read_consistency> may also be given in the C<isolation_level> array of
+C<ib_set_tx_param()>.
+
+=back
+
+As they set the same parameters, C<lock_timeout> cannot be given with
+C<lock_resolution>, nor C<read_consistency> with C<isolation_level>; such
+a profile is refused.
+
+Redefining a profile replaces it; if it is the profile in use, the new
+parameters apply to the next transaction.
+
+=item B<ib_use_tx_profile>
+
+ $dbh->ib_use_tx_profile('report');
+ $dbh->ib_use_tx_profile(undef);   # back to ib_set_tx_param() values
+
+Uses the named profile for the transactions that follow. Nothing is
+committed and no statement is finished: a transaction already started,
+such as the one of a SELECT still being fetched under C<AutoCommit>, keeps
+its parameters, and the profile applies from the next transaction on.
+Calling C<ib_set_tx_param()> drops the selected profile.
+
+The profile can also be chosen for a single transaction:
+
+ $dbh->begin_work({ ib_profile => 'booking' });
+
+The transaction is guaranteed to use the profile: a transaction still open
+under C<AutoCommit>, as C<ib_softcommit> keeps one, is committed first (it
+has nothing left to commit), and begin_work fails if a statement is still
+being fetched, since the commit would close its cursor. The transaction is
+ended with a real commit or rollback, even under C<ib_softcommit>, and the
+profile selected before is used again afterwards. C<ib_use_tx_profile> and
+C<ib_set_tx_param()> called inside the transaction change that profile.
+
+=item B<ib_txn>
+
+ my $total = $dbh->ib_txn(sub {
+     my $dbh = shift;
+     $dbh->do('UPDATE account SET balance = balance - ? WHERE id = ?',
+         undef, 100, $id);
+     return $dbh->selectrow_array('SELECT SUM(balance) FROM account');
+ }, retries => 5, backoff => 0.1);
+
+Runs the code reference inside one transaction and commits it. If the
+transaction fails with an update conflict, a lock conflict or a deadlock, it
+is rolled back, and after a short sleep the code is run again, up to
+C<retries> times (default 3). Any other error, or a conflict after the last
+retry, rolls back the transaction and is rethrown. The code may therefore be
+run more than once, and should not have side effects outside the database.
+Its return value (in list or scalar context) is returned.
+
+C<RaiseError> is turned on while the code runs, and the transaction is
+opened with C<begin_work>. C<ib_txn> needs C<AutoCommit> on: with it off it
+sets an error and returns C<undef> without running the code, as a rollback
+on conflict would also throw away the work already done in the open
+transaction. The code gets the database handle C<ib_txn> was called on.
+
+The delay before retry N is a random value between half and all of
+C<backoff * 2 ** (N - 1)> seconds (default C<backoff> is 0.05), but no more
+than C<backoff_max> (default 2) seconds. The random part keeps competing
+transactions from colliding again. C<backoff> may also be a code reference,
+which is called with the retry number and the kind of conflict
+(C<update_conflict>, C<lock_conflict> or C<deadlock>) and returns the delay
+in seconds.
+
+With the default C<wait> lock resolution Firebird itself waits for the
+competing transaction to finish, so conflicts are usually only reported to
+C<snapshot> transactions or with C<no_wait>; see L</ib_set_tx_param>.
+
+=item B<ib_txn_stats>  (driver-specific, read-only)
+
+ my $stats = $dbh->{ib_txn_stats};
+
+A hash ref with counters kept by the database handle: C<conflicts> is the
+number of conflict errors seen (inside C<ib_txn> or not), C<retries> is the
+number of times C<ib_txn> re-ran a transaction, and C<wasted> is the time in
+seconds spent in the C<ib_txn> attempts that were run again, sleeps
+included. The last attempt of a transaction that finally fails is not
+counted.
+
 =back
 
 =head1 DATE, TIME, and TIMESTAMP FORMATTING SUPPORT
@@ -1075,12 +1902,73 @@ Perl's localtime(). The C<ISO> format applies sprintf()'s pattern
 "%04d-%02d-%02d %02d:%02d:%02d.%04d" for TIMESTAMP, "%04d-%02d-%02d" for DATE,
 and "%02d:%02d:%02d.%04d" for TIME.
 
+C<ISO> may be followed by the number of fractional second digits, from 0 to
+4: C<ISO0> gives "2011-01-29 12:30:15", C<ISO3> "2011-01-29 12:30:15.123".
+The digits are truncated, not rounded.
+
+strftime() patterns using only the conversions C<%Y %y %m %d %e %j %H %M %S
+%u %w %F %T %D %R %n %t %%> are formatted by the driver itself; any other
+conversion (including the default C<%c>, C<%x> and C<%X>) is passed to the C
+library's strftime().
+
+For computing with the values there are three numeric formats, calculated
+directly from the values on the wire:
+
+=over
+
+=item C<epoch>
+
+Seconds since 1970-01-01 00:00:00 as a floating point number, keeping the
+fraction of the second.
+
+=item C<epoch_ms>
+
+Milliseconds since 1970-01-01 00:00:00 as an integer, rounded down.
+
+=item C<julian>
+
+The Julian Day, a floating point number of days since noon of
+4713-11-24 BC (proleptic Gregorian).
+
+=back
+
+TIMESTAMP and DATE values carry no time zone and are taken as UTC. TIME
+values count from midnight, and C<julian> gives the fraction of the day. For
+C<TIMESTAMP WITH TIME ZONE> and C<TIME WITH TIME ZONE> the result is the UTC
+instant, whatever the zone of the value.
+
 C<$dbh-E<gt>{ib_time_all}> can be used to specify all of the three formats at
 once. Example:
 
  $dbh->{ib_time_all} = 'TM';
 
 
+Date and time parameters are encoded by the driver when given as
+
+=over
+
+=item * ISO 8601 strings
+
+C<2011-01-29>, C<12:30>, C<12:30:15.1234>, C<2011-01-29 12:30:15> or
+C<2011-01-29T12:30:15>. Up to four fractional digits are kept. A C<T> must
+be followed by a time.
+
+=item * numbers, with B<ib_bind_epoch>
+
+Seconds since 1970-01-01 00:00:00 UTC, with an optional fraction, as
+numbers or numeric strings. For TIME parameters this is the time of that
+day. Without B<ib_bind_epoch>, numbers are passed on as text, as they
+always were.
+
+=item * array references
+
+The same layout as C<TM> format, as returned by Perl's localtime().
+
+=back
+
+Other strings, like C<29.01.2011>, C<NOW> or C<TODAY>, are passed on as text
+and parsed by the server.
+
 =head1 TIMESTAMP WITH TIME ZONE and TIME WITH TIME ZONE (Firebird 4.0+)
 
 Firebird 4.0 introduced C<TIMESTAMP WITH TIME ZONE> and C<TIME WITH TIME ZONE>
@@ -1103,8 +1991,18 @@ Returns the local time with timezone offset appended, e.g.:
   "2020-01-01 12:00:00.0000 +05:30"    # TIMESTAMP WITH TIME ZONE
   "12:00:00.0000 +05:30"               # TIME WITH TIME ZONE
 
-For named timezone columns (e.g. C<America/New_York>), if the offset cannot be
-decoded without the ICU timezone database, UTC time with C<+00:00> is returned.
+Values in a named zone are shown in the local time of that zone, followed by
+the zone name, as Firebird itself prints them:
+
+  "2020-07-15 12:00:00.0000 Europe/Berlin"
+  "12:00:00.0000 Europe/Berlin"
+
+The zone names are read from C<RDB$TIME_ZONES> once per connection, and the
+offsets from C<RDB$TIME_ZONE_UTIL.TRANSITIONS> for a window of a few years
+around the first value that needs them. Both are cached on the database
+handle, so the server is only asked again for values outside the cached
+periods. As in Firebird, a C<TIME WITH TIME ZONE> takes the offset its zone
+had on 2020-01-01.
 
 =item C<TM> format
 
@@ -1117,15 +2015,257 @@ additional elements:
 
 =back
 
+=head2 ib_tz_epoch
+
+  $dbh->{ib_tz_epoch} = 1;
+
+Fetches every C<TIMESTAMP WITH TIME ZONE> and C<TIME WITH TIME ZONE> value as
+its UTC instant in seconds since the epoch, like the C<epoch> format, whatever
+the format attributes say. Columns without a time zone keep their format. No
+zone lookup is done in this mode. Off by default.
+
 =head2 Writing (binding)
 
 Bind string values containing a timestamp and timezone identifier:
 
   $sth->execute('2020-02-03 20:00:00.0000 -05:00');
+  $sth->execute('2020-02-03T20:00:00Z');
   $sth->execute('2020-02-03 20:00:00.0000 America/New_York');
 
-Firebird's server-side parser interprets the timezone identifier.
+Values with a numeric offset or C<Z> are encoded by the driver. Named zones
+are interpreted by Firebird's server-side parser. With B<ib_bind_epoch>,
+numbers (seconds since the epoch) are bound as C<GMT>.
+
+=head1 INT128 and DECFLOAT (Firebird 4.0+)
+
+Firebird 4.0 stores C<NUMERIC> and C<DECIMAL> columns with more than 18 digits
+(up to C<NUMERIC(38,x)>) and C<INT128> as 128-bit integers, and added the
+C<DECFLOAT(16)> and C<DECFLOAT(34)> decimal floating point types. The driver
+converts all of them itself, without going through a floating point number,
+so no digits are lost.
+
+Values are fetched as strings, like C<BIGINT> and scaled C<NUMERIC> values
+are:
+
+  "-12345678901234567890123456789.0123"  # NUMERIC(38,4)
+  "1.5E+20"                              # DECFLOAT, as Firebird writes it
+  "Infinity", "NaN"
+
+Whole numbers without a scale that fit into a Perl integer are fetched as
+integers instead, and a Perl integer bound to an C<INT128> without a scale
+is stored without going through its text. Both shortcuts can be turned
+off, so that every value takes the text path:
+
+  $dbh->{ib_fast_int} = 0;
+
+For binding, strings in the usual notation (C<-12.5>, C<1.5e-3>, C<Infinity>,
+C<NaN>) are accepted. Values with more decimals than the column has are
+rounded half away from zero, as for the other C<NUMERIC> types. A value that
+does not fit, or is not a number, fails the execute with a
+C<Cannot convert ...> error.
+
+The C<TYPE> attribute reports C<SQL_NUMERIC> for C<INT128> based columns and
+C<SQL_DECIMAL> for C<DECFLOAT>.
+
+
+=head1 ASYNCHRONOUS EXECUTE AND FETCH
+
+Executing a statement and fetching from it normally block the whole
+interpreter until the server answers. The asynchronous methods run the
+client library call on a worker thread of the connection instead, so that
+an event loop (AnyEvent, Mojo::IOLoop, ...) can go on serving other
+requests meanwhile:
+
+  my $fd = $dbh->ib_async_fd;
+  open my $wakeup, '<&=', $fd or die $!;
+
+  my $sth = $dbh->prepare('SELECT id, name FROM big_report WHERE day = ?');
+  $sth->ib_execute_async($day);
+
+  my $w; $w = AnyEvent->io(fh => $wakeup, poll => 'r', cb => sub {
+      undef $w;
+      $sth->ib_async_result or die $sth->errstr;
+      # go on with ib_fetch_async and ib_async_result for each row
+  });
+
+=over 4
+
+=item C<ib_async_fd>
+
+  $fd = $dbh->ib_async_fd;
+
+Returns a file descriptor that becomes readable when an asynchronous
+operation on the connection has finished. Watch it for reading, but do not
+read from it; B<ib_async_result> does. The descriptor is the same for the
+life of the connection.
+
+=item C<ib_execute_async>
+
+  $sth->ib_execute_async(@bind_values);
+
+Starts executing the statement, binding the values like B<execute> does,
+and returns at once.
+
+=item C<ib_fetch_async>
+
+  $sth->ib_fetch_async;
+
+Starts fetching the next row and returns at once.
+
+=item C<ib_async_result>
+
+  $rv  = $sth->ib_async_result;    # after ib_execute_async
+  $row = $sth->ib_async_result;    # after ib_fetch_async
+
+Finishes the operation started on the statement, waiting for it if it is
+still running, and returns what B<execute> or B<fetchrow_arrayref> would
+have returned.
+
+=item C<ib_cancel>
+
+  $dbh->ib_cancel;
+
+Cancels the operation running on the connection, asynchronous or not.
+The cancelled call fails with C<< $h->state >> set to C<HY008>, and the
+statement and connection stay usable, so a pool can hand them out again
+instead of reconnecting. Returns false if there was nothing to cancel.
+Needs a Firebird 2.5 or newer client library.
 
+C<ib_cancel> can be called from another thread, but not from a signal
+handler: it is a method call, which allocates Perl values and records
+errors on the handle. To put a time limit on a blocking call, use
+B<ib_cancel_after>.
+
+=item C<ib_cancel_after>
+
+  $dbh->ib_cancel_after(10);
+  $sth->execute;
+  $dbh->ib_cancel_after(0);
+
+Cancels the operation running on the connection once the given number of
+seconds (fractions allowed) has passed, as B<ib_cancel> would. The cancel
+is made by a thread of the connection that runs no Perl code, so no signal
+handler is involved. Another call moves the deadline, and C<0> disarms it;
+disarm it when the call returned in time, or a later statement gets
+cancelled. Needs a Firebird 2.5 or newer client library and is not
+available on Windows. With Firebird 4.0, B<ib_timeout_ms> is the server
+side alternative.
+
+=back
+
+Only one operation can be in flight on a connection; until its result is
+collected, the connection refuses other work. A statement is C<Active> from
+B<ib_execute_async> until its result is collected, so B<finish> or
+destroying the statement cancels an operation still in flight on it. An
+execute left uncollected is then ended as if it had been collected: its
+cursor is closed, and under C<AutoCommit> its transaction is committed;
+its errors are not reported. Asynchronous operations are not available on
+Windows.
+
+=head1 PARALLEL SELECT
+
+  my $it = $dbh->ib_parallel_select('SELECT * FROM orders',
+      partitions => 8, key => 'ID');
+  while (my $row = $it->next) {
+      ...
+  }
+
+  $dbh->ib_parallel_select('SELECT * FROM orders WHERE day < ?',
+      partitions => 8, key => 'ID', bind => [ $day ],
+      on_row => sub { my ($row, $partition) = @_; ... });
+
+B<ib_parallel_select> reads the result of a query over several connections
+at once. It opens C<partitions> (default 4) new connections with C<clone>,
+splits the range of the numeric C<key> column of the result into as many
+parts, and runs a copy of the query restricted to each part on each
+connection. Rows with a NULL key belong to the first part. C<bind> gives the
+values for the placeholders of the query.
+
+The connections share one snapshot, so together they see the same data as
+a single C<snapshot> transaction would. This needs Firebird 4.0 or newer,
+unless C<partitions> is 1. The connections are read-only and are closed
+when all the rows are read or the iterator is destroyed.
+
+Each part is executed and fetched asynchronously (see
+L</ASYNCHRONOUS EXECUTE AND FETCH>), so the server works on all of them
+while the rows are handed out in the order they arrive. Where asynchronous
+operations are not available, the parts are read one after another.
+
+Without C<on_row>, an iterator is returned. Its C<next> method returns the
+next row as an array reference, or undef when all rows are read or an error
+happened; C<partition> tells which part the last row came from, C<rows> how
+many rows were returned, and C<finish> closes the connections early,
+cancelling the queries still running.
+
+With C<on_row>, the code reference is called with each row and its part
+number, and the number of rows is returned. As with B<fetchrow_arrayref>,
+the row array is reused; copy it to keep it.
+
+Errors are reported on the database handle.
+
+=head1 BULK LOADING
+
+L<DBD::Firebird::BulkLoader> loads rows from arrays, callbacks or CSV/TSV
+files into a table over several connections at once:
+
+  use DBD::Firebird::BulkLoader;
+
+  my $loader = DBD::Firebird::BulkLoader->new($dbh,
+      table => 'ORDERS', columns => [qw(ID CUSTOMER AMOUNT)], workers => 8);
+  $loader->load('orders.csv', header => 1);
+  my $stats = $loader->finish;    # rows, errors, rows_per_sec, ...
+
+Loading into an empty or staging table is faster when the indexes are built
+once at the end instead of row by row:
+
+  my $times = $dbh->ib_bulk_load('ORDERS', sub {
+      my $load = shift;
+      ... insert the rows through $load and commit them ...
+  }, triggers => 0, no_db_triggers => 1);
+
+=over 4
+
+=item B<ib_bulk_load>
+
+  $times = $dbh->ib_bulk_load($table, sub { my $load_dbh = shift; ... }, %options);
+
+Calls B<ib_bulk_load_begin> with the table and options, the code with the
+handle to load through, and B<ib_bulk_load_end>, which runs whether the code
+returns or dies. Returns what B<ib_bulk_load_end> returns; if the code died,
+its error is raised again once the table is restored.
+
+=item B<ib_bulk_load_begin>
+
+  $load_dbh = $dbh->ib_bulk_load_begin($table, %options);
+
+Deactivates the active indexes of the table, apart from the ones backing
+a primary key, unique or foreign key constraint. With C<< triggers => 0 >>
+the active triggers of the table are deactivated as well. With
+C<< no_db_triggers => 1 >> a new connection is opened with
+C<< ib_db_triggers => 0 >>, so that database triggers do not fire for it.
+
+Returns the handle to load through: the new connection, or C<$dbh> itself.
+C<$dbh> must be in C<AutoCommit> mode, as the changes to the table are
+committed at once. If a step fails, whatever was already deactivated is
+reactivated.
+
+=item B<ib_bulk_load_end>
+
+  $times = $dbh->ib_bulk_load_end;
+
+Closes the connection opened by B<ib_bulk_load_begin>, if any, reactivates
+the indexes and triggers, and recomputes the selectivity of all the indexes
+of the table with C<SET STATISTICS>. Commit the loaded rows first. Call it
+also when the load fails, to get the table back to its previous state;
+B<ib_bulk_load> does that for you.
+
+Returns a hash ref with the seconds spent in each phase (C<deactivate>,
+C<load>, C<activate>, C<statistics>), and the names of the C<indexes> and
+C<triggers> that were deactivated. An index that cannot be reactivated, such
+as a unique index over duplicate keys, stays inactive and is reported as an
+error, after the others have been reactivated.
+
+=back
 
 =head1 EVENT ALERT SUPPORT
 
@@ -1203,6 +2343,13 @@ up.
 
 Retrieve information about current active transaction.
 
+With a Firebird 4.0 client library the hash includes C<snapshot_number>,
+which another attachment can join with C<-at_snapshot_number>.
+
+Besides the values reported by the server, the hash contains C<retained_age>
+(seconds since the transaction was started) and C<retained_commits> (number
+of soft commits done on it), see L</ib_softcommit_max_commits>.
+
 =item C<ib_database_info>
 
  $hash_ref = $dbh->func(@info, 'ib_database_info');
@@ -144,169 +144,639 @@ short length, char ISC_FAR *updated
 }
 
 
-MODULE = DBD::Firebird     PACKAGE = DBD::Firebird
+/*
+   Build a transaction parameter buffer from the -key => value pairs in
+   args[1 .. items-1], as given to ib_set_tx_param(). On success the
+   buffer is allocated with Newx and owned by the caller.
+ */
+static int ib_compile_tpb(SV *dbh, SV **args, int items,
+                          char **tpb_buffer, unsigned short *tpb_length)
+{
+    STRLEN len;
+    char   *tx_key, *tx_val, *tpb, *tmp_tpb;
+    int    i, rc = 0;
+    int    tpb_len;
+    char   am_set = 0, il_set = 0, ls_set = 0, sn_set = 0;
+    I32    j;
+    AV     *av;
+    HV     *hv;
+    SV     *sv, *sv_value;
+    HE     *he;
 
-#ifndef FB_API_VER
-#define FB_API_VER 0
-#endif
+    /* we need to know the max. size of TBP, (buffer overflow problem) */
+    /* mem usage: -access_mode:     max. 1 byte                        */
+    /*            -isolation_level: max. 3 bytes                       */
+    /*            -lock_resolution: max. 7 bytes (with lock timeout)   */
+    /*            -reserving:       max. 4 bytes + strlen(tablename)   */
+    /*            -at_snapshot_number: 10 bytes                        */
+    tpb_len = 22; /* 21 + 1 for tpb_version                            */
 
-BOOT:
-    HV *stash = gv_stashpv( "DBD::Firebird", TRUE );
-    newCONSTSUB( stash, "fb_api_ver", newSViv(FB_API_VER) );
-    newCONSTSUB( stash, "client_major_version", newSViv( isc_get_client_major_version() ) );
-    newCONSTSUB( stash, "client_minor_version", newSViv( isc_get_client_minor_version() ) );
+    /* we need to add the length of each table name + 4 bytes */
+    for (i = 1; i < items-1; i += 2)
     {
-        char version_string[1024];
-        isc_get_client_version(version_string);
-        int len = strlen(version_string);
-        if (len > 1023)
-            die("Version string buffer overflow detected");
-        SV *ver = newSVpv(version_string, len);
-        newCONSTSUB( stash, "client_version", ver );
+        sv_value = args[i + 1];
+        if (strEQ(SvPV_nolen(args[i]), "-reserving"))
+            if (SvROK(sv_value) && SvTYPE(SvRV(sv_value)) == SVt_PVHV)
+            {
+                hv = (HV *)SvRV(sv_value);
+                hv_iterinit(hv);
+                while ((he = hv_iternext(hv)))
+                {
+                    /* retrieve the size of table name(s) */
+                    HePV(he, len);
+                    tpb_len += len + 4;
+                }
+            }
     }
 
-INCLUDE: Firebird.xsi
-
-MODULE = DBD::Firebird     PACKAGE = DBD::Firebird::db
-
-void
-_do(dbh, statement, attr=Nullsv)
-    SV *        dbh
-    SV *    statement
-  PROTOTYPE: $$;$@
-  CODE:
-{
-    D_imp_dbh(dbh);
-    ISC_STATUS status[ISC_STATUS_LENGTH]; /* isc api status vector    */
-    STRLEN     slen;
-    int        retval;
-    char       *sbuf = SvPV(statement, slen);
+    /* alloc it */
+	Newx(tmp_tpb, tpb_len, char);
 
-    DBI_TRACE_imp_xxh(imp_dbh, 1, (DBIc_LOGPIO(imp_dbh), "db::_do\n" "Executing : %s\n", sbuf));
+    /* do set TPB values */
+    tpb = tmp_tpb;
+    *tpb++ = isc_tpb_version3;
 
-    /* we need an open transaction */
-    if (!imp_dbh->tr)
+    for (i = 1; i < items; i += 2)
     {
-        DBI_TRACE_imp_xxh(imp_dbh, 1, (DBIc_LOGPIO(imp_dbh), "starting new transaction..\n"));
+        tx_key   = SvPV_nolen(args[i]);
+        sv_value = args[i + 1];
 
-        if (!ib_start_transaction(dbh, imp_dbh))
+        /* value specified? */
+        if (i >= items - 1)
         {
-            retval = -2;
-            XST_mUNDEF(0);      /* <= -2 means error        */
-            return;
+            Safefree(tmp_tpb);
+            croak("You must specify parameter => value pairs, but there's no value for %s", tx_key);
         }
 
-        DBI_TRACE_imp_xxh(imp_dbh, 1, (DBIc_LOGPIO(imp_dbh), "new transaction started.\n"));
-    }
-
-    /* we need to count the DDL statement whether in soft / hard commit */
-#if 0
-    /* only execute_immediate statment if NOT in soft commit mode */
-    if (!(imp_dbh->soft_commit))
-    {
-        isc_dsql_execute_immediate(status, &(imp_dbh->db), &(imp_dbh->tr), 0,
-                                   sbuf, imp_dbh->sqldialect, NULL);
-
-        if (ib_error_check(dbh, status))
-            retval = -2;
-        else
-            retval = -1 ;
-    }
-    else
-#endif
-    /* count DDL statements is necessary for ib_commit_transaction to work properly */
-    {
-        isc_stmt_handle stmt = 0L;        /* temp statment handle */
-        static char     stmt_info[] = { isc_info_sql_stmt_type };
-        char            info_buffer[20];  /* statment info buffer */
+        /**********************************************************************/
+        if (strEQ(tx_key, "-access_mode"))
+        {
+            if (am_set)
+            {
+                warn("-access_mode already set; ignoring second try!");
+                continue;
+            }
 
-        retval = -2;
+            tx_val = SvPV_nolen(sv_value);
+            if (strEQ(tx_val, "read_write"))
+                *tpb++ = isc_tpb_write;
+            else if (strEQ(tx_val, "read_only"))
+                *tpb++ = isc_tpb_read;
+            else
+            {
+                Safefree(tmp_tpb);
+                croak("Unknown -access_mode value %s", tx_val);
+            }
 
-        do
+            am_set = 1; /* flag */
+        }
+        /**********************************************************************/
+        else if (strEQ(tx_key, "-isolation_level"))
         {
-            char count_item = 0;
+            if (il_set)
+            {
+                warn("-isolation_level already set; ignoring second try!");
+                continue;
+            }
 
-            /* init statement handle */
-            if (isc_dsql_alloc_statement2(status, &(imp_dbh->db), &stmt))
-                break;
+            if (SvROK(sv_value) && SvTYPE(SvRV(sv_value)) == SVt_PVAV)
+            {
+                av = (AV *)SvRV(sv_value);
 
-            /* prepare statement */
-            isc_dsql_prepare(status, &(imp_dbh->tr), &stmt, 0, sbuf,
-                             imp_dbh->sqldialect, NULL);
-            if (ib_error_check(dbh, status))
-                break;
+                /* sanity check */
+                for (j = 0; (j <= av_len(av)) && !rc; j++)
+                {
+                    sv = *av_fetch(av, j, FALSE);
+                    if (strEQ(SvPV_nolen(sv), "read_committed"))
+                    {
+                        rc = 1;
+                        *tpb++ = isc_tpb_read_committed;
+                    }
+                }
 
-            /* get statement type */
-            if (!isc_dsql_sql_info(status, &stmt, sizeof(stmt_info), stmt_info,
-                              sizeof(info_buffer), info_buffer))
-            {
-                /* need to count DDL statments */
-                short l = (short) isc_vax_integer((char *) info_buffer + 1, 2);
-                ISC_LONG stmt_type = isc_vax_integer((char *) info_buffer + 3, l);
+                if (!rc)
+                {
+                    Safefree(tmp_tpb);
+                    croak("Invalid -isolation_level value");
+                }
 
-                switch (stmt_type) {
-                    case isc_info_sql_stmt_ddl:
-                        imp_dbh->sth_ddl++;
-                        break;
-                    case isc_info_sql_stmt_insert:
-                        count_item = isc_info_req_insert_count;
+                for (j = 0; j <= av_len(av); j++)
+                {
+                    tx_val = SvPV_nolen(*(av_fetch(av, j, FALSE)));
+                    if (strEQ(tx_val, "record_version"))
+                    {
+                        *tpb++ = isc_tpb_rec_version;
                         break;
-                    case isc_info_sql_stmt_update:
-                        count_item = isc_info_req_update_count;
+                    }
+                    else if (strEQ(tx_val, "no_record_version"))
+                    {
+                        *tpb++ = isc_tpb_no_rec_version;
                         break;
-                    case isc_info_sql_stmt_delete:
-                        count_item = isc_info_req_delete_count;
+                    }
+                    else if (strEQ(tx_val, "read_consistency"))
+                    {
+#ifdef isc_tpb_read_consistency
+                        *tpb++ = isc_tpb_read_consistency;
                         break;
+#else
+                        Safefree(tmp_tpb);
+                        croak("read_consistency needs Firebird 4.0 client library");
+#endif
+                    }
+                    else if (!strEQ(tx_val, "read_committed"))
+                    {
+                        Safefree(tmp_tpb);
+                        croak("Unknown -isolation_level value %s", tx_val);
+                    }
                 }
-
             }
             else
-                break;
-
-            /* exec the statement */
-            isc_dsql_execute(status, &(imp_dbh->tr), &stmt, imp_dbh->sqldialect, NULL);
-            if (!ib_error_check(dbh, status))
-                retval = -1;
-
-            if (count_item) {
-                ISC_LONG rows = ib_rows(dbh, &stmt, count_item);
-                if ( rows >= 0 )
-                    retval = rows;
+            {
+                tx_val = SvPV_nolen(sv_value);
+                if (strEQ(tx_val, "read_committed"))
+                    *tpb++ = isc_tpb_read_committed;
+                else if (strEQ(tx_val, "snapshot"))
+                    *tpb++ = isc_tpb_concurrency;
+                else if (strEQ(tx_val, "snapshot_table_stability"))
+                    *tpb++ = isc_tpb_consistency;
+                else
+                {
+                    Safefree(tmp_tpb);
+                    croak("Unknown -isolation_level value %s", tx_val);
+                }
             }
 
-        } while (0);
-
-        /* close statement */
-        if (stmt)
-           isc_dsql_free_statement(status, &stmt, DSQL_drop);
-    }
-
-    /* for AutoCommit: commit */
-    if (DBIc_has(imp_dbh, DBIcf_AutoCommit))
-    {
-        if (!ib_commit_transaction(dbh, imp_dbh))
-            retval = -2;
-    }
-
-    if (retval < -1)
-        XST_mUNDEF(0);
-    else
-        XST_mIV(0, retval); /* typically 1, rowcount or -1  */
-}
+            il_set = 1; /* flag */
+        }
+        /**********************************************************************/
+        else if (strEQ(tx_key, "-lock_resolution"))
+        {
+            if (ls_set)
+            {
+                warn("-lock_resolution already set; ignoring second try!");
+                continue;
+            }
 
-void
-_ping(dbh)
-    SV *    dbh
-    CODE:
-{
-    int ret;
-    ret = dbd_db_ping(dbh);
-    if (ret == 0)
+            if (SvROK(sv_value) && SvTYPE(SvRV(sv_value)) == SVt_PVHV) {
+#if defined(FB_API_VER) && FB_API_VER >= 20
+                hv = (HV *)SvRV(sv_value);
+                if (hv_exists(hv, "wait", 4)) {
+                    *tpb++ = isc_tpb_wait;
+                    sv = *hv_fetch(hv, "wait", 4, FALSE);
+                    if (SvIOK(sv)) {
+                        IV lock_timeout = SvIV(sv);
+                        if (lock_timeout < 0) {
+                            do_error(dbh, 2, "Wait timeout value must be positive integer");
+                            Safefree(tmp_tpb);
+                            return FALSE;
+                        } else if (lock_timeout > 0) {
+                            *tpb++ = isc_tpb_lock_timeout;
+                            *tpb++ = sizeof(ISC_LONG);      /* length = 4 bytes */
+                            *(ISC_LONG*)tpb = lock_timeout; /* infinite timeout */
+                            tpb += sizeof(ISC_LONG);
+                        }
+                    } else {
+                        do_error(dbh, 2, "Wait timeout value must be positive integer");
+                        Safefree(tmp_tpb);
+                        return FALSE;
+                    }
+                } else {
+                    do_error(dbh, 2, "The only valid key is 'wait'");
+                    Safefree(tmp_tpb);
+                    return FALSE;
+                }
+#else
+                do_error(dbh, 2, "Hashref unsupported. Must be compiled with Firebird 2.0 client library");
+                Safefree(tmp_tpb);
+                return FALSE;
+#endif
+            } else {
+                tx_val = SvPV_nolen(sv_value);
+                if (strEQ(tx_val, "wait"))
+                    *tpb++ = isc_tpb_wait;
+                else if (strEQ(tx_val, "no_wait"))
+                    *tpb++ = isc_tpb_nowait;
+                else
+                {
+                    Safefree(tmp_tpb);
+                    croak("Unknown transaction parameter %s", tx_val);
+                }
+            }
+            ls_set = 1; /* flag */
+        }
+        /**********************************************************************/
+        else if (strEQ(tx_key, "-reserving"))
+        {
+            if (SvROK(sv_value) && SvTYPE(SvRV(sv_value)) == SVt_PVHV)
+            {
+                char *table_name;
+                HV *table_opts;
+                hv = (HV *)SvRV(sv_value);
+                hv_iterinit(hv);
+                while ((he = hv_iternext(hv)))
+                {
+                    /* check val type */
+                    if (SvROK(HeVAL(he)) && SvTYPE(SvRV(HeVAL(he))) == SVt_PVHV)
+                    {
+                        table_opts = (HV*)SvRV(HeVAL(he));
+
+                        /*
+                        if (hv_exists(table_opts, "access", 6))
+                        {
+                            comment: access is optional
+                            sv = *hv_fetch(table_opts, "access", 6, FALSE);
+                            if (strnEQ(SvPV_nolen(sv), "shared", 6))
+                                *tpb++ = isc_tpb_shared;
+                            else if (strnEQ(SvPV_nolen(sv), "protected", 9))
+                                *tpb++ = isc_tpb_protected;
+                            else
+                            {
+                                Safefree(tmp_tpb);
+                                croak("Invalid -reserving access value");
+                            }
+                        }
+                        */
+
+                        if (hv_exists(table_opts, "lock", 4))
+                        {
+                            /* lock is required */
+                            sv = *hv_fetch(table_opts, "lock", 4, FALSE);
+                            if (strnEQ(SvPV_nolen(sv), "read", 4))
+                               *tpb++ = isc_tpb_lock_read;
+                            else if (strnEQ(SvPV_nolen(sv), "write", 5))
+                               *tpb++ = isc_tpb_lock_write;
+                            else
+                            {
+                              Safefree(tmp_tpb);
+                              croak("Invalid -reserving lock value");
+                            }
+                        }
+                        else /* lock */
+                        {
+                            Safefree(tmp_tpb);
+                            croak("Lock value is required in -reserving");
+                        }
+
+                        /* add the table name to TPB */
+                        table_name = HePV(he, len);
+                        *tpb++ = len + 1;
+                        {
+                            unsigned int k;
+                            for (k = 0; k < len; k++)
+                                *tpb++ = toupper(*table_name++);
+                        }
+                        *tpb++ = 0;
+
+                        if (hv_exists(table_opts, "access", 6))
+                        {
+                            /* access is optional */
+                            sv = *hv_fetch(table_opts, "access", 6, FALSE);
+                            if (strnEQ(SvPV_nolen(sv), "shared", 6))
+                                *tpb++ = isc_tpb_shared;
+                            else if (strnEQ(SvPV_nolen(sv), "protected", 9))
+                                *tpb++ = isc_tpb_protected;
+                            else
+                            {
+                                Safefree(tmp_tpb);
+                                croak("Invalid -reserving access value");
+                            }
+                        }
+
+                    } /* end hashref check*/
+                    else
+                    {
+                        Safefree(tmp_tpb);
+                        croak("Reservation for a given table must be hashref.");
+                    }
+                } /* end of while() */
+            }
+            else
+            {
+                Safefree(tmp_tpb);
+                croak("Invalid -reserving value. Must be hashref.");
+            }
+        } /* end table reservation */
+        /**********************************************************************/
+        else if (strEQ(tx_key, "-at_snapshot_number"))
+        {
+#ifdef isc_tpb_at_snapshot_number
+            ISC_INT64 number;
+            int k;
+
+            if (sn_set)
+            {
+                warn("-at_snapshot_number already set; ignoring second try!");
+                continue;
+            }
+
+            number = (ISC_INT64)SvIV(sv_value);
+            if (number <= 0)
+            {
+                Safefree(tmp_tpb);
+                croak("Invalid -at_snapshot_number value");
+            }
+
+            /* the number is sent as a little-endian 8 byte integer */
+            *tpb++ = isc_tpb_at_snapshot_number;
+            *tpb++ = sizeof(ISC_INT64);
+            for (k = 0; k < (int)sizeof(ISC_INT64); k++)
+                *tpb++ = (char)((number >> (8 * k)) & 0xFF);
+
+            sn_set = 1; /* flag */
+#else
+            Safefree(tmp_tpb);
+            croak("-at_snapshot_number needs Firebird 4.0 client library");
+#endif
+        }
+        else
+        {
+            Safefree(tmp_tpb);
+            croak("Unknown transaction parameter %s", tx_key);
+        }
+    }
+
+
+    /* a shared snapshot is only possible in a snapshot transaction */
+    if (sn_set && !il_set)
+        *tpb++ = isc_tpb_concurrency;
+
+    *tpb_buffer = tmp_tpb;
+    *tpb_length = tpb - tmp_tpb;
+    return TRUE;
+}
+
+
+MODULE = DBD::Firebird     PACKAGE = DBD::Firebird
+
+#ifndef FB_API_VER
+#define FB_API_VER 0
+#endif
+
+BOOT:
+    HV *stash = gv_stashpv( "DBD::Firebird", TRUE );
+    newCONSTSUB( stash, "fb_api_ver", newSViv(FB_API_VER) );
+    newCONSTSUB( stash, "client_major_version", newSViv( isc_get_client_major_version() ) );
+    newCONSTSUB( stash, "client_minor_version", newSViv( isc_get_client_minor_version() ) );
+    {
+        char version_string[1024];
+        isc_get_client_version(version_string);
+        int len = strlen(version_string);
+        if (len > 1023)
+            die("Version string buffer overflow detected");
+        SV *ver = newSVpv(version_string, len);
+        newCONSTSUB( stash, "client_version", ver );
+    }
+
+INCLUDE: Firebird.xsi
+
+MODULE = DBD::Firebird     PACKAGE = DBD::Firebird::db
+
+void
+_do(dbh, statement, attr=Nullsv)
+    SV *        dbh
+    SV *    statement
+  PROTOTYPE: $$;$@
+  CODE:
+{
+    D_imp_dbh(dbh);
+    ISC_STATUS status[ISC_STATUS_LENGTH]; /* isc api status vector    */
+    STRLEN     slen;
+    int        retval;
+    char       *sbuf = SvPV(statement, slen);
+
+    DBI_TRACE_imp_xxh(imp_dbh, 1, (DBIc_LOGPIO(imp_dbh), "db::_do\n" "Executing : %s\n", sbuf));
+
+    if (ib_async_busy(dbh, imp_dbh))
+    {
+        XST_mUNDEF(0);
+        return;
+    }
+
+    /* we need an open transaction */
+    if (!imp_dbh->tr)
+    {
+        DBI_TRACE_imp_xxh(imp_dbh, 1, (DBIc_LOGPIO(imp_dbh), "starting new transaction..\n"));
+
+        if (!ib_start_transaction(dbh, imp_dbh))
+        {
+            retval = -2;
+            XST_mUNDEF(0);      /* <= -2 means error        */
+            return;
+        }
+
+        DBI_TRACE_imp_xxh(imp_dbh, 1, (DBIc_LOGPIO(imp_dbh), "new transaction started.\n"));
+    }
+
+    /* we need to count the DDL statement whether in soft / hard commit */
+#if 0
+    /* only execute_immediate statment if NOT in soft commit mode */
+    if (!(imp_dbh->soft_commit))
+    {
+        isc_dsql_execute_immediate(status, &(imp_dbh->db), &(imp_dbh->tr), 0,
+                                   sbuf, imp_dbh->sqldialect, NULL);
+
+        if (ib_error_check(dbh, status))
+            retval = -2;
+        else
+            retval = -1 ;
+    }
+    else
+#endif
+    /* count DDL statements is necessary for ib_commit_transaction to work properly */
+    {
+        isc_stmt_handle stmt = 0L;        /* temp statment handle */
+        static char     stmt_info[] = { isc_info_sql_stmt_type };
+        char            info_buffer[20];  /* statment info buffer */
+
+        retval = -2;
+
+        do
+        {
+            char count_item = 0;
+
+            /* init statement handle */
+            if (isc_dsql_alloc_statement2(status, &(imp_dbh->db), &stmt))
+                break;
+
+            /* prepare statement */
+            isc_dsql_prepare(status, &(imp_dbh->tr), &stmt, 0, sbuf,
+                             imp_dbh->sqldialect, NULL);
+            if (ib_error_check(dbh, status))
+                break;
+#if defined(FB_API_VER) && FB_API_VER >= 40
+            /* ib_timeout_ms */
+            if (imp_dbh->timeout_ms)
+            {
+                fb_dsql_set_timeout(status, &stmt, imp_dbh->timeout_ms);
+                if (ib_error_check(dbh, status))
+                    break;
+            }
+#endif
+
+            /* get statement type */
+            if (!isc_dsql_sql_info(status, &stmt, sizeof(stmt_info), stmt_info,
+                              sizeof(info_buffer), info_buffer))
+            {
+                /* need to count DDL statments */
+                short l = (short) isc_vax_integer((char *) info_buffer + 1, 2);
+                ISC_LONG stmt_type = isc_vax_integer((char *) info_buffer + 3, l);
+
+                switch (stmt_type) {
+                    case isc_info_sql_stmt_ddl:
+                        imp_dbh->sth_ddl++;
+                        break;
+                    case isc_info_sql_stmt_insert:
+                        count_item = isc_info_req_insert_count;
+                        break;
+                    case isc_info_sql_stmt_update:
+                        count_item = isc_info_req_update_count;
+                        break;
+                    case isc_info_sql_stmt_delete:
+                        count_item = isc_info_req_delete_count;
+                        break;
+                }
+
+            }
+            else
+                break;
+
+            /* exec the statement */
+            isc_dsql_execute(status, &(imp_dbh->tr), &stmt, imp_dbh->sqldialect, NULL);
+            if (!ib_error_check(dbh, status))
+                retval = -1;
+
+            if (count_item) {
+                ISC_LONG rows = ib_rows(dbh, &stmt, count_item);
+                if ( rows >= 0 )
+                    retval = rows;
+            }
+
+        } while (0);
+
+        /* close statement */
+        if (stmt)
+           isc_dsql_free_statement(status, &stmt, DSQL_drop);
+    }
+
+    /* for AutoCommit: commit */
+    if (DBIc_has(imp_dbh, DBIcf_AutoCommit))
+    {
+        if (!ib_commit_transaction(dbh, imp_dbh))
+            retval = -2;
+    }
+
+    if (retval < -1)
+        XST_mUNDEF(0);
+    else
+        XST_mIV(0, retval); /* typically 1, rowcount or -1  */
+}
+
+void
+_ping(dbh)
+    SV *    dbh
+    CODE:
+{
+    int ret;
+    ret = dbd_db_ping(dbh);
+    if (ret == 0)
         XST_mUNDEF(0);
     else
         XST_mIV(0, ret);
 }
 
+void
+_txn_conflict(dbh)
+    SV *    dbh
+    CODE:
+{
+    D_imp_dbh(dbh);
+    ISC_STATUS conflict = imp_dbh->tx_conflict;
+
+    /* report and forget the last lock conflict seen on this handle */
+    imp_dbh->tx_conflict = 0;
+
+    switch (conflict)
+    {
+        case isc_update_conflict:
+            XST_mPV(0, "update_conflict");
+            break;
+        case isc_lock_conflict:
+            XST_mPV(0, "lock_conflict");
+            break;
+        case isc_deadlock:
+            XST_mPV(0, "deadlock");
+            break;
+        default:
+            XST_mUNDEF(0);
+    }
+}
+
+void
+_db_cache_tag(dbh)
+    SV *    dbh
+    PPCODE:
+{
+    D_imp_dbh(dbh);
+    SV *key;
+    unsigned long generation;
+
+    /* identity of the database and its DDL generation, see ib_db_cache() */
+    if (ib_db_cache_tag(imp_dbh, &key, &generation))
+    {
+        XPUSHs(sv_2mortal(key));
+        XPUSHs(sv_2mortal(newSVuv(generation)));
+    }
+}
+
+void
+ib_async_fd(dbh)
+    SV *    dbh
+    PPCODE:
+{
+    D_imp_dbh(dbh);
+    int fd = ib_async_fd(dbh, imp_dbh);
+
+    if (fd < 0)
+        XSRETURN_UNDEF;
+    XPUSHs(sv_2mortal(newSViv(fd)));
+}
+
+int
+ib_cancel(dbh)
+    SV *    dbh
+    CODE:
+{
+    /* from another thread, not from a signal handler: see ib_cancel_after */
+    D_imp_dbh(dbh);
+    RETVAL = ib_cancel(dbh, imp_dbh);
+}
+    OUTPUT:
+    RETVAL
+
+int
+ib_cancel_after(dbh, seconds)
+    SV *    dbh
+    NV      seconds
+    CODE:
+{
+    D_imp_dbh(dbh);
+    RETVAL = ib_cancel_after(dbh, imp_dbh, seconds);
+}
+    OUTPUT:
+    RETVAL
+
+void
+_txn_wasted(dbh, seconds)
+    SV *    dbh
+    NV      seconds
+    CODE:
+{
+    D_imp_dbh(dbh);
+
+    imp_dbh->tx_wasted += seconds;
+    imp_dbh->tx_retries++;
+}
+
 #define TX_INFOBUF(name, len) \
 if (strEQ(item, #name)) { \
     *p++ = (char) isc_info_tra_##name; \
@@ -350,6 +820,10 @@ ib_tx_info(dbh)
         isc_info_tra_lock_timeout,
         isc_info_tra_isolation,
         isc_info_tra_access,
+#endif
+#ifdef isc_info_tra_snapshot_number
+        /* FB 4.0: */
+        isc_info_tra_snapshot_number,
 #endif
         isc_info_end
     };
@@ -386,6 +860,12 @@ ib_tx_info(dbh)
                 */
                 result_length += 3;
                 break;
+#endif
+#ifdef isc_info_tra_snapshot_number
+            case isc_info_tra_snapshot_number:
+                /* result: length (2 bytes) + content (8 bytes) */
+                result_length += 10;
+                break;
 #endif
             default:
                 result_length += 2; /* length (2 bytes) */
@@ -451,405 +931,245 @@ ib_tx_info(dbh)
 
                     /* PerlIO_printf(PerlIO_stderr(), "Content length: %d\n", length); */
 
-                    keyname = "isolation";
-
-                    /* PerlIO_printf(PerlIO_stderr(), "Got 'isolation' at byte: %d\n", (p - 1 - result)); */
-                    p += 2;
-
-                    if (*p == isc_info_tra_consistency) {
-                        (void)hv_store(RETVAL, keyname, strlen(keyname), newSVpv("consistency", 0), 0);
-                    } else if (*p == isc_info_tra_concurrency) {
-                        (void)hv_store(RETVAL, keyname, strlen(keyname), newSVpv("snapshot (concurrency)", 0), 0);
-                    } else if (*p == isc_info_tra_read_committed) {
-                        /* warn("got 'read_committed'"); */
-                        reshv = newHV();
-                        if (!reshv) {
-                            if (result) {
-                                Safefree(result);
-                            }
-                            do_error(dbh, 2, "unable to allocate hash for read_committed rec/no_rec version");
-                            XSRETURN_UNDEF;
-                        }
-                        if (*(p + 1) == isc_info_tra_no_rec_version) {
-                            (void)hv_store(reshv, "read_committed", 14, newSVpv("no_rec_version", 0), 0);
-                        } else if (*(p + 1) == isc_info_tra_rec_version) {
-                            (void)hv_store(reshv, "read_committed", 14, newSVpv("rec_version", 0), 0);
-                        } else {
-                            warn("unrecognized byte");
-                            continue;
-                        }
-                        (void)hv_store(RETVAL, keyname, strlen(keyname),
-                                 newRV_noinc((SV*) reshv), 0);
-
-                    } else {
-                        PerlIO_printf(PerlIO_stderr(), "+2: got unrecognized byte: %d\n", *((char*)p));
-                    }
-                    p += length;
-                    break;
-                }
-                case isc_info_tra_access: {
-                    short length = isc_vax_integer(++p, 2);
-                    keyname = "access";
-                    /* PerlIO_printf(PerlIO_stderr(), "Got 'access' at byte: %d\n", (p - 1 - result)); */
-                    p += 2;
-                    if (*p == isc_info_tra_readonly) {
-                        (void)hv_store(RETVAL, keyname, strlen(keyname), newSVpvn("readonly", 8), 0);
-                    } else if (*p == isc_info_tra_readwrite) {
-                        (void)hv_store(RETVAL, keyname, strlen(keyname), newSVpvn("readwrite", 9), 0);
-                    }
-                    p += length;
-                    break;
-                }
-#endif
-                default:
-                    /* PerlIO_printf(PerlIO_stderr(), "now at byte: %d\n", (p - result)); */
-                    p++;
-            }
-        }
-    }
-}
-    OUTPUT:
-    RETVAL
-    CLEANUP:
-    SvREFCNT_dec(RETVAL);
-
-#undef TX_INFOBUF
-#undef TX_RESBUF_CASE
-
-int
-ib_set_tx_param(dbh, ...)
-    SV *dbh
-    ALIAS:
-    set_tx_param = 1
-    PREINIT:
-    STRLEN len;
-    char   *tx_key, *tx_val, *tpb, *tmp_tpb;
-    int    i, rc = 0;
-    int    tpb_len;
-    char   am_set = 0, il_set = 0, ls_set = 0;
-    I32    j;
-    AV     *av;
-    HV     *hv;
-    SV     *sv, *sv_value;
-    HE     *he;
-
-    CODE:
-{
-    D_imp_dbh(dbh);
-#ifdef PERL_UNUSED_VAR
-    PERL_UNUSED_VAR(ix); /* -Wall */
-#endif
-    /* if no params or first parameter = 0 or undef -> reset TPB to NULL */
-    if (items < 3)
-    {
-        if ((items == 1) || !(SvTRUE(ST(1))))
-        {
-            tpb     = NULL;
-            tmp_tpb = NULL;
-            tpb_len = 0;
-            goto do_set_tpb;
-        }
-    }
-
-    /* we need to know the max. size of TBP, (buffer overflow problem) */
-    /* mem usage: -access_mode:     max. 1 byte                        */
-    /*            -isolation_level: max. 2 bytes                       */
-    /*            -lock_resolution: max. 1 byte                        */
-    /*            -reserving:       max. 4 bytes + strlen(tablename)   */
-    tpb_len = 5; /* 4 + 1 for tpb_version                              */
-
-    /* we need to add the length of each table name + 4 bytes */
-    for (i = 1; i < items-1; i += 2)
-    {
-        sv_value = ST(i + 1);
-        if (strEQ(SvPV_nolen(ST(i)), "-reserving"))
-            if (SvROK(sv_value) && SvTYPE(SvRV(sv_value)) == SVt_PVHV)
-            {
-                hv = (HV *)SvRV(sv_value);
-                hv_iterinit(hv);
-                while ((he = hv_iternext(hv)))
-                {
-                    /* retrieve the size of table name(s) */
-                    HePV(he, len);
-                    tpb_len += len + 4;
-                }
-            }
-    }
-
-    /* alloc it */
-	Newx(tmp_tpb, tpb_len, char);
-
-    /* do set TPB values */
-    tpb = tmp_tpb;
-    *tpb++ = isc_tpb_version3;
-
-    for (i = 1; i < items; i += 2)
-    {
-        tx_key   = SvPV_nolen(ST(i));
-        sv_value = ST(i + 1);
-
-        /* value specified? */
-        if (i >= items - 1)
-        {
-            Safefree(tmp_tpb);
-            croak("You must specify parameter => value pairs, but there's no value for %s", tx_key);
-        }
-
-        /**********************************************************************/
-        if (strEQ(tx_key, "-access_mode"))
-        {
-            if (am_set)
-            {
-                warn("-access_mode already set; ignoring second try!");
-                continue;
-            }
-
-            tx_val = SvPV_nolen(sv_value);
-            if (strEQ(tx_val, "read_write"))
-                *tpb++ = isc_tpb_write;
-            else if (strEQ(tx_val, "read_only"))
-                *tpb++ = isc_tpb_read;
-            else
-            {
-                Safefree(tmp_tpb);
-                croak("Unknown -access_mode value %s", tx_val);
-            }
-
-            am_set = 1; /* flag */
-        }
-        /**********************************************************************/
-        else if (strEQ(tx_key, "-isolation_level"))
-        {
-            if (il_set)
-            {
-                warn("-isolation_level already set; ignoring second try!");
-                continue;
-            }
-
-            if (SvROK(sv_value) && SvTYPE(SvRV(sv_value)) == SVt_PVAV)
-            {
-                av = (AV *)SvRV(sv_value);
-
-                /* sanity check */
-                for (j = 0; (j <= av_len(av)) && !rc; j++)
-                {
-                    sv = *av_fetch(av, j, FALSE);
-                    if (strEQ(SvPV_nolen(sv), "read_committed"))
-                    {
-                        rc = 1;
-                        *tpb++ = isc_tpb_read_committed;
-                    }
-                }
-
-                if (!rc)
-                {
-                    Safefree(tmp_tpb);
-                    croak("Invalid -isolation_level value");
-                }
-
-                for (j = 0; j <= av_len(av); j++)
-                {
-                    tx_val = SvPV_nolen(*(av_fetch(av, j, FALSE)));
-                    if (strEQ(tx_val, "record_version"))
-                    {
-                        *tpb++ = isc_tpb_rec_version;
-                        break;
-                    }
-                    else if (strEQ(tx_val, "no_record_version"))
-                    {
-                        *tpb++ = isc_tpb_no_rec_version;
-                        break;
-                    }
-                    else if (!strEQ(tx_val, "read_committed"))
-                    {
-                        Safefree(tmp_tpb);
-                        croak("Unknown -isolation_level value %s", tx_val);
-                    }
-                }
-            }
-            else
-            {
-                tx_val = SvPV_nolen(sv_value);
-                if (strEQ(tx_val, "read_committed"))
-                    *tpb++ = isc_tpb_read_committed;
-                else if (strEQ(tx_val, "snapshot"))
-                    *tpb++ = isc_tpb_concurrency;
-                else if (strEQ(tx_val, "snapshot_table_stability"))
-                    *tpb++ = isc_tpb_consistency;
-                else
-                {
-                    Safefree(tmp_tpb);
-                    croak("Unknown -isolation_level value %s", tx_val);
-                }
-            }
-
-            il_set = 1; /* flag */
-        }
-        /**********************************************************************/
-        else if (strEQ(tx_key, "-lock_resolution"))
-        {
-            if (ls_set)
-            {
-                warn("-lock_resolution already set; ignoring second try!");
-                continue;
-            }
-
-            if (SvROK(sv_value) && SvTYPE(SvRV(sv_value)) == SVt_PVHV) {
-#if defined(FB_API_VER) && FB_API_VER >= 20
-                hv = (HV *)SvRV(sv_value);
-                if (hv_exists(hv, "wait", 4)) {
-                    *tpb++ = isc_tpb_wait;
-                    sv = *hv_fetch(hv, "wait", 4, FALSE);
-                    if (SvIOK(sv)) {
-                        IV lock_timeout = SvIV(sv);
-                        if (lock_timeout < 0) {
-                            do_error(dbh, 2, "Wait timeout value must be positive integer");
+                    keyname = "isolation";
+
+                    /* PerlIO_printf(PerlIO_stderr(), "Got 'isolation' at byte: %d\n", (p - 1 - result)); */
+                    p += 2;
+
+                    if (*p == isc_info_tra_consistency) {
+                        (void)hv_store(RETVAL, keyname, strlen(keyname), newSVpv("consistency", 0), 0);
+                    } else if (*p == isc_info_tra_concurrency) {
+                        (void)hv_store(RETVAL, keyname, strlen(keyname), newSVpv("snapshot (concurrency)", 0), 0);
+                    } else if (*p == isc_info_tra_read_committed) {
+                        /* warn("got 'read_committed'"); */
+                        reshv = newHV();
+                        if (!reshv) {
+                            if (result) {
+                                Safefree(result);
+                            }
+                            do_error(dbh, 2, "unable to allocate hash for read_committed rec/no_rec version");
                             XSRETURN_UNDEF;
-                        } else if (lock_timeout > 0) {
-                            *tpb++ = isc_tpb_lock_timeout;
-                            *tpb++ = sizeof(ISC_LONG);      /* length = 4 bytes */
-                            *(ISC_LONG*)tpb = lock_timeout; /* infinite timeout */
-                            tpb += sizeof(ISC_LONG);
                         }
+                        if (*(p + 1) == isc_info_tra_no_rec_version) {
+                            (void)hv_store(reshv, "read_committed", 14, newSVpv("no_rec_version", 0), 0);
+                        } else if (*(p + 1) == isc_info_tra_rec_version) {
+                            (void)hv_store(reshv, "read_committed", 14, newSVpv("rec_version", 0), 0);
+                        } else {
+                            warn("unrecognized byte");
+                            continue;
+                        }
+                        (void)hv_store(RETVAL, keyname, strlen(keyname),
+                                 newRV_noinc((SV*) reshv), 0);
+
                     } else {
-                        do_error(dbh, 2, "Wait timeout value must be positive integer");
-                        XSRETURN_UNDEF;
+                        PerlIO_printf(PerlIO_stderr(), "+2: got unrecognized byte: %d\n", *((char*)p));
                     }
-                } else {
-                    do_error(dbh, 2, "The only valid key is 'wait'");
-                    XSRETURN_UNDEF;
+                    p += length;
+                    break;
+                }
+                case isc_info_tra_access: {
+                    short length = isc_vax_integer(++p, 2);
+                    keyname = "access";
+                    /* PerlIO_printf(PerlIO_stderr(), "Got 'access' at byte: %d\n", (p - 1 - result)); */
+                    p += 2;
+                    if (*p == isc_info_tra_readonly) {
+                        (void)hv_store(RETVAL, keyname, strlen(keyname), newSVpvn("readonly", 8), 0);
+                    } else if (*p == isc_info_tra_readwrite) {
+                        (void)hv_store(RETVAL, keyname, strlen(keyname), newSVpvn("readwrite", 9), 0);
+                    }
+                    p += length;
+                    break;
                 }
-#else
-                do_error(dbh, 2, "Hashref unsupported. Must be compiled with Firebird 2.0 client library");
-                XSRETURN_UNDEF;
 #endif
-            } else {
-                tx_val = SvPV_nolen(sv_value);
-                if (strEQ(tx_val, "wait"))
-                    *tpb++ = isc_tpb_wait;
-                else if (strEQ(tx_val, "no_wait"))
-                    *tpb++ = isc_tpb_nowait;
-                else
-                {
-                    Safefree(tmp_tpb);
-                    croak("Unknown transaction parameter %s", tx_val);
+#ifdef isc_info_tra_snapshot_number
+                case isc_info_tra_snapshot_number: {
+                    short length = isc_vax_integer(++p, 2);
+                    p += 2;
+                    (void)hv_store(RETVAL, "snapshot_number", 15,
+                        newSViv((IV)isc_portable_integer((ISC_UCHAR*)p, length)), 0);
+                    p += length;
+                    break;
                 }
+#endif
+                default:
+                    /* PerlIO_printf(PerlIO_stderr(), "now at byte: %d\n", (p - result)); */
+                    p++;
             }
-            ls_set = 1; /* flag */
         }
-        /**********************************************************************/
-        else if (strEQ(tx_key, "-reserving"))
-        {
-            if (SvROK(sv_value) && SvTYPE(SvRV(sv_value)) == SVt_PVHV)
-            {
-                char *table_name;
-                HV *table_opts;
-                hv = (HV *)SvRV(sv_value);
-                hv_iterinit(hv);
-                while ((he = hv_iternext(hv)))
-                {
-                    /* check val type */
-                    if (SvROK(HeVAL(he)) && SvTYPE(SvRV(HeVAL(he))) == SVt_PVHV)
-                    {
-                        table_opts = (HV*)SvRV(HeVAL(he));
-
-                        /*
-                        if (hv_exists(table_opts, "access", 6))
-                        {
-                            comment: access is optional
-                            sv = *hv_fetch(table_opts, "access", 6, FALSE);
-                            if (strnEQ(SvPV_nolen(sv), "shared", 6))
-                                *tpb++ = isc_tpb_shared;
-                            else if (strnEQ(SvPV_nolen(sv), "protected", 9))
-                                *tpb++ = isc_tpb_protected;
-                            else
-                            {
-                                Safefree(tmp_tpb);
-                                croak("Invalid -reserving access value");
-                            }
-                        }
-                        */
 
-                        if (hv_exists(table_opts, "lock", 4))
-                        {
-                            /* lock is required */
-                            sv = *hv_fetch(table_opts, "lock", 4, FALSE);
-                            if (strnEQ(SvPV_nolen(sv), "read", 4))
-                               *tpb++ = isc_tpb_lock_read;
-                            else if (strnEQ(SvPV_nolen(sv), "write", 5))
-                               *tpb++ = isc_tpb_lock_write;
-                            else
-                            {
-                              Safefree(tmp_tpb);
-                              croak("Invalid -reserving lock value");
-                            }
-                        }
-                        else /* lock */
-                        {
-                            Safefree(tmp_tpb);
-                            croak("Lock value is required in -reserving");
-                        }
+        /* driver side: how long this transaction was kept by soft commits */
+        (void)hv_store(RETVAL, "retained_age", 12,
+                       newSViv((IV)(time(NULL) - imp_dbh->tr_started)), 0);
+        (void)hv_store(RETVAL, "retained_commits", 16,
+                       newSVuv(imp_dbh->tr_soft_commits), 0);
+    }
+}
+    OUTPUT:
+    RETVAL
+    CLEANUP:
+    SvREFCNT_dec(RETVAL);
 
-                        /* add the table name to TPB */
-                        table_name = HePV(he, len);
-                        *tpb++ = len + 1;
-                        {
-                            unsigned int k;
-                            for (k = 0; k < len; k++)
-                                *tpb++ = toupper(*table_name++);
-                        }
-                        *tpb++ = 0;
+#undef TX_INFOBUF
+#undef TX_RESBUF_CASE
 
-                        if (hv_exists(table_opts, "access", 6))
-                        {
-                            /* access is optional */
-                            sv = *hv_fetch(table_opts, "access", 6, FALSE);
-                            if (strnEQ(SvPV_nolen(sv), "shared", 6))
-                                *tpb++ = isc_tpb_shared;
-                            else if (strnEQ(SvPV_nolen(sv), "protected", 9))
-                                *tpb++ = isc_tpb_protected;
-                            else
-                            {
-                                Safefree(tmp_tpb);
-                                croak("Invalid -reserving access value");
-                            }
-                        }
+int
+ib_set_tx_param(dbh, ...)
+    SV *dbh
+    ALIAS:
+    set_tx_param = 1
+    PREINIT:
+    char           *tmp_tpb;
+    unsigned short tpb_len;
 
-                    } /* end hashref check*/
-                    else
-                    {
-                        Safefree(tmp_tpb);
-                        croak("Reservation for a given table must be hashref.");
-                    }
-                } /* end of while() */
-            }
-            else
-            {
-                Safefree(tmp_tpb);
-                croak("Invalid -reserving value. Must be hashref.");
-            }
-        } /* end table reservation */
-        else
+    CODE:
+{
+    D_imp_dbh(dbh);
+#ifdef PERL_UNUSED_VAR
+    PERL_UNUSED_VAR(ix); /* -Wall */
+#endif
+    /* if no params or first parameter = 0 or undef -> reset TPB to NULL */
+    if (items < 3)
+    {
+        if ((items == 1) || !(SvTRUE(ST(1))))
         {
-            Safefree(tmp_tpb);
-            croak("Unknown transaction parameter %s", tx_key);
+            tmp_tpb = NULL;
+            tpb_len = 0;
+            goto do_set_tpb;
         }
     }
 
+    if (!ib_compile_tpb(dbh, &ST(0), items, &tmp_tpb, &tpb_len))
+        XSRETURN_UNDEF;
+
     /* an ugly label... */
     do_set_tpb:
 
     Safefree(imp_dbh->tpb_buffer);
     imp_dbh->tpb_buffer = tmp_tpb;
-    imp_dbh->tpb_length = tpb - imp_dbh->tpb_buffer;
+    imp_dbh->tpb_length = tpb_len;
+
+    /* explicit parameters replace the selected profile */
+    ib_select_tx_profile(imp_dbh, NULL);
+
+    /* for AutoCommit: commit current transaction */
+    if (DBIc_has(imp_dbh, DBIcf_AutoCommit))
+    {
+        imp_dbh->sth_ddl++;
+        ib_commit_transaction(dbh, imp_dbh);
+    }
+    RETVAL = 1;
+}
+    OUTPUT:
+    RETVAL
+
+int
+_define_tx_profile(dbh, name, ...)
+    SV *dbh
+    SV *name
+    PREINIT:
+    char           *tpb;
+    unsigned short tpb_len;
+    SV             *compiled;
+    SV             **old;
+    STRLEN         name_len;
+    char           *name_str;
+    CODE:
+{
+    D_imp_dbh(dbh);
+
+    /* ST(2) .. ST(items-1) are the ib_set_tx_param() style pairs */
+    if (!ib_compile_tpb(dbh, &ST(1), items - 1, &tpb, &tpb_len))
+        XSRETURN_UNDEF;
+
+    compiled = newSVpvn(tpb, tpb_len);
+    Safefree(tpb);
+
+    if (!imp_dbh->tx_profiles)
+        imp_dbh->tx_profiles = newHV();
+
+    name_str = SvPV(name, name_len);
+
+    /* redefining the profile in use: switch to the new TPB too */
+    old = hv_fetch(imp_dbh->tx_profiles, name_str, name_len, 0);
+    if (old && *old == imp_dbh->tx_profile)
+    {
+        SvREFCNT_dec(imp_dbh->tx_profile);
+        imp_dbh->tx_profile = SvREFCNT_inc(compiled);
+    }
+    if (old && *old == imp_dbh->tx_profile_prev)
+    {
+        SvREFCNT_dec(imp_dbh->tx_profile_prev);
+        imp_dbh->tx_profile_prev = SvREFCNT_inc(compiled);
+    }
+
+    (void)hv_store(imp_dbh->tx_profiles, name_str, name_len, compiled, 0);
+    RETVAL = 1;
+}
+    OUTPUT:
+    RETVAL
+
+
+int
+ib_use_tx_profile(dbh, name = &PL_sv_undef)
+    SV *dbh
+    SV *name
+    PREINIT:
+    SV     **profile = NULL;
+    STRLEN name_len;
+    char   *name_str;
+    CODE:
+{
+    D_imp_dbh(dbh);
+
+    if (SvOK(name))
+    {
+        name_str = SvPV(name, name_len);
+        if (imp_dbh->tx_profiles)
+            profile = hv_fetch(imp_dbh->tx_profiles, name_str, name_len, 0);
+
+        if (!profile)
+        {
+            do_error(dbh, 2, "Unknown transaction profile");
+            XSRETURN_UNDEF;
+        }
+    }
+
+    /*
+     * nothing to compile, just point to the other TPB; a transaction
+     * already started keeps its parameters, the next one uses these
+     */
+    ib_select_tx_profile(imp_dbh, profile ? *profile : NULL);
+    RETVAL = 1;
+}
+    OUTPUT:
+    RETVAL
+
+
+int
+_begin_tx_profile(dbh, name)
+    SV *dbh
+    SV *name
+    PREINIT:
+    SV     **profile = NULL;
+    STRLEN name_len;
+    char   *name_str;
+    CODE:
+{
+    D_imp_dbh(dbh);
 
-    /* for AutoCommit: commit current transaction */
-    if (DBIc_has(imp_dbh, DBIcf_AutoCommit))
+    name_str = SvPV(name, name_len);
+    if (imp_dbh->tx_profiles)
+        profile = hv_fetch(imp_dbh->tx_profiles, name_str, name_len, 0);
+
+    if (!profile)
     {
-        imp_dbh->sth_ddl++;
-        ib_commit_transaction(dbh, imp_dbh);
+        do_error(dbh, 2, "Unknown transaction profile");
+        XSRETURN_UNDEF;
     }
-    RETVAL = 1;
+
+    RETVAL = ib_begin_tx_profile(dbh, imp_dbh, *profile);
+    if (!RETVAL)
+        XSRETURN_UNDEF;
 }
     OUTPUT:
     RETVAL
@@ -1648,6 +1968,311 @@ DESTROY(ev_rv)
 
 MODULE = DBD::Firebird     PACKAGE = DBD::Firebird::st
 
+void
+ib_fetch_into_hash(sth, hvref)
+    SV *sth
+    SV *hvref
+    PPCODE:
+{
+    D_imp_sth(sth);
+    HV  *hv;
+    AV  *row;
+    AV  *keys;
+    I32 i, n;
+
+    if (!SvROK(hvref) || SvTYPE(SvRV(hvref)) != SVt_PVHV)
+        croak("ib_fetch_into_hash: argument must be a hash reference");
+    hv = (HV*)SvRV(hvref);
+
+    row = dbd_st_fetch(sth, imp_sth);
+    if (!row)
+        XSRETURN_UNDEF;
+
+    keys = ib_st_hash_keys(sth, imp_sth);
+    if (!keys)
+        XSRETURN_UNDEF;
+
+    /* overwrite the values in place; the keys carry their shared hash */
+    n = av_len(row) + 1;
+    for (i = 0; i < n; i++)
+    {
+        SV *key = AvARRAY(keys)[i];
+        HE *he  = hv_fetch_ent(hv, key, 1, SvSHARED_HASH(key));
+
+        sv_setsv(HeVAL(he), AvARRAY(row)[i]);
+    }
+
+    XPUSHs(hvref);
+}
+
+void
+ib_execute_async(sth, ...)
+    SV *sth
+    PPCODE:
+{
+    D_imp_sth(sth);
+
+    /* bind values as execute does */
+    if (items > 1)
+    {
+        int i;
+        SV  *idx;
+
+        if (items - 1 != DBIc_NUM_PARAMS(imp_sth))
+        {
+            char errmsg[99];
+            snprintf(errmsg, sizeof(errmsg),
+                     "called with %d bind variables when %d are needed",
+                     (int) items - 1, (int) DBIc_NUM_PARAMS(imp_sth));
+            do_error(sth, -1, errmsg);
+            XSRETURN_UNDEF;
+        }
+
+        idx = sv_2mortal(newSViv(0));
+        for (i = 1; i < items; i++)
+        {
+            SV *value = ST(i);
+
+            if (SvGMAGICAL(value))
+                mg_get(value);
+            sv_setiv(idx, i);
+            if (!dbd_bind_ph(sth, imp_sth, idx, value, 0, Nullsv, FALSE, 0))
+                XSRETURN_UNDEF;
+        }
+    }
+
+    if (!ib_execute_async(sth, imp_sth))
+        XSRETURN_UNDEF;
+    XSRETURN_YES;
+}
+
+void
+ib_fetch_async(sth)
+    SV *sth
+    PPCODE:
+{
+    D_imp_sth(sth);
+
+    if (!ib_fetch_async(sth, imp_sth))
+        XSRETURN_UNDEF;
+    XSRETURN_YES;
+}
+
+void
+ib_async_result(sth)
+    SV *sth
+    PPCODE:
+{
+    D_imp_sth(sth);
+    int retval = -2;
+    AV  *row;
+
+    switch (ib_async_collect(sth, imp_sth, &retval))
+    {
+        case IB_ASYNC_EXECUTE: /* what execute would return */
+            if (retval == 0)
+                XPUSHs(sv_2mortal(newSVpvs("0E0")));
+            else if (retval < -1)
+                XSRETURN_UNDEF;
+            else
+                XPUSHs(sv_2mortal(newSViv(retval)));
+            break;
+
+        case IB_ASYNC_FETCH: /* what fetchrow_arrayref would return */
+            row = dbd_st_fetch(sth, imp_sth);
+            if (!row)
+                XSRETURN_UNDEF;
+            XPUSHs(sv_2mortal(newRV_inc((SV*)row)));
+            break;
+
+        default:
+            XSRETURN_UNDEF;
+    }
+}
+
+void
+ib_export(sth, ...)
+    SV *sth
+    PPCODE:
+{
+    D_imp_sth(sth);
+    IB_EXPORT_OPT opt;
+    PerlIO  *io = NULL;
+    long    rows;
+    int     i;
+
+    opt.format      = IB_EXPORT_CSV;
+    opt.sep         = ',';
+    opt.header      = 1;
+    opt.null        = NULL;
+    opt.null_len    = 0;
+    opt.buffer_size = 1024 * 1024;
+
+    if (!(items & 1))
+        croak("ib_export: odd number of arguments");
+
+    for (i = 1; i < items; i += 2)
+    {
+        char *key   = SvPV_nolen(ST(i));
+        SV   *value = ST(i + 1);
+
+        if (strEQ(key, "fh"))
+        {
+            IO *fio = SvOK(value) ? sv_2io(value) : NULL;
+
+            if (!fio || !(io = IoOFP(fio)))
+                croak("ib_export: fh is not open for writing");
+        }
+        else if (strEQ(key, "format"))
+        {
+            char *format = SvPV_nolen(value);
+
+            if (strEQ(format, "csv"))
+                opt.format = IB_EXPORT_CSV;
+            else if (strEQ(format, "tsv"))
+                opt.format = IB_EXPORT_TSV;
+            else if (strEQ(format, "jsonl"))
+                opt.format = IB_EXPORT_JSONL;
+            else
+                croak("ib_export: unknown format %s", format);
+        }
+        else if (strEQ(key, "header"))
+            opt.header = SvTRUE(value);
+        else if (strEQ(key, "sep_char"))
+        {
+            STRLEN len;
+            char   *sep = SvPV(value, len);
+
+            if (len != 1 || *sep == '"' || *sep == '\n' || *sep == '\r')
+                croak("ib_export: sep_char must be a single character");
+            opt.sep = *sep;
+        }
+        else if (strEQ(key, "null"))
+        {
+            opt.null     = "";
+            opt.null_len = 0;
+            if (SvOK(value))
+                opt.null = SvPV(value, opt.null_len);
+        }
+        else if (strEQ(key, "buffer_size"))
+        {
+            IV size = SvIV(value);
+
+            if (size < 1)
+                croak("ib_export: buffer_size must be a positive number");
+            opt.buffer_size = (size_t) size;
+        }
+        else
+            croak("ib_export: unknown option %s", key);
+    }
+
+    if (!io)
+        croak("ib_export: fh is required");
+
+    /* empty fields are NULL in CSV, \N in TSV */
+    if (!opt.null)
+    {
+        opt.null     = opt.format == IB_EXPORT_TSV ? "\\N" : "";
+        opt.null_len = strlen(opt.null);
+    }
+
+    rows = ib_st_export(sth, imp_sth, io, &opt);
+    if (rows < 0)
+        XSRETURN_UNDEF;
+    if (rows == 0)
+        XPUSHs(sv_2mortal(newSVpvs("0E0")));
+    else
+        XPUSHs(sv_2mortal(newSViv(rows)));
+}
+
+void
+ib_fetch_arrow(sth, fh, ...)
+    SV *sth
+    SV *fh
+    PPCODE:
+{
+    D_imp_sth(sth);
+    IO      *fio = SvOK(fh) ? sv_2io(fh) : NULL;
+    PerlIO  *io;
+    long    batch_rows = 65536;
+    long    rows;
+    int     i;
+
+    if (!fio || !(io = IoOFP(fio)))
+        croak("ib_fetch_arrow: fh is not open for writing");
+
+    if (items & 1)
+        croak("ib_fetch_arrow: odd number of arguments");
+
+    for (i = 2; i < items; i += 2)
+    {
+        char *key = SvPV_nolen(ST(i));
+
+        if (strEQ(key, "batch_rows"))
+        {
+            batch_rows = (long) SvIV(ST(i + 1));
+            if (batch_rows < 1)
+                croak("ib_fetch_arrow: batch_rows must be a positive number");
+        }
+        else
+            croak("ib_fetch_arrow: unknown option %s", key);
+    }
+
+    rows = ib_st_fetch_arrow(sth, imp_sth, io, batch_rows);
+    if (rows < 0)
+        XSRETURN_UNDEF;
+    if (rows == 0)
+        XPUSHs(sv_2mortal(newSVpvs("0E0")));
+    else
+        XPUSHs(sv_2mortal(newSViv(rows)));
+}
+
+SV *
+_ib_spill(sth, outer, path, keep)
+    SV *sth
+    SV *outer
+    SV *path
+    int keep
+    CODE:
+{
+    D_imp_sth(sth);
+    IB_SPILL s;
+
+    if (ib_spill_write(sth, imp_sth, &s, SvOK(path) ? SvPV_nolen(path) : NULL) < 0)
+        XSRETURN_UNDEF;
+
+    /* the outer handle: the inner one alone does not keep the statement */
+    s.sth  = newSVsv(outer);
+    s.keep = keep;
+
+    RETVAL = sv_bless(
+        newRV_noinc(newSVpvn((char *)&s, sizeof(s))),
+        gv_stashpvs("DBD::Firebird::Spill", GV_ADD));
+}
+    OUTPUT:
+    RETVAL
+
+SV *
+_ib_fetch_lazy(sth, outer)
+    SV *sth
+    SV *outer
+    CODE:
+{
+    D_imp_sth(sth);
+    IB_LAZY_ROW r;
+
+    if (ib_st_fetch_lazy(sth, imp_sth, &r) <= 0)
+        XSRETURN_UNDEF;
+
+    r.sth = newSVsv(outer);
+
+    RETVAL = sv_bless(
+        newRV_noinc(newSVpvn((char *)&r, sizeof(r))),
+        gv_stashpvs("DBD::Firebird::Row", GV_ADD));
+}
+    OUTPUT:
+    RETVAL
+
 char*
 ib_plan(sth)
     SV *sth
@@ -1680,3 +2305,194 @@ ib_plan(sth)
 }
     OUTPUT:
     RETVAL
+
+
+MODULE = DBD::Firebird     PACKAGE = DBD::Firebird::BulkLoader
+PROTOTYPES: DISABLE
+
+void
+_load_fh(self, fh, tsv, sep, header, utf8, async)
+    SV *    self
+    SV *    fh
+    int     tsv
+    char    sep
+    int     header
+    int     utf8
+    int     async
+    CODE:
+{
+    IO  *fio = sv_2io(fh);
+
+    if (!fio || !IoIFP(fio))
+        croak("DBD::Firebird::BulkLoader: the file is not open for reading");
+    ib_bulk_load_fh(self, IoIFP(fio), tsv, sep, header, utf8, async);
+}
+
+
+MODULE = DBD::Firebird     PACKAGE = DBD::Firebird::Spill
+PROTOTYPES: DISABLE
+
+SV *
+rows(spill)
+    SV *spill
+    CODE:
+{
+    IB_SPILL *s = (IB_SPILL *) SvPV_nolen(SvRV(spill));
+
+    RETVAL = newSVuv((UV) s->rows);
+}
+    OUTPUT:
+    RETVAL
+
+SV *
+sth(spill)
+    SV *spill
+    CODE:
+{
+    IB_SPILL *s = (IB_SPILL *) SvPV_nolen(SvRV(spill));
+
+    RETVAL = newSVsv(s->sth);
+}
+    OUTPUT:
+    RETVAL
+
+SV *
+row(spill, i)
+    SV *spill
+    IV i
+    CODE:
+{
+    IB_SPILL *s = (IB_SPILL *) SvPV_nolen(SvRV(spill));
+    D_imp_sth(s->sth);
+    AV  *av;
+    int j;
+
+    if (i < 0 || (ISC_UINT64) i >= s->rows)
+        XSRETURN_UNDEF;
+
+    av = newAV();
+    av_extend(av, s->ncols - 1);
+    for (j = 0; j < s->ncols; j++)
+        av_store(av, j, newSV(0));
+
+    if (!ib_spill_decode(s->sth, imp_sth, s, (ISC_UINT64) i, -1, AvARRAY(av)))
+    {
+        SvREFCNT_dec((SV *) av);
+        XSRETURN_UNDEF;
+    }
+    RETVAL = newRV_noinc((SV *) av);
+}
+    OUTPUT:
+    RETVAL
+
+SV *
+cell(spill, i, j)
+    SV *spill
+    IV i
+    IV j
+    CODE:
+{
+    IB_SPILL *s = (IB_SPILL *) SvPV_nolen(SvRV(spill));
+    D_imp_sth(s->sth);
+
+    if (i < 0 || (ISC_UINT64) i >= s->rows || j < 0 || j >= s->ncols)
+        XSRETURN_UNDEF;
+
+    RETVAL = newSV(0);
+    if (!ib_spill_decode(s->sth, imp_sth, s, (ISC_UINT64) i, (int) j, &RETVAL))
+    {
+        SvREFCNT_dec(RETVAL);
+        XSRETURN_UNDEF;
+    }
+}
+    OUTPUT:
+    RETVAL
+
+void
+DESTROY(spill)
+    SV *spill
+    CODE:
+{
+    IB_SPILL *s = (IB_SPILL *) SvPV_nolen(SvRV(spill));
+
+    ib_spill_close(s);
+    SvREFCNT_dec(s->sth);
+    s->sth = NULL;
+}
+
+
+MODULE = DBD::Firebird     PACKAGE = DBD::Firebird::Row
+PROTOTYPES: DISABLE
+
+int
+count(row)
+    SV *row
+    CODE:
+{
+    IB_LAZY_ROW *r = (IB_LAZY_ROW *) SvPV_nolen(SvRV(row));
+
+    RETVAL = r->ncols;
+}
+    OUTPUT:
+    RETVAL
+
+SV *
+sth(row)
+    SV *row
+    CODE:
+{
+    IB_LAZY_ROW *r = (IB_LAZY_ROW *) SvPV_nolen(SvRV(row));
+
+    RETVAL = newSVsv(r->sth);
+}
+    OUTPUT:
+    RETVAL
+
+SV *
+col(row, i)
+    SV *row
+    IV i
+    CODE:
+{
+    IB_LAZY_ROW *r = (IB_LAZY_ROW *) SvPV_nolen(SvRV(row));
+    D_imp_sth(r->sth);
+    SV *sv;
+
+    if (i < 0)
+        i += r->ncols;
+    if (i < 0 || i >= r->ncols)
+        XSRETURN_UNDEF;
+
+    sv = ib_lazy_column(r->sth, imp_sth, r, (int) i);
+    if (!sv)
+        XSRETURN_UNDEF;
+    RETVAL = SvREFCNT_inc_simple_NN(sv);
+}
+    OUTPUT:
+    RETVAL
+
+int
+_decoded(row, i)
+    SV *row
+    IV i
+    CODE:
+{
+    /* for the tests: whether column i has been decoded yet */
+    IB_LAZY_ROW *r = (IB_LAZY_ROW *) SvPV_nolen(SvRV(row));
+
+    RETVAL = i >= 0 && i < r->ncols && r->memo[i] != NULL;
+}
+    OUTPUT:
+    RETVAL
+
+void
+DESTROY(row)
+    SV *row
+    CODE:
+{
+    IB_LAZY_ROW *r = (IB_LAZY_ROW *) SvPV_nolen(SvRV(row));
+
+    ib_lazy_free(r);
+    SvREFCNT_dec(r->sth);
+    r->sth = NULL;
+}
@@ -15,10 +15,28 @@
 #include "Firebird.h"
 #include <stdint.h>
 
+#ifdef IB_HAVE_ASYNC
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#endif
+
 #ifndef _MSC_VER
 #include <inttypes.h>
 #endif
 
+#ifdef HAS_MMAP
+#include <sys/mman.h>
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define IB_HAVE_SSE2
+#endif
+
 DBISTATE_DECLARE;
 
 #define ERRBUFSIZE  255
@@ -50,25 +68,151 @@ do {                                                         \
     sqlda->version = SQLDA_OK_VERSION;                       \
 } while (0)
 
-#ifndef is_ascii_string
-#warning "Using built-in implementation of is_ascii_string."
-#warning "Upgrading perl to 5.12 is suggested."
-// for perl before 5.12.0 RC1
-// taken straight from the perl source
-bool is_ascii_string(const U8 *s, STRLEN len) {
-    const U8* const send = s + (len ? len : strlen((const char *)s));
-    const U8* x = s;
+/*
+ * UTF-8 scanning for ib_enable_utf8
+ *
+ * One pass tells plain ASCII, well-formed UTF-8 and anything else apart.
+ * Runs of ASCII are skipped 32 (AVX2), 16 (SSE2) or 8 bytes at a time,
+ * multi-byte sequences are checked one by one: overlong forms, surrogates
+ * and code points above U+10FFFF are rejected.
+ */
+#define IB_UTF8_ASCII   0
+#define IB_UTF8_VALID   1
+#define IB_UTF8_INVALID 2
+
+/* length of the leading ASCII run of s */
+static STRLEN ib_ascii_prefix(const U8 *s, STRLEN len)
+{
+    STRLEN i = 0;
+
+#if defined(__AVX2__)
+    for (; i + 32 <= len; i += 32)
+        if (_mm256_movemask_epi8(_mm256_loadu_si256((const __m256i *)(s + i))))
+            break;
+#endif
+#if defined(IB_HAVE_SSE2)
+    for (; i + 16 <= len; i += 16)
+        if (_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(s + i))))
+            break;
+#endif
+    for (; i + 8 <= len; i += 8)
+    {
+        uint64_t w;
 
-    for (; x < send; ++x) {
-        if (!UTF8_IS_INVARIANT(*x))
+        memcpy(&w, s + i, sizeof(w));
+        if (w & UINT64_C(0x8080808080808080))
             break;
+    }
+    while (i < len && s[i] < 0x80)
+        i++;
+
+    return i;
+}
+
+/* length of s without its trailing blanks */
+static STRLEN ib_rtrim_len(const char *s, STRLEN len)
+{
+#if defined(IB_HAVE_SSE2)
+    const __m128i blanks = _mm_set1_epi8(' ');
+
+    while (len >= 16
+           && _mm_movemask_epi8(_mm_cmpeq_epi8(
+                  _mm_loadu_si128((const __m128i *)(s + len - 16)), blanks)) == 0xFFFF)
+        len -= 16;
+#endif
+    while (len >= 8)
+    {
+        uint64_t w;
 
+        memcpy(&w, s + len - 8, sizeof(w));
+        if (w != UINT64_C(0x2020202020202020))
+            break;
+        len -= 8;
     }
+    while (len && s[len - 1] == ' ')
+        len--;
+
+    return len;
+}
 
-    return x == send;
+#if defined(__GNUC__)
+#define IB_POPCOUNT64(w) __builtin_popcountll(w)
+#else
+static int IB_POPCOUNT64(uint64_t w)
+{
+    w = w - ((w >> 1) & UINT64_C(0x5555555555555555));
+    w = (w & UINT64_C(0x3333333333333333)) + ((w >> 2) & UINT64_C(0x3333333333333333));
+    w = (w + (w >> 4)) & UINT64_C(0x0F0F0F0F0F0F0F0F);
+    return (int) ((w * UINT64_C(0x0101010101010101)) >> 56);
 }
 #endif
 
+/* number of characters in UTF-8 text: bytes that are not 10xxxxxx */
+static STRLEN ib_utf8_length(const U8 *s, STRLEN len)
+{
+    STRLEN i = 0, cont = 0;
+
+    for (; i + 8 <= len; i += 8)
+    {
+        uint64_t w;
+
+        memcpy(&w, s + i, sizeof(w));
+        cont += IB_POPCOUNT64(w & ~(w << 1) & UINT64_C(0x8080808080808080));
+    }
+    for (; i < len; i++)
+        cont += (s[i] & 0xC0) == 0x80;
+
+    return len - cont;
+}
+
+static int ib_utf8_scan(const U8 *s, STRLEN len)
+{
+    STRLEN i = ib_ascii_prefix(s, len);
+
+    if (i == len)
+        return IB_UTF8_ASCII;
+
+    while (i < len)
+    {
+        U8 c = s[i], lo = 0x80, hi = 0xBF;
+        int n;
+
+        if (c < 0x80)
+        {
+            i += ib_ascii_prefix(s + i, len - i);
+            continue;
+        }
+
+        if (c >= 0xC2 && c <= 0xDF)
+            n = 1;
+        else if (c >= 0xE0 && c <= 0xEF)
+        {
+            n = 2;
+            if (c == 0xE0) lo = 0xA0;       /* overlong */
+            if (c == 0xED) hi = 0x9F;       /* surrogates */
+        }
+        else if (c >= 0xF0 && c <= 0xF4)
+        {
+            n = 3;
+            if (c == 0xF0) lo = 0x90;       /* overlong */
+            if (c == 0xF4) hi = 0x8F;       /* above U+10FFFF */
+        }
+        else
+            return IB_UTF8_INVALID;
+
+        if (len - i <= (STRLEN) n || s[i + 1] < lo || s[i + 1] > hi)
+            return IB_UTF8_INVALID;
+        if (n > 1 && (s[i + 2] & 0xC0) != 0x80)
+            return IB_UTF8_INVALID;
+        if (n > 2 && (s[i + 3] & 0xC0) != 0x80)
+            return IB_UTF8_INVALID;
+
+        i += n + 1;
+    }
+
+    return IB_UTF8_VALID;
+}
+
 int create_cursor_name(SV *sth, imp_sth_t *imp_sth)
 {
     ISC_STATUS status[ISC_STATUS_LENGTH];
@@ -82,1996 +226,7550 @@ int create_cursor_name(SV *sth, imp_sth_t *imp_sth)
     return TRUE;
 }
 
-void maybe_upgrade_to_utf8(imp_dbh_t *imp_dbh, SV *sv) {
-    if (imp_dbh->ib_enable_utf8) {
-        U8 *p;
-        STRLEN len;
-        p = (U8*)SvPV(sv, len);
+/*
+ * Transliteration for single-byte connection character sets
+ *
+ * With ib_enable_utf8 on a WIN1251 or ISO8859_1 connection, the server
+ * sends one byte per character and the driver does the conversion to and
+ * from Perl character strings through 256-entry tables, built once by
+ * dbd_init().
+ */
+struct ib_xlat
+{
+    const char  *name;                  /* RDB$CHARACTER_SET_NAME */
+    int         id;                     /* RDB$CHARACTER_SET_ID */
+    const U16   *high;                  /* code points of 0x80..0xFF, NULL for Latin-1 */
+    U8          utf8[256][4];           /* UTF-8 length, then the bytes */
+    U16         max_cp;
+    U8          *rev;                   /* code point -> byte, 0 if none */
+};
+
+static const U16 ib_win1251_high[128] =
+{
+    0x0402, 0x0403, 0x201A, 0x0453, 0x201E, 0x2026, 0x2020, 0x2021,
+    0x20AC, 0x2030, 0x0409, 0x2039, 0x040A, 0x040C, 0x040B, 0x040F,
+    0x0452, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+    0x0098, 0x2122, 0x0459, 0x203A, 0x045A, 0x045C, 0x045B, 0x045F,
+    0x00A0, 0x040E, 0x045E, 0x0408, 0x00A4, 0x0490, 0x00A6, 0x00A7,
+    0x0401, 0x00A9, 0x0404, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x0407,
+    0x00B0, 0x00B1, 0x0406, 0x0456, 0x0491, 0x00B5, 0x00B6, 0x00B7,
+    0x0451, 0x2116, 0x0454, 0x00BB, 0x0458, 0x0405, 0x0455, 0x0457,
+    0x0410, 0x0411, 0x0412, 0x0413, 0x0414, 0x0415, 0x0416, 0x0417,
+    0x0418, 0x0419, 0x041A, 0x041B, 0x041C, 0x041D, 0x041E, 0x041F,
+    0x0420, 0x0421, 0x0422, 0x0423, 0x0424, 0x0425, 0x0426, 0x0427,
+    0x0428, 0x0429, 0x042A, 0x042B, 0x042C, 0x042D, 0x042E, 0x042F,
+    0x0430, 0x0431, 0x0432, 0x0433, 0x0434, 0x0435, 0x0436, 0x0437,
+    0x0438, 0x0439, 0x043A, 0x043B, 0x043C, 0x043D, 0x043E, 0x043F,
+    0x0440, 0x0441, 0x0442, 0x0443, 0x0444, 0x0445, 0x0446, 0x0447,
+    0x0448, 0x0449, 0x044A, 0x044B, 0x044C, 0x044D, 0x044E, 0x044F
+};
+
+static IB_XLAT ib_xlat_tables[] =
+{
+    { "WIN1251",   52, ib_win1251_high },
+    { "ISO8859_1", 21, NULL },
+    { NULL }
+};
 
-        if (!is_ascii_string(p, len)
-                && is_utf8_string(p, len)) {
-            SvUTF8_on(sv);
+static void ib_xlat_init(void)
+{
+    IB_XLAT *x;
+    unsigned int b;
+
+    for (x = ib_xlat_tables; x->name; x++)
+    {
+        if (x->rev)
+            continue;
+
+        x->max_cp = 0;
+        for (b = 0; b < 256; b++)
+        {
+            U16 cp = (b < 0x80 || !x->high) ? b : x->high[b - 0x80];
+            U8 *u = x->utf8[b];
+
+            if (cp < 0x80)
+            {
+                u[0] = 1; u[1] = (U8) cp;
+            }
+            else if (cp < 0x800)
+            {
+                u[0] = 2;
+                u[1] = (U8) (0xC0 | (cp >> 6));
+                u[2] = (U8) (0x80 | (cp & 0x3F));
+            }
+            else
+            {
+                u[0] = 3;
+                u[1] = (U8) (0xE0 | (cp >> 12));
+                u[2] = (U8) (0x80 | ((cp >> 6) & 0x3F));
+                u[3] = (U8) (0x80 | (cp & 0x3F));
+            }
+            if (cp > x->max_cp)
+                x->max_cp = cp;
         }
+
+        Newxz(x->rev, x->max_cp + 1, U8);
+        for (b = 0x80; b < 256; b++)
+            x->rev[x->high ? x->high[b - 0x80] : b] = (U8) b;
     }
 }
 
-void dbd_init(dbistate_t *dbistate)
+/* the table for a connection character set, NULL if there is none */
+static const IB_XLAT *ib_xlat_find(const char *charset)
 {
-    DBISTATE_INIT;
-}
+    const IB_XLAT *x;
 
+    if (charset)
+        for (x = ib_xlat_tables; x->name; x++)
+            if (strEQ(x->name, charset))
+                return x;
+    return NULL;
+}
 
-void ib_cleanup_st_prepare (imp_sth_t *imp_sth)
+/* decode single-byte text in sv to UTF-8, widening it in place */
+static void ib_xlat_decode(const IB_XLAT *x, SV *sv)
 {
-    FREE_SETNULL(imp_sth->in_sqlda);
-    FREE_SETNULL(imp_sth->out_sqlda);
-    FREE_SETNULL(imp_sth->dateformat);
-    FREE_SETNULL(imp_sth->timeformat);
-    FREE_SETNULL(imp_sth->timestampformat);
-}
+    STRLEN len, out, ascii, i;
+    U8 *s, *src, *dst;
 
+    s = (U8 *) SvPV(sv, len);
+    ascii = ib_ascii_prefix(s, len);
+    if (ascii == len)
+        return;
 
-void ib_cleanup_st_execute (imp_sth_t *imp_sth)
-{
-    if (imp_sth->in_sqlda)
+    for (out = len, i = ascii; i < len; i++)
+        out += x->utf8[s[i]][0] - 1;
+
+    s = (U8 *) SvGROW(sv, out + 1);
+    src = s + len;
+    dst = s + out;
+    while (src > s + ascii)
     {
-        int i;
-        XSQLVAR *var = imp_sth->in_sqlda->sqlvar;
+        const U8 *u = x->utf8[*--src];
 
-        for (i = 0; i < imp_sth->in_sqlda->sqln; i++, var++)
+        switch (u[0])
         {
-            Safefree(var->sqldata);
-            var->sqldata = NULL;
-            if (var->sqlind)
-                *(var->sqlind) = -1;    /* isNULL */
+            case 3: *--dst = u[3]; /* FALLTHROUGH */
+            case 2: *--dst = u[2]; /* FALLTHROUGH */
+            default: *--dst = u[1];
         }
     }
+    s[out] = '\0';
+    SvCUR_set(sv, out);
+    SvUTF8_on(sv);
 }
 
-
-/* lower level error handling */
-void do_error(SV *h, int rc, char *what)
+/*
+ * A text parameter in the connection character set: value itself, or a
+ * mortal copy for a Perl character string. NULL with the error set if a
+ * character has no equivalent.
+ */
+static SV *ib_xlat_param(SV *h, imp_dbh_t *imp_dbh, SV *value)
 {
-    D_imp_xxh(h);
-    SV *errstr = DBIc_ERRSTR(imp_xxh);
+    const IB_XLAT *x = imp_dbh->ib_xlat;
+    STRLEN len, i;
+    U8    *s, *d;
+    SV    *out;
 
-    sv_setiv(DBIc_ERR(imp_xxh), (IV)rc);
-    sv_setpv(errstr, what);
+    if (!x || !imp_dbh->ib_enable_utf8 || !SvUTF8(value))
+        return value;
 
-    if (DBIc_TRACE_LEVEL(imp_xxh) >= 2)
-        PerlIO_printf(DBIc_LOGPIO(imp_xxh), "%s error %d recorded: %s\n", 
-            what, rc, SvPV(errstr,PL_na));
+    s = (U8 *) SvPV(value, len);
+    out = sv_2mortal(newSV(len + 1));
+    d = (U8 *) SvPVX(out);
+
+    /* perl keeps the string well-formed */
+    for (i = 0; i < len; )
+    {
+        UV  cp = s[i];
+        int n = cp < 0x80 ? 0 : cp < 0xE0 ? 1 : cp < 0xF0 ? 2 : 3;
+
+        if (n)
+            cp &= 0x3F >> n;
+        if (i + n >= len)
+            n = (int) (len - i - 1);
+        for (i++; n > 0; n--, i++)
+            cp = (cp << 6) | (s[i] & 0x3F);
+
+        if (cp < 0x80)
+            *d++ = (U8) cp;
+        else if (cp <= x->max_cp && x->rev[cp])
+            *d++ = x->rev[cp];
+        else
+        {
+            char err[ERRBUFSIZE];
+            snprintf(err, sizeof(err),
+                "Cannot transliterate character U+%04" UVXf " to %s", cp, x->name);
+            do_error(h, 2, err);
+            return NULL;
+        }
+    }
+    *d = '\0';
+    SvCUR_set(out, d - (U8 *) SvPVX(out));
+    SvPOK_only(out);
+
+    return out;
 }
 
-#define CALC_AVAILABLE(buff) sizeof(buff) - strlen(buff) - 1
+void maybe_upgrade_to_utf8(imp_dbh_t *imp_dbh, SV *sv, int charset) {
+    if (imp_dbh->ib_enable_utf8) {
+        U8 *p;
+        STRLEN len;
+
+        if (imp_dbh->ib_xlat && charset == imp_dbh->ib_xlat->id) {
+            ib_xlat_decode(imp_dbh->ib_xlat, sv);
+            return;
+        }
+
+        /* the server only hands out well-formed UTF8 columns */
+        if (imp_dbh->ib_trust_utf8 && charset == IB_CS_UTF8) {
+            SvUTF8_on(sv);
+            return;
+        }
+
+        p = (U8*)SvPV(sv, len);
+        if (ib_utf8_scan(p, len) == IB_UTF8_VALID) {
+            SvUTF8_on(sv);
+        }
+    }
+}
 
 /*
-   decode status vector into a char pointer (implemented by a mortal scalar)
-   Returns NULL if there is no error
+ * INT128 and DECFLOAT (Firebird 4.0+)
+ *
+ * Both are converted by the driver without going through a double:
+ * INT128 with 32-bit limbs, as not every compiler has a 128-bit integer,
+ * DECFLOAT(16) and DECFLOAT(34) from and to the IEEE 754 decimal64 and
+ * decimal128 densely packed decimal (DPD) encoding the client library
+ * uses. Numbers travel as IB_DECIMAL, a coefficient of decimal digits and
+ * a power of ten; text looks like what the server gives for a CAST to
+ * VARCHAR.
  */
-char* ib_error_decode(const ISC_STATUS *status) {
-    SV *sv = NULL;
-    long sqlcode;
-#if !defined(FB_API_VER) || FB_API_VER < 20
-    ISC_STATUS *pvector = status;
-#else
-    const ISC_STATUS *pvector = status;
-#endif
-#if defined (INCLUDE_TYPES_PUB_H) || defined(FIREBIRD_IMPL_TYPES_PUB_H)
-    ISC_SCHAR msg[1024];
+#define IB_DEC_DIGITS   40          /* significant digits kept */
+
+#define IB_DEC_INF      1
+#define IB_DEC_NAN      2
+#define IB_DEC_SNAN     3
+
+typedef struct
+{
+    char    sign;                   /* 1 for negative */
+    char    special;                /* IB_DEC_INF, IB_DEC_NAN, IB_DEC_SNAN */
+    int     ndigits;                /* 0 for zero, no leading zeros */
+    long    exponent;               /* value is digits * 10^exponent */
+    U8      digit[IB_DEC_DIGITS + 1];
+} IB_DECIMAL;
+
+/* FB_I128 and FB_DEC34 keep their 64-bit halves in machine order */
+#if BYTEORDER == 0x4321 || BYTEORDER == 0x87654321
+#  define IB_W128_LO 1
+#  define IB_W128_HI 0
 #else
-    char msg[1024];
+#  define IB_W128_LO 0
+#  define IB_W128_HI 1
 #endif
 
-    if (status[0] != 1 || status[1] <= 0)
-	return NULL;
+/* declet -> 0..999 and back, filled by dbd_init() */
+static U16 ib_dpd_decode[1024];
+static U16 ib_dpd_encode[1000];
 
-    if ((sqlcode = isc_sqlcode(status)) != 0)
-    {
-	isc_sql_interprete((short) sqlcode, msg, sizeof(msg));
-	sv = sv_2mortal(newSVpv(msg, 0));
-    }
+static void ib_dpd_init(void)
+{
+    int d;
 
-#if !defined(FB_API_VER) || FB_API_VER < 20
-    while (isc_interprete(msg, &pvector))
-#else
-    while (fb_interpret(msg, sizeof(msg), &pvector))
-#endif
+    for (d = 1023; d >= 0; d--)
     {
-	if ( sv != NULL ) {
-	    sv_catpvn(sv, "\n-", 2);
-	    sv_catpv(sv, msg);
-	}
-	else sv = sv_2mortal(newSVpv(msg,0));
-    }
+        int h = (d >> 7) & 7, m = (d >> 4) & 7, l = d & 7;
+        int b9b8 = (d >> 8) & 3, b6b5 = (d >> 5) & 3, b7 = (d >> 7) & 1,
+            b4 = (d >> 4) & 1, b0 = d & 1;
 
-    sv_catpvn(sv, "\0", 1);  // NUL-terminate
+        if (d & 8)
+            switch ((d >> 1) & 3)
+            {
+                case 0: l = 8 + b0; break;
+                case 1: m = 8 + b4; l = (b6b5 << 1) | b0; break;
+                case 2: h = 8 + b7; l = (b9b8 << 1) | b0; break;
+                default:
+                    switch (b6b5)
+                    {
+                        case 0: h = 8 + b7; m = 8 + b4; l = (b9b8 << 1) | b0; break;
+                        case 1: h = 8 + b7; m = (b9b8 << 1) | b4; l = 8 + b0; break;
+                        case 2: m = 8 + b4; l = 8 + b0; break;
+                        default: h = 8 + b7; m = 8 + b4; l = 8 + b0;
+                    }
+            }
 
-    return SvPV_nolen(sv);
+        ib_dpd_decode[d] = (U16) (h * 100 + m * 10 + l);
+        /* going down, the canonical declet of a value is stored last */
+        ib_dpd_encode[h * 100 + m * 10 + l] = (U16) d;
+    }
 }
 
-/* higher level error handling, check and decode status */
-int ib_error_check(SV *h, ISC_STATUS *status)
+/* width bits at pos of a 128-bit word pair, u[0] the low half */
+static unsigned ib_w128_get(const ISC_UINT64 *u, int pos, int width)
 {
-    char *msg = ib_error_decode(status);
+    ISC_UINT64 v;
 
-    if (msg == NULL)
-	return SUCCESS;
+    if (pos >= 64)
+        v = u[1] >> (pos - 64);
+    else if (pos + width <= 64)
+        v = u[0] >> pos;
+    else
+        v = (u[0] >> pos) | (u[1] << (64 - pos));
 
-    do_error(h, isc_sqlcode(status), msg);
-    return FAILURE;
+    return (unsigned) (v & ((1U << width) - 1));
 }
 
-
-static int ib2sql_type(int ibtype)
+static void ib_w128_put(ISC_UINT64 *u, int pos, unsigned v)
 {
-    /* Firebird Internal (not external) types */
-    switch(ibtype & ~1)
+    if (pos >= 64)
+        u[1] |= (ISC_UINT64) v << (pos - 64);
+    else
     {
-        case SQL_TEXT:
-            return DBI_SQL_CHAR;
+        u[0] |= (ISC_UINT64) v << pos;
+        if (pos)
+            u[1] |= (ISC_UINT64) v >> (64 - pos);
+    }
+}
 
-        case SQL_LONG:
-            return DBI_SQL_INTEGER;  /* integer */
+/* drop all but keep digits, rounding half away from zero */
+static void ib_dec_round(IB_DECIMAL *d, int keep)
+{
+    int i, up;
 
-        case SQL_SHORT:
-            return DBI_SQL_SMALLINT; /* smallint */
+    if (keep >= d->ndigits)
+        return;
 
-        case SQL_FLOAT:
-            return DBI_SQL_FLOAT;
+    up = keep >= 0 && d->digit[keep] >= 5;
+    d->exponent += d->ndigits - keep;
+    if (keep <= 0)
+    {
+        d->ndigits = up ? 1 : 0;
+        d->digit[0] = 1;
+        return;
+    }
 
-        case SQL_DOUBLE:
-            return DBI_SQL_DOUBLE;
+    d->ndigits = keep;
+    for (i = keep - 1; up && i >= 0; i--)
+    {
+        if (++d->digit[i] < 10)
+            up = 0;
+        else
+            d->digit[i] = 0;
+    }
+    if (up)
+    {
+        /* 99..9 became 100..0 */
+        d->digit[0] = 1;
+        d->exponent++;
+    }
+}
 
-        case SQL_TIMESTAMP:
-            return DBI_SQL_TIMESTAMP;
+static int ib_dec_word(const char *s, const char *end, const char *word)
+{
+    for (; s < end && *word; s++, word++)
+        if (toLOWER(*s) != *word)
+            return FALSE;
+    return s == end && !*word;
+}
 
-        case SQL_TYPE_DATE:
-            return DBI_SQL_DATE;
+/* parse "-12.50", "1.5e-3", ".5", "Infinity" or "NaN" */
+static int ib_dec_parse(const char *s, STRLEN len, IB_DECIMAL *d)
+{
+    const char *end = s + len;
+    int dot = 0, any = 0;
+
+    Zero(d, 1, IB_DECIMAL);
+
+    while (s < end && isSPACE(*s))
+        s++;
+    while (end > s && isSPACE(end[-1]))
+        end--;
+
+    if (s < end && (*s == '-' || *s == '+'))
+        d->sign = (*s++ == '-');
+
+    if (ib_dec_word(s, end, "inf") || ib_dec_word(s, end, "infinity"))
+        d->special = IB_DEC_INF;
+    else if (ib_dec_word(s, end, "nan"))
+        d->special = IB_DEC_NAN;
+    else if (ib_dec_word(s, end, "snan"))
+        d->special = IB_DEC_SNAN;
+    if (d->special)
+        return TRUE;
 
-        case SQL_TYPE_TIME:
-            return DBI_SQL_TIME;
+    for (; s < end; s++)
+    {
+        if (isDIGIT(*s))
+        {
+            any = 1;
+            if (*s == '0' && !d->ndigits)
+                d->exponent -= dot;
+            else if (d->ndigits <= IB_DEC_DIGITS)
+            {
+                d->digit[d->ndigits++] = *s - '0';
+                d->exponent -= dot;
+            }
+            else if (!dot)
+                d->exponent++;
+        }
+        else if (*s == '.' && !dot)
+            dot = 1;
+        else
+            break;
+    }
 
-        case SQL_VARYING:
-            return DBI_SQL_VARCHAR;
+    if (any && s < end && (*s == 'e' || *s == 'E'))
+    {
+        long e = 0;
+        int  neg = 0;
 
-#ifdef SQL_INT64
-        case SQL_INT64:
-            return DBI_SQL_BIGINT;
-#endif
+        if (++s < end && (*s == '-' || *s == '+'))
+            neg = (*s++ == '-');
+        if (s == end)
+            return FALSE;
+        for (; s < end && isDIGIT(*s); s++)
+            if (e < 100000)
+                e = e * 10 + (*s - '0');
+        d->exponent += neg ? -e : e;
+    }
 
-#ifdef SQL_BOOLEAN
-        case SQL_BOOLEAN:
-            return DBI_SQL_BOOLEAN;
-#endif
+    if (!any || s != end)
+        return FALSE;
 
-        case SQL_TIMESTAMP_TZ:
-        case SQL_TIMESTAMP_TZ_EX:
-            return DBI_SQL_TIMESTAMP;
-
-        case SQL_TIME_TZ:
-        case SQL_TIME_TZ_EX:
-            return DBI_SQL_TYPE_TIME;
-    }
-    /* else map type into DBI reserved standard range */
-    return -9000 - ibtype;
+    ib_dec_round(d, IB_DEC_DIGITS);
+    return TRUE;
 }
 
-#if 0
-/* from DBI (ANSI/ISO/ODBC) types to Firebird types */
-static int ib_sql_type(imp_sth_t *imp_sth, char *name, int sql_type)
+/*
+   Text of a number: plain notation for the scaled INT128 values and for
+   DECFLOAT values with a small enough exponent, "1.5E+20" otherwise.
+   buf needs 96 bytes.
+ */
+static STRLEN ib_dec_format(const IB_DECIMAL *d, int plain, char *buf)
 {
-    /* XXX should detect DBI reserved standard type range here */
-    switch (sql_type) {
-    case DBI_SQL_NUMERIC:
-    case DBI_SQL_DECIMAL:
-    case DBI_SQL_INTEGER:
-    case DBI_SQL_BIGINT:
-    case DBI_SQL_TINYINT:
-    case DBI_SQL_SMALLINT:
-    case DBI_SQL_FLOAT:
-    case DBI_SQL_REAL:
-    case DBI_SQL_DOUBLE:
-        return 481;
-    case DBI_SQL_VARCHAR:
-        return 449;
-    case DBI_SQL_CHAR:
-        return 453;
+    static const U8 zero = 0;
+    const U8 *digit = d->ndigits ? d->digit : &zero;
+    int  n = d->ndigits ? d->ndigits : 1, i;
+    long adjusted = d->exponent + n - 1;
+    char *p = buf;
 
-    case SQL_DATE:
-    case SQL_TIME:
-    case SQL_TIMESTAMP:
-    default:
-    if (DBIc_WARN(imp_sth) && imp_sth && name)
-        warn("SQL type %d for '%s' is not fully supported, bound as SQL_VARCHAR instead");
-    return ib_sql_type(imp_sth, name, DBI_SQL_VARCHAR);
+    if (d->sign)
+        *p++ = '-';
+
+    if (d->special)
+    {
+        strcpy(p, d->special == IB_DEC_INF ? "Infinity"
+                  : d->special == IB_DEC_NAN ? "NaN" : "sNaN");
+        return strlen(buf);
     }
-}
-#endif
 
-int dbd_db_login6(SV *dbh, imp_dbh_t *imp_dbh, char *dbname, char *uid,
-                  char *pwd, SV *attr)
-{
-    dTHR;
+    if (plain || (d->exponent <= 0 && adjusted >= -6))
+    {
+        int scale = (int) -d->exponent;
 
-    ISC_STATUS status[ISC_STATUS_LENGTH];
+        if (scale >= n)
+        {
+            *p++ = '0';
+            *p++ = '.';
+            for (i = n; i < scale; i++)
+                *p++ = '0';
+            for (i = 0; i < n; i++)
+                *p++ = '0' + digit[i];
+        }
+        else
+        {
+            for (i = 0; i < n; i++)
+            {
+                if (i == n - scale)
+                    *p++ = '.';
+                *p++ = '0' + digit[i];
+            }
+        }
+    }
+    else
+    {
+        *p++ = '0' + digit[0];
+        if (n > 1)
+            *p++ = '.';
+        for (i = 1; i < n; i++)
+            *p++ = '0' + digit[i];
+        p += sprintf(p, "E%+ld", adjusted);
+    }
+    *p = '\0';
 
-    HV *hv;
-    SV *sv;
-    SV **svp;  /* versatile scalar storage */
+    return p - buf;
+}
 
-    unsigned short ib_dialect, ib_cache;
-    bool ib_db_triggers = true;
-    char *ib_role;
-    char ISC_FAR *dpb_buffer, *dpb;
-    int connect_timeout = 0;
+/* the number as an IV, if it is a whole number that fits */
+static int ib_dec_iv(const IB_DECIMAL *d, IV *iv)
+{
+    UV v = 0;
+    int i;
 
-    char ISC_FAR *database;
+    if (d->special || d->exponent != 0 || d->ndigits > (IVSIZE >= 8 ? 18 : 9)
+        || (d->sign && !d->ndigits))
+        return FALSE;
 
-    STRLEN len, db_len; /* for SvPV */
+    for (i = 0; i < d->ndigits; i++)
+        v = v * 10 + d->digit[i];
+    *iv = d->sign ? -(IV) v : (IV) v;
 
-    char  dbkey_scope   = 0;
-    short dpb_length    = 0;
-    unsigned int buflen = 0;   /* buffer size is dynamic */
-    imp_dbh->db         = 0L;
-    imp_dbh->tr         = 0L;
-    imp_dbh->tpb_buffer = NULL;
-    imp_dbh->tpb_length = 0;
-    imp_dbh->sth_ddl    = 0;
+    return TRUE;
+}
 
-    imp_dbh->soft_commit = 0; /* use soft commit (isc_commit_retaining)? */
+/* a fetched column as an IV when it fits and fast is on, as text otherwise */
+static void ib_dec_to_sv(SV *sv, const IB_DECIMAL *d, int plain, int fast)
+{
+    char buf[96];
+    IV   iv;
 
-    imp_dbh->ib_enable_utf8 = FALSE;
+    if (fast && ib_dec_iv(d, &iv))
+        sv_setiv(sv, iv);
+    else
+        sv_setpvn(sv, buf, ib_dec_format(d, plain, buf));
+}
 
-    /* default date/time formats
-       +     *
-     * Old API:  dateformat ........ %c
-     *           timeformat ........ (none)
-     *           timestampformat ... (none)
-     *
-     * v6 API:   dateformat ........ %x
-     *           timeformat ........ %X
-     *           timestampformat ... %c
-     */
-    Newxz(imp_dbh->dateformat, 3, char);
-    strcpy(imp_dbh->dateformat, "%x");
+/*
+ * Scaled SMALLINT, INTEGER, BIGINT and dialect 1 DOUBLE PRECISION NUMERICs
+ *
+ * The powers of ten come from a table instead of pow(). With
+ * ib_exact_numeric the stored integer is handed out as it is, either as
+ * exact text ("12.30") or, in "minor" mode, as an IV of 10^-scale units.
+ */
+static const double ib_pow10[] =
+{
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9,
+    1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18
+};
 
-    Newxz(imp_dbh->timeformat, 3, char);
-    strcpy(imp_dbh->timeformat, "%X");
+#define IB_POW10(n) ((n) < 19 ? ib_pow10[n] : pow(10.0, (double) (n)))
 
-    Newxz(imp_dbh->timestampformat, 3, char);
-    strcpy(imp_dbh->timestampformat, "%c");
+/* exact text of v * 10^scale, buf needs 96 bytes */
+static STRLEN ib_exact_format(ISC_INT64 v, int scale, char *buf)
+{
+    ISC_UINT64 m = v < 0 ? 0 - (ISC_UINT64) v : (ISC_UINT64) v;
+    IB_DECIMAL d;
+    U8   rev[20];
+    int  n = 0;
+
+    Zero(&d, 1, IB_DECIMAL);
+    d.sign = v < 0;
+    d.exponent = scale;
+    for (; m; m /= 10)
+        rev[n++] = (U8) (m % 10);
+    while (n)
+        d.digit[d.ndigits++] = rev[--n];
+
+    return ib_dec_format(&d, TRUE, buf);
+}
 
-    /* linked list */
-    imp_dbh->first_sth = NULL;
-    imp_dbh->last_sth  = NULL;
+static void ib_exact_to_sv(SV *sv, ISC_INT64 v, int scale, char mode)
+{
+    char buf[96];
 
-    /* save the current context for thread/multiplicy safety */
-#if defined(USE_THREADS) || defined(USE_ITHREADS) || defined(MULTIPLICITY)
-    imp_dbh->context = PERL_GET_CONTEXT;
+#if IVSIZE >= 8
+    if (mode == IB_EXACT_MINOR)
+#else
+    if (mode == IB_EXACT_MINOR && v >= IV_MIN && v <= IV_MAX)
 #endif
+    {
+        sv_setiv(sv, (IV) v);
+        return;
+    }
 
-    /* Parse DSN and init values */
-    sv = DBIc_IMP_DATA(imp_dbh);
-
-    if (!sv || !SvROK(sv))
-        return FALSE;
+    sv_setpvn(sv, buf, ib_exact_format(v, mode == IB_EXACT_MINOR ? 0 : scale, buf));
+}
 
-    hv = (HV*) SvRV(sv);
-    if (SvTYPE(hv) != SVt_PVHV)
-        return FALSE;
+static int ib_u128_muladd(U32 *m, U32 mul, U32 add)
+{
+    ISC_UINT64 carry = add;
+    int i;
 
-    if (uid != NULL) {
-        DPB_PREP_STRING(buflen, uid);
+    for (i = 0; i < 4; i++)
+    {
+        carry += (ISC_UINT64) m[i] * mul;
+        m[i] = (U32) carry;
+        carry >>= 32;
     }
 
-    if (pwd != NULL) {
-        DPB_PREP_STRING(buflen, pwd);
-    }
+    return carry != 0;
+}
 
-    /* does't go to DPB -> no buflen inc */
-    if ((svp = hv_fetch(hv, "database", 8, FALSE)))
-        database = SvPV(*svp, db_len);
-    else database = NULL;
+static U32 ib_u128_divmod(U32 *m, U32 div)
+{
+    ISC_UINT64 rem = 0;
+    int i;
 
+    for (i = 3; i >= 0; i--)
+    {
+        rem = (rem << 32) | m[i];
+        m[i] = (U32) (rem / div);
+        rem %= div;
+    }
 
-    /* role, cache, charset, sqldialect */
+    return (U32) rem;
+}
 
-    if ((svp = hv_fetch(hv, "ib_dialect", 10, FALSE)))
-        ib_dialect = (unsigned short) SvIV(*svp);
-    else
-        ib_dialect = DEFAULT_SQL_DIALECT;
-    DPB_PREP_INTEGER(buflen);
+static void ib_int128_unpack(const FB_I128 *v, int scale, IB_DECIMAL *d)
+{
+    ISC_UINT64 lo = v->fb_data[IB_W128_LO], hi = v->fb_data[IB_W128_HI];
+    U32  m[4];
+    U8   rev[45];
+    int  n = 0;
 
+    Zero(d, 1, IB_DECIMAL);
+    d->exponent = scale;
 
-    if ((svp = hv_fetch(hv, "ib_cache", 8, FALSE)))
+    if (hi >> 63)
     {
-        ib_cache = (unsigned short) SvIV(*svp);
-        DPB_PREP_INTEGER(buflen);
+        d->sign = 1;
+        lo = ~lo + 1;
+        hi = ~hi + (lo == 0);
     }
-    else
-        ib_cache = 0;
+    m[0] = (U32) lo; m[1] = (U32) (lo >> 32);
+    m[2] = (U32) hi; m[3] = (U32) (hi >> 32);
 
-    if ((svp = hv_fetch(hv, "ib_charset", 10, FALSE)))
+    while (m[0] | m[1] | m[2] | m[3])
     {
-        char *p = SvPV(*svp, len);
-        DPB_PREP_STRING_LEN(buflen, len);
+        U32 r = ib_u128_divmod(m, 1000000000);
+        int i;
 
-        Newx(imp_dbh->ib_charset, len+1, char);
-        strncpy(imp_dbh->ib_charset, p, len);
-        *(imp_dbh->ib_charset + len) = '\0';
-    }
-    else {
-        imp_dbh->ib_charset = NULL;
+        for (i = 0; i < 9; i++, r /= 10)
+            rev[n++] = (U8) (r % 10);
     }
+    while (n && !rev[n - 1])
+        n--;
+    while (n)
+        d->digit[d->ndigits++] = rev[--n];
+}
 
-    if ((svp = hv_fetch(hv, "ib_role", 7, FALSE)))
-    {
-        ib_role = SvPV(*svp, len);
-        DPB_PREP_STRING_LEN(buflen, len);
-    }
-    else
-        ib_role = NULL;
+/* FALSE if the value is not a number or does not fit */
+static int ib_int128_pack(IB_DECIMAL *d, int scale, FB_I128 *v)
+{
+    ISC_UINT64 lo, hi;
+    U32  m[4] = { 0, 0, 0, 0 };
+    int  i, n;
 
-    if ((svp = hv_fetch(hv, "ib_dbkey_scope", 14, FALSE)))
-    {
-        dbkey_scope = (char)SvIV(*svp);
-        if (dbkey_scope)
-            DPB_PREP_INTEGER(buflen);
-    }
+    if (d->special)
+        return FALSE;
 
-    if ((svp = hv_fetch(hv, "timeout", 7, FALSE)))
-    {
-        int val = SvIV(*svp);
-        if (val <= 0) croak("Positive timeout required");
+    /* to a whole number of 10^scale units */
+    if (d->exponent < scale)
+        ib_dec_round(d, d->ndigits - (int) (scale - d->exponent));
+    n = d->ndigits ? d->ndigits + (int) (d->exponent - scale) : 0;
+    if (n > 39)
+        return FALSE;
 
-        connect_timeout = val;
-        DPB_PREP_INTEGER(buflen);
-    }
+    for (i = 0; i < n; i++)
+        if (ib_u128_muladd(m, 10, i < d->ndigits ? d->digit[i] : 0))
+            return FALSE;
 
-    if ((svp = hv_fetch(hv, "ib_db_triggers", 14, FALSE)))
+    /* up to 2^127 - 1, or 2^127 for negative numbers */
+    if ((m[3] >> 31) && (!d->sign || m[3] != 0x80000000U || (m[2] | m[1] | m[0])))
+        return FALSE;
+
+    lo = (ISC_UINT64) m[1] << 32 | m[0];
+    hi = (ISC_UINT64) m[3] << 32 | m[2];
+    if (d->sign)
     {
-        ib_db_triggers = SvTRUE(*svp);
-        if (!ib_db_triggers)
-            DPB_PREP_BYTE(buflen);
-    }
-    else {
-        if (SvOK(attr)) {
-            HV *attr_h = (HV*) SvRV(attr);
-            if (SvTYPE(hv) == SVt_PVHV) {
-                if (svp = hv_fetch(attr_h, "ib_db_triggers", 14, FALSE)) {
-                    ib_db_triggers = SvTRUE(*svp);
-                    if (!ib_db_triggers)
-                        DPB_PREP_BYTE(buflen);
-                }
-            }
-        }
+        lo = ~lo + 1;
+        hi = ~hi + (lo == 0);
     }
+    v->fb_data[IB_W128_LO] = lo;
+    v->fb_data[IB_W128_HI] = hi;
 
-    /* add length of other parameters to needed buflen */
-    buflen += 1; /* dbpversion */
-
-    DBI_TRACE_imp_xxh(imp_dbh, 2, (DBIc_LOGPIO(imp_dbh), "dbd_db_login6\n"));
-
-    /* Allocate DPB */
-    Newx(dpb_buffer, buflen, char);
+    return TRUE;
+}
 
-    /* Default SQL dialect for every statement  */
-    imp_dbh->sqldialect = ib_dialect;
+/* layout of decimal64 and decimal128 */
+#define IB_DECFLOAT_DECLETS(q)  ((q) ? 11 : 5)
+#define IB_DECFLOAT_EBITS(q)    ((q) ? 12 : 8)
+#define IB_DECFLOAT_BIAS(q)     ((q) ? 6176 : 398)
+#define IB_DECFLOAT_DIGITS(q)   ((q) ? 34 : 16)
 
-    /* Fill DPB */
-    dpb = dpb_buffer;
-    *dpb++ = isc_dpb_version1;
+static void ib_decfloat_unpack(const ISC_UINT64 *data, int quad, IB_DECIMAL *d)
+{
+    ISC_UINT64 u[2];
+    int  declets = IB_DECFLOAT_DECLETS(quad), ebits = IB_DECFLOAT_EBITS(quad);
+    int  cpos = 10 * declets + ebits, i;
+    unsigned comb, emsb, msd;
 
-    DPB_FILL_STRING(dpb, isc_dpb_user_name, uid);
+    u[0] = quad ? data[IB_W128_LO] : data[0];
+    u[1] = quad ? data[IB_W128_HI] : 0;
 
-    DPB_FILL_STRING(dpb, isc_dpb_password, pwd);
+    Zero(d, 1, IB_DECIMAL);
+    d->sign = ib_w128_get(u, quad ? 127 : 63, 1);
+    comb = ib_w128_get(u, cpos, 5);
 
-    if (ib_cache)
+    if ((comb >> 1) == 0xF)
     {
-        /*
-         * Safety check: Do not allocate a cache buffer greater than
-         * 10000 pages, so we don't exhaust memory inadvertently.
-         */
-        if (ib_cache > 10000) ib_cache = 10000;
-        DPB_FILL_INTEGER(dpb, isc_dpb_num_buffers, ib_cache);
+        d->special = !(comb & 1) ? IB_DEC_INF
+                   : ib_w128_get(u, cpos - 1, 1) ? IB_DEC_SNAN : IB_DEC_NAN;
+        return;
     }
-
-    DPB_FILL_INTEGER(dpb, isc_dpb_sql_dialect, ib_dialect);
-
-    if (dbkey_scope)
+    if ((comb >> 3) == 3)
     {
-        DPB_FILL_INTEGER(dpb, isc_dpb_dbkey_scope, dbkey_scope);
+        emsb = (comb >> 1) & 3;
+        msd = 8 + (comb & 1);
     }
-
-    if (imp_dbh->ib_charset)
+    else
     {
-        DPB_FILL_STRING(dpb, isc_dpb_lc_ctype, imp_dbh->ib_charset);
+        emsb = comb >> 3;
+        msd = comb & 7;
     }
+    d->exponent = (long) ((emsb << ebits) | ib_w128_get(u, 10 * declets, ebits))
+                  - IB_DECFLOAT_BIAS(quad);
 
-    if (ib_role)
+    if (msd)
+        d->digit[d->ndigits++] = (U8) msd;
+    for (i = declets - 1; i >= 0; i--)
     {
-        DPB_FILL_STRING(dpb, isc_dpb_sql_role_name, ib_role);
+        unsigned v = ib_dpd_decode[ib_w128_get(u, 10 * i, 10)];
+        U8 three[3];
+        int j;
+
+        three[0] = (U8) (v / 100);
+        three[1] = (U8) (v / 10 % 10);
+        three[2] = (U8) (v % 10);
+        for (j = 0; j < 3; j++)
+            if (d->ndigits || three[j])
+                d->digit[d->ndigits++] = three[j];
     }
+}
 
-    if (connect_timeout)
-    {
-        DPB_FILL_INTEGER(dpb, isc_dpb_connect_timeout, connect_timeout);
-    }
+/* FALSE if the value does not fit; it is rounded to the precision */
+static int ib_decfloat_pack(IB_DECIMAL *d, int quad, ISC_UINT64 *data)
+{
+    ISC_UINT64 u[2] = { 0, 0 };
+    int  declets = IB_DECFLOAT_DECLETS(quad), ebits = IB_DECFLOAT_EBITS(quad);
+    int  precision = IB_DECFLOAT_DIGITS(quad), cpos = 10 * declets + ebits;
+    long bias = IB_DECFLOAT_BIAS(quad), emax = (3L << ebits) - 1 - bias;
+    U8   coef[34];
+    int  i;
+    unsigned biased, msd;
 
-    if (!ib_db_triggers)
+    ib_w128_put(u, quad ? 127 : 63, d->sign);
+
+    if (d->special)
     {
-        DPB_FILL_BYTE(dpb, isc_dpb_no_db_triggers, 1);
+        ib_w128_put(u, cpos, d->special == IB_DEC_INF ? 0x1E : 0x1F);
+        if (d->special == IB_DEC_SNAN)
+            ib_w128_put(u, cpos - 1, 1);
     }
+    else
+    {
+        ib_dec_round(d, precision);
 
-    dpb_length = dpb - dpb_buffer;
-
-    if ( dpb_length != buflen ) {
-        fprintf(stderr, "# db_login6: %d != %d\n", dpb_length, buflen);
-        fflush(stderr);
-        abort();
-    }
-
-    DBI_TRACE_imp_xxh(imp_dbh, 3, (DBIc_LOGPIO(imp_dbh), "dbd_db_login6: attaching to database %s..\n", database));
-
-    isc_attach_database(status,           /* status vector */
-                        db_len,
-                        database,         /* connect string */
-                        &(imp_dbh->db),   /* ref to db handle */
-                        dpb_length,       /* length of dpb */
-                        dpb_buffer);      /* connect options */
-
-    /* freeing database parameter buffer */
-    Safefree(dpb_buffer);
-
-    /* return false on failed attach */
-    if (ib_error_check(dbh, status))
-        return FALSE;
+        /* fold large exponents into the coefficient, round off small ones */
+        while (d->exponent > emax && d->ndigits && d->ndigits < precision)
+        {
+            d->digit[d->ndigits++] = 0;
+            d->exponent--;
+        }
+        if (d->exponent < -bias)
+            ib_dec_round(d, d->ndigits - (int) (-bias - d->exponent));
+        if (!d->ndigits && (d->exponent > emax || d->exponent < -bias))
+            d->exponent = d->exponent > emax ? emax : -bias;
+        if (d->exponent > emax || d->exponent < -bias)
+            return FALSE;
 
-    imp_dbh->charset_bytes_per_char = NULL;
+        Zero(coef, precision, U8);
+        Copy(d->digit, coef + precision - d->ndigits, d->ndigits, U8);
 
-    DBI_TRACE_imp_xxh(imp_dbh, 3, (DBIc_LOGPIO(imp_dbh), "dbd_db_login6: success attaching.\n"));
+        biased = (unsigned) (d->exponent + bias);
+        msd = coef[0];
+        ib_w128_put(u, cpos, msd < 8
+            ? ((biased >> ebits) << 3) | msd
+            : 0x18 | ((biased >> ebits) << 1) | (msd & 1));
+        ib_w128_put(u, 10 * declets, biased & ((1U << ebits) - 1));
 
-    /* Tell DBI, that dbh->destroy should be called for this handle */
-    DBIc_IMPSET_on(imp_dbh);
+        for (i = 0; i < declets; i++)
+        {
+            const U8 *c = coef + precision - 3 * (i + 1);
+            ib_w128_put(u, 10 * i, ib_dpd_encode[c[0] * 100 + c[1] * 10 + c[2]]);
+        }
+    }
 
-    /* Tell DBI, that dbh->disconnect should be called for this handle */
-    DBIc_ACTIVE_on(imp_dbh);
+    if (quad)
+    {
+        data[IB_W128_LO] = u[0];
+        data[IB_W128_HI] = u[1];
+    }
+    else
+        data[0] = u[0];
 
     return TRUE;
 }
 
-
-int dbd_db_login(SV *dbh, imp_dbh_t *imp_dbh, char *dbname, char  *uid,
-                 char *pwd)
+/*
+ * Process-wide cache per database, shared by all connections to it
+ *
+ * A database is known by what isc_info_db_id and isc_info_creation_date
+ * report, so different paths or aliases of one file share an entry, and a
+ * file recreated under the same name does not. The entry keeps the
+ * character set table, and a generation number that committed DDL moves
+ * on, which the catalog cache of ib_cache_metadata is keyed by. Entries
+ * live until the process ends.
+ */
+struct ib_db_cache
 {
-    return dbd_db_login6(dbh, imp_dbh, dbname, uid, pwd, Nullsv);
-}
-
+    IB_DB_CACHE     *next;
+    char            *key;
+    STRLEN          key_len;
+    unsigned long   generation;
+    unsigned char   *charset_bytes_per_char;
+};
+
+static IB_DB_CACHE *ib_db_caches = NULL;
+
+#ifdef USE_ITHREADS
+static perl_mutex ib_db_cache_mutex;
+#  define IB_DB_CACHE_LOCK   MUTEX_LOCK(&ib_db_cache_mutex)
+#  define IB_DB_CACHE_UNLOCK MUTEX_UNLOCK(&ib_db_cache_mutex)
+#else
+#  define IB_DB_CACHE_LOCK   NOOP
+#  define IB_DB_CACHE_UNLOCK NOOP
+#endif
 
-int dbd_db_ping(SV *dbh)
+/* the entry of the connected database, NULL if it cannot be identified */
+IB_DB_CACHE *ib_db_cache(imp_dbh_t *imp_dbh)
 {
-    D_imp_dbh(dbh);
-    ISC_STATUS status[ISC_STATUS_LENGTH];
-
-    char buffer[100];
-    char req[] = {
-        isc_info_ods_version,
+    ISC_STATUS   status[ISC_STATUS_LENGTH];
+    char         items[] = {
+        isc_info_db_id,
+#ifdef isc_info_creation_date
+        isc_info_creation_date,
+#endif
         isc_info_end
     };
+    char         res[512], *p;
+    IB_DB_CACHE *c;
 
-    DBI_TRACE_imp_xxh(imp_dbh, 1, (DBIc_LOGPIO(imp_dbh), "dbd_db_ping\n"));
+    if (imp_dbh->db_cache)
+        return imp_dbh->db_cache;
 
-    if (isc_database_info(status, &(imp_dbh->db), sizeof(req), req, sizeof(buffer), buffer))
-        if (ib_error_check(dbh, status))
-            return FALSE;
-    return TRUE;
-}
+    if (isc_database_info(status, &(imp_dbh->db), sizeof(items), items,
+                          sizeof(res), res))
+        return NULL;
 
+    /* the key is the raw reply, up to isc_info_end */
+    for (p = res; p < res + sizeof(res) - 3 && *p != isc_info_end; )
+    {
+        if (*p == isc_info_truncated)
+            return NULL;
+        p += 3 + isc_vax_integer(p + 1, 2);
+    }
+    if (p >= res + sizeof(res) - 3)
+        return NULL;
 
-int dbd_db_disconnect(SV *dbh, imp_dbh_t *imp_dbh)
-{
-    dTHR;
-    ISC_STATUS status[ISC_STATUS_LENGTH];
+    IB_DB_CACHE_LOCK;
+    for (c = ib_db_caches; c; c = c->next)
+        if (c->key_len == (STRLEN) (p - res) && memEQ(c->key, res, p - res))
+            break;
+    if (c == NULL)
+    {
+        Newxz(c, 1, IB_DB_CACHE);
+        c->key_len = p - res;
+        Newx(c->key, c->key_len, char);
+        Copy(res, c->key, c->key_len, char);
+        c->next = ib_db_caches;
+        ib_db_caches = c;
+    }
+    IB_DB_CACHE_UNLOCK;
 
-    DBI_TRACE_imp_xxh(imp_dbh, 2, (DBIc_LOGPIO(imp_dbh), "dbd_db_disconnect\n"));
+    imp_dbh->db_cache = c;
+    return c;
+}
 
-    /* set the database handle to inactive */
-    DBIc_ACTIVE_off(imp_dbh);
+/* committed DDL: cached catalog data of this database is stale */
+static void ib_db_cache_ddl(imp_dbh_t *imp_dbh)
+{
+    IB_DB_CACHE *c = ib_db_cache(imp_dbh);
 
-    /* always do a rollback if there's an open transaction.
-     * Firebird requires to close open transactions before
-     * detaching a database.
-     */
-    if (imp_dbh->tr)
+    if (c)
     {
-        /* rollback and close trans context */
-        isc_rollback_transaction(status, &(imp_dbh->tr));
-        if (ib_error_check(dbh, status))
-            return FALSE;
-
-        imp_dbh->tr = 0L;
+        IB_DB_CACHE_LOCK;
+        c->generation++;
+        IB_DB_CACHE_UNLOCK;
     }
+}
 
-    FREE_SETNULL(imp_dbh->ib_charset);
-    FREE_SETNULL(imp_dbh->tpb_buffer);
-    FREE_SETNULL(imp_dbh->dateformat);
-    FREE_SETNULL(imp_dbh->timeformat);
-    FREE_SETNULL(imp_dbh->timestampformat);
-    FREE_SETNULL(imp_dbh->charset_bytes_per_char);
+/* identity and generation of the database cache entry, for Firebird.pm */
+int ib_db_cache_tag(imp_dbh_t *imp_dbh, SV **key, unsigned long *generation)
+{
+    IB_DB_CACHE *c = ib_db_cache(imp_dbh);
 
-    /* detach database */
-    isc_detach_database(status, &(imp_dbh->db));
-    if (ib_error_check(dbh, status))
+    if (!c)
         return FALSE;
 
+    *key = newSVpvn(c->key, c->key_len);
+    IB_DB_CACHE_LOCK;
+    *generation = c->generation;
+    IB_DB_CACHE_UNLOCK;
     return TRUE;
 }
 
-
-void dbd_db_destroy (SV *dbh, imp_dbh_t *imp_dbh)
+void dbd_init(dbistate_t *dbistate)
 {
-    DBI_TRACE_imp_xxh(imp_dbh, 2, (DBIc_LOGPIO(imp_dbh), "dbd_db_destroy\n"));
+    static int initialized = 0;
 
-    if (DBIc_ACTIVE(imp_dbh))
-        dbd_db_disconnect(dbh, imp_dbh);
-
-    /* Nothing in imp_dbh to be freed   */
-    DBIc_IMPSET_off(imp_dbh);
+    DBISTATE_INIT;
+    if (!initialized)
+    {
+        initialized = 1;
+#ifdef USE_ITHREADS
+        MUTEX_INIT(&ib_db_cache_mutex);
+#endif
+        ib_xlat_init();
+        ib_dpd_init();
+    }
 }
 
 
-int dbd_db_commit (SV *dbh, imp_dbh_t *imp_dbh)
+void ib_cleanup_st_prepare (imp_sth_t *imp_sth)
 {
-    DBI_TRACE_imp_xxh(imp_dbh, 2, (DBIc_LOGPIO(imp_dbh), "dbd_db_commit\n"));
-
-    /* no commit if AutoCommit on */
-    if (DBIc_has(imp_dbh, DBIcf_AutoCommit))
-        return FALSE;
+    FREE_SETNULL(imp_sth->in_sqlda);
+    FREE_SETNULL(imp_sth->out_sqlda);
+    FREE_SETNULL(imp_sth->dateformat);
+    FREE_SETNULL(imp_sth->timeformat);
+    FREE_SETNULL(imp_sth->timestampformat);
+}
 
-    /* commit the transaction */
-    if (!ib_commit_transaction(dbh, imp_dbh))
-        return FALSE;
 
-    DBI_TRACE_imp_xxh(imp_dbh, 3, (DBIc_LOGPIO(imp_dbh), "dbd_db_commit succeed.\n"));
+void ib_cleanup_st_execute (imp_sth_t *imp_sth)
+{
+    if (imp_sth->in_sqlda)
+    {
+        int i;
+        XSQLVAR *var = imp_sth->in_sqlda->sqlvar;
 
-    return TRUE;
+        for (i = 0; i < imp_sth->in_sqlda->sqln; i++, var++)
+        {
+            Safefree(var->sqldata);
+            var->sqldata = NULL;
+            if (var->sqlind)
+                *(var->sqlind) = -1;    /* isNULL */
+        }
+    }
 }
 
 
-int dbd_db_rollback(SV *dbh, imp_dbh_t *imp_dbh)
+/* lower level error handling */
+void do_error(SV *h, int rc, char *what)
 {
-    DBI_TRACE_imp_xxh(imp_dbh, 2, (DBIc_LOGPIO(imp_dbh), "dbd_db_rollback\n"));
-
-    /* no rollback if AutoCommit = on */
-    if (DBIc_has(imp_dbh, DBIcf_AutoCommit) != FALSE)
-        return FALSE;
-
-    /* rollback the transaction */
-    if (!ib_rollback_transaction(dbh, imp_dbh))
-        return FALSE;
+    D_imp_xxh(h);
+    SV *errstr = DBIc_ERRSTR(imp_xxh);
 
-    DBI_TRACE_imp_xxh(imp_dbh, 3, (DBIc_LOGPIO(imp_dbh), "dbd_db_rollback succeed.\n"));
+    sv_setiv(DBIc_ERR(imp_xxh), (IV)rc);
+    sv_setpv(errstr, what);
 
-    return TRUE;
+    if (DBIc_TRACE_LEVEL(imp_xxh) >= 2)
+        PerlIO_printf(DBIc_LOGPIO(imp_xxh), "%s error %d recorded: %s\n", 
+            what, rc, SvPV(errstr,PL_na));
 }
 
+#define CALC_AVAILABLE(buff) sizeof(buff) - strlen(buff) - 1
 
-int dbd_db_STORE_attrib(SV *dbh, imp_dbh_t *imp_dbh, SV *keysv, SV *valuesv)
-{
-    STRLEN  kl;
-    char *key   = SvPV(keysv, kl);
-    int  on     = SvTRUE(valuesv)? 1: 0;
-    int  oldval;
-    int  set_frmts = 0;
+/*
+   decode status vector into a char pointer (implemented by a mortal scalar)
+   Returns NULL if there is no error
+ */
+char* ib_error_decode(const ISC_STATUS *status) {
+    SV *sv = NULL;
+    long sqlcode;
+#if !defined(FB_API_VER) || FB_API_VER < 20
+    ISC_STATUS *pvector = status;
+#else
+    const ISC_STATUS *pvector = status;
+#endif
+#if defined (INCLUDE_TYPES_PUB_H) || defined(FIREBIRD_IMPL_TYPES_PUB_H)
+    ISC_SCHAR msg[1024];
+#else
+    char msg[1024];
+#endif
 
-    DBI_TRACE_imp_xxh(imp_dbh, 2, (DBIc_LOGPIO(imp_dbh), "dbd_db_STORE - %s\n", key));
+    if (status[0] != 1 || status[1] <= 0)
+	return NULL;
 
-    /**************************************************************************/
-    if ((kl==10) && strEQ(key, "AutoCommit"))
+    if ((sqlcode = isc_sqlcode(status)) != 0)
     {
-        oldval = DBIc_has(imp_dbh, DBIcf_AutoCommit)? 1: 0;
-        DBIc_set(imp_dbh, DBIcf_AutoCommit, on);
+	isc_sql_interprete((short) sqlcode, msg, sizeof(msg));
+	sv = sv_2mortal(newSVpv(msg, 0));
+    }
 
-        DBI_TRACE_imp_xxh(imp_dbh, 3, (DBIc_LOGPIO(imp_dbh), "dbd_db_STORE: switch AutoCommit from %d to %d\n", oldval, on));
+#if !defined(FB_API_VER) || FB_API_VER < 20
+    while (isc_interprete(msg, &pvector))
+#else
+    while (fb_interpret(msg, sizeof(msg), &pvector))
+#endif
+    {
+	if ( sv != NULL ) {
+	    sv_catpvn(sv, "\n-", 2);
+	    sv_catpv(sv, msg);
+	}
+	else sv = sv_2mortal(newSVpv(msg,0));
+    }
 
-        if (oldval == FALSE && on)
+    sv_catpvn(sv, "\0", 1);  // NUL-terminate
+
+    return SvPV_nolen(sv);
+}
+
+/* higher level error handling, check and decode status */
+/*
+   Find out if the status vector reports a lock conflict between concurrent
+   transactions, i.e. an error worth retrying the transaction for. Returns
+   the most specific gds code found, or 0.
+ */
+ISC_STATUS ib_error_conflict(const ISC_STATUS *status)
+{
+    const ISC_STATUS *p = status;
+    ISC_STATUS found = 0;
+
+    while (*p != isc_arg_end && p < status + ISC_STATUS_LENGTH - 1)
+    {
+        if (*p == isc_arg_gds)
         {
-            /* AutoCommit set from 0 to 1, commit any outstanding changes */
-            if (imp_dbh->tr)
+            switch (p[1])
             {
-                if (!ib_commit_transaction(dbh, imp_dbh))
-                    return FALSE;
+                case isc_update_conflict:
+                case isc_lock_conflict:
+                    return p[1];
 
-                DBI_TRACE_imp_xxh(imp_dbh, 3, (DBIc_LOGPIO(imp_dbh), "dbd_db_STORE: commit open transaction\n"));
+                case isc_deadlock:
+                    found = p[1];
+                    break;
             }
         }
-
-        return TRUE; /* handled */
+        /* skip the argument; cstring args carry a length as well */
+        p += (*p == isc_arg_cstring) ? 3 : 2;
     }
-    /**************************************************************************/
-    else if ((kl==13) && strEQ(key, "ib_softcommit"))
-    {
-        oldval = imp_dbh->soft_commit;
+    return found;
+}
 
-        DBI_TRACE_imp_xxh(imp_dbh, 3, (DBIc_LOGPIO(imp_dbh), "dbd_db_STORE: switch ib_softcommit from %d to %d\n", oldval, on));
 
-        /* set new value */
-        imp_dbh->soft_commit = on;
+/*
+   SQLSTATE for the errors that leave the handle usable and that a caller
+   may want to tell from others: HY008 for a statement cancelled by
+   ib_cancel, HYT00 for one that ran out of ib_timeout_ms. NULL otherwise.
+ */
+static const char *ib_error_state(const ISC_STATUS *status)
+{
+    const ISC_STATUS *p = status;
 
-        /* switching softcommit from 1 to 0 -> make a hard commit */
-        if (!on && oldval)
+    while (*p != isc_arg_end && p < status + ISC_STATUS_LENGTH - 1)
+    {
+        if (*p == isc_arg_gds)
         {
-            if (imp_dbh->tr)
+            switch (p[1])
             {
-                if (!ib_commit_transaction(dbh, imp_dbh))
-                    return FALSE;
-
-                DBI_TRACE_imp_xxh(imp_dbh, 3, (DBIc_LOGPIO(imp_dbh), "dbd_db_STORE: commit open transaction\n"));
+                case isc_cancelled:
+                    return "HY008";
+#ifdef isc_req_stmt_timeout
+                case isc_req_stmt_timeout:
+                case isc_cfg_stmt_timeout:
+                    return "HYT00";
+#endif
             }
         }
-        return TRUE; /* handled */
+        p += (*p == isc_arg_cstring) ? 3 : 2;
     }
-    else if ((kl==14) && strEQ(key, "ib_enable_utf8")) {
-        if (on) {
-            if (imp_dbh->ib_charset && strEQ(imp_dbh->ib_charset, "UTF8")) {
-                imp_dbh->ib_enable_utf8 = TRUE;
+    return NULL;
+}
+
+
+int ib_error_check(SV *h, ISC_STATUS *status)
+{
+    char *msg = ib_error_decode(status);
+    ISC_STATUS conflict;
+
+    if (msg == NULL)
+	return SUCCESS;
+
+    if ((conflict = ib_error_conflict(status)) != 0)
+    {
+        D_imp_xxh(h);
+        imp_dbh_t *imp_dbh = NULL;
+
+        if (DBIc_TYPE(imp_xxh) == DBIt_DB)
+            imp_dbh = (imp_dbh_t *) imp_xxh;
+        else if (DBIc_TYPE(imp_xxh) == DBIt_ST)
+            imp_dbh = (imp_dbh_t *) DBIc_PARENT_COM(imp_xxh);
+
+        if (imp_dbh)
+        {
+            imp_dbh->tx_conflict = conflict;
+            imp_dbh->tx_conflicts++;
+        }
+    }
+
+    do_error(h, isc_sqlcode(status), msg);
+
+    {
+        const char *state = ib_error_state(status);
+
+        if (state)
+        {
+            D_imp_xxh(h);
+            sv_setpv(DBIc_STATE(imp_xxh), state);
+        }
+    }
+    return FAILURE;
+}
+
+
+static int ib2sql_type(int ibtype)
+{
+    /* Firebird Internal (not external) types */
+    switch(ibtype & ~1)
+    {
+        case SQL_TEXT:
+            return DBI_SQL_CHAR;
+
+        case SQL_LONG:
+            return DBI_SQL_INTEGER;  /* integer */
+
+        case SQL_SHORT:
+            return DBI_SQL_SMALLINT; /* smallint */
+
+        case SQL_FLOAT:
+            return DBI_SQL_FLOAT;
+
+        case SQL_DOUBLE:
+            return DBI_SQL_DOUBLE;
+
+        case SQL_TIMESTAMP:
+            return DBI_SQL_TIMESTAMP;
+
+        case SQL_TYPE_DATE:
+            return DBI_SQL_DATE;
+
+        case SQL_TYPE_TIME:
+            return DBI_SQL_TIME;
+
+        case SQL_VARYING:
+            return DBI_SQL_VARCHAR;
+
+#ifdef SQL_INT64
+        case SQL_INT64:
+            return DBI_SQL_BIGINT;
+#endif
+
+#ifdef SQL_BOOLEAN
+        case SQL_BOOLEAN:
+            return DBI_SQL_BOOLEAN;
+#endif
+
+        case SQL_TIMESTAMP_TZ:
+        case SQL_TIMESTAMP_TZ_EX:
+            return DBI_SQL_TIMESTAMP;
+
+        case SQL_TIME_TZ:
+        case SQL_TIME_TZ_EX:
+            return DBI_SQL_TYPE_TIME;
+
+        case SQL_INT128:
+            return DBI_SQL_NUMERIC;
+
+        case SQL_DEC16:
+        case SQL_DEC34:
+            return DBI_SQL_DECIMAL;
+    }
+    /* else map type into DBI reserved standard range */
+    return -9000 - ibtype;
+}
+
+#if 0
+/* from DBI (ANSI/ISO/ODBC) types to Firebird types */
+static int ib_sql_type(imp_sth_t *imp_sth, char *name, int sql_type)
+{
+    /* XXX should detect DBI reserved standard type range here */
+    switch (sql_type) {
+    case DBI_SQL_NUMERIC:
+    case DBI_SQL_DECIMAL:
+    case DBI_SQL_INTEGER:
+    case DBI_SQL_BIGINT:
+    case DBI_SQL_TINYINT:
+    case DBI_SQL_SMALLINT:
+    case DBI_SQL_FLOAT:
+    case DBI_SQL_REAL:
+    case DBI_SQL_DOUBLE:
+        return 481;
+    case DBI_SQL_VARCHAR:
+        return 449;
+    case DBI_SQL_CHAR:
+        return 453;
+
+    case SQL_DATE:
+    case SQL_TIME:
+    case SQL_TIMESTAMP:
+    default:
+    if (DBIc_WARN(imp_sth) && imp_sth && name)
+        warn("SQL type %d for '%s' is not fully supported, bound as SQL_VARCHAR instead");
+    return ib_sql_type(imp_sth, name, DBI_SQL_VARCHAR);
+    }
+}
+#endif
+
+int dbd_db_login6(SV *dbh, imp_dbh_t *imp_dbh, char *dbname, char *uid,
+                  char *pwd, SV *attr)
+{
+    dTHR;
+
+    ISC_STATUS status[ISC_STATUS_LENGTH];
+
+    HV *hv;
+    SV *sv;
+    SV **svp;  /* versatile scalar storage */
+
+    unsigned short ib_dialect, ib_cache;
+    bool ib_db_triggers = true;
+    char *ib_role;
+    char ISC_FAR *dpb_buffer, *dpb;
+    int connect_timeout = 0;
+
+    char ISC_FAR *database;
+
+    STRLEN len, db_len; /* for SvPV */
+
+    char  dbkey_scope   = 0;
+    short dpb_length    = 0;
+    unsigned int buflen = 0;   /* buffer size is dynamic */
+    imp_dbh->db         = 0L;
+    imp_dbh->tr         = 0L;
+    imp_dbh->tpb_buffer = NULL;
+    imp_dbh->tpb_length = 0;
+    imp_dbh->tx_profiles = NULL;
+    imp_dbh->tx_profile  = NULL;
+    imp_dbh->tx_profile_prev = NULL;
+    imp_dbh->tx_profile_once = 0;
+    imp_dbh->sth_ddl    = 0;
+
+    imp_dbh->soft_commit = 0; /* use soft commit (isc_commit_retaining)? */
+    imp_dbh->softcommit_max_age     = 0; /* no limits by default */
+    imp_dbh->softcommit_max_commits = 0;
+    imp_dbh->tr_started      = 0;
+    imp_dbh->tr_soft_commits = 0;
+    imp_dbh->tx_conflict  = 0;
+    imp_dbh->tx_conflicts = 0;
+    imp_dbh->tx_retries   = 0;
+    imp_dbh->tx_wasted    = 0.0;
+
+    imp_dbh->ib_enable_utf8 = FALSE;
+    imp_dbh->ib_trust_utf8 = FALSE;
+    imp_dbh->ib_xlat = NULL;
+
+    /* default date/time formats
+       +     *
+     * Old API:  dateformat ........ %c
+     *           timeformat ........ (none)
+     *           timestampformat ... (none)
+     *
+     * v6 API:   dateformat ........ %x
+     *           timeformat ........ %X
+     *           timestampformat ... %c
+     */
+    Newxz(imp_dbh->dateformat, 3, char);
+    strcpy(imp_dbh->dateformat, "%x");
+
+    Newxz(imp_dbh->timeformat, 3, char);
+    strcpy(imp_dbh->timeformat, "%X");
+
+    Newxz(imp_dbh->timestampformat, 3, char);
+    strcpy(imp_dbh->timestampformat, "%c");
+
+    /* linked list */
+    imp_dbh->first_sth = NULL;
+    imp_dbh->last_sth  = NULL;
+
+    /* save the current context for thread/multiplicy safety */
+#if defined(USE_THREADS) || defined(USE_ITHREADS) || defined(MULTIPLICITY)
+    imp_dbh->context = PERL_GET_CONTEXT;
+#endif
+
+    /* Parse DSN and init values */
+    sv = DBIc_IMP_DATA(imp_dbh);
+
+    if (!sv || !SvROK(sv))
+        return FALSE;
+
+    hv = (HV*) SvRV(sv);
+    if (SvTYPE(hv) != SVt_PVHV)
+        return FALSE;
+
+    if (uid != NULL) {
+        DPB_PREP_STRING(buflen, uid);
+    }
+
+    if (pwd != NULL) {
+        DPB_PREP_STRING(buflen, pwd);
+    }
+
+    /* does't go to DPB -> no buflen inc */
+    if ((svp = hv_fetch(hv, "database", 8, FALSE)))
+        database = SvPV(*svp, db_len);
+    else database = NULL;
+
+
+    /* role, cache, charset, sqldialect */
+
+    if ((svp = hv_fetch(hv, "ib_dialect", 10, FALSE)))
+        ib_dialect = (unsigned short) SvIV(*svp);
+    else
+        ib_dialect = DEFAULT_SQL_DIALECT;
+    DPB_PREP_INTEGER(buflen);
+
+
+    if ((svp = hv_fetch(hv, "ib_cache", 8, FALSE)))
+    {
+        ib_cache = (unsigned short) SvIV(*svp);
+        DPB_PREP_INTEGER(buflen);
+    }
+    else
+        ib_cache = 0;
+
+    if ((svp = hv_fetch(hv, "ib_charset", 10, FALSE)))
+    {
+        char *p = SvPV(*svp, len);
+        DPB_PREP_STRING_LEN(buflen, len);
+
+        Newx(imp_dbh->ib_charset, len+1, char);
+        strncpy(imp_dbh->ib_charset, p, len);
+        *(imp_dbh->ib_charset + len) = '\0';
+    }
+    else {
+        imp_dbh->ib_charset = NULL;
+    }
+
+    if ((svp = hv_fetch(hv, "ib_role", 7, FALSE)))
+    {
+        ib_role = SvPV(*svp, len);
+        DPB_PREP_STRING_LEN(buflen, len);
+    }
+    else
+        ib_role = NULL;
+
+    if ((svp = hv_fetch(hv, "ib_dbkey_scope", 14, FALSE)))
+    {
+        dbkey_scope = (char)SvIV(*svp);
+        if (dbkey_scope)
+            DPB_PREP_INTEGER(buflen);
+    }
+
+    if ((svp = hv_fetch(hv, "timeout", 7, FALSE)))
+    {
+        int val = SvIV(*svp);
+        if (val <= 0) croak("Positive timeout required");
+
+        connect_timeout = val;
+        DPB_PREP_INTEGER(buflen);
+    }
+
+    if ((svp = hv_fetch(hv, "ib_db_triggers", 14, FALSE)))
+    {
+        ib_db_triggers = SvTRUE(*svp);
+        if (!ib_db_triggers)
+            DPB_PREP_BYTE(buflen);
+    }
+    else {
+        if (SvOK(attr)) {
+            HV *attr_h = (HV*) SvRV(attr);
+            if (SvTYPE(hv) == SVt_PVHV) {
+                if (svp = hv_fetch(attr_h, "ib_db_triggers", 14, FALSE)) {
+                    ib_db_triggers = SvTRUE(*svp);
+                    if (!ib_db_triggers)
+                        DPB_PREP_BYTE(buflen);
+                }
+            }
+        }
+    }
+
+    /* add length of other parameters to needed buflen */
+    buflen += 1; /* dbpversion */
+
+    DBI_TRACE_imp_xxh(imp_dbh, 2, (DBIc_LOGPIO(imp_dbh), "dbd_db_login6\n"));
+
+    /* Allocate DPB */
+    Newx(dpb_buffer, buflen, char);
+
+    /* Default SQL dialect for every statement  */
+    imp_dbh->sqldialect = ib_dialect;
+
+    /* Fill DPB */
+    dpb = dpb_buffer;
+    *dpb++ = isc_dpb_version1;
+
+    DPB_FILL_STRING(dpb, isc_dpb_user_name, uid);
+
+    DPB_FILL_STRING(dpb, isc_dpb_password, pwd);
+
+    if (ib_cache)
+    {
+        /*
+         * Safety check: Do not allocate a cache buffer greater than
+         * 10000 pages, so we don't exhaust memory inadvertently.
+         */
+        if (ib_cache > 10000) ib_cache = 10000;
+        DPB_FILL_INTEGER(dpb, isc_dpb_num_buffers, ib_cache);
+    }
+
+    DPB_FILL_INTEGER(dpb, isc_dpb_sql_dialect, ib_dialect);
+
+    if (dbkey_scope)
+    {
+        DPB_FILL_INTEGER(dpb, isc_dpb_dbkey_scope, dbkey_scope);
+    }
+
+    if (imp_dbh->ib_charset)
+    {
+        DPB_FILL_STRING(dpb, isc_dpb_lc_ctype, imp_dbh->ib_charset);
+    }
+
+    if (ib_role)
+    {
+        DPB_FILL_STRING(dpb, isc_dpb_sql_role_name, ib_role);
+    }
+
+    if (connect_timeout)
+    {
+        DPB_FILL_INTEGER(dpb, isc_dpb_connect_timeout, connect_timeout);
+    }
+
+    if (!ib_db_triggers)
+    {
+        DPB_FILL_BYTE(dpb, isc_dpb_no_db_triggers, 1);
+    }
+
+    dpb_length = dpb - dpb_buffer;
+
+    if ( dpb_length != buflen ) {
+        fprintf(stderr, "# db_login6: %d != %d\n", dpb_length, buflen);
+        fflush(stderr);
+        abort();
+    }
+
+    DBI_TRACE_imp_xxh(imp_dbh, 3, (DBIc_LOGPIO(imp_dbh), "dbd_db_login6: attaching to database %s..\n", database));
+
+    isc_attach_database(status,           /* status vector */
+                        db_len,
+                        database,         /* connect string */
+                        &(imp_dbh->db),   /* ref to db handle */
+                        dpb_length,       /* length of dpb */
+                        dpb_buffer);      /* connect options */
+
+    /* freeing database parameter buffer */
+    Safefree(dpb_buffer);
+
+    /* return false on failed attach */
+    if (ib_error_check(dbh, status))
+        return FALSE;
+
+    imp_dbh->charset_bytes_per_char = NULL;
+    imp_dbh->tz_zones = NULL;
+    imp_dbh->tz_zone_count = 0;
+    imp_dbh->tz_first_id = 0;
+    imp_dbh->tz_epoch = 0;
+    imp_dbh->bind_epoch = 0;
+    imp_dbh->exact_numeric = IB_EXACT_OFF;
+    imp_dbh->fast_int = 1;
+    imp_dbh->db_cache = NULL;
+    imp_dbh->cache_metadata = 0;
+    imp_dbh->async = NULL;
+    imp_dbh->watchdog = NULL;
+    imp_dbh->timeout_ms = 0;
+
+    DBI_TRACE_imp_xxh(imp_dbh, 3, (DBIc_LOGPIO(imp_dbh), "dbd_db_login6: success attaching.\n"));
+
+    /* Tell DBI, that dbh->destroy should be called for this handle */
+    DBIc_IMPSET_on(imp_dbh);
+
+    /* Tell DBI, that dbh->disconnect should be called for this handle */
+    DBIc_ACTIVE_on(imp_dbh);
+
+    return TRUE;
+}
+
+
+int dbd_db_login(SV *dbh, imp_dbh_t *imp_dbh, char *dbname, char  *uid,
+                 char *pwd)
+{
+    return dbd_db_login6(dbh, imp_dbh, dbname, uid, pwd, Nullsv);
+}
+
+
+int dbd_db_ping(SV *dbh)
+{
+    D_imp_dbh(dbh);
+    ISC_STATUS status[ISC_STATUS_LENGTH];
+
+    char buffer[100];
+    char req[] = {
+        isc_info_ods_version,
+        isc_info_end
+    };
+
+    DBI_TRACE_imp_xxh(imp_dbh, 1, (DBIc_LOGPIO(imp_dbh), "dbd_db_ping\n"));
+
+    if (isc_database_info(status, &(imp_dbh->db), sizeof(req), req, sizeof(buffer), buffer))
+        if (ib_error_check(dbh, status))
+            return FALSE;
+    return TRUE;
+}
+
+
+int dbd_db_disconnect(SV *dbh, imp_dbh_t *imp_dbh)
+{
+    dTHR;
+    ISC_STATUS status[ISC_STATUS_LENGTH];
+
+    DBI_TRACE_imp_xxh(imp_dbh, 2, (DBIc_LOGPIO(imp_dbh), "dbd_db_disconnect\n"));
+
+    /* set the database handle to inactive */
+    DBIc_ACTIVE_off(imp_dbh);
+
+    /* nothing may run on the attachment from here on */
+    ib_async_stop(imp_dbh);
+    ib_watchdog_stop(imp_dbh);
+
+    /* and no read-ahead thread of a statement still pipelined */
+    {
+        imp_sth_t *s;
+
+        for (s = imp_dbh->first_sth; s != NULL; s = s->next_sth)
+            ib_pipe_stop(s);
+    }
+
+    /* always do a rollback if there's an open transaction.
+     * Firebird requires to close open transactions before
+     * detaching a database.
+     */
+    if (imp_dbh->tr)
+    {
+        /* rollback and close trans context */
+        isc_rollback_transaction(status, &(imp_dbh->tr));
+        if (ib_error_check(dbh, status))
+            return FALSE;
+
+        imp_dbh->tr = 0L;
+    }
+
+    FREE_SETNULL(imp_dbh->ib_charset);
+    FREE_SETNULL(imp_dbh->tpb_buffer);
+    FREE_SETNULL(imp_dbh->dateformat);
+    FREE_SETNULL(imp_dbh->timeformat);
+    FREE_SETNULL(imp_dbh->timestampformat);
+    FREE_SETNULL(imp_dbh->charset_bytes_per_char);
+
+    if (imp_dbh->tz_zones)
+    {
+        unsigned int i;
+
+        for (i = 0; i < imp_dbh->tz_zone_count; i++)
+        {
+            Safefree(imp_dbh->tz_zones[i].name);
+            Safefree(imp_dbh->tz_zones[i].ranges);
+        }
+        FREE_SETNULL(imp_dbh->tz_zones);
+        imp_dbh->tz_zone_count = 0;
+    }
+
+    if (imp_dbh->tx_profile)
+    {
+        SvREFCNT_dec(imp_dbh->tx_profile);
+        imp_dbh->tx_profile = NULL;
+    }
+    if (imp_dbh->tx_profile_prev)
+    {
+        SvREFCNT_dec(imp_dbh->tx_profile_prev);
+        imp_dbh->tx_profile_prev = NULL;
+    }
+    imp_dbh->tx_profile_once = 0;
+    if (imp_dbh->tx_profiles)
+    {
+        SvREFCNT_dec((SV *) imp_dbh->tx_profiles);
+        imp_dbh->tx_profiles = NULL;
+    }
+
+    /* detach database */
+    isc_detach_database(status, &(imp_dbh->db));
+    if (ib_error_check(dbh, status))
+        return FALSE;
+
+    return TRUE;
+}
+
+
+void dbd_db_destroy (SV *dbh, imp_dbh_t *imp_dbh)
+{
+    DBI_TRACE_imp_xxh(imp_dbh, 2, (DBIc_LOGPIO(imp_dbh), "dbd_db_destroy\n"));
+
+    if (DBIc_ACTIVE(imp_dbh))
+        dbd_db_disconnect(dbh, imp_dbh);
+
+    /* Nothing in imp_dbh to be freed   */
+    DBIc_IMPSET_off(imp_dbh);
+}
+
+
+/* the transaction of begin_work's ib_profile ended: back to the profile before */
+static void ib_end_tx_profile(imp_dbh_t *imp_dbh)
+{
+    if (!imp_dbh->tx_profile_once)
+        return;
+
+    if (imp_dbh->tx_profile)
+        SvREFCNT_dec(imp_dbh->tx_profile);
+    imp_dbh->tx_profile      = imp_dbh->tx_profile_prev;
+    imp_dbh->tx_profile_prev = NULL;
+    imp_dbh->tx_profile_once = 0;
+}
+
+
+int dbd_db_commit (SV *dbh, imp_dbh_t *imp_dbh)
+{
+    DBI_TRACE_imp_xxh(imp_dbh, 2, (DBIc_LOGPIO(imp_dbh), "dbd_db_commit\n"));
+
+    /* no commit if AutoCommit on */
+    if (DBIc_has(imp_dbh, DBIcf_AutoCommit))
+        return FALSE;
+
+    if (ib_async_busy(dbh, imp_dbh))
+        return FALSE;
+
+    /* commit the transaction */
+    if (!ib_commit_transaction(dbh, imp_dbh))
+        return FALSE;
+
+    ib_end_tx_profile(imp_dbh);
+
+    DBI_TRACE_imp_xxh(imp_dbh, 3, (DBIc_LOGPIO(imp_dbh), "dbd_db_commit succeed.\n"));
+
+    return TRUE;
+}
+
+
+int dbd_db_rollback(SV *dbh, imp_dbh_t *imp_dbh)
+{
+    DBI_TRACE_imp_xxh(imp_dbh, 2, (DBIc_LOGPIO(imp_dbh), "dbd_db_rollback\n"));
+
+    /* no rollback if AutoCommit = on */
+    if (DBIc_has(imp_dbh, DBIcf_AutoCommit) != FALSE)
+        return FALSE;
+
+    if (ib_async_busy(dbh, imp_dbh))
+        return FALSE;
+
+    /* rollback the transaction */
+    if (!ib_rollback_transaction(dbh, imp_dbh))
+        return FALSE;
+
+    ib_end_tx_profile(imp_dbh);
+
+    DBI_TRACE_imp_xxh(imp_dbh, 3, (DBIc_LOGPIO(imp_dbh), "dbd_db_rollback succeed.\n"));
+
+    return TRUE;
+}
+
+
+/* an ib_timeout_ms value; 0 (or undef) is no timeout */
+static ISC_ULONG ib_timeout_value(SV *valuesv)
+{
+    IV val = SvOK(valuesv) ? SvIV(valuesv) : 0;
+
+    if (val < 0)
+        croak("ib_timeout_ms must not be negative");
+#if !defined(FB_API_VER) || FB_API_VER < 40
+    if (val)
+        croak("ib_timeout_ms requires a Firebird 4.0 or newer client library");
+#endif
+    return (ISC_ULONG) val;
+}
+
+
+int dbd_db_STORE_attrib(SV *dbh, imp_dbh_t *imp_dbh, SV *keysv, SV *valuesv)
+{
+    STRLEN  kl;
+    char *key   = SvPV(keysv, kl);
+    int  on     = SvTRUE(valuesv)? 1: 0;
+    int  oldval;
+    int  set_frmts = 0;
+
+    DBI_TRACE_imp_xxh(imp_dbh, 2, (DBIc_LOGPIO(imp_dbh), "dbd_db_STORE - %s\n", key));
+
+    /**************************************************************************/
+    if ((kl==10) && strEQ(key, "AutoCommit"))
+    {
+        oldval = DBIc_has(imp_dbh, DBIcf_AutoCommit)? 1: 0;
+        DBIc_set(imp_dbh, DBIcf_AutoCommit, on);
+
+        DBI_TRACE_imp_xxh(imp_dbh, 3, (DBIc_LOGPIO(imp_dbh), "dbd_db_STORE: switch AutoCommit from %d to %d\n", oldval, on));
+
+        if (oldval == FALSE && on)
+        {
+            /* AutoCommit set from 0 to 1, commit any outstanding changes */
+            if (imp_dbh->tr)
+            {
+                if (!ib_commit_transaction(dbh, imp_dbh))
+                    return FALSE;
+
+                DBI_TRACE_imp_xxh(imp_dbh, 3, (DBIc_LOGPIO(imp_dbh), "dbd_db_STORE: commit open transaction\n"));
+            }
+        }
+
+        return TRUE; /* handled */
+    }
+    /**************************************************************************/
+    else if ((kl==13) && strEQ(key, "ib_softcommit"))
+    {
+        oldval = imp_dbh->soft_commit;
+
+        DBI_TRACE_imp_xxh(imp_dbh, 3, (DBIc_LOGPIO(imp_dbh), "dbd_db_STORE: switch ib_softcommit from %d to %d\n", oldval, on));
+
+        /* set new value */
+        imp_dbh->soft_commit = on;
+
+        /* switching softcommit from 1 to 0 -> make a hard commit */
+        if (!on && oldval)
+        {
+            if (imp_dbh->tr)
+            {
+                if (!ib_commit_transaction(dbh, imp_dbh))
+                    return FALSE;
+
+                DBI_TRACE_imp_xxh(imp_dbh, 3, (DBIc_LOGPIO(imp_dbh), "dbd_db_STORE: commit open transaction\n"));
+            }
+        }
+        return TRUE; /* handled */
+    }
+    else if ((kl==21) && strEQ(key, "ib_softcommit_max_age"))
+    {
+        IV val = SvOK(valuesv) ? SvIV(valuesv) : 0;
+        if (val < 0) croak("ib_softcommit_max_age must not be negative");
+
+        imp_dbh->softcommit_max_age = (unsigned int) val;
+        return TRUE;
+    }
+    else if ((kl==25) && strEQ(key, "ib_softcommit_max_commits"))
+    {
+        IV val = SvOK(valuesv) ? SvIV(valuesv) : 0;
+        if (val < 0) croak("ib_softcommit_max_commits must not be negative");
+
+        imp_dbh->softcommit_max_commits = (unsigned int) val;
+        return TRUE;
+    }
+    else if ((kl==14) && strEQ(key, "ib_enable_utf8")) {
+        if (on) {
+            if (imp_dbh->ib_charset && strEQ(imp_dbh->ib_charset, "UTF8")) {
+                imp_dbh->ib_enable_utf8 = TRUE;
+                return TRUE;
+            }
+            else if ((imp_dbh->ib_xlat = ib_xlat_find(imp_dbh->ib_charset)) != NULL) {
+                imp_dbh->ib_enable_utf8 = TRUE;
                 return TRUE;
             }
-            else croak( "ib_enable_utf8 requires ib_charset=UTF8 in DSN (you gave %s)", imp_dbh->ib_charset ? imp_dbh->ib_charset : "<nothing>" );
+            else croak( "ib_enable_utf8 requires ib_charset=UTF8, WIN1251 or ISO8859_1 in DSN (you gave %s)", imp_dbh->ib_charset ? imp_dbh->ib_charset : "<nothing>" );
+        }
+        else {
+            imp_dbh->ib_enable_utf8 = FALSE;
+            return TRUE;
+        }
+    }
+    else if ((kl==13) && strEQ(key, "ib_trust_utf8")) {
+        if (on && !(imp_dbh->ib_charset && strEQ(imp_dbh->ib_charset, "UTF8")))
+            croak( "ib_trust_utf8 requires ib_charset=UTF8 in DSN (you gave %s)", imp_dbh->ib_charset ? imp_dbh->ib_charset : "<nothing>" );
+        imp_dbh->ib_trust_utf8 = on;
+        return TRUE;
+    }
+    else if ((kl==11) && strEQ(key, "ib_tz_epoch"))
+    {
+        imp_dbh->tz_epoch = on;
+        return TRUE;
+    }
+    else if ((kl==13) && strEQ(key, "ib_bind_epoch"))
+    {
+        imp_dbh->bind_epoch = on;
+        return TRUE;
+    }
+    else if ((kl==17) && strEQ(key, "ib_cache_metadata"))
+    {
+        imp_dbh->cache_metadata = on;
+        return TRUE;
+    }
+    else if ((kl==16) && strEQ(key, "ib_exact_numeric"))
+    {
+        if (on && strEQ(SvPV_nolen(valuesv), "minor"))
+            imp_dbh->exact_numeric = IB_EXACT_MINOR;
+        else
+            imp_dbh->exact_numeric = on ? IB_EXACT_STRING : IB_EXACT_OFF;
+        return TRUE;
+    }
+    else if ((kl==11) && strEQ(key, "ib_fast_int"))
+    {
+        imp_dbh->fast_int = on;
+        return TRUE;
+    }
+    else if ((kl==13) && strEQ(key, "ib_timeout_ms"))
+    {
+        imp_dbh->timeout_ms = ib_timeout_value(valuesv);
+        return TRUE;
+    }
+    else if ((kl==11) && strEQ(key, "ib_time_all"))
+        set_frmts = 1;
+
+    /**************************************************************************/
+    if (set_frmts || ((kl==13) && strEQ(key, "ib_dateformat")))
+    {
+        IB_SQLtimeformat(dbh, imp_dbh->dateformat, valuesv);
+        if (!set_frmts) return TRUE;
+    }
+    if (set_frmts || ((kl==13) && strEQ(key, "ib_timeformat")))
+    {
+        IB_SQLtimeformat(dbh, imp_dbh->timeformat, valuesv);
+        if (!set_frmts) return TRUE;
+    }
+    if (set_frmts || ((kl==18) && strEQ(key, "ib_timestampformat")))
+    {
+        IB_SQLtimeformat(dbh, imp_dbh->timestampformat, valuesv);
+        if (!set_frmts) return TRUE;
+    }
+    /**************************************************************************/
+
+    if (set_frmts) return TRUE;
+    else return FALSE; /* not handled */
+}
+
+
+SV *dbd_db_FETCH_attrib(SV *dbh, imp_dbh_t *imp_dbh, SV *keysv)
+{
+    STRLEN  kl;
+    char *  key = SvPV(keysv, kl);
+    SV *    result = NULL;
+
+    DBI_TRACE_imp_xxh(imp_dbh, 2, (DBIc_LOGPIO(imp_dbh), "dbd_db_FETCH - %s\n", key));
+
+    if ((kl==10) && strEQ(key, "AutoCommit"))
+        result = boolSV(DBIc_has(imp_dbh, DBIcf_AutoCommit));
+    else if ((kl==13) && strEQ(key, "ib_softcommit"))
+        result = boolSV(imp_dbh->soft_commit);
+    else if ((kl==21) && strEQ(key, "ib_softcommit_max_age"))
+        result = newSVuv(imp_dbh->softcommit_max_age);
+    else if ((kl==25) && strEQ(key, "ib_softcommit_max_commits"))
+        result = newSVuv(imp_dbh->softcommit_max_commits);
+    else if ((kl==14) && strEQ(key, "ib_enable_utf8"))
+        result = boolSV(imp_dbh->ib_enable_utf8);
+    else if ((kl==13) && strEQ(key, "ib_trust_utf8"))
+        result = boolSV(imp_dbh->ib_trust_utf8);
+    else if ((kl==11) && strEQ(key, "ib_tz_epoch"))
+        result = boolSV(imp_dbh->tz_epoch);
+    else if ((kl==13) && strEQ(key, "ib_bind_epoch"))
+        result = boolSV(imp_dbh->bind_epoch);
+    else if ((kl==17) && strEQ(key, "ib_cache_metadata"))
+        result = boolSV(imp_dbh->cache_metadata);
+    else if ((kl==16) && strEQ(key, "ib_exact_numeric"))
+        result = imp_dbh->exact_numeric == IB_EXACT_MINOR ? newSVpvs("minor")
+                 : boolSV(imp_dbh->exact_numeric);
+    else if ((kl==11) && strEQ(key, "ib_fast_int"))
+        result = boolSV(imp_dbh->fast_int);
+    else if ((kl==13) && strEQ(key, "ib_timeout_ms"))
+        result = newSVuv(imp_dbh->timeout_ms);
+    else if ((kl==12) && strEQ(key, "ib_txn_stats"))
+    {
+        HV *stats = newHV();
+
+        (void)hv_store(stats, "conflicts", 9, newSVuv(imp_dbh->tx_conflicts), 0);
+        (void)hv_store(stats, "retries",   7, newSVuv(imp_dbh->tx_retries), 0);
+        (void)hv_store(stats, "wasted",    6, newSVnv(imp_dbh->tx_wasted), 0);
+        result = newRV_noinc((SV *) stats);
+    }
+    else if ((kl==13) && strEQ(key, "ib_dateformat"))
+        result = newSVpvn(imp_dbh->dateformat, strlen(imp_dbh->dateformat));
+    else if ((kl==13) && strEQ(key, "ib_timeformat"))
+        result = newSVpvn(imp_dbh->timeformat, strlen(imp_dbh->timeformat));
+    else if ((kl==18) && strEQ(key, "ib_timestampformat"))
+        result = newSVpvn(imp_dbh->timestampformat,
+                          strlen(imp_dbh->timestampformat));
+    else if ((kl==11) && strEQ(key, "ib_embedded"))
+#ifdef EMBEDDED
+        result = &PL_sv_yes;
+#else
+        result = &PL_sv_no;
+#endif
+
+    if (result == NULL)
+        return Nullsv;
+    else
+    {
+        if ((result == &PL_sv_yes) || (result == &PL_sv_no))
+            return result;
+        else
+            return sv_2mortal(result);
+    }
+}
+
+
+void dbd_preparse(SV *sth, imp_sth_t *imp_sth, char *statement)
+{
+    ISC_STATUS status[ISC_STATUS_LENGTH];
+
+    DBI_TRACE_imp_xxh(imp_sth, 2, (DBIc_LOGPIO(imp_sth), "Enter dbd_preparse\n"));
+
+    isc_dsql_describe_bind(status, &(imp_sth->stmt), 1, imp_sth->in_sqlda);
+
+    if (ib_error_check(sth, status))
+    {
+        ib_cleanup_st_prepare(imp_sth);
+        return;
+    }
+
+    /* realloc in_sqlda and rebind if not enough XSQLVAR for bind params */
+    if (imp_sth->in_sqlda->sqld > imp_sth->in_sqlda->sqln)
+    {
+        IB_alloc_sqlda(imp_sth->in_sqlda, imp_sth->in_sqlda->sqld);
+        if (imp_sth->in_sqlda == NULL)
+        {
+            do_error(sth, 1, "Fail to reallocate in_slqda");
+            ib_cleanup_st_prepare(imp_sth);
+            return;
+        }
+        else
+        {
+            isc_dsql_describe_bind(status, &(imp_sth->stmt), 1, imp_sth->in_sqlda);
+            if (ib_error_check(sth, status))
+            {
+                ib_cleanup_st_prepare(imp_sth);
+                return;
+            }
+        }
+    }
+
+    DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "dbd_preparse: describe_bind passed.\n"
+                  "dbd_preparse: exit; in_sqlda: sqld: %d, sqln: %d.\n",
+                      imp_sth->in_sqlda->sqld, imp_sth->in_sqlda->sqln));
+
+    DBIc_NUM_PARAMS(imp_sth) = imp_sth->in_sqlda->sqld;
+}
+
+
+/*
+ * Build the column names once per statement as shared-key SVs: hashes
+ * keyed with them (fetchrow_hashref, ib_fetch_into_hash) reuse the
+ * interpreter's shared HEK and its precomputed hash instead of hashing
+ * every name on every row.
+ */
+static void ib_st_col_keys(imp_sth_t *imp_sth)
+{
+    XSQLVAR *var = imp_sth->out_sqlda->sqlvar;
+    int     i;
+
+    imp_sth->col_keys = newAV();
+    av_extend(imp_sth->col_keys, imp_sth->out_sqlda->sqld);
+
+    for (i = 0; i < imp_sth->out_sqlda->sqld; i++, var++)
+    {
+        if (var->aliasname_length > 0)
+        {
+            av_store(imp_sth->col_keys, i,
+                     newSVpvn_share(var->aliasname, var->aliasname_length, 0));
+        }
+        else
+        {
+            char s[20];
+            snprintf(s, sizeof(s), "COLUMN%d", i);
+            av_store(imp_sth->col_keys, i, newSVpvn_share(s, strlen(s), 0));
+        }
+    }
+}
+
+
+/*
+ * Keys for ib_fetch_into_hash, following FetchHashKeyName like
+ * fetchrow_hashref does. Rebuilt only when FetchHashKeyName changes.
+ */
+AV *ib_st_hash_keys(SV *sth, imp_sth_t *imp_sth)
+{
+    SV      **svp;
+    char    key_case = 'N';
+    I32     i, n;
+
+    if (!imp_sth->col_keys)
+        return NULL;
+
+    svp = hv_fetch((HV*)SvRV(sth), "FetchHashKeyName", 16, 0);
+    if (svp && SvOK(*svp))
+    {
+        STRLEN  len;
+        char    *name = SvPV(*svp, len);
+
+        if (len == 7 && strEQ(name, "NAME_lc"))
+            key_case = 'l';
+        else if (len == 7 && strEQ(name, "NAME_uc"))
+            key_case = 'u';
+    }
+
+    if (imp_sth->hash_keys && imp_sth->hash_key_case == key_case)
+        return imp_sth->hash_keys;
+
+    if (imp_sth->hash_keys)
+        SvREFCNT_dec((SV*)imp_sth->hash_keys);
+    imp_sth->hash_key_case = key_case;
+
+    if (key_case == 'N')
+    {
+        imp_sth->hash_keys = (AV*)SvREFCNT_inc((SV*)imp_sth->col_keys);
+        return imp_sth->hash_keys;
+    }
+
+    n = av_len(imp_sth->col_keys) + 1;
+    imp_sth->hash_keys = newAV();
+    av_extend(imp_sth->hash_keys, n);
+
+    for (i = 0; i < n; i++)
+    {
+        STRLEN  len, j;
+        char    *name = SvPV(AvARRAY(imp_sth->col_keys)[i], len);
+        char    *buf;
+
+        Newx(buf, len + 1, char);
+        for (j = 0; j < len; j++)
+            buf[j] = key_case == 'l' ? toLOWER(name[j]) : toUPPER(name[j]);
+        buf[len] = '\0';
+
+        av_store(imp_sth->hash_keys, i, newSVpvn_share(buf, len, 0));
+        Safefree(buf);
+    }
+
+    return imp_sth->hash_keys;
+}
+
+
+/* an ib_pipeline or ib_pipeline_bytes value */
+static unsigned long ib_pipe_value(SV *valuesv, const char *name)
+{
+    IV val = SvOK(valuesv) ? SvIV(valuesv) : 0;
+
+    if (val < 0)
+        croak("%s must not be negative", name);
+    return (unsigned long) val;
+}
+
+
+int dbd_st_prepare(SV *sth, imp_sth_t *imp_sth, char *statement, SV *attribs)
+{
+    D_imp_dbh_from_sth;
+    ISC_STATUS  status[ISC_STATUS_LENGTH];
+    int         i;
+    short       dtype;
+    static char stmt_info[1];
+    char        info_buffer[20], count_item;
+    XSQLVAR     *var;
+
+    DBI_TRACE_imp_xxh(imp_sth, 2, (DBIc_LOGPIO(imp_sth), "Enter dbd_st_prepare\n"));
+
+    if (!DBIc_ACTIVE(imp_dbh))
+    {
+        do_error(sth, -1, "Database disconnected");
+        return FALSE;
+    }
+
+    if (ib_async_busy(sth, imp_dbh))
+        return FALSE;
+
+    /* init values */
+    count_item = 0;
+    imp_sth->count_item  = 0;
+    imp_sth->affected    = -1;
+    imp_sth->in_sqlda    = NULL;
+    imp_sth->out_sqlda   = NULL;
+    imp_sth->cursor_name = NULL;
+
+    imp_sth->dateformat      = NULL;
+    imp_sth->timestampformat = NULL;
+    imp_sth->timeformat      = NULL;
+
+    /* double linked list */
+    imp_sth->prev_sth = NULL;
+    imp_sth->next_sth = NULL;
+
+    imp_sth->col_rep    = NULL;
+    imp_sth->bound_only = 0;
+    imp_sth->col_keys   = NULL;
+    imp_sth->hash_keys  = NULL;
+    imp_sth->hash_key_case = 0;
+    imp_sth->async_fetched = 0;
+    imp_sth->timeout_set   = 0;
+    imp_sth->timeout_ms    = 0;
+    imp_sth->timeout_applied = 0;
+    imp_sth->pipe          = NULL;
+    imp_sth->pipe_rows     = 0;
+    imp_sth->pipe_bytes    = IB_PIPE_BYTES;
+
+    if (attribs)
+    {
+        SV **svp;
+
+        if ((svp = DBD_ATTRIB_GET_SVP(attribs, "ib_time_all", 11)) != NULL)
+        {
+            IB_SQLtimeformat(sth, imp_sth->dateformat, *svp);
+            IB_SQLtimeformat(sth, imp_sth->timestampformat, *svp);
+            IB_SQLtimeformat(sth, imp_sth->timeformat, *svp);
+        }
+
+
+        if ((svp = DBD_ATTRIB_GET_SVP(attribs, "ib_dateformat", 13)) != NULL)
+            IB_SQLtimeformat(sth, imp_sth->dateformat, *svp);
+
+        if ((svp = DBD_ATTRIB_GET_SVP(attribs, "ib_timestampformat", 18)) != NULL)
+            IB_SQLtimeformat(sth, imp_sth->timestampformat, *svp);
+
+        if ((svp = DBD_ATTRIB_GET_SVP(attribs, "ib_timeformat", 13)) != NULL)
+            IB_SQLtimeformat(sth, imp_sth->timeformat, *svp);
+
+        if ((svp = DBD_ATTRIB_GET_SVP(attribs, "ib_bound_only", 13)) != NULL)
+            imp_sth->bound_only = SvTRUE(*svp);
+
+        if ((svp = DBD_ATTRIB_GET_SVP(attribs, "ib_timeout_ms", 13)) != NULL
+            && SvOK(*svp))
+        {
+            imp_sth->timeout_ms  = ib_timeout_value(*svp);
+            imp_sth->timeout_set = 1;
+        }
+
+        if ((svp = DBD_ATTRIB_GET_SVP(attribs, "ib_pipeline", 11)) != NULL)
+            imp_sth->pipe_rows = ib_pipe_value(*svp, "ib_pipeline");
+
+        if ((svp = DBD_ATTRIB_GET_SVP(attribs, "ib_pipeline_bytes", 17)) != NULL)
+            imp_sth->pipe_bytes = ib_pipe_value(*svp, "ib_pipeline_bytes");
+    }
+
+
+    /* allocate 1 XSQLVAR to in_sqlda */
+    IB_alloc_sqlda(imp_sth->in_sqlda, 1);
+    if (imp_sth->in_sqlda == NULL)
+    {
+        do_error(sth, 2, "Fail to allocate in_sqlda");
+        return FALSE;
+    }
+
+    /* allocate 1 XSQLVAR to out_sqlda */
+    IB_alloc_sqlda(imp_sth->out_sqlda, 1);
+    if (imp_sth->out_sqlda == NULL)
+    {
+        do_error(sth, 2, "Fail to allocate out_sqlda");
+        ib_cleanup_st_prepare(imp_sth);
+        return FALSE;
+    }
+
+    /* init statement handle */
+    isc_dsql_alloc_statement2(status, &(imp_dbh->db), &(imp_sth->stmt));
+    if (ib_error_check(sth, status))
+    {
+        ib_cleanup_st_prepare(imp_sth);
+        return FALSE;
+    }
+
+    DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "dbd_st_prepare: sqldialect: %d.\n", imp_dbh->sqldialect));
+
+    if (!imp_dbh->tr)
+    {
+        /* start a new transaction using current TPB */
+        if (!ib_start_transaction(sth, imp_dbh))
+        {
+            ib_cleanup_st_prepare(imp_sth);
+            return FALSE;
+        }
+    }
+
+    DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "dbd_st_prepare: statement: %s.\n", statement));
+
+    isc_dsql_prepare(status, &(imp_dbh->tr), &(imp_sth->stmt), 0, statement,
+                     imp_dbh->sqldialect, imp_sth->out_sqlda);
+
+    if (ib_error_check(sth, status))
+    {
+        ib_cleanup_st_prepare(imp_sth);
+        return FALSE;
+    }
+
+    DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "dbd_st_prepare: isc_dsql_prepare succeed..\n"));
+
+    stmt_info[0] = isc_info_sql_stmt_type;
+    isc_dsql_sql_info(status, &(imp_sth->stmt), sizeof (stmt_info), stmt_info,
+                      sizeof (info_buffer), info_buffer);
+
+    if (ib_error_check(sth, status))
+    {
+        ib_cleanup_st_prepare(imp_sth);
+        return FALSE;
+    }
+
+    {
+        short l = (short) isc_vax_integer((char *) info_buffer + 1, 2);
+        imp_sth->type = isc_vax_integer((char *) info_buffer + 3, l);
+    }
+
+    /* sanity check of statement type */
+    DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "dbd_st_prepare: statement type: %ld.\n", imp_sth->type));
+
+    switch (imp_sth->type)
+    {
+        /* Implemented statement types. */
+        case isc_info_sql_stmt_select:
+        case isc_info_sql_stmt_select_for_upd:
+            /*
+             * Unfortunately, select count item doesn't work
+             * in current versions of Firebird.
+             * isql does it literally by fetching everything
+             * and counting the number of rows it fetched.
+             * Firebird doesn't seem to be able to estimate
+             * the number of rows before the client app
+             * fetches them all.
+             */
+             //count_item = isc_info_req_select_count;
+             break;
+
+        case isc_info_sql_stmt_insert:
+            count_item = isc_info_req_insert_count;
+            break;
+
+        case isc_info_sql_stmt_update:
+            count_item = isc_info_req_update_count;
+            break;
+
+        case isc_info_sql_stmt_delete:
+            count_item = isc_info_req_delete_count;
+            break;
+
+        case isc_info_sql_stmt_ddl:
+        case isc_info_sql_stmt_set_generator:
+        case isc_info_sql_stmt_exec_procedure:
+        case isc_info_sql_stmt_savepoint:
+        case isc_info_sql_stmt_start_trans:
+        case isc_info_sql_stmt_commit:
+        case isc_info_sql_stmt_rollback:
+            /* no count_item to gather */
+            break;
+
+        /*
+         * Unimplemented statement types. Some may be implemented in the future.
+         */
+        case isc_info_sql_stmt_get_segment:
+        case isc_info_sql_stmt_put_segment:
+        default:
+            do_error(sth, 10, "Statement type is not implemented in this version of DBD::Firebird");
+            return FALSE;
+            break;
+    }
+
+    imp_sth->count_item = count_item;
+
+    /* scan statement for '?', ':1' and/or ':foo' style placeholders    */
+    /* realloc in_sqlda where needed */
+    dbd_preparse(sth, imp_sth, statement);
+
+    DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "dbd_st_prepare: dbd_describe passed.\n"
+                            "out_sqlda: sqld: %d, sqln: %d.\n",
+                            imp_sth->out_sqlda->sqld, imp_sth->out_sqlda->sqln));
+
+    /* enough output parameter block ? */
+    if (imp_sth->out_sqlda->sqld > imp_sth->out_sqlda->sqln)
+    {
+        DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "dbd_st_prepare: realloc out_sqlda..\n"));
+
+        IB_alloc_sqlda(imp_sth->out_sqlda, imp_sth->out_sqlda->sqld);
+
+        if (imp_sth->out_sqlda == NULL)
+        {
+            do_error(sth, IB_ALLOC_FAIL, "Fail to reallocate out_sqlda");
+            ib_cleanup_st_prepare(imp_sth);
+            return FALSE;
+        }
+        else
+        {
+            DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "dbd_st_prepare: calling isc_dsql_describe again..\n"));
+
+            isc_dsql_describe(status, &(imp_sth->stmt), 1, imp_sth->out_sqlda);
+            if (ib_error_check(sth, status))
+            {
+                ib_cleanup_st_prepare(imp_sth);
+                return FALSE;
+            }
+
+            DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "dbd_st_prepare: success calling isc_dsql_describe.\n"));
+        }
+    }
+    else if (imp_sth->out_sqlda->sqld == 0) /* not a select statement */
+    {
+        Safefree(imp_sth->out_sqlda);
+        imp_sth->out_sqlda = NULL;
+    }
+
+    if (imp_sth->out_sqlda)
+    {
+        for (i = 0, var = imp_sth->out_sqlda->sqlvar;
+             i < imp_sth->out_sqlda->sqld;
+             i++, var++)
+        {
+            dtype = (var->sqltype & ~1);
+            var->sqlind = NULL;
+
+            DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "dbd_st_prepare: field type: %d.\n", dtype));
+
+            /* Alloc space for sqldata */
+            Newx(var->sqldata,
+                 var->sqllen + (dtype == SQL_VARYING ? sizeof(short) : 0),
+                 ISC_SCHAR);
+
+            /* Nullable? */
+            if (var->sqltype & 1)
+                Newx(var->sqlind, 1, short);
+        }
+
+        ib_st_col_keys(imp_sth);
+    }
+
+
+    /* statment is valid -> insert into linked list (at begin) */
+    imp_sth->next_sth = imp_dbh->first_sth;
+
+    if (imp_dbh->first_sth == NULL)
+        imp_dbh->last_sth = imp_sth;
+    else
+        imp_dbh->first_sth->prev_sth = imp_sth;
+
+    imp_dbh->first_sth = imp_sth;
+
+    DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "dbd_st_prepare: sth inserted into linked list.\n"));
+
+    /* tell DBI that we have a real statement handle now */
+    DBIc_IMPSET_on(imp_sth);
+    return TRUE;
+}
+
+int dbd_st_finish_internal(SV *sth, imp_sth_t *imp_sth, int honour_auto_commit)
+{
+    D_imp_dbh_from_sth;
+    ISC_STATUS status[ISC_STATUS_LENGTH];
+
+    DBI_TRACE_imp_xxh(imp_sth, 2, (DBIc_LOGPIO(imp_sth), "dbd_st_finish\n"));
+
+    ib_async_abandon(sth, imp_dbh, imp_sth);
+    ib_pipe_stop(imp_sth);
+
+    if (!DBIc_ACTIVE(imp_sth)) /* already finished */
+    {
+        DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "dbd_st_finish: nothing to do (not active)\n"));
+        return TRUE;
+    }
+
+    /* Close the cursor, not drop the statement! */
+    if (imp_sth->type != isc_info_sql_stmt_exec_procedure) {
+        isc_dsql_free_statement(status, (isc_stmt_handle *)&(imp_sth->stmt), DSQL_close);
+
+        /* Ignore errors when closing already closed cursor (sqlcode -501).
+           May happen when closing "select * from sample" statement, which was
+           closed by the server because of a "drop table sample" statement.
+           There is no point to error-out here, since nothing bad has happened --
+           the statement is closed, just without we knowing. There is no resource
+           leak and the user can't and needs not do anything.
+         */
+        if ((status[0] == 1) && (status[1] > 0)) {
+            long sqlcode = isc_sqlcode(status);
+
+            if (sqlcode != -501) {
+                if (ib_error_check(sth, status))
+                    return FALSE;
+            }
+            else
+            {
+                DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "dbd_st_finish: ignoring error -501 from isc_dsql_free_statement.\n"));
+            }
+        }
+
+        DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "dbd_st_finish: isc_dsql_free_statement passed.\n"));
+    }
+
+    /* set statement to inactive - must be before ib_commit_transaction 'cos
+       commit can call dbd_st_finish function again */
+    DBIc_ACTIVE_off(imp_sth);
+
+    if ( imp_sth->param_values != NULL )
+        hv_clear(imp_sth->param_values);
+
+    /* if AutoCommit on */
+    if (DBIc_has(imp_dbh, DBIcf_AutoCommit) && honour_auto_commit)
+    {
+        DBI_TRACE_imp_xxh(imp_sth, 4, (DBIc_LOGPIO(imp_sth), "dbd_st_finish: Trying to call ib_commit_transaction.\n"));
+
+        if (!ib_commit_transaction(sth, imp_dbh))
+        {
+            DBI_TRACE_imp_xxh(imp_sth, 4, (DBIc_LOGPIO(imp_sth), "dbd_st_finish: Call ib_commit_transaction finished returned FALSE.\n"));
+            return FALSE;
+        }
+        DBI_TRACE_imp_xxh(imp_sth, 4, (DBIc_LOGPIO(imp_sth), "dbd_st_finish: Call ib_commit_transaction succeeded.\n"));
+    }
+
+    return TRUE;
+}
+
+int dbd_st_finish(SV *sth, imp_sth_t *imp_sth)
+{
+    return dbd_st_finish_internal(sth, imp_sth, TRUE);
+}
+
+
+/*
+ * dbd_st_execute in three parts, so that ib_execute_async can run the
+ * client library call on the worker thread: ib_st_execute_start and
+ * ib_st_execute_done use the Perl API, ib_st_execute_call must not.
+ */
+static int ib_st_execute_start(SV *sth, imp_sth_t *imp_sth)
+{
+    D_imp_dbh_from_sth;
+
+    if (DBIc_ACTIVE(imp_sth))
+        dbd_st_finish_internal( sth, imp_sth, TRUE);
+
+    DBI_TRACE_imp_xxh(imp_sth, 2, (DBIc_LOGPIO(imp_sth), "dbd_st_execute\n"));
+
+    if (DBIc_ACTIVE(imp_sth))
+	dbd_st_finish_internal(sth, imp_sth, TRUE);
+
+    /* if not already done: start new transaction */
+    if (!imp_dbh->tr)
+        if (!ib_start_transaction(sth, imp_dbh))
+            return FALSE;
+
+    DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "dbd_st_execute: statement type: %ld.\n", imp_sth->type));
+
+#if defined(FB_API_VER) && FB_API_VER >= 40
+    /* the statement keeps its timeout, only send changes */
+    {
+        ISC_ULONG timeout = imp_sth->timeout_set ? imp_sth->timeout_ms
+                                                 : imp_dbh->timeout_ms;
+        if (timeout != imp_sth->timeout_applied)
+        {
+            ISC_STATUS status[ISC_STATUS_LENGTH];
+
+            fb_dsql_set_timeout(status, &(imp_sth->stmt), timeout);
+            if (ib_error_check(sth, status))
+                return FALSE;
+            imp_sth->timeout_applied = timeout;
+        }
+    }
+#endif
+
+    /* we count DDL statments */
+    if (imp_sth->type == isc_info_sql_stmt_ddl)
+    {
+        imp_dbh->sth_ddl++;
+        /* and this transaction sees the change before the commit */
+        ib_db_cache_ddl(imp_dbh);
+    }
+
+    return TRUE;
+}
+
+static void ib_st_execute_call(imp_dbh_t *imp_dbh, imp_sth_t *imp_sth, ISC_STATUS *status)
+{
+    /* exec procedure statement */
+    if (imp_sth->type == isc_info_sql_stmt_exec_procedure)
+    {
+        isc_dsql_execute2(status, &(imp_dbh->tr), &(imp_sth->stmt),
+                          imp_dbh->sqldialect,
+                          (imp_sth->in_sqlda && (imp_sth->in_sqlda->sqld > 0))?
+                           imp_sth->in_sqlda: NULL,
+                          (imp_sth->out_sqlda && (imp_sth->out_sqlda->sqld > 0))?
+                           imp_sth->out_sqlda: NULL);
+    }
+    else /* all other types of SQL statements */
+    {
+        isc_dsql_execute(status, &(imp_dbh->tr), &(imp_sth->stmt),
+                         imp_dbh->sqldialect,
+                         imp_sth->in_sqlda->sqld > 0 ? imp_sth->in_sqlda: NULL);
+    }
+}
+
+static int ib_st_execute_done(SV *sth, imp_sth_t *imp_sth, ISC_STATUS *status)
+{
+    D_imp_dbh_from_sth;
+    int        result = -2;
+    int        row_count = 0;
+
+    if (imp_sth->type == isc_info_sql_stmt_exec_procedure)
+    {
+        if (ib_error_check(sth, status))
+        {
+            ib_cleanup_st_execute(imp_sth);
+            return result;
+        }
+
+        DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "dbd_st_execute: isc_dsql_execute2 succeed.\n"));
+
+        result = row_count = imp_sth->affected = 0;
+    }
+    else
+    {
+        if (ib_error_check(sth, status))
+        {
+            ib_cleanup_st_execute(imp_sth);
+
+            /* rollback any active transaction */
+            if (DBIc_has(imp_dbh, DBIcf_AutoCommit) && imp_dbh->tr)
+                ib_commit_transaction(sth, imp_dbh);
+
+            return result;
+        }
+
+        DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "dbd_st_execute: isc_dsql_execute succeed.\n"));
+    }
+
+    if (imp_sth->count_item)
+    {
+        //PerlIO_printf(PerlIO_stderr(), "calculating row count\n");
+        row_count = ib_rows(sth, &(imp_sth->stmt), imp_sth->count_item);
+        if (row_count <= -2)
+            ib_cleanup_st_execute(imp_sth);
+        else
+            result = imp_sth->affected = row_count;
+    }
+    else if (imp_sth->type == isc_info_sql_stmt_select)
+        result = row_count = imp_sth->affected = 0;
+    else
+        result = -1;
+
+    /* Jika AutoCommit On, commit_transaction() (bukan retaining),
+     * dan reset imp_dbh->tr == 0L
+     * For SELECT statement, commit_transaction() is called after fetch,
+     * or within finish()
+     */
+    if (DBIc_has(imp_dbh, DBIcf_AutoCommit)
+        && imp_sth->type != isc_info_sql_stmt_select
+        && imp_sth->type != isc_info_sql_stmt_select_for_upd
+        && imp_sth->type != isc_info_sql_stmt_exec_procedure)
+    {
+        DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "dbd_st_execute: calling ib_commit_transaction..\n"));
+
+        if (!ib_commit_transaction(sth, imp_dbh))
+        {
+            ib_cleanup_st_execute(imp_sth);
+            return result;
+        }
+
+        DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "dbd_st_execute: ib_commit_transaction succeed.\n"));
+    }
+
+    /* Declare a unique cursor for this query */
+    if (imp_sth->type == isc_info_sql_stmt_select_for_upd)
+    {
+        /* We free the cursor_name buffer in dbd_st_destroy. */
+        if (!create_cursor_name(sth, imp_sth))
+        {
+            ib_cleanup_st_execute(imp_sth);
+            return result;
+        }
+    }
+
+
+    switch (imp_sth->type)
+    {
+        case isc_info_sql_stmt_select:
+        case isc_info_sql_stmt_select_for_upd:
+        case isc_info_sql_stmt_exec_procedure:
+            DBIc_NUM_FIELDS(imp_sth) = (imp_sth->out_sqlda)?
+                                        imp_sth->out_sqlda->sqld: 0;
+            DBIc_ACTIVE_on(imp_sth);
+            break;
+    }
+
+    if (DBIc_ACTIVE(imp_sth))
+        ib_pipe_start(sth, imp_sth);
+
+    DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "dbd_st_execute: row count: %d.\n"
+                            "dbd_st_execute: count_item: %d.\n",
+                            row_count, imp_sth->count_item));
+
+    return result;
+}
+
+int dbd_st_execute(SV *sth, imp_sth_t *imp_sth)
+{
+    D_imp_dbh_from_sth;
+    ISC_STATUS status[ISC_STATUS_LENGTH];
+
+    if (ib_async_busy(sth, imp_dbh))
+        return -2;
+
+    if (!ib_st_execute_start(sth, imp_sth))
+        return -2;
+
+    /* check for valid in_sqlda */
+    if (imp_sth->type != isc_info_sql_stmt_exec_procedure && !imp_sth->in_sqlda)
+        return FALSE;
+
+    DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "dbd_st_execute: calling isc_dsql_execute..\n"));
+
+    ib_st_execute_call(imp_dbh, imp_sth, status);
+
+    return ib_st_execute_done(sth, imp_sth, status);
+}
+
+/*
+ * Asynchronous execute and fetch (ib_execute_async, ib_fetch_async).
+ *
+ * A connection gets one worker thread, started by the first asynchronous
+ * call. The Perl thread does everything that needs the interpreter:
+ * binding, starting the transaction and decoding the row. The worker only
+ * makes the blocking isc_dsql_execute or isc_dsql_fetch call, and then
+ * writes a byte to a pipe, the read end of which is ib_async_fd, so that
+ * an event loop can watch it. ib_async_result collects the outcome. Only
+ * one operation per attachment can be in flight.
+ */
+#define IB_ASYNC_IDLE       0
+#define IB_ASYNC_QUEUED     1
+#define IB_ASYNC_RUNNING    2
+#define IB_ASYNC_DONE       3
+
+#ifdef IB_HAVE_ASYNC
+
+struct ib_async
+{
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    int             fd[2];      /* completion pipe, fd[0] is ib_async_fd */
+    pid_t           pid;        /* process the worker runs in */
+    int             state;      /* IB_ASYNC_IDLE .. IB_ASYNC_DONE */
+    int             op;         /* IB_ASYNC_EXECUTE or IB_ASYNC_FETCH */
+    int             quit;
+    imp_dbh_t       *imp_dbh;
+    imp_sth_t       *imp_sth;
+    ISC_STATUS      fetch;      /* isc_dsql_fetch() result */
+    ISC_STATUS      status[ISC_STATUS_LENGTH];
+};
+
+static void *ib_async_worker(void *arg)
+{
+    IB_ASYNC    *a = (IB_ASYNC *) arg;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&a->lock);
+        while (!a->quit && a->state != IB_ASYNC_QUEUED)
+            pthread_cond_wait(&a->cond, &a->lock);
+        if (a->quit)
+        {
+            pthread_mutex_unlock(&a->lock);
+            break;
+        }
+        a->state = IB_ASYNC_RUNNING;
+        pthread_mutex_unlock(&a->lock);
+
+        /* no Perl API from here on */
+        memset(a->status, 0, sizeof(a->status));
+        a->fetch = 0;
+        if (a->op == IB_ASYNC_EXECUTE)
+            ib_st_execute_call(a->imp_dbh, a->imp_sth, a->status);
+        else if (a->imp_sth->type != isc_info_sql_stmt_exec_procedure)
+            a->fetch = isc_dsql_fetch(a->status, &(a->imp_sth->stmt),
+                                      a->imp_dbh->sqldialect,
+                                      a->imp_sth->out_sqlda);
+
+        pthread_mutex_lock(&a->lock);
+        a->state = IB_ASYNC_DONE;
+        pthread_cond_broadcast(&a->cond);
+        pthread_mutex_unlock(&a->lock);
+
+        while (write(a->fd[1], "", 1) < 0 && errno == EINTR)
+            ;
+    }
+
+    return NULL;
+}
+
+/* the worker of the connection, started if needed */
+static IB_ASYNC *ib_async_get(SV *h, imp_dbh_t *imp_dbh)
+{
+    IB_ASYNC    *a = imp_dbh->async;
+    sigset_t    all, old;
+    int         i, rc;
+
+    /* a forked child has the structure but not the thread */
+    if (a && a->pid != getpid())
+    {
+        close(a->fd[0]);
+        close(a->fd[1]);
+        Safefree(a);
+        a = imp_dbh->async = NULL;
+    }
+
+    if (a)
+        return a;
+
+    Newxz(a, 1, IB_ASYNC);
+    if (pipe(a->fd) != 0)
+    {
+        Safefree(a);
+        do_error(h, 2, "Cannot create the ib_async_fd pipe");
+        return NULL;
+    }
+    for (i = 0; i < 2; i++)
+    {
+        fcntl(a->fd[i], F_SETFD, FD_CLOEXEC);
+        fcntl(a->fd[i], F_SETFL, fcntl(a->fd[i], F_GETFL) | O_NONBLOCK);
+    }
+
+    pthread_mutex_init(&a->lock, NULL);
+    pthread_cond_init(&a->cond, NULL);
+    a->imp_dbh = imp_dbh;
+    a->pid = getpid();
+    a->state = IB_ASYNC_IDLE;
+
+    /* signals stay with the Perl thread */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    rc = pthread_create(&a->thread, NULL, ib_async_worker, a);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (rc != 0)
+    {
+        pthread_cond_destroy(&a->cond);
+        pthread_mutex_destroy(&a->lock);
+        close(a->fd[0]);
+        close(a->fd[1]);
+        Safefree(a);
+        do_error(h, 2, "Cannot start the asynchronous worker thread");
+        return NULL;
+    }
+
+    imp_dbh->async = a;
+    return a;
+}
+
+static void ib_async_queue(IB_ASYNC *a, imp_sth_t *imp_sth, int op)
+{
+    pthread_mutex_lock(&a->lock);
+    a->op = op;
+    a->imp_sth = imp_sth;
+    a->state = IB_ASYNC_QUEUED;
+    pthread_cond_signal(&a->cond);
+    pthread_mutex_unlock(&a->lock);
+}
+
+/* wait for the operation in flight and take its byte off the pipe */
+static void ib_async_wait(IB_ASYNC *a)
+{
+    char buf[8];
+
+    pthread_mutex_lock(&a->lock);
+    while (a->state == IB_ASYNC_QUEUED || a->state == IB_ASYNC_RUNNING)
+        pthread_cond_wait(&a->cond, &a->lock);
+    pthread_mutex_unlock(&a->lock);
+
+    while (read(a->fd[0], buf, sizeof(buf)) > 0)
+        ;
+}
+
+static int ib_async_pending(imp_dbh_t *imp_dbh)
+{
+    IB_ASYNC *a = imp_dbh->async;
+
+    return a && a->pid == getpid() && a->state != IB_ASYNC_IDLE;
+}
+
+#else /* !IB_HAVE_ASYNC */
+
+struct ib_async
+{
+    int unused;
+};
+
+#define ib_async_pending(imp_dbh)   0
+
+static IB_ASYNC *ib_async_get(SV *h, imp_dbh_t *imp_dbh)
+{
+    do_error(h, 2, "Asynchronous execution is not supported on this platform");
+    return NULL;
+}
+
+#endif /* IB_HAVE_ASYNC */
+
+/* refuse to use a connection while an operation is in flight on it */
+int ib_async_busy(SV *h, imp_dbh_t *imp_dbh)
+{
+    if (!ib_async_pending(imp_dbh))
+        return FALSE;
+
+    do_error(h, 2, "An asynchronous operation is in progress on this connection, "
+                   "collect it with ib_async_result first");
+    return TRUE;
+}
+
+/*
+ * Cancel and forget the operation in flight, if it is on imp_sth (or on
+ * any statement, imp_sth == NULL), before the statement goes away. sth is
+ * the handle of imp_sth, or NULL to take it from the statement in flight.
+ */
+void ib_async_abandon(SV *sth, imp_dbh_t *imp_dbh, imp_sth_t *imp_sth)
+{
+#ifdef IB_HAVE_ASYNC
+    IB_ASYNC    *a = imp_dbh->async;
+    int         op;
+
+    if (!ib_async_pending(imp_dbh) || (imp_sth && a->imp_sth != imp_sth))
+        return;
+
+#if defined(FB_API_VER) && FB_API_VER >= 25
+    if (a->state != IB_ASYNC_DONE)
+    {
+        ISC_STATUS status[ISC_STATUS_LENGTH];
+        fb_cancel_operation(status, &(imp_dbh->db), fb_cancel_raise);
+    }
+#endif
+    ib_async_wait(a);
+
+    op = a->op;
+    imp_sth = a->imp_sth;
+    imp_sth->async_fetched = 0;
+    a->state = IB_ASYNC_IDLE;
+    a->imp_sth = NULL;
+
+    /*
+     * An execute nobody collected still has to end like one: a cursor was
+     * opened, or the AutoCommit transaction waits for its commit. Run the
+     * rest of it, but its errors are nobody's business any more.
+     */
+    if (op == IB_ASYNC_EXECUTE)
+    {
+        SV  *err, *errstr, *state;
+
+        if (!sth)
+            sth = (SV*)DBIc_MY_H(imp_sth);
+
+        err    = newSVsv(DBIc_ERR(imp_sth));
+        errstr = newSVsv(DBIc_ERRSTR(imp_sth));
+        state  = newSVsv(DBIc_STATE(imp_sth));
+
+        DBIc_ACTIVE_off(imp_sth);
+        ib_st_execute_done(sth, imp_sth, a->status);
+
+        sv_setsv(DBIc_ERR(imp_sth), err);
+        sv_setsv(DBIc_ERRSTR(imp_sth), errstr);
+        sv_setsv(DBIc_STATE(imp_sth), state);
+        SvREFCNT_dec(err);
+        SvREFCNT_dec(errstr);
+        SvREFCNT_dec(state);
+    }
+#endif
+}
+
+/* stop the worker, called on disconnect */
+void ib_async_stop(imp_dbh_t *imp_dbh)
+{
+#ifdef IB_HAVE_ASYNC
+    IB_ASYNC    *a = imp_dbh->async;
+
+    if (!a)
+        return;
+
+    if (a->pid == getpid())
+    {
+        ib_async_abandon(NULL, imp_dbh, NULL);
+
+        pthread_mutex_lock(&a->lock);
+        a->quit = 1;
+        pthread_cond_signal(&a->cond);
+        pthread_mutex_unlock(&a->lock);
+        pthread_join(a->thread, NULL);
+
+        pthread_cond_destroy(&a->cond);
+        pthread_mutex_destroy(&a->lock);
+    }
+
+    close(a->fd[0]);
+    close(a->fd[1]);
+    Safefree(a);
+    imp_dbh->async = NULL;
+#endif
+}
+
+int ib_async_fd(SV *dbh, imp_dbh_t *imp_dbh)
+{
+#ifdef IB_HAVE_ASYNC
+    IB_ASYNC *a = ib_async_get(dbh, imp_dbh);
+
+    return a ? a->fd[0] : -1;
+#else
+    ib_async_get(dbh, imp_dbh);
+    return -1;
+#endif
+}
+
+int ib_execute_async(SV *sth, imp_sth_t *imp_sth)
+{
+    D_imp_dbh_from_sth;
+    IB_ASYNC    *a;
+
+    if (ib_async_busy(sth, imp_dbh))
+        return FALSE;
+
+    if ((a = ib_async_get(sth, imp_dbh)) == NULL)
+        return FALSE;
+
+    if (!ib_st_execute_start(sth, imp_sth))
+        return FALSE;
+
+    if (imp_sth->type != isc_info_sql_stmt_exec_procedure && !imp_sth->in_sqlda)
+    {
+        do_error(sth, 2, "Statement has no input descriptor");
+        return FALSE;
+    }
+
+    DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "ib_execute_async: queued\n"));
+
+#ifdef IB_HAVE_ASYNC
+    ib_async_queue(a, imp_sth, IB_ASYNC_EXECUTE);
+
+    /* active until collected, so that finish reaches ib_async_abandon */
+    DBIc_ACTIVE_on(imp_sth);
+#endif
+    return TRUE;
+}
+
+int ib_fetch_async(SV *sth, imp_sth_t *imp_sth)
+{
+    D_imp_dbh_from_sth;
+    IB_ASYNC    *a;
+
+    if (ib_async_busy(sth, imp_dbh))
+        return FALSE;
+
+    if (!DBIc_ACTIVE(imp_sth))
+    {
+        do_error(sth, 0, "no statement executing (perhaps you need to call execute first)\n");
+        return FALSE;
+    }
+
+    if (imp_sth->pipe)
+    {
+        do_error(sth, 2, "ib_fetch_async cannot be used with ib_pipeline");
+        return FALSE;
+    }
+
+    if ((a = ib_async_get(sth, imp_dbh)) == NULL)
+        return FALSE;
+
+    DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "ib_fetch_async: queued\n"));
+
+#ifdef IB_HAVE_ASYNC
+    ib_async_queue(a, imp_sth, IB_ASYNC_FETCH);
+#endif
+    return TRUE;
+}
+
+/*
+ * Finish the operation in flight on imp_sth, waiting for it if needed.
+ * Returns the operation, or 0 if there is none. The result of an execute
+ * is put into *retval; the row of a fetch is left in out_sqlda for
+ * dbd_st_fetch to decode.
+ */
+int ib_async_collect(SV *sth, imp_sth_t *imp_sth, int *retval)
+{
+#ifdef IB_HAVE_ASYNC
+    D_imp_dbh_from_sth;
+    IB_ASYNC    *a = imp_dbh->async;
+    int         op;
+
+    if (!ib_async_pending(imp_dbh) || a->imp_sth != imp_sth)
+    {
+        do_error(sth, 2, "No asynchronous operation in progress on this statement");
+        return 0;
+    }
+
+    ib_async_wait(a);
+
+    op = a->op;
+    a->state = IB_ASYNC_IDLE;
+    a->imp_sth = NULL;
+
+    if (op == IB_ASYNC_EXECUTE)
+    {
+        DBIc_ACTIVE_off(imp_sth);
+        *retval = ib_st_execute_done(sth, imp_sth, a->status);
+    }
+    else if (imp_sth->type != isc_info_sql_stmt_exec_procedure)
+        imp_sth->async_fetched = 1;
+
+    return op;
+#else
+    do_error(sth, 2, "No asynchronous operation in progress on this statement");
+    return 0;
+#endif
+}
+
+/* the outcome of the isc_dsql_fetch() ib_fetch_async made */
+static ISC_STATUS ib_async_fetched(imp_dbh_t *imp_dbh, ISC_STATUS *status)
+{
+#ifdef IB_HAVE_ASYNC
+    Copy(imp_dbh->async->status, status, ISC_STATUS_LENGTH, ISC_STATUS);
+    return imp_dbh->async->fetch;
+#else
+    return 0;
+#endif
+}
+
+/*
+ * Cancel the operation running on the attachment. Returns TRUE if there
+ * was one, FALSE (without an error) if there was nothing to cancel.
+ */
+int ib_cancel(SV *dbh, imp_dbh_t *imp_dbh)
+{
+#if defined(FB_API_VER) && FB_API_VER >= 25
+    ISC_STATUS status[ISC_STATUS_LENGTH];
+
+    fb_cancel_operation(status, &(imp_dbh->db), fb_cancel_raise);
+#ifdef isc_nothing_to_cancel
+    if (status[0] == 1 && status[1] == isc_nothing_to_cancel)
+        return FALSE;
+#endif
+    if (ib_error_check(dbh, status))
+        return FALSE;
+
+    return TRUE;
+#else
+    do_error(dbh, 2, "ib_cancel requires a Firebird 2.5 or newer client library");
+    return FALSE;
+#endif
+}
+
+/*
+ * Watchdog of a connection (ib_cancel_after). Its thread sleeps until the
+ * deadline and then calls fb_cancel_operation(), and nothing else, so a
+ * call blocking the Perl thread can be given a time limit without running
+ * Perl code from a signal handler.
+ */
+#if defined(IB_HAVE_ASYNC) && defined(FB_API_VER) && FB_API_VER >= 25
+
+struct ib_watchdog
+{
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    pid_t           pid;        /* process the thread runs in */
+    isc_db_handle   *db;
+    struct timespec deadline;
+    int             armed;
+    int             firing;     /* in fb_cancel_operation() */
+    int             quit;
+};
+
+static void *ib_watchdog_thread(void *arg)
+{
+    IB_WATCHDOG     *w = (IB_WATCHDOG *) arg;
+    struct timespec now;
+
+    pthread_mutex_lock(&w->lock);
+    while (!w->quit)
+    {
+        if (!w->armed)
+        {
+            pthread_cond_wait(&w->cond, &w->lock);
+            continue;
+        }
+
+        pthread_cond_timedwait(&w->cond, &w->lock, &w->deadline);
+
+        /* woken early, or disarmed or moved meanwhile */
+        clock_gettime(CLOCK_REALTIME, &now);
+        if (!w->armed || now.tv_sec < w->deadline.tv_sec
+            || (now.tv_sec == w->deadline.tv_sec
+                && now.tv_nsec < w->deadline.tv_nsec))
+            continue;
+
+        w->armed = 0;
+        w->firing = 1;
+        pthread_mutex_unlock(&w->lock);
+        {
+            ISC_STATUS status[ISC_STATUS_LENGTH];
+            fb_cancel_operation(status, w->db, fb_cancel_raise);
+        }
+        pthread_mutex_lock(&w->lock);
+        w->firing = 0;
+        pthread_cond_broadcast(&w->cond);
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    return NULL;
+}
+
+int ib_cancel_after(SV *dbh, imp_dbh_t *imp_dbh, double seconds)
+{
+    IB_WATCHDOG *w = imp_dbh->watchdog;
+    sigset_t    all, old;
+    int         rc;
+
+    if (seconds < 0)
+        croak("ib_cancel_after: seconds must not be negative");
+
+    /* a forked child has the structure but not the thread */
+    if (w && w->pid != getpid())
+    {
+        Safefree(w);
+        w = imp_dbh->watchdog = NULL;
+    }
+
+    if (!w)
+    {
+        if (seconds == 0)
+            return TRUE;
+
+        Newxz(w, 1, IB_WATCHDOG);
+        pthread_mutex_init(&w->lock, NULL);
+        pthread_cond_init(&w->cond, NULL);
+        w->pid = getpid();
+        w->db = &(imp_dbh->db);
+
+        /* signals stay with the Perl thread */
+        sigfillset(&all);
+        pthread_sigmask(SIG_SETMASK, &all, &old);
+        rc = pthread_create(&w->thread, NULL, ib_watchdog_thread, w);
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+        if (rc != 0)
+        {
+            pthread_cond_destroy(&w->cond);
+            pthread_mutex_destroy(&w->lock);
+            Safefree(w);
+            do_error(dbh, 2, "Cannot start the ib_cancel_after watchdog thread");
+            return FALSE;
+        }
+        imp_dbh->watchdog = w;
+    }
+
+    pthread_mutex_lock(&w->lock);
+
+    /* a cancel on its way must not hit what the caller runs next */
+    while (w->firing)
+        pthread_cond_wait(&w->cond, &w->lock);
+
+    if (seconds == 0)
+        w->armed = 0;
+    else
+    {
+        clock_gettime(CLOCK_REALTIME, &w->deadline);
+        w->deadline.tv_sec  += (time_t) seconds;
+        w->deadline.tv_nsec += (long) ((seconds - (double)(time_t) seconds) * 1e9);
+        if (w->deadline.tv_nsec >= 1000000000L)
+        {
+            w->deadline.tv_sec++;
+            w->deadline.tv_nsec -= 1000000000L;
+        }
+        w->armed = 1;
+    }
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+
+    return TRUE;
+}
+
+/* stop the watchdog, called on disconnect */
+void ib_watchdog_stop(imp_dbh_t *imp_dbh)
+{
+    IB_WATCHDOG *w = imp_dbh->watchdog;
+
+    if (!w)
+        return;
+
+    if (w->pid == getpid())
+    {
+        pthread_mutex_lock(&w->lock);
+        w->quit = 1;
+        pthread_cond_signal(&w->cond);
+        pthread_mutex_unlock(&w->lock);
+        pthread_join(w->thread, NULL);
+
+        pthread_cond_destroy(&w->cond);
+        pthread_mutex_destroy(&w->lock);
+    }
+
+    Safefree(w);
+    imp_dbh->watchdog = NULL;
+}
+
+#else /* no threads or no fb_cancel_operation() */
+
+struct ib_watchdog
+{
+    int unused;
+};
+
+int ib_cancel_after(SV *dbh, imp_dbh_t *imp_dbh, double seconds)
+{
+    if (seconds < 0)
+        croak("ib_cancel_after: seconds must not be negative");
+
+    do_error(dbh, 2, "ib_cancel_after is not supported on this platform");
+    return FALSE;
+}
+
+void ib_watchdog_stop(imp_dbh_t *imp_dbh)
+{
+}
+
+#endif
+
+/*
+ * File source of DBD::Firebird::BulkLoader (_load_fh). The CSV or TSV text
+ * is parsed here, and each row is bound with dbd_bind_ph into the INSERT of
+ * the next free worker, whose execute runs on the worker thread of its
+ * connection (see ib_execute_async). No Perl code runs for a row unless it
+ * fails or a progress report is due: then _done and _progress of the loader
+ * are called. The row in flight on a worker is kept in its busy key, as the
+ * Perl side does, so that the loader can collect it.
+ */
+typedef struct
+{
+    SV          *ref;           /* the worker hash of the loader */
+    HV          *hv;
+    SV          *sth;
+    imp_sth_t   *imp_sth;
+    SV          *dbh;
+    imp_dbh_t   *imp_dbh;
+    SV          *rows;          /* its counters */
+    SV          *uncommitted;
+    SV          *commits;
+    int         fd;
+} IB_BULK_WORKER;
+
+typedef struct
+{
+    PerlIO      *io;
+    char        buf[65536];
+    int         pos;
+    int         len;
+} IB_BULK_IN;
+
+/* the next line, with its line break, appended to line; FALSE at the end */
+static int ib_bulk_getline(IB_BULK_IN *in, SV *line)
+{
+    int got = 0;
+
+    for (;;)
+    {
+        char *nl;
+
+        if (in->pos == in->len)
+        {
+            SSize_t n = PerlIO_read(in->io, in->buf, sizeof(in->buf));
+
+            if (n <= 0)
+                return got;
+            in->pos = 0;
+            in->len = (int) n;
+        }
+
+        nl = (char *) memchr(in->buf + in->pos, '\n', in->len - in->pos);
+        if (nl)
+        {
+            sv_catpvn(line, in->buf + in->pos, nl + 1 - (in->buf + in->pos));
+            in->pos = nl + 1 - in->buf;
+            return TRUE;
+        }
+
+        sv_catpvn(line, in->buf + in->pos, in->len - in->pos);
+        in->pos = in->len;
+        got = 1;
+    }
+}
+
+static void ib_bulk_push(AV *row, const char *s, STRLEN len, int utf8)
+{
+    SV *sv = newSVpvn(s, len);
+
+    if (utf8)
+        SvUTF8_on(sv);
+    av_push(row, sv);
+}
+
+/*
+ * CSV: fields may be quoted with ", doubled inside, and go on over several
+ * lines; an unquoted empty field is NULL, a quoted one an empty string
+ */
+static int ib_bulk_csv_row(IB_BULK_IN *in, SV *line, char sep, int utf8, AV *row)
+{
+    SV      *field = sv_2mortal(newSVpvs(""));
+    char    *p, *end;
+
+    sv_setpvs(line, "");
+    if (!ib_bulk_getline(in, line))
+        return FALSE;
+    p   = SvPVX(line);
+    end = p + SvCUR(line);
+
+    for (;;)
+    {
+        if (p < end && *p == '"')
+        {
+            sv_setpvs(field, "");
+            p++;
+            for (;;)
+            {
+                char *q = p;
+
+                while (q < end && !(*q == '"' && (q + 1 >= end || q[1] != '"')))
+                    q += (*q == '"') ? 2 : 1;
+                if (q < end)
+                {
+                    sv_catpvn(field, p, q - p);
+                    p = q + 1;
+                    break;
+                }
+
+                /* no closing quote on this line */
+                sv_catpvn(field, p, end - p);
+                sv_setpvs(line, "");
+                if (!ib_bulk_getline(in, line))
+                    croak("DBD::Firebird::BulkLoader: unterminated quoted field");
+                p   = SvPVX(line);
+                end = p + SvCUR(line);
+            }
+
+            /* "" is a quote */
+            {
+                char    *s = SvPVX(field), *d = s, *e = s + SvCUR(field);
+
+                while (s < e)
+                {
+                    *d++ = *s;
+                    s += (*s == '"' && s + 1 < e && s[1] == '"') ? 2 : 1;
+                }
+                ib_bulk_push(row, SvPVX(field), d - SvPVX(field), utf8);
+            }
+
+            /* text after the closing quote */
+            while (p < end && *p != sep && *p != '\r' && *p != '\n')
+                p++;
+        }
+        else
+        {
+            char *q = p;
+
+            while (q < end && *q != sep && *q != '\r' && *q != '\n')
+                q++;
+            if (q > p)
+                ib_bulk_push(row, p, q - p, utf8);
+            else
+                av_push(row, newSV(0));
+            p = q;
+        }
+
+        if (p < end && *p == sep)
+            p++;
+        else
+            break;
+    }
+
+    return TRUE;
+}
+
+/*
+ * TSV: fields split on tabs, \N is NULL, and the \t \n \r \\ escapes
+ * ib_export writes are undone
+ */
+static int ib_bulk_tsv_row(IB_BULK_IN *in, SV *line, int utf8, AV *row)
+{
+    char    *p, *end;
+
+    sv_setpvs(line, "");
+    if (!ib_bulk_getline(in, line))
+        return FALSE;
+    p   = SvPVX(line);
+    end = p + SvCUR(line);
+
+    if (end > p && end[-1] == '\n')
+        end--;
+    if (end > p && end[-1] == '\r')
+        end--;
+
+    /* like split, an empty line has no fields */
+    if (end == p)
+        return TRUE;
+
+    for (;;)
+    {
+        char *q = (char *) memchr(p, '\t', end - p);
+        char *e = q ? q : end;
+
+        if (e - p == 2 && p[0] == '\\' && p[1] == 'N')
+            av_push(row, newSV(0));
+        else
+        {
+            /* unescape in place, the line is ours */
+            char *s = p, *d = p;
+
+            while (s < e)
+            {
+                if (*s == '\\' && s + 1 < e && strchr("tnr\\", s[1]))
+                {
+                    *d++ = s[1] == 't' ? '\t' : s[1] == 'n' ? '\n'
+                         : s[1] == 'r' ? '\r' : '\\';
+                    s += 2;
+                }
+                else
+                    *d++ = *s++;
+            }
+            ib_bulk_push(row, p, d - p, utf8);
+        }
+
+        if (!q)
+            break;
+        p = q + 1;
+    }
+
+    return TRUE;
+}
+
+/* bookkeeping of a row done on worker w, as the loader's _done does it */
+static void ib_bulk_done(SV *self, HV *hv, IB_BULK_WORKER *w, SV *row, int ok)
+{
+    SV  *total;
+    IV  every;
+
+    if (!ok)
+    {
+        dSP;
+
+        ENTER;
+        SAVETMPS;
+        PUSHMARK(SP);
+        XPUSHs(self);
+        XPUSHs(w->ref);
+        XPUSHs(row);
+        XPUSHs(&PL_sv_undef);
+        PUTBACK;
+        call_method("_done", G_DISCARD);
+        FREETMPS;
+        LEAVE;
+        return;
+    }
+
+    sv_setiv(w->rows, SvIV(w->rows) + 1);
+    sv_setiv(w->uncommitted, SvIV(w->uncommitted) + 1);
+    if (SvIV(w->uncommitted) >= SvIV(*hv_fetchs(hv, "commit_every", 1)))
+    {
+        if (!dbd_db_commit(w->dbh, w->imp_dbh))
+            croak("%s", SvPV_nolen(DBIc_ERRSTR(w->imp_dbh)));
+        sv_setiv(w->commits, SvIV(w->commits) + 1);
+        sv_setiv(w->uncommitted, 0);
+    }
+
+    total = *hv_fetchs(hv, "rows", 1);
+    sv_setiv(total, SvIV(total) + 1);
+
+    every = SvIV(*hv_fetchs(hv, "progress_every", 1));
+    if (every > 0 && SvIV(total) % every == 0
+        && SvTRUE(*hv_fetchs(hv, "on_progress", 1)))
+    {
+        dSP;
+
+        ENTER;
+        SAVETMPS;
+        PUSHMARK(SP);
+        XPUSHs(self);
+        PUTBACK;
+        call_method("_progress", G_DISCARD);
+        FREETMPS;
+        LEAVE;
+    }
+}
+
+#ifdef IB_HAVE_ASYNC
+/* the outcome of the insert in flight on w */
+static void ib_bulk_collect(SV *self, HV *hv, IB_BULK_WORKER *w)
+{
+    SV  *row = hv_deletes(w->hv, "busy", 0);      /* mortal */
+    int retval = -2;
+    int op;
+
+    if (!row)
+        return;
+
+    op = ib_async_collect(w->sth, w->imp_sth, &retval);
+    ib_bulk_done(self, hv, w, row, op == IB_ASYNC_EXECUTE && retval >= -1);
+}
+
+/* a worker free to take a row, collecting finished inserts if none is */
+static IB_BULK_WORKER *ib_bulk_idle(SV *self, HV *hv, IB_BULK_WORKER *w, int n,
+                                    int *next, struct pollfd *fds)
+{
+    int i;
+
+    for (;;)
+    {
+        for (i = 0; i < n; i++)
+        {
+            IB_BULK_WORKER *c = &w[(*next)++ % n];
+
+            if (!hv_exists(c->hv, "busy", 4))
+                return c;
+        }
+
+        for (i = 0; i < n; i++)
+        {
+            fds[i].fd = w[i].fd;
+            fds[i].events = POLLIN;
+            fds[i].revents = 0;
+        }
+        if (poll(fds, n, -1) < 0 && errno != EINTR)
+            croak("DBD::Firebird::BulkLoader: poll: %s", Strerror(errno));
+
+        for (i = 0; i < n; i++)
+            if (fds[i].revents)
+                ib_bulk_collect(self, hv, &w[i]);
+    }
+}
+#endif
+
+void ib_bulk_load_fh(SV *self, PerlIO *io, int tsv, char sep, int header,
+                     int utf8, int async)
+{
+    HV              *hv = (HV *) SvRV(self);
+    AV              *workers = (AV *) SvRV(*hv_fetchs(hv, "workers", 0));
+    IB_BULK_WORKER  *w;
+    IB_BULK_IN      *in;
+    SV              *line, *idx;
+    int             n = av_len(workers) + 1;
+    int             next = 0;
+    int             i, more;
+#ifdef IB_HAVE_ASYNC
+    struct pollfd   *fds;
+#else
+    async = 0;
+#endif
+
+    ENTER;
+
+    Newxz(w, n, IB_BULK_WORKER);
+    SAVEFREEPV(w);
+    Newxz(in, 1, IB_BULK_IN);
+    SAVEFREEPV(in);
+    in->io = io;
+    line = newSVpvs("");
+    SAVEFREESV(line);
+    idx  = newSViv(0);
+    SAVEFREESV(idx);
+#ifdef IB_HAVE_ASYNC
+    Newx(fds, n, struct pollfd);
+    SAVEFREEPV(fds);
+#endif
+
+    for (i = 0; i < n; i++)
+    {
+        w[i].ref         = *av_fetch(workers, i, 0);
+        w[i].hv          = (HV *) SvRV(w[i].ref);
+        w[i].sth         = *hv_fetchs(w[i].hv, "sth", 0);
+        w[i].dbh         = *hv_fetchs(w[i].hv, "dbh", 0);
+        {
+            D_imp_sth(w[i].sth);
+            D_imp_dbh(w[i].dbh);
+
+            w[i].imp_sth = imp_sth;
+            w[i].imp_dbh = imp_dbh;
+        }
+        w[i].rows        = *hv_fetchs(w[i].hv, "rows", 1);
+        w[i].uncommitted = *hv_fetchs(w[i].hv, "uncommitted", 1);
+        w[i].commits     = *hv_fetchs(w[i].hv, "commits", 1);
+        w[i].fd          = async ? SvIV(*hv_fetchs(w[i].hv, "fd", 1)) : -1;
+    }
+
+    for (i = header ? -1 : 0, more = TRUE; more; i++)
+    {
+        AV              *fields;
+        SV              *row;
+        IB_BULK_WORKER  *c;
+        int             ok = TRUE;
+        int             k, nf;
+
+        ENTER;
+        SAVETMPS;
+
+        fields = newAV();
+        row = sv_2mortal(newRV_noinc((SV *) fields));
+        more = tsv ? ib_bulk_tsv_row(in, line, utf8, fields)
+                   : ib_bulk_csv_row(in, line, sep, utf8, fields);
+        if (!more || i < 0)
+        {
+            FREETMPS;
+            LEAVE;
+            continue;
+        }
+
+#ifdef IB_HAVE_ASYNC
+        c = async ? ib_bulk_idle(self, hv, w, n, &next, fds) : &w[next++ % n];
+#else
+        c = &w[next++ % n];
+#endif
+
+        /* bind the values as execute does */
+        nf = av_len(fields) + 1;
+        if (nf != DBIc_NUM_PARAMS(c->imp_sth))
+        {
+            char errmsg[99];
+            snprintf(errmsg, sizeof(errmsg),
+                     "called with %d bind variables when %d are needed",
+                     nf, (int) DBIc_NUM_PARAMS(c->imp_sth));
+            do_error(c->sth, -1, errmsg);
+            ok = FALSE;
+        }
+        for (k = 0; ok && k < nf; k++)
+        {
+            sv_setiv(idx, k + 1);
+            ok = dbd_bind_ph(c->sth, c->imp_sth, idx, *av_fetch(fields, k, 0),
+                             0, Nullsv, FALSE, 0);
+        }
+
+        if (ok && async)
+            ok = ib_execute_async(c->sth, c->imp_sth);
+        else if (ok)
+            ok = dbd_st_execute(c->sth, c->imp_sth) >= -1;
+
+        if (ok && async)
+            (void) hv_stores(c->hv, "busy", SvREFCNT_inc(row));
+        else
+            ib_bulk_done(self, hv, c, row, ok);
+
+        FREETMPS;
+        LEAVE;
+    }
+
+    LEAVE;
+}
+
+/*
+ * Pipelined fetch (ib_pipeline).
+ *
+ * A thread of the statement keeps calling isc_dsql_fetch() into a ring of
+ * raw row images while dbd_st_fetch decodes the rows already there, so the
+ * network wait for the next batch overlaps with building SVs. The thread
+ * fetches through a descriptor of its own, whose sqldata and sqlind point
+ * into the ring slot being filled; dbd_st_fetch copies a slot back into
+ * out_sqlda and decodes it as usual. The ring holds at most ib_pipeline
+ * rows and ib_pipeline_bytes bytes.
+ */
+#ifdef IB_HAVE_ASYNC
+
+struct ib_pipe
+{
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    imp_sth_t       *imp_sth;
+    pid_t           pid;        /* process the thread runs in */
+    ISC_USHORT      dialect;
+    XSQLDA          *sqlda;     /* the thread's descriptor */
+    char            *ring;
+    size_t          *offset;    /* of each column's data in a row image */
+    size_t          row_bytes;
+    unsigned long   slots;
+    unsigned long   produced;   /* rows fetched into the ring */
+    unsigned long   consumed;   /* rows taken by dbd_st_fetch */
+    int             stop;
+    int             end;        /* no more rows: fetch holds why */
+    ISC_STATUS      fetch;
+    ISC_STATUS      status[ISC_STATUS_LENGTH];
+};
+
+static void *ib_pipe_worker(void *arg)
+{
+    IB_PIPE     *p = (IB_PIPE *) arg;
+    ISC_STATUS  status[ISC_STATUS_LENGTH];
+
+    for (;;)
+    {
+        char        *row;
+        ISC_STATUS  fetch;
+        int         i;
+
+        pthread_mutex_lock(&p->lock);
+        while (!p->stop && p->produced - p->consumed == p->slots)
+            pthread_cond_wait(&p->cond, &p->lock);
+        if (p->stop)
+        {
+            pthread_mutex_unlock(&p->lock);
+            break;
+        }
+        row = p->ring + (p->produced % p->slots) * p->row_bytes;
+        pthread_mutex_unlock(&p->lock);
+
+        for (i = 0; i < p->sqlda->sqld; i++)
+        {
+            p->sqlda->sqlvar[i].sqldata = row + p->offset[i];
+            p->sqlda->sqlvar[i].sqlind  = (short *) row + i;
+        }
+
+        memset(status, 0, sizeof(status));
+        fetch = isc_dsql_fetch(status, &(p->imp_sth->stmt), p->dialect, p->sqlda);
+
+        pthread_mutex_lock(&p->lock);
+        if (fetch != 0 || (status[0] == 1 && status[1] > 0))
+        {
+            p->end = 1;
+            p->fetch = fetch;
+            memcpy(p->status, status, sizeof(status));
+        }
+        else
+            p->produced++;
+        pthread_cond_signal(&p->cond);
+        pthread_mutex_unlock(&p->lock);
+
+        if (p->end)
+            break;
+    }
+
+    return NULL;
+}
+
+/* the size of a column's data in a row image */
+static size_t ib_pipe_data_len(XSQLVAR *var)
+{
+    size_t len = var->sqllen;
+
+    if ((var->sqltype & ~1) == SQL_VARYING)
+        len += sizeof(short);
+    /* keep the next column aligned for the thread to fetch into */
+    return (len + 7) & ~(size_t) 7;
+}
+
+#endif /* IB_HAVE_ASYNC */
+
+/*
+ * Start reading ahead after a SELECT has been executed, if ib_pipeline
+ * asks for it. Failing to start is not an error: the rows are then
+ * fetched the usual way.
+ */
+void ib_pipe_start(SV *sth, imp_sth_t *imp_sth)
+{
+#ifdef IB_HAVE_ASYNC
+    D_imp_dbh_from_sth;
+    XSQLDA      *out = imp_sth->out_sqlda;
+    IB_PIPE     *p;
+    sigset_t    all, old;
+    size_t      row_bytes;
+    int         i, rc;
+
+    if (!imp_sth->pipe_rows || !out || out->sqld == 0
+        || imp_sth->type != isc_info_sql_stmt_select)
+        return;
+
+    Newxz(p, 1, IB_PIPE);
+    Newx(p->offset, out->sqld, size_t);
+
+    /* a row image: the indicators first, then the data of each column */
+    row_bytes = ((out->sqld * sizeof(short)) + 7) & ~(size_t) 7;
+    for (i = 0; i < out->sqld; i++)
+    {
+        p->offset[i] = row_bytes;
+        row_bytes += ib_pipe_data_len(&out->sqlvar[i]);
+    }
+    p->row_bytes = row_bytes;
+
+    p->slots = imp_sth->pipe_bytes / row_bytes;
+    if (p->slots > imp_sth->pipe_rows)
+        p->slots = imp_sth->pipe_rows;
+    if (p->slots < 1)
+        p->slots = 1;
+    Newx(p->ring, p->slots * row_bytes, char);
+
+    IB_alloc_sqlda(p->sqlda, out->sqld);
+    p->sqlda->sqld = out->sqld;
+    Copy(out->sqlvar, p->sqlda->sqlvar, out->sqld, XSQLVAR);
+
+    p->imp_sth = imp_sth;
+    p->pid = getpid();
+    p->dialect = imp_dbh->sqldialect;
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->cond, NULL);
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    rc = pthread_create(&p->thread, NULL, ib_pipe_worker, p);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (rc != 0)
+    {
+        DBI_TRACE_imp_xxh(imp_sth, 2, (DBIc_LOGPIO(imp_sth), "ib_pipe_start: no thread, not pipelined\n"));
+        pthread_cond_destroy(&p->cond);
+        pthread_mutex_destroy(&p->lock);
+        Safefree(p->sqlda);
+        Safefree(p->ring);
+        Safefree(p->offset);
+        Safefree(p);
+        return;
+    }
+
+    DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "ib_pipe_start: %lu rows of %lu bytes\n",
+                      p->slots, (unsigned long) row_bytes));
+    imp_sth->pipe = p;
+#endif
+}
+
+/* stop reading ahead and forget the rows read, before closing the cursor */
+void ib_pipe_stop(imp_sth_t *imp_sth)
+{
+#ifdef IB_HAVE_ASYNC
+    IB_PIPE *p = imp_sth->pipe;
+
+    if (!p)
+        return;
+
+    /* a forked child has the ring but not the thread */
+    if (p->pid == getpid())
+    {
+        pthread_mutex_lock(&p->lock);
+        p->stop = 1;
+        pthread_cond_signal(&p->cond);
+        pthread_mutex_unlock(&p->lock);
+
+        /* waits for a fetch still on the wire */
+        pthread_join(p->thread, NULL);
+
+        pthread_cond_destroy(&p->cond);
+        pthread_mutex_destroy(&p->lock);
+    }
+    Safefree(p->sqlda);
+    Safefree(p->ring);
+    Safefree(p->offset);
+    Safefree(p);
+    imp_sth->pipe = NULL;
+#endif
+}
+
+/*
+ * The next row from the ring, copied into out_sqlda, waiting for the
+ * thread if needed. Returns what isc_dsql_fetch() would have.
+ */
+static ISC_STATUS ib_pipe_next(imp_sth_t *imp_sth, ISC_STATUS *status)
+{
+#ifdef IB_HAVE_ASYNC
+    IB_PIPE     *p = imp_sth->pipe;
+    XSQLVAR     *var;
+    char        *row;
+    int         i;
+
+    pthread_mutex_lock(&p->lock);
+    while (p->consumed == p->produced && !p->end)
+        pthread_cond_wait(&p->cond, &p->lock);
+
+    if (p->consumed == p->produced)
+    {
+        ISC_STATUS fetch = p->fetch;
+
+        Copy(p->status, status, ISC_STATUS_LENGTH, ISC_STATUS);
+        pthread_mutex_unlock(&p->lock);
+        return fetch;
+    }
+    row = p->ring + (p->consumed % p->slots) * p->row_bytes;
+    pthread_mutex_unlock(&p->lock);
+
+    /* the slot is ours until consumed moves on */
+    for (i = 0, var = imp_sth->out_sqlda->sqlvar;
+         i < imp_sth->out_sqlda->sqld;
+         i++, var++)
+    {
+        if (var->sqlind)
+            *(var->sqlind) = ((short *) row)[i];
+        Copy(row + p->offset[i], var->sqldata,
+             var->sqllen + ((var->sqltype & ~1) == SQL_VARYING ? sizeof(short) : 0),
+             char);
+    }
+
+    pthread_mutex_lock(&p->lock);
+    p->consumed++;
+    pthread_cond_signal(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+
+    status[0] = 1;
+    status[1] = 0;
+    status[2] = isc_arg_end;
+    return 0;
+#else
+    return 100;
+#endif
+}
+
+/*
+   Date/time decoding without isc_decode_*(): ISC_DATE counts days since
+   1858-11-17 (Modified Julian Day), ISC_TIME counts 1/10000 seconds since
+   midnight. The day number is turned into a civil date with the algorithm
+   from http://howardhinnant.github.io/date_algorithms.html
+ */
+#define IB_MJD_UNIX_EPOCH   40587   /* 1970-01-01 */
+#define IB_DAY_TICKS        (86400L * ISC_TIME_SECONDS_PRECISION)
+
+/* days since 1970-01-01 of a proleptic Gregorian y-m-d */
+static long ib_days_from_civil(long y, int m, int d)
+{
+    long era;
+    long yoe, doy, doe;
+
+    y -= m <= 2;
+    era = (y >= 0 ? y : y - 399) / 400;
+    yoe = y - era * 400;
+    doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+    return era * 146097 + doe - 719468;
+}
+
+static void ib_decode_date(ISC_DATE date, struct tm *times)
+{
+    long z = (long) date - IB_MJD_UNIX_EPOCH;
+    long era, doe, yoe, doy, mp, y;
+
+    /* 1970-01-01 was a Thursday */
+    times->tm_wday = (int) ((z % 7 + 11) % 7);
+
+    z += 719468;
+    era = (z >= 0 ? z : z - 146096) / 146097;
+    doe = z - era * 146097;
+    yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    y   = yoe + era * 400;
+    doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    mp  = (5 * doy + 2) / 153;
+
+    times->tm_mday = (int) (doy - (153 * mp + 2) / 5 + 1);
+    times->tm_mon  = (int) (mp < 10 ? mp + 2 : mp - 10);
+    if (times->tm_mon <= 1)
+        y++;
+    times->tm_year = (int) (y - 1900);
+    times->tm_yday = (int) ((long) date - IB_MJD_UNIX_EPOCH
+                            - ib_days_from_civil(y, 1, 1));
+}
+
+static void ib_decode_time(ISC_TIME time, struct tm *times)
+{
+    unsigned int secs = time / ISC_TIME_SECONDS_PRECISION;
+
+    times->tm_hour = secs / 3600;
+    times->tm_min  = secs / 60 % 60;
+    times->tm_sec  = secs % 60;
+}
+
+/* Shift a UTC date/time by a number of minutes, carrying into the date */
+static void ib_shift_timestamp(ISC_DATE *date, ISC_TIME *time, int minutes)
+{
+    long ticks = (long) *time + (long) minutes * 60 * ISC_TIME_SECONDS_PRECISION;
+
+    if (ticks < 0)
+    {
+        ticks += IB_DAY_TICKS;
+        (*date)--;
+    }
+    else if (ticks >= IB_DAY_TICKS)
+    {
+        ticks -= IB_DAY_TICKS;
+        (*date)++;
+    }
+    *time = (ISC_TIME) ticks;
+}
+
+/* "iso" is followed by the number of fractional digits, 4 if omitted */
+static int ib_iso_digits(const char *format)
+{
+    if ((format[0] != 'i' && format[0] != 'I')
+        || (format[1] != 's' && format[1] != 'S')
+        || (format[2] != 'o' && format[2] != 'O'))
+        return -1;
+
+    if (format[3] == '\0')
+        return 4;
+    if (format[3] >= '0' && format[3] <= '4' && format[4] == '\0')
+        return format[3] - '0';
+    return -1;
+}
+
+/* numeric output modes of ib_*format */
+#define IB_TIME_EPOCH       1   /* NV seconds since 1970-01-01 00:00 UTC */
+#define IB_TIME_EPOCH_MS    2   /* IV milliseconds */
+#define IB_TIME_JULIAN      3   /* NV Julian Day */
+
+static int ib_numeric_time_mode(const char *format)
+{
+    if (strEQ(format, "epoch") || strEQ(format, "EPOCH"))
+        return IB_TIME_EPOCH;
+    if (strEQ(format, "epoch_ms") || strEQ(format, "EPOCH_MS"))
+        return IB_TIME_EPOCH_MS;
+    if (strEQ(format, "julian") || strEQ(format, "JULIAN"))
+        return IB_TIME_JULIAN;
+    return 0;
+}
+
+/*
+   Store a date/time value as a number. Without a date (TIME columns) the
+   result counts from midnight, and julian gives the fraction of the day.
+ */
+static void ib_set_numeric_time(SV *sv, int mode, int has_date,
+                                ISC_DATE date, ISC_TIME time)
+{
+    ISC_INT64 ticks = time;
+
+    if (has_date)
+        ticks += ((ISC_INT64) date - IB_MJD_UNIX_EPOCH) * IB_DAY_TICKS;
+
+    switch (mode)
+    {
+        case IB_TIME_EPOCH:
+            sv_setnv(sv, (NV) ticks / ISC_TIME_SECONDS_PRECISION);
+            break;
+
+        case IB_TIME_EPOCH_MS:
+        {
+            /* round towards -infinity, also before 1970 */
+            ISC_INT64 rest = ticks % 10;
+            if (rest < 0)
+                rest += 10;
+            sv_setiv(sv, (IV) ((ticks - rest) / 10));
+            break;
+        }
+
+        case IB_TIME_JULIAN:
+            /* the Modified Julian Day starts at JD 2400000.5 */
+            sv_setnv(sv, (has_date ? (NV) date + 2400000.5 : 0.0)
+                         + (NV) time / IB_DAY_TICKS);
+            break;
+    }
+}
+
+#define IB_PUT2(p, v) \
+    do { *(p)++ = '0' + (v) / 10 % 10; *(p)++ = '0' + (v) % 10; } while (0)
+#define IB_PUT4(p, v) \
+    do { IB_PUT2(p, (v) / 100); IB_PUT2(p, (v) % 100); } while (0)
+
+static char *ib_put_date(char *p, const struct tm *times)
+{
+    int year = times->tm_year + 1900;
+
+    IB_PUT4(p, year);
+    *p++ = '-';
+    IB_PUT2(p, times->tm_mon + 1);
+    *p++ = '-';
+    IB_PUT2(p, times->tm_mday);
+    return p;
+}
+
+static char *ib_put_time(char *p, const struct tm *times, long fpsec, int digits)
+{
+    IB_PUT2(p, times->tm_hour);
+    *p++ = ':';
+    IB_PUT2(p, times->tm_min);
+    *p++ = ':';
+    IB_PUT2(p, times->tm_sec);
+
+    if (digits > 0)
+    {
+        char frac[4];
+        int  i;
+
+        frac[0] = '0' + fpsec / 1000 % 10;
+        frac[1] = '0' + fpsec / 100 % 10;
+        frac[2] = '0' + fpsec / 10 % 10;
+        frac[3] = '0' + fpsec % 10;
+
+        *p++ = '.';
+        for (i = 0; i < digits; i++)
+            *p++ = frac[i];
+    }
+    return p;
+}
+
+/* the year as glibc's %Y writes it: as many digits as needed, no padding */
+static char *ib_put_year(char *p, int year)
+{
+    char         digits[12];
+    int          n = 0;
+    unsigned int v = year < 0 ? 0U - (unsigned int) year : (unsigned int) year;
+
+    if (year < 0)
+        *p++ = '-';
+    do
+    {
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    while (n)
+        *p++ = digits[--n];
+    return p;
+}
+
+/* the year in the century, as glibc's %y: 0 to 99 for year 1 (01) too */
+static int ib_year2(const struct tm *times)
+{
+    return (times->tm_year % 100 + 100) % 100;
+}
+
+/*
+   strftime() for the locale independent conversions, which covers the
+   formats usually given for ib_*format, with the output of glibc's.
+   Returns the length of the result, or -1 when the format needs the C
+   library's strftime().
+ */
+static int ib_strftime(char *buf, size_t size, const char *format,
+                       const struct tm *times)
+{
+    char *p = buf, *end = buf + size - 24; /* room for the longest item */
+
+    for (; *format; format++)
+    {
+        if (p >= end)
+            return -1;
+
+        if (*format != '%')
+        {
+            *p++ = *format;
+            continue;
+        }
+
+        switch (*++format)
+        {
+            case 'Y': p = ib_put_year(p, times->tm_year + 1900); break;
+            case 'y': IB_PUT2(p, ib_year2(times));          break;
+            case 'm': IB_PUT2(p, times->tm_mon + 1);        break;
+            case 'd': IB_PUT2(p, times->tm_mday);           break;
+            case 'e':
+                *p++ = times->tm_mday < 10 ? ' ' : '0' + times->tm_mday / 10;
+                *p++ = '0' + times->tm_mday % 10;
+                break;
+            case 'j':
+                *p++ = '0' + (times->tm_yday + 1) / 100;
+                IB_PUT2(p, times->tm_yday + 1);
+                break;
+            case 'H': IB_PUT2(p, times->tm_hour);           break;
+            case 'M': IB_PUT2(p, times->tm_min);            break;
+            case 'S': IB_PUT2(p, times->tm_sec);            break;
+            case 'u': *p++ = '0' + (times->tm_wday ? times->tm_wday : 7); break;
+            case 'w': *p++ = '0' + times->tm_wday;          break;
+            case 'F':
+                p = ib_put_year(p, times->tm_year + 1900);
+                *p++ = '-';
+                IB_PUT2(p, times->tm_mon + 1);
+                *p++ = '-';
+                IB_PUT2(p, times->tm_mday);
+                break;
+            case 'T': p = ib_put_time(p, times, 0, 0);      break;
+            case 'R':
+                IB_PUT2(p, times->tm_hour);
+                *p++ = ':';
+                IB_PUT2(p, times->tm_min);
+                break;
+            case 'D':
+                IB_PUT2(p, times->tm_mon + 1);
+                *p++ = '/';
+                IB_PUT2(p, times->tm_mday);
+                *p++ = '/';
+                IB_PUT2(p, ib_year2(times));
+                break;
+            case 'n': *p++ = '\n';                          break;
+            case 't': *p++ = '\t';                          break;
+            case '%': *p++ = '%';                           break;
+            default:
+                /* locale dependent, or unknown */
+                return -1;
+        }
+    }
+
+    *p = '\0';
+    return p - buf;
+}
+
+/* ib_strftime(), falling back to strftime() */
+static int ib_format_tm(char *buf, size_t size, const char *format,
+                        struct tm *times)
+{
+    int len = ib_strftime(buf, size, format, times);
+
+    if (len >= 0)
+        return len;
+
+#ifndef WIN32
+    /*
+     * may be we must here copy additional fields needed on
+     * some platforms for some strftime formats. copy from a
+     * dummy struct passed to mktime(). calling mktime()
+     * directly with &times is wrong.
+     */
+
+    /* struct tm has 9 fields plus may be some more */
+    if (sizeof(struct tm) > (9*sizeof(int)))
+    {
+        struct tm dummy;
+        Zero(&dummy, 1, struct tm);
+        mktime(&dummy);
+        memcpy(((char *)times) + 9*sizeof(int),
+               ((char *)&dummy) + 9*sizeof(int),
+               sizeof(struct tm) - (9*sizeof(int)));
+    }
+#endif
+
+    return (int) strftime(buf, size, format, times);
+}
+
+/*
+   Date/time parameters the driver cannot encode itself are passed to the
+   server as text (workaround for date problem, bug #429820). sqlsubtype
+   then remembers the described type, so the next execute can go back to
+   binary binding.
+ */
+#define IB_DT_TEXT_TIMESTAMP    0x77    /* (0x77 is a random value) */
+#define IB_DT_TEXT_DATE         0x78
+#define IB_DT_TEXT_TIME         0x79
+#define IB_DT_TEXT_TIMESTAMP_TZ 0x7a
+#define IB_DT_TEXT_TIME_TZ      0x7b
+#define IB_DT_TEXT_TIMESTAMP_TZ_EX 0x7c
+#define IB_DT_TEXT_TIME_TZ_EX   0x7d
+
+static short ib_datetime_text_subtype(int dtype)
+{
+    switch (dtype)
+    {
+        case SQL_TYPE_DATE:         return IB_DT_TEXT_DATE;
+        case SQL_TYPE_TIME:         return IB_DT_TEXT_TIME;
+        case SQL_TIMESTAMP_TZ:      return IB_DT_TEXT_TIMESTAMP_TZ;
+        case SQL_TIMESTAMP_TZ_EX:   return IB_DT_TEXT_TIMESTAMP_TZ_EX;
+        case SQL_TIME_TZ:           return IB_DT_TEXT_TIME_TZ;
+        case SQL_TIME_TZ_EX:        return IB_DT_TEXT_TIME_TZ_EX;
+        default:                    return IB_DT_TEXT_TIMESTAMP;
+    }
+}
+
+static int ib_datetime_from_text_subtype(short subtype)
+{
+    switch (subtype)
+    {
+        case IB_DT_TEXT_TIMESTAMP:    return SQL_TIMESTAMP;
+        case IB_DT_TEXT_DATE:         return SQL_TYPE_DATE;
+        case IB_DT_TEXT_TIME:         return SQL_TYPE_TIME;
+        case IB_DT_TEXT_TIMESTAMP_TZ: return SQL_TIMESTAMP_TZ;
+        case IB_DT_TEXT_TIME_TZ:      return SQL_TIME_TZ;
+        case IB_DT_TEXT_TIMESTAMP_TZ_EX: return SQL_TIMESTAMP_TZ_EX;
+        case IB_DT_TEXT_TIME_TZ_EX:   return SQL_TIME_TZ_EX;
+        default:                      return 0;
+    }
+}
+
+/* parts found by ib_parse_iso() */
+#define IB_ISO_DATE     1
+#define IB_ISO_TIME     2
+#define IB_ISO_OFFSET   4   /* +HH:MM */
+#define IB_ISO_UTC      8   /* Z */
+
+static int ib_iso_number(const char **p, const char *end, int n)
+{
+    int v = 0;
+
+    if (end - *p < n)
+        return -1;
+    while (n--)
+    {
+        if (**p < '0' || **p > '9')
+            return -1;
+        v = v * 10 + (*(*p)++ - '0');
+    }
+    return v;
+}
+
+/*
+   Parse "YYYY-MM-DD", "HH:MM[:SS[.ffff]]" or both separated by a space or
+   a 'T', optionally followed by "Z" or a "+HH[[:]MM]" offset. Anything else
+   (named zones, 'NOW', other date orders) is left to the server. Returns
+   the parts found, 0 for a string to leave to the server, or -1 for a date
+   and a 'T' without the time.
+ */
+static int ib_parse_iso(const char *s, STRLEN len, ISC_DATE *date,
+                        ISC_TIME *time, int *offset)
+{
+    const char *p = s, *end = s + len;
+    int parts = 0, y, m, d, hh, mm, ss = 0, frac = 0, scale;
+
+    *date = 0;
+    *time = 0;
+    *offset = 0;
+
+    while (p < end && *p == ' ')
+        p++;
+    while (end > p && end[-1] == ' ')
+        end--;
+
+    if (end - p >= 10 && p[4] == '-')
+    {
+        static const int mdays[] = { 31,29,31,30,31,30,31,31,30,31,30,31 };
+
+        if ((y = ib_iso_number(&p, end, 4)) < 1 || *p++ != '-'
+            || (m = ib_iso_number(&p, end, 2)) < 1 || m > 12 || *p++ != '-'
+            || (d = ib_iso_number(&p, end, 2)) < 1 || d > mdays[m - 1])
+            return 0;
+        if (m == 2 && d == 29 && !((y % 4 == 0 && y % 100 != 0) || y % 400 == 0))
+            return 0;
+
+        *date = (ISC_DATE) (ib_days_from_civil(y, m, d) + IB_MJD_UNIX_EPOCH);
+        parts |= IB_ISO_DATE;
+
+        if (p < end)
+        {
+            if (*p != ' ' && *p != 'T')
+                return 0;
+            p++;
+
+            /* only a 'T' can end here, the blanks are gone already */
+            if (p == end)
+                return -1;
+        }
+    }
+
+    if (p < end && end - p >= 5 && p[2] == ':')
+    {
+        if ((hh = ib_iso_number(&p, end, 2)) < 0 || hh > 23 || *p++ != ':'
+            || (mm = ib_iso_number(&p, end, 2)) < 0 || mm > 59)
+            return 0;
+
+        if (p < end && *p == ':')
+        {
+            p++;
+            if ((ss = ib_iso_number(&p, end, 2)) < 0 || ss > 59)
+                return 0;
+
+            if (p < end && *p == '.')
+            {
+                /* 1/10000 s precision, further digits are dropped */
+                p++;
+                for (scale = 1000; p < end && *p >= '0' && *p <= '9'; p++)
+                {
+                    frac += (*p - '0') * scale;
+                    scale /= 10;
+                }
+            }
+        }
+
+        *time = (ISC_TIME) ((hh * 3600 + mm * 60 + ss) * ISC_TIME_SECONDS_PRECISION
+                            + frac);
+        parts |= IB_ISO_TIME;
+
+        if (p < end && *p == ' ')
+            p++;
+
+        if (p < end && *p == 'Z' && p + 1 == end)
+        {
+            p++;
+            parts |= IB_ISO_UTC;
+        }
+        else if (p < end && (*p == '+' || *p == '-'))
+        {
+            int sign = *p++ == '-' ? -1 : 1;
+            int oh, om = 0;
+
+            if ((oh = ib_iso_number(&p, end, 2)) < 0 || oh > 23)
+                return 0;
+            if (p < end && *p == ':')
+                p++;
+            if (p < end && ((om = ib_iso_number(&p, end, 2)) < 0 || om > 59))
+                return 0;
+
+            *offset = sign * (oh * 60 + om);
+            parts |= IB_ISO_OFFSET;
+        }
+    }
+
+    /* something not understood left over */
+    if (p != end || !parts)
+        return 0;
+
+    return parts;
+}
+
+/* seconds since 1970-01-01 00:00:00 UTC to date and time, rounded to ticks */
+static void ib_epoch_to_timestamp(SV *value, ISC_DATE *date, ISC_TIME *time)
+{
+    ISC_INT64 ticks, days;
+
+    if (SvIOK(value) && !SvNOK(value))
+        ticks = (ISC_INT64) SvIV(value) * ISC_TIME_SECONDS_PRECISION;
+    else
+        ticks = (ISC_INT64) floor(SvNV(value) * ISC_TIME_SECONDS_PRECISION + 0.5);
+
+    days = ticks / IB_DAY_TICKS;
+    if (ticks % IB_DAY_TICKS < 0)
+        days--;
+
+    *date = (ISC_DATE) (days + IB_MJD_UNIX_EPOCH);
+    *time = (ISC_TIME) (ticks - days * IB_DAY_TICKS);
+}
+
+/*
+ * Named time zones
+ *
+ * The names come from RDB$TIME_ZONES, read once per connection. The offsets
+ * come from RDB$TIME_ZONE_UTIL.TRANSITIONS, asked for a three year window
+ * around the first value that misses the cache, so a column of values from
+ * the same period costs one query per zone instead of one per cell.
+ */
+#define IB_TZ_REF_DATE  58849   /* 2020-01-01, the date TIME WITH TIME ZONE uses */
+
+/*
+ * prepare and execute an internal query, with room for every column.
+ * Returns FALSE with the error set on the handle; *out is allocated either
+ * way and released by ib_tz_query_done().
+ */
+static int ib_tz_query(SV *sth, imp_dbh_t *imp_dbh, isc_stmt_handle *stmt,
+                       char *sql, short cols, XSQLDA **out)
+{
+    ISC_STATUS status[ISC_STATUS_LENGTH];
+    XSQLDA  *sqlda = NULL;
+    XSQLVAR *var;
+    int      i;
+
+    IB_alloc_sqlda(sqlda, cols);
+    *out = sqlda;
+    if (sqlda == NULL)
+    {
+        do_error(sth, 2, "Failed to allocate out sqlda");
+        return FALSE;
+    }
+
+    isc_dsql_alloc_statement2(status, &(imp_dbh->db), stmt);
+    if (ib_error_check(sth, status))
+        return FALSE;
+
+    isc_dsql_prepare(status, &(imp_dbh->tr), stmt, 0, sql,
+                     imp_dbh->sqldialect, *out);
+    if (ib_error_check(sth, status))
+        return FALSE;
+
+    if ((*out)->sqld != cols)
+    {
+        do_error(sth, 2, "Unexpected number of columns");
+        return FALSE;
+    }
+
+    for (i = 0, var = (*out)->sqlvar; i < cols; i++, var++)
+    {
+        Newxz(var->sqldata, var->sqllen + sizeof(short), char);
+        Newx(var->sqlind, 1, ISC_SHORT);
+    }
+
+    isc_dsql_execute(status, &(imp_dbh->tr), stmt, 1, NULL);
+    if (ib_error_check(sth, status))
+        return FALSE;
+
+    return TRUE;
+}
+
+static void ib_tz_query_done(XSQLDA *out, isc_stmt_handle *stmt)
+{
+    ISC_STATUS status[ISC_STATUS_LENGTH];
+    int i;
+
+    if (*stmt)
+        isc_dsql_free_statement(status, stmt, DSQL_drop);
+
+    if (out)
+    {
+        for (i = 0; i < out->sqld && i < out->sqln; i++)
+        {
+            Safefree(out->sqlvar[i].sqldata);
+            Safefree(out->sqlvar[i].sqlind);
+        }
+        Safefree(out);
+    }
+}
+
+/* UTC instant of a TIMESTAMP WITH TIME ZONE column, in ticks */
+static int ib_tz_ticks(XSQLVAR *var, ISC_INT64 *ticks)
+{
+    ISC_TIMESTAMP *ts;
+    short dtype = var->sqltype & ~1;
+
+    if (dtype != SQL_TIMESTAMP_TZ && dtype != SQL_TIMESTAMP_TZ_EX)
+        return FALSE;
+
+    /* both variants start with the UTC timestamp */
+    ts = (ISC_TIMESTAMP *) var->sqldata;
+    *ticks = (ISC_INT64) ts->timestamp_date * IB_DAY_TICKS + ts->timestamp_time;
+    return TRUE;
+}
+
+/*
+ * zone id -> cache entry (NULL for an unknown id), reading RDB$TIME_ZONES
+ * on first use. Returns FALSE with the error set on the handle.
+ */
+static int ib_tz_zone(SV *sth, imp_dbh_t *imp_dbh, ISC_USHORT id,
+                      IB_TZ_ZONE **zone)
+{
+    *zone = NULL;
+    if (imp_dbh->tz_zones == NULL)
+    {
+        int       ok;
+        ISC_STATUS status[ISC_STATUS_LENGTH];
+        isc_stmt_handle stmt = 0;
+        XSQLDA   *out;
+        char      sql[] = "SELECT RDB$TIME_ZONE_ID, RDB$TIME_ZONE_NAME FROM RDB$TIME_ZONES";
+        ISC_ULONG lo = 0xFFFF, hi = 0;
+        AV       *rows = newAV();
+        I32       n;
+
+        if ((ok = ib_tz_query(sth, imp_dbh, &stmt, sql, 2, &out)))
+        {
+            if (((out->sqlvar[0].sqltype & ~1) != SQL_LONG
+                 && (out->sqlvar[0].sqltype & ~1) != SQL_SHORT)
+                || ((out->sqlvar[1].sqltype & ~1) != SQL_TEXT
+                    && (out->sqlvar[1].sqltype & ~1) != SQL_VARYING))
+            {
+                do_error(sth, 2, "Unexpected datatype");
+                ok = FALSE;
+            }
+            else
+            {
+                /* collect first, the id range is not known up front */
+                while (isc_dsql_fetch(status, &stmt, 1, out) == 0)
+                {
+                    XSQLVAR *nv = &out->sqlvar[1];
+                    ISC_LONG zid = (out->sqlvar[0].sqltype & ~1) == SQL_LONG ?
+                        *(ISC_LONG *) out->sqlvar[0].sqldata :
+                        (ISC_USHORT) *(ISC_SHORT *) out->sqlvar[0].sqldata;
+                    char    *name = nv->sqldata;
+                    STRLEN   len = nv->sqllen;
+
+                    if (zid < 0 || zid > 0xFFFF)
+                        continue;
+                    if ((nv->sqltype & ~1) == SQL_VARYING)
+                    {
+                        len = *(short *) name;
+                        name += sizeof(short);
+                    }
+                    while (len && name[len - 1] == ' ')
+                        len--;
+
+                    av_push(rows, newSViv(zid));
+                    av_push(rows, newSVpvn(name, len));
+                    if ((ISC_ULONG) zid < lo) lo = zid;
+                    if ((ISC_ULONG) zid > hi) hi = zid;
+                }
+            }
+        }
+        ib_tz_query_done(out, &stmt);
+
+        if (ok && av_len(rows) >= 0)
+        {
+            imp_dbh->tz_first_id = (ISC_USHORT) lo;
+            imp_dbh->tz_zone_count = hi - lo + 1;
+            Newxz(imp_dbh->tz_zones, imp_dbh->tz_zone_count, IB_TZ_ZONE);
+
+            for (n = 0; n < av_len(rows); n += 2)
+            {
+                IB_TZ_ZONE *z = &imp_dbh->tz_zones[SvIV(*av_fetch(rows, n, 0)) - lo];
+                STRLEN len;
+                char  *name = SvPV(*av_fetch(rows, n + 1, 0), len);
+
+                Newx(z->name, len + 1, char);
+                Copy(name, z->name, len, char);
+                z->name[len] = '\0';
+            }
+
+            DBI_TRACE_imp_xxh(imp_dbh, 3, (DBIc_LOGPIO(imp_dbh),
+                "ib_tz_zone: %d named zones loaded\n", (int)(av_len(rows) + 1) / 2));
+        }
+        SvREFCNT_dec((SV *) rows);
+
+        if (!ok)
+            return FALSE;
+    }
+
+    if (imp_dbh->tz_zones
+        && id >= imp_dbh->tz_first_id
+        && id - imp_dbh->tz_first_id < imp_dbh->tz_zone_count
+        && imp_dbh->tz_zones[id - imp_dbh->tz_first_id].name != NULL)
+        *zone = &imp_dbh->tz_zones[id - imp_dbh->tz_first_id];
+
+    return TRUE;
+}
+
+/* index of the cached range holding ticks, or of where it would go */
+static unsigned int ib_tz_find(IB_TZ_ZONE *zone, ISC_INT64 ticks, int *found)
+{
+    unsigned int lo = 0, hi = zone->count;
+
+    while (lo < hi)
+    {
+        unsigned int mid = (lo + hi) / 2;
+
+        if (zone->ranges[mid].end < ticks)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    *found = lo < zone->count && zone->ranges[lo].start <= ticks;
+    return lo;
+}
+
+/* merge one TRANSITIONS row into the sorted range list */
+static void ib_tz_add_range(IB_TZ_ZONE *zone, ISC_INT64 start, ISC_INT64 end,
+                            ISC_SHORT offset)
+{
+    unsigned int i;
+    int found;
+
+    i = ib_tz_find(zone, start, &found);
+    if (found)
+        return;
+
+    /* overlapping windows: keep what is cached */
+    if (i < zone->count && end >= zone->ranges[i].start)
+        end = zone->ranges[i].start - 1;
+
+    if (zone->count == zone->alloc)
+    {
+        zone->alloc = zone->alloc ? zone->alloc * 2 : 8;
+        Renew(zone->ranges, zone->alloc, IB_TZ_RANGE);
+    }
+    Move(&zone->ranges[i], &zone->ranges[i + 1], zone->count - i, IB_TZ_RANGE);
+    zone->ranges[i].start = start;
+    zone->ranges[i].end = end;
+    zone->ranges[i].offset = offset;
+    zone->count++;
+}
+
+/*
+ * UTC offset in minutes of a named zone at the UTC instant ticks. Returns
+ * FALSE with the error set on the handle if the server could not be asked.
+ */
+static int ib_tz_offset(SV *sth, imp_dbh_t *imp_dbh, IB_TZ_ZONE *zone,
+                        ISC_INT64 ticks, ISC_SHORT *offset)
+{
+    ISC_STATUS status[ISC_STATUS_LENGTH];
+    isc_stmt_handle stmt = 0;
+    XSQLDA   *out = NULL;
+    struct tm times;
+    char      sql[512];
+    unsigned int i;
+    int       found, year, ok;
+    ISC_INT64 from, to;
+
+    i = ib_tz_find(zone, ticks, &found);
+    if (found)
+    {
+        *offset = zone->ranges[i].offset;
+        return TRUE;
+    }
+
+    /* zone names come from the catalog and never need quoting */
+    if (strchr(zone->name, '\'') || strlen(zone->name) > 300)
+    {
+        *offset = 0;
+        return TRUE;
+    }
+
+    ib_decode_date((ISC_DATE) (ticks / IB_DAY_TICKS), &times);
+    year = times.tm_year + 1900;
+    if (year < 2)    year = 2;
+    if (year > 9997) year = 9997;
+
+    from = (ISC_INT64) (ib_days_from_civil(year - 1, 1, 1) + IB_MJD_UNIX_EPOCH) * IB_DAY_TICKS;
+    to   = (ISC_INT64) (ib_days_from_civil(year + 2, 1, 1) + IB_MJD_UNIX_EPOCH) * IB_DAY_TICKS;
+
+    snprintf(sql, sizeof(sql),
+        "SELECT RDB$START_TIMESTAMP, RDB$END_TIMESTAMP, RDB$EFFECTIVE_OFFSET"
+        " FROM RDB$TIME_ZONE_UTIL.TRANSITIONS('%s',"
+        " CAST('%04d-01-01 00:00:00 +00:00' AS TIMESTAMP WITH TIME ZONE),"
+        " CAST('%04d-01-01 00:00:00 +00:00' AS TIMESTAMP WITH TIME ZONE))",
+        zone->name, year - 1, year + 2);
+
+    DBI_TRACE_imp_xxh(imp_dbh, 3, (DBIc_LOGPIO(imp_dbh),
+        "ib_tz_offset: loading %s %d..%d\n", zone->name, year - 1, year + 1));
+
+    ok = ib_tz_query(sth, imp_dbh, &stmt, sql, 3, &out);
+    if (ok && (out->sqlvar[2].sqltype & ~1) != SQL_SHORT)
+    {
+        do_error(sth, 2, "Unexpected datatype");
+        ok = FALSE;
+    }
+    while (ok && isc_dsql_fetch(status, &stmt, 1, out) == 0)
+    {
+        ISC_INT64 start, end;
+
+        if (!ib_tz_ticks(&out->sqlvar[0], &start)
+            || !ib_tz_ticks(&out->sqlvar[1], &end))
+        {
+            do_error(sth, 2, "Unexpected datatype");
+            ok = FALSE;
+            break;
+        }
+        ib_tz_add_range(zone, start, end, *(ISC_SHORT *) out->sqlvar[2].sqldata);
+    }
+    ib_tz_query_done(out, &stmt);
+
+    if (!ok)
+        return FALSE;
+
+    i = ib_tz_find(zone, ticks, &found);
+    if (!found)
+    {
+        /*
+         * no rule for this instant: remember the gap inside the window as
+         * UTC, so it is not asked for again
+         */
+        from = i > 0 && zone->ranges[i - 1].end + 1 > from ?
+            zone->ranges[i - 1].end + 1 : from;
+        to = i < zone->count && zone->ranges[i].start - 1 < to - 1 ?
+            zone->ranges[i].start - 1 : to - 1;
+        if (from <= ticks && ticks <= to)
+            ib_tz_add_range(zone, from, to, 0);
+        else
+            ib_tz_add_range(zone, ticks, ticks, 0);
+        i = ib_tz_find(zone, ticks, &found);
+    }
+
+    *offset = zone->ranges[i].offset;
+    return TRUE;
+}
+
+/* the representation a TYPE of bind_col asks for */
+/* the UTC date and time of a TIME/TIMESTAMP WITH TIME ZONE value, and its
+   zone id, or its offset for the *_EX types */
+static void ib_tz_fields(XSQLVAR *var, short dtype, ISC_DATE *date,
+                         ISC_TIME *time, ISC_USHORT *zone_id, ISC_SHORT *offset)
+{
+    switch (dtype)
+    {
+        case SQL_TIMESTAMP_TZ_EX:
+        {
+            ISC_TIMESTAMP_TZ_EX *ts = (ISC_TIMESTAMP_TZ_EX *) var->sqldata;
+            *date = ts->utc_timestamp.timestamp_date;
+            *time = ts->utc_timestamp.timestamp_time;
+            *offset = ts->ext_offset;
+            break;
+        }
+        case SQL_TIMESTAMP_TZ:
+        {
+            ISC_TIMESTAMP_TZ *ts = (ISC_TIMESTAMP_TZ *) var->sqldata;
+            *date = ts->utc_timestamp.timestamp_date;
+            *time = ts->utc_timestamp.timestamp_time;
+            *zone_id = ts->time_zone;
+            break;
+        }
+        case SQL_TIME_TZ_EX:
+        {
+            ISC_TIME_TZ_EX *t = (ISC_TIME_TZ_EX *) var->sqldata;
+            *time = t->utc_time;
+            *offset = t->ext_offset;
+            break;
+        }
+        case SQL_TIME_TZ:
+        {
+            ISC_TIME_TZ *t = (ISC_TIME_TZ *) var->sqldata;
+            *time = t->utc_time;
+            *zone_id = t->time_zone;
+            break;
+        }
+    }
+}
+
+/*
+   Shifts the UTC date and time of a zoned value to local time, carrying
+   day boundary crossings into the date. Sets the offset in minutes, and
+   the zone when it is a named one.
+ */
+static int ib_tz_local(SV *sth, imp_dbh_t *imp_dbh, short dtype,
+                       ISC_USHORT zone_id, ISC_DATE *date, ISC_TIME *time,
+                       ISC_SHORT *offset, IB_TZ_ZONE **zone)
+{
+    *zone = NULL;
+
+    if (zone_id <= FB_TZ_MAX_OFFSET_ZONE)
+        *offset = (ISC_SHORT)((int)zone_id - FB_TZ_ONE_DAY_OFFSET);
+    else if (zone_id != FB_TZ_GMT_ZONE)
+    {
+        /* a TIME in a named zone takes the offset of 2020-01-01 */
+        ISC_INT64 ticks = (ISC_INT64)
+            (dtype == SQL_TIMESTAMP_TZ ? *date : IB_TZ_REF_DATE)
+            * IB_DAY_TICKS + *time;
+
+        if (!ib_tz_zone(sth, imp_dbh, zone_id, zone))
+            return FALSE;
+        if (*zone && !ib_tz_offset(sth, imp_dbh, *zone, ticks, offset))
+            return FALSE;
+    }
+
+    ib_shift_timestamp(date, time, *offset);
+    return TRUE;
+}
+
+static char ib_col_rep(IV sql_type)
+{
+    if (sql_type == DBI_SQL_INTEGER || sql_type == DBI_SQL_SMALLINT
+        || sql_type == DBI_SQL_BIGINT || sql_type == SQL_TINYINT)
+        return IB_COL_IV;
+    if (sql_type == DBI_SQL_DOUBLE || sql_type == DBI_SQL_FLOAT
+        || sql_type == DBI_SQL_REAL)
+        return IB_COL_NV;
+    if (sql_type == DBI_SQL_CHAR || sql_type == DBI_SQL_VARCHAR
+        || sql_type == SQL_LONGVARCHAR)
+        return IB_COL_STR;
+    if (sql_type == SQL_BINARY || sql_type == SQL_VARBINARY
+        || sql_type == SQL_LONGVARBINARY || sql_type == DBI_SQL_BLOB)
+        return IB_COL_RAW;
+    return IB_COL_DEFAULT;
+}
+
+/*
+ * DBI ties a bound variable to the row buffer itself, so dbd_st_fetch
+ * writes straight into it. Here the TYPE is remembered, to write the value
+ * in that form, and that the column is bound, for ib_bound_only.
+ */
+int dbd_st_bind_col(SV *sth, imp_sth_t *imp_sth, SV *col, SV *ref,
+                    IV sql_type, SV *attribs)
+{
+    int i = (int) SvIV(col) - 1;
+
+    DBI_TRACE_imp_xxh(imp_sth, 2, (DBIc_LOGPIO(imp_sth),
+        "dbd_st_bind_col: column %d, type %ld\n", i + 1, (long) sql_type));
+
+    /* DBI complains about a bad column number */
+    if (!imp_sth->out_sqlda || i < 0 || i >= imp_sth->out_sqlda->sqld)
+        return 1;
+
+    if (!imp_sth->col_rep)
+        Newxz(imp_sth->col_rep, imp_sth->out_sqlda->sqld, char);
+    imp_sth->col_rep[i] = ib_col_rep(sql_type) | IB_COL_BOUND;
+
+    return 1; /* and let DBI do the binding */
+}
+
+/*
+   A SMALLINT, INTEGER, BIGINT, FLOAT or DOUBLE column as an IV or NV. As
+   DBI's sql_type_cast(), an IV is only given for an integral value in the
+   IV range: FALSE leaves anything else to the default decoding.
+ */
+static int ib_typed_number(SV *sv, XSQLVAR *var, int dtype, int rep)
+{
+    double nv;
+
+    if (dtype == SQL_FLOAT)
+        nv = *(float *) var->sqldata;
+    else if (dtype == SQL_DOUBLE)
+        nv = *(double *) var->sqldata;
+    else
+    {
+        ISC_INT64 v, scale = 1;
+        int i;
+
+        switch (dtype)
+        {
+            case SQL_SHORT: v = *(ISC_SHORT *) var->sqldata; break;
+            case SQL_LONG:  v = *(ISC_LONG *) var->sqldata;  break;
+            case SQL_INT64: v = *(ISC_INT64 *) var->sqldata; break;
+            default:        return FALSE;
+        }
+        if (rep == IB_COL_NV)
+        {
+            sv_setnv(sv, var->sqlscale ? (double) v / IB_POW10(-var->sqlscale)
+                                       : (double) v);
+            return TRUE;
+        }
+
+        /* the scaled value, if it has no fraction */
+        for (i = var->sqlscale; i < 0; i++)
+            scale *= 10;
+        if (v % scale)
+            return FALSE;
+        sv_setiv(sv, (IV) (v / scale));
+        return TRUE;
+    }
+
+    if (rep == IB_COL_IV)
+    {
+        /* NaN fails both comparisons */
+        if (!(nv >= (NV) IV_MIN && nv < -(NV) IV_MIN) || nv != floor(nv))
+            return FALSE;
+        sv_setiv(sv, (IV) nv);
+    }
+    else
+        sv_setnv(sv, nv);
+
+    return TRUE;
+}
+
+unsigned get_charset_bytes_per_char(const ISC_SHORT subtype, SV *sth);
+
+/* from out_sqlda to AV */
+/*
+   Fetches the next row into out_sqlda. Returns 1 for a row, 0 at the end
+   of the result set (the cursor is closed then) and -1 on error.
+ */
+static int ib_st_fetch_row(SV *sth, imp_sth_t *imp_sth)
+{
+    D_imp_dbh_from_sth;
+    ISC_STATUS  fetch = 0;
+    ISC_STATUS  status[ISC_STATUS_LENGTH];
+
+    if (ib_async_busy(sth, imp_dbh))
+        return -1;
+
+    if (!DBIc_ACTIVE(imp_sth))
+    {
+        do_error(sth, 0, "no statement executing (perhaps you need to call execute first)\n");
+        return -1;
+    }
+
+    /*
+     * if it's an execute procedure, we've already got the
+     * output from the isc_dsql_execute2() call in dbd_st_execute().
+     */
+    if (imp_sth->type != isc_info_sql_stmt_exec_procedure)
+    {
+        if (imp_sth->async_fetched)
+        {
+            /* ib_fetch_async got the row already */
+            imp_sth->async_fetched = 0;
+            fetch = ib_async_fetched(imp_dbh, status);
+        }
+        else if (imp_sth->pipe)
+        {
+            fetch = ib_pipe_next(imp_sth, status);
+
+            /* the thread is done, the cursor can be closed */
+            if (fetch || (status[0] == 1 && status[1] > 0))
+                ib_pipe_stop(imp_sth);
+        }
+        else
+            fetch = isc_dsql_fetch(status, &(imp_sth->stmt), imp_dbh->sqldialect,
+                                   imp_sth->out_sqlda);
+
+        if (ib_error_check(sth, status))
+            return -1;
+
+        /*
+         * Code 100 means we've reached the end of the set
+         * of rows that the SELECT will return.
+         */
+
+        DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "dbd_st_fetch: fetch result: %ld\n", fetch));
+
+        if (imp_sth->affected < 0)
+            imp_sth->affected = 0;
+
+        if (fetch == 100)
+        {
+            /* close the cursor */
+            isc_dsql_free_statement(status, &(imp_sth->stmt), DSQL_close);
+
+            if (ib_error_check(sth, status))
+                return -1;
+
+            DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "isc_dsql_free_statement succeed.\n"));
+
+            DBIc_ACTIVE_off(imp_sth); /* dbd_st_finish is no longer needed */
+
+            /* if AutoCommit on XXX. what to return if fails? */
+            if (DBIc_has(imp_dbh, DBIcf_AutoCommit))
+            {
+                if (!ib_commit_transaction(sth, imp_dbh))
+                    return -1;
+
+                DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "fetch ends: ib_commit_transaction succeed.\n"));
+            }
+
+            return 0;
+        }
+        else if (fetch != 0) /* something bad */
+        {   do_error(sth, 0, "Fetch error");
+            DBIc_ACTIVE_off(imp_sth);
+            return -1;
+        }
+    } /* !exec_procedure */
+    else
+    {
+        /* we only fetch one row for exec procedure */
+        if (imp_sth->affected)
+            return 0;
+    }
+
+    return 1;
+}
+
+/*
+   Sets sv to the value of var, decoded as fetch does for the column
+   representation rep (see ib_col_rep). Returns FALSE on error.
+ */
+static int ib_st_decode_var(SV *sth, imp_sth_t *imp_sth, XSQLVAR *var,
+                            int rep, SV *sv)
+{
+    D_imp_dbh_from_sth;
+    ISC_STATUS  status[ISC_STATUS_LENGTH];
+    int         chopBlanks = DBIc_is(imp_sth, DBIcf_ChopBlanks);
+    int         raw = IB_COL_REP(rep) == IB_COL_RAW;
+    short       dtype = var->sqltype & ~1;
+
+    if ((var->sqltype & 1) && (*(var->sqlind) == -1))
+    /* if nullable field */
+    {
+        /* isNULL */
+        SvOK_off(sv);
+    }
+    else if ((IB_COL_REP(rep) == IB_COL_IV || IB_COL_REP(rep) == IB_COL_NV)
+             && ib_typed_number(sv, var, dtype, IB_COL_REP(rep)))
+    {
+        /* written as the TYPE of bind_col asked, with no text in between */
+    }
+    else
+    {
+        /*
+         * Got a non-null field.  Got to pass it back to the
+         * application, which means some datatype dependant code.
+         */
+        switch (dtype)
+        {
+#ifdef SQL_BOOLEAN
+            case SQL_BOOLEAN: 
+                {
+                   FB_BOOLEAN b = (*((FB_BOOLEAN *) (var->sqldata)));
+#ifdef sv_set_bool
+                   sv_set_bool(sv, b == FB_TRUE);
+#else
+#ifdef sv_setbool
+                   sv_setbool(sv, b == FB_TRUE);
+#else
+                   sv_setiv(sv, (b == FB_TRUE) ? 1 : 0);
+#endif
+#endif
+                } 
+                break;
+#endif
+
+            case SQL_SHORT:
+                if (var->sqlscale && imp_dbh->exact_numeric)
+                    ib_exact_to_sv(sv, *(short *) var->sqldata,
+                                   var->sqlscale, imp_dbh->exact_numeric);
+                else if (var->sqlscale) /* handle NUMERICs */
+                    sv_setnv(sv, (double) (*(short *) var->sqldata) /
+                                 IB_POW10(-var->sqlscale));
+                else
+                    sv_setiv(sv, *(short *) (var->sqldata));
+                break;
+
+            case SQL_LONG:
+                if (var->sqlscale && imp_dbh->exact_numeric)
+                    ib_exact_to_sv(sv, *(ISC_LONG *) var->sqldata,
+                                   var->sqlscale, imp_dbh->exact_numeric);
+                else if (var->sqlscale) /* handle NUMERICs */
+                    sv_setnv(sv, (double) (*(ISC_LONG *) var->sqldata) /
+                                 IB_POW10(-var->sqlscale));
+                else
+                    sv_setiv(sv, *(ISC_LONG *) (var->sqldata));
+                break;
+#ifdef SQL_INT64
+            case SQL_INT64:
+            /*
+             * This seemed difficult at first to return
+             * a 64-bit scaled numeric to Perl through the
+             * SV interface.  But as luck would have it,
+             * Perl treats strings and numerics identically.
+             * I can return this numeric as a string and
+             * nobody has a problem with it.
+             */
+            if (var->sqlscale && imp_dbh->exact_numeric == IB_EXACT_MINOR)
+            {
+                ib_exact_to_sv(sv, *(ISC_INT64 *) var->sqldata,
+                               var->sqlscale, IB_EXACT_MINOR);
+                break;
+            }
+            {
+                static ISC_INT64 const scales[] = { 1LL,
+                                                    10LL,
+                                                    100LL,
+                                                    1000LL,
+                                                    10000LL,
+                                                    100000LL,
+                                                    1000000LL,
+                                                    10000000LL,
+                                                    100000000LL,
+                                                    1000000000LL,
+                                                    10000000000LL,
+                                                    100000000000LL,
+                                                    1000000000000LL,
+                                                    10000000000000LL,
+                                                    100000000000000LL,
+                                                    1000000000000000LL,
+                                                    10000000000000000LL,
+                                                    100000000000000000LL };
+                ISC_INT64 i; /* significand */
+                char buf[22]; /* NUMERIC(18,2) = -92233720368547758.08 + '\0' */
+
+                i = *((ISC_INT64 *) (var->sqldata));
+
+                /* We use the system snprintf(3) and system-specific
+                 * format codes. :(  On my perl, I was unable to
+                 * persuade sv_setpvf to handle INT64 values with
+                 * IVdf (and there is no I64f).
+                 *  - MJP 2010-03-25
+                 */
+#if defined(_MSC_VER)        /* Microsoft C compiler/library */
+#  define DBD_IB_INT64f "I64d"
+#elif defined (__FreeBSD__)  /* FreeBSD */
+#  define DBD_IB_INT64f "qd"
+#else                        /* others: linux, various unices */
+#  define DBD_IB_INT64f "lld"
+#endif
+                if (var->sqlscale == 0) {
+                    snprintf(buf, sizeof(buf), "%"DBD_IB_INT64f, i);
+                    sv_setpvn(sv, buf, strlen(buf));
+                } else {
+                    bool sign = ( i < 0 );
+                    ISC_INT64 divisor, remainder;
+                    divisor   = scales[-var->sqlscale];
+                    if (sign) divisor = -divisor;
+                    remainder = (i%divisor);
+                    if (remainder < 0) remainder = -remainder;
+
+                    snprintf(buf+1, sizeof(buf)-1,
+                            "%"DBD_IB_INT64f".%0*"DBD_IB_INT64f,
+                            i/divisor, -var->sqlscale, remainder);
+			DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "-------------->SQLINT64=%"DBD_IB_INT64f".%0*"DBD_IB_INT64f,i/divisor, -var->sqlscale, remainder ));
+
+                    if (sign) {
+                        *buf = '-';
+                        sv_setpvn(sv, buf, strlen(buf));
+                    }
+                    else {
+                        sv_setpvn(sv, buf+1, strlen(buf+1));
+                    }
+                }
+            }
+            break;
+#endif
+
+            case SQL_INT128:
+            {
+                IB_DECIMAL d;
+
+                ib_int128_unpack((FB_I128 *) var->sqldata,
+                    imp_dbh->exact_numeric == IB_EXACT_MINOR ? 0 : var->sqlscale, &d);
+                ib_dec_to_sv(sv, &d, TRUE, imp_dbh->fast_int);
+                break;
+            }
+
+            case SQL_DEC16:
+            case SQL_DEC34:
+            {
+                IB_DECIMAL d;
+
+                ib_decfloat_unpack((ISC_UINT64 *) var->sqldata,
+                                   dtype == SQL_DEC34, &d);
+                ib_dec_to_sv(sv, &d, FALSE, imp_dbh->fast_int);
+                break;
+            }
+
+            case SQL_FLOAT:
+                sv_setnv(sv, (double)(*(float *) (var->sqldata)));
+                break;
+
+            case SQL_DOUBLE:
+                if (var->sqlscale) /* handle NUMERICs */
+                {
+                    double d = *(double *)var->sqldata;
+                    double f = IB_POW10(-var->sqlscale);
+                    double x = d * f;
+
+                    /* dialect 1: the double holds the value, round it */
+                    if (imp_dbh->exact_numeric && x > -9.2e18 && x < 9.2e18)
+                        ib_exact_to_sv(sv,
+                            (ISC_INT64) (x < 0 ? x - 0.5 : x + 0.5),
+                            var->sqlscale, imp_dbh->exact_numeric);
+                    else
+                        sv_setnv(sv, (d > 0 ? floor(x) : ceil(x)) / f);
+                }
+                else
+                    sv_setnv(sv, *(double *) (var->sqldata));
+                break;
+
+            case SQL_TEXT:
+            /*
+             * Thanks to DAM for pointing out that I
+             * don't need to null-terminate this
+             * buffer, and in fact it's a buffer
+             * overrun if I do!
+             */
+
+                DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "Fill in TEXT type..\nLength: %d\n", var->sqllen));
+
+                if (chopBlanks && (var->sqllen > 0))
+                {
+                    sv_setpvn(sv, var->sqldata,
+                              ib_rtrim_len(var->sqldata, var->sqllen));
+                    if (!raw)
+                        maybe_upgrade_to_utf8(imp_dbh, sv, var->sqlsubtype & 0xff);
+                }
+                else
+                {
+                    /* we need to shrink the string for multy-byte character
+                       sets. the padding spaces are too many in this case
+                       */
+                    unsigned bpc = get_charset_bytes_per_char(
+                            var->sqlsubtype, sth);
+                    unsigned len = var->sqllen;
+                    int      cs = var->sqlsubtype & 0xff;
+
+                    if (bpc > 1 && (cs == IB_CS_UTF8 || cs == IB_CS_UNICODE_FSS))
+                    {
+                        /*
+                         * CHAR(n) holds n characters: the text, then
+                         * blanks. Copy the text and add the blanks
+                         * that make it up to n characters.
+                         */
+                        STRLEN used = ib_rtrim_len(var->sqldata, len);
+                        STRLEN chars = ib_utf8_length((U8 *) var->sqldata, used);
+                        STRLEN pad = chars < len / bpc ? len / bpc - chars : 0;
+                        char  *d;
+
+                        sv_setpvn(sv, var->sqldata, used);
+                        d = SvGROW(sv, used + pad + 1);
+                        memset(d + used, ' ', pad);
+                        d[used + pad] = '\0';
+                        SvCUR_set(sv, used + pad);
+                    }
+                    else
+                        sv_setpvn(sv, var->sqldata, len/bpc);
+                    if (!raw)
+                        maybe_upgrade_to_utf8(imp_dbh, sv, cs);
+                }
+                break;
+
+            case SQL_VARYING:
+            {
+                DBD_VARY *vary = (DBD_VARY *) var->sqldata;
+                sv_setpvn(sv, vary->vary_string, vary->vary_length);
+                /* Note that sqllen for VARCHARs is the max length */
+                if (!raw)
+                    maybe_upgrade_to_utf8(imp_dbh, sv, var->sqlsubtype & 0xff);
+                break;
+            }
+
+
+            /*
+             * If user specifies a TimestampFormat, TimeFormat, or
+             * DateFormat property of the Statement class, then that
+             * string is the format string for strftime().
+             *
+             * If the user doesn't specify an XxxFormat, then format
+             * is %c, defined in /usr/lib/locale/<locale>/LC_TIME/time,
+             * where <locale> is the host's chosen locale.
+             */
+            case SQL_TIMESTAMP:
+            case SQL_TYPE_DATE:
+            case SQL_TYPE_TIME:
+            {
+                char     *format = NULL, buf[100], *p;
+                struct tm times;
+                long int  fpsec = 0;
+                int       digits, mode;
+                ISC_DATE  ts_date = 0;
+                ISC_TIME  ts_time = 0;
+
+                Zero(&times, 1, struct tm);
+
+                switch (dtype)
+                {
+                    case SQL_TIMESTAMP:
+                        ts_date = ((ISC_TIMESTAMP *) var->sqldata)->timestamp_date;
+                        ts_time = ((ISC_TIMESTAMP *) var->sqldata)->timestamp_time;
+                        format = imp_sth->timestampformat ?
+                            imp_sth->timestampformat :
+                            imp_dbh->timestampformat;
+                        fpsec = TIMESTAMP_FPSECS(var->sqldata);
+                        break;
+
+                    case SQL_TYPE_DATE:
+                        ts_date = *(ISC_DATE *) var->sqldata;
+                        format = imp_sth->dateformat ?
+                            imp_sth->dateformat :
+                            imp_dbh->dateformat;
+                        break;
+
+                    case SQL_TYPE_TIME:
+                        ts_time = *(ISC_TIME *) var->sqldata;
+                        format = imp_sth->timeformat ?
+                            imp_sth->timeformat :
+                            imp_dbh->timeformat;
+                        fpsec = TIME_FPSECS(var->sqldata);
+                        break;
+                }
+
+                /* numbers straight from the wire format */
+                if ((mode = ib_numeric_time_mode(format)) != 0)
+                {
+                    ib_set_numeric_time(sv, mode, dtype != SQL_TYPE_TIME,
+                                        ts_date, ts_time);
+                    break;
+                }
+
+                if (dtype != SQL_TYPE_TIME)
+                    ib_decode_date(ts_date, &times);
+                ib_decode_time(ts_time, &times);
+
+                DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "Decode passed.\n"));
+
+
+                /* hardcoded output format.... */
+                if ((digits = ib_iso_digits(format)) >= 0)
+                {
+                    p = buf;
+                    switch (dtype)
+                    {
+                        case SQL_TIMESTAMP:
+                            p = ib_put_date(p, &times);
+                            *p++ = ' ';
+                            p = ib_put_time(p, &times, fpsec, digits);
+                            break;
+                        case SQL_TYPE_DATE:
+                            p = ib_put_date(p, &times);
+                            break;
+
+                        case SQL_TYPE_TIME:
+                            p = ib_put_time(p, &times, fpsec, digits);
+                            break;
+                    }
+
+                    sv_setpvn(sv, buf, p - buf);
+                    break;
+                }
+
+
+                /* output as array like perl's localtime? */
+                if (strEQ(format, "tm") || strEQ(format, "TM"))
+                {
+                    AV *list = newAV();
+
+                    av_push(list, newSViv(times.tm_sec));
+                    av_push(list, newSViv(times.tm_min));
+                    av_push(list, newSViv(times.tm_hour));
+                    av_push(list, newSViv(times.tm_mday));
+                    av_push(list, newSViv(times.tm_mon));
+                    av_push(list, newSViv(times.tm_year));
+                    av_push(list, newSViv(times.tm_wday));
+                    av_push(list, newSViv(times.tm_yday));
+                    av_push(list, newSViv(times.tm_isdst));
+
+                    /* value returned is a reference to the array */
+                    sv_setsv(sv, sv_2mortal(newRV_noinc((SV *) list)));
+                    break;
+                }
+
+                sv_setpvn(sv, buf, ib_format_tm(buf, sizeof(buf), format, &times));
+                break;
+            }
+
+            /*
+             * Firebird 4.0+: TIME WITH TIME ZONE and TIMESTAMP WITH TIME ZONE
+             *
+             * These types store the value in UTC plus a timezone identifier.
+             * The timezone identifier is either:
+             *   - An offset zone ID (0..2878): displacement = time_zone - FB_TZ_ONE_DAY_OFFSET
+             *   - FB_TZ_GMT_ZONE (65535): UTC, displacement = 0
+             *   - A named zone ID (> 2878 and < 65535): the offset comes from
+             *     the per-connection zone cache, see ib_tz_offset()
+             *
+             * We apply the offset to convert UTC to local time, and format
+             * the result with the offset (or the zone name) appended.
+             *
+             * The *_EX variants (SQL_TIMESTAMP_TZ_EX, SQL_TIME_TZ_EX) carry
+             * an explicit signed-minute offset in the ext_offset field.
+             */
+            case SQL_TIMESTAMP_TZ:
+            case SQL_TIMESTAMP_TZ_EX:
+            case SQL_TIME_TZ:
+            case SQL_TIME_TZ_EX:
+            {
+                char     *format = NULL, buf[128], *p;
+                struct tm times;
+                long int  fpsec = 0;
+                ISC_SHORT offset_minutes = 0;
+                ISC_USHORT zone_id = FB_TZ_GMT_ZONE;
+                IB_TZ_ZONE *zone = NULL;
+                ISC_DATE  ts_date = 0;
+                ISC_TIME  ts_time = 0;
+                int       digits, mode;
+
+                Zero(&times, 1, struct tm);
+
+                ib_tz_fields(var, dtype, &ts_date, &ts_time,
+                             &zone_id, &offset_minutes);
+
+                /* Determine format string */
+                if (dtype == SQL_TIMESTAMP_TZ || dtype == SQL_TIMESTAMP_TZ_EX)
+                    format = imp_sth->timestampformat ?
+                        imp_sth->timestampformat : imp_dbh->timestampformat;
+                else
+                    format = imp_sth->timeformat ?
+                        imp_sth->timeformat : imp_dbh->timeformat;
+
+                /* numeric modes give the UTC instant, the zone is not needed */
+                if (imp_dbh->tz_epoch)
+                    mode = IB_TIME_EPOCH;
+                else
+                    mode = format ? ib_numeric_time_mode(format) : 0;
+                if (mode)
+                {
+                    ib_set_numeric_time(sv, mode,
+                        dtype == SQL_TIMESTAMP_TZ || dtype == SQL_TIMESTAMP_TZ_EX,
+                        ts_date, ts_time);
+                    break;
+                }
+
+                /* Apply timezone offset: convert UTC to local time */
+                fpsec = ts_time % ISC_TIME_SECONDS_PRECISION;
+                if (!ib_tz_local(sth, imp_dbh, dtype, zone_id, &ts_date,
+                                 &ts_time, &offset_minutes, &zone))
+                    return FALSE;
+                if (dtype == SQL_TIMESTAMP_TZ || dtype == SQL_TIMESTAMP_TZ_EX)
+                    ib_decode_date(ts_date, &times);
+                ib_decode_time(ts_time, &times);
+
+                DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth),
+                    "Decode TZ type passed, offset=%d minutes.\n", (int)offset_minutes));
+
+                /* ISO format: YYYY-MM-DD HH:MM:SS.NNNN +HH:MM */
+                if (!format || (digits = ib_iso_digits(format)) >= 0)
+                {
+                    int abs_off = offset_minutes < 0 ? -offset_minutes : offset_minutes;
+
+                    if (!format)
+                        digits = 4;
+
+                    p = buf;
+                    if (dtype == SQL_TIMESTAMP_TZ || dtype == SQL_TIMESTAMP_TZ_EX)
+                    {
+                        p = ib_put_date(p, &times);
+                        *p++ = ' ';
+                    }
+                    p = ib_put_time(p, &times, fpsec, digits);
+
+                    *p++ = ' ';
+                    if (zone)
+                    {
+                        /* named zones print like Firebird does */
+                        sv_setpvn(sv, buf, p - buf);
+                        sv_catpv(sv, zone->name);
+                        break;
+                    }
+                    *p++ = offset_minutes < 0 ? '-' : '+';
+                    IB_PUT2(p, abs_off / 60);
+                    *p++ = ':';
+                    IB_PUT2(p, abs_off % 60);
+
+                    sv_setpvn(sv, buf, p - buf);
+                    break;
+                }
+
+                /* TM format: return as reference to array (like localtime()),
+                 * with two extra elements: fractional seconds and offset minutes */
+                if (strEQ(format, "tm") || strEQ(format, "TM"))
+                {
+                    AV *list = newAV();
+                    av_push(list, newSViv(times.tm_sec));
+                    av_push(list, newSViv(times.tm_min));
+                    av_push(list, newSViv(times.tm_hour));
+                    av_push(list, newSViv(times.tm_mday));
+                    av_push(list, newSViv(times.tm_mon));
+                    av_push(list, newSViv(times.tm_year));
+                    av_push(list, newSViv(times.tm_wday));
+                    av_push(list, newSViv(times.tm_yday));
+                    av_push(list, newSViv(times.tm_isdst));
+                    av_push(list, newSViv(fpsec));
+                    av_push(list, newSViv((IV)offset_minutes));
+                    sv_setsv(sv, sv_2mortal(newRV_noinc((SV *) list)));
+                    break;
+                }
+
+                /* strftime() format - no timezone info in output */
+                sv_setpvn(sv, buf, ib_format_tm(buf, sizeof(buf), format, &times));
+                break;
+            }
+
+            case SQL_BLOB:
+            {
+                isc_blob_handle blob_handle = 0;
+                int blob_stat;
+                char blob_info_buffer[32], *p,
+                     blob_segment_buffer[BLOB_SEGMENT];
+                char blob_info_items[] =
+                {
+                    isc_info_blob_type,
+                    isc_info_blob_max_segment,
+                    isc_info_blob_total_length
+                };
+                long max_segment = -1L, total_length = -1L, t;
+                unsigned short seg_length;
+                short blob_type = -1;
+
+                /* Open the Blob according to the Blob id. */
+                isc_open_blob2(status, &(imp_dbh->db), &(imp_dbh->tr),
+                               &blob_handle, (ISC_QUAD *) var->sqldata,
+#if defined(INCLUDE_FB_TYPES_H) || defined(INCLUDE_TYPES_PUB_H) || defined(FIREBIRD_IMPL_TYPES_PUB_H)
+                               (ISC_USHORT) 0,
+                               (ISC_UCHAR *) NULL);
+#else
+                               (short) 0,       /* no Blob filter */
+                               (char *) NULL);  /* no Blob filter */
+#endif
+
+                if (ib_error_check(sth, status))
+                    return FALSE;
+
+                /* query blob information to find out the segment size */
+                isc_blob_info(status, &blob_handle, sizeof(blob_info_items),
+                              blob_info_items, sizeof(blob_info_buffer),
+                              blob_info_buffer);
+
+                if (ib_error_check(sth, status))
+                {
+                    isc_cancel_blob(status, &blob_handle);
+                    return FALSE;
+                }
+
+                /* Get the information out of the info buffer. */
+                for (p = blob_info_buffer; *p != isc_info_end; )
+                {
+                    short length;
+                    char  datum = *p++;
+
+                    length = (short) isc_vax_integer(p, 2);
+                    p += 2;
+                    switch (datum)
+                    {
+                      case isc_info_blob_max_segment:
+                          max_segment = isc_vax_integer(p, length);
+                          break;
+                      case isc_info_blob_total_length:
+                          total_length = isc_vax_integer(p, length);
+                          break;
+                      case isc_info_blob_type:
+                          blob_type = isc_vax_integer(p, length);
+                          break;
+                      default:
+                          croak("Unknown parameter %d", (int)datum);
+                    }
+                    p += length;
+                }
+
+                DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth),
+                              "dbd_st_fetch: BLOB info - max_segment: %ld, total_length: %ld, type: %d\n",
+                              max_segment, total_length, blob_type));
+
+                if (max_segment == -1L || total_length == -1L || blob_type == -1)
+                {
+                    isc_cancel_blob(status, &blob_handle);
+                    do_error(sth, 1, "Cannot determine Blob dimensions or type.");
+                    return FALSE;
+                    break;
+                }
+
+                /* if maximum segment size is zero, don't pass it to isc_get_segment()  */
+                if (max_segment == 0)
+                {
+                    sv_setpv(sv, "");
+                    isc_cancel_blob(status, &blob_handle);
+                    if (ib_error_check(sth, status))
+                        return FALSE;
+                    break;
+                }
+
+                if ((DBIc_LongReadLen(imp_sth) < (unsigned long) total_length) &&
+                    (! DBIc_is(imp_dbh, DBIcf_LongTruncOk)))
+                {
+                    isc_close_blob(status, &blob_handle);
+                    do_error(sth, 1, "Not enough LongReadLen buffer.");
+                    return FALSE;
+                    break;
+                }
+
+                /* Create a zero-length string. */
+                sv_setpv(sv, "");
+
+                t = total_length;
+                while (1)
+                {
+                    blob_stat = isc_get_segment(status, &blob_handle,
+                                                &seg_length,
+                                                (short) BLOB_SEGMENT,
+                                                blob_segment_buffer);
+
+                    if (status[1] == isc_segstr_eof)
+                        break;
+
+                    if (status[1] != isc_segment)
+                        if (ib_error_check(sth, status))
+                        {
+                            isc_cancel_blob(status, &blob_handle);
+                            return FALSE;
+                        }
+
+                    if (seg_length > DBIc_LongReadLen(imp_sth))
+                         break;
+
+/*
+ * As long as the fetch was successful, concatenate the segment we fetched
+ * into the growing Perl scalar.
+ */
+
+                    sv_catpvn(sv, blob_segment_buffer, seg_length);
+                    t -= seg_length;
+
+                    if (t <= 0) break;
+                    if (blob_stat == 100) break;
+                }
+
+                /* Clean up after ourselves. */
+                isc_close_blob(status, &blob_handle);
+                if (ib_error_check(sth, status))
+                    return FALSE;
+
+                if (!raw && ( blob_type == isc_blob_text
+                        || var->sqlsubtype == isc_blob_text ))
+                    /* text blobs carry their character set in sqlscale */
+                    maybe_upgrade_to_utf8(imp_dbh, sv, var->sqlscale & 0xff);
+
+                break;
+            }
+
+            case SQL_ARRAY:
+#ifdef ARRAY_SUPPORT
+        !!! NOT IMPLEMENTED YET !!!
+#else
+                sv_setpvn(sv, "** array **", 11);
+#endif
+                break;
+
+            default:
+                sv_setpvn(sv, "** unknown **", 13);
         }
-        else {
-            imp_dbh->ib_enable_utf8 = FALSE;
-            return TRUE;
+
+        if (IB_COL_REP(rep) == IB_COL_STR && SvOK(sv) && !SvPOK(sv) && !SvROK(sv))
+        {
+            (void) SvPV_nolen(sv);
+            SvPOK_only(sv);
+        }
+
+    /*
+     * I use the column's alias name because in the absence
+     * of an alias, it contains the column name anyway.
+     * Only if the alias AND the column names are zero-length
+     * do I want to use a generic "COLUMN%d" header.
+     * This happens, for example, when the column is a
+     * computed field and the query doesn't use an AS clause
+     * to label the column.
+     */
+/*
+        if (var->aliasname_length > 0)
+        {
+            sv_setpvn(sv, var->aliasname, var->aliasname_length));
+        }
+        else
+        {
+            char s[20];
+            snprintf(s, sizeof(s), "COLUMN%d", i);
+            sv_setpvn(sv, s, strlen(s));
         }
+*/
     }
-    else if ((kl==11) && strEQ(key, "ib_time_all"))
-        set_frmts = 1;
+    return TRUE;
+}
 
-    /**************************************************************************/
-    if (set_frmts || ((kl==13) && strEQ(key, "ib_dateformat")))
+AV *dbd_st_fetch(SV *sth, imp_sth_t *imp_sth)
+{
+    AV          *av;        /* array buffer             */
+    SV          **svp;      /* buffers */
+    XSQLVAR     *var;       /* working pointer XSQLVAR  */
+    int         i;          /* loop */
+
+    DBI_TRACE_imp_xxh(imp_sth, 2, (DBIc_LOGPIO(imp_sth), "dbd_st_fetch\n"));
+
+    if (ib_st_fetch_row(sth, imp_sth) <= 0)
+        return Nullav;
+
+    av = DBIS->get_fbav(imp_sth);
+    svp = AvARRAY(av);
+
+    var = imp_sth->out_sqlda->sqlvar;
+    for (i = 0; i < imp_sth->out_sqlda->sqld; i++, var++)
     {
-        IB_SQLtimeformat(dbh, imp_dbh->dateformat, valuesv);
-        if (!set_frmts) return TRUE;
+        int rep = imp_sth->col_rep ? imp_sth->col_rep[i] : IB_COL_DEFAULT;
+
+        if (imp_sth->bound_only && !(rep & IB_COL_BOUND))
+        {
+            /* not bound, not decoded */
+            SvOK_off(svp[i]);
+            continue;
+        }
+
+        if (!ib_st_decode_var(sth, imp_sth, var, rep, svp[i]))
+            return Nullav;
     }
-    if (set_frmts || ((kl==13) && strEQ(key, "ib_timeformat")))
+    imp_sth->affected += 1;
+    return av;
+}
+
+
+
+/*
+   The bytes of a CHAR value as fetch gives them: without the trailing
+   blanks under ChopBlanks, else n characters, blanks included.
+ */
+static STRLEN ib_char_len(SV *sth, imp_sth_t *imp_sth, XSQLVAR *var)
+{
+    STRLEN   used = ib_rtrim_len(var->sqldata, var->sqllen);
+    unsigned bpc;
+    int      cs = var->sqlsubtype & 0xff;
+
+    if (DBIc_is(imp_sth, DBIcf_ChopBlanks))
+        return used;
+
+    bpc = get_charset_bytes_per_char(var->sqlsubtype, sth);
+    if (bpc > 1 && (cs == IB_CS_UTF8 || cs == IB_CS_UNICODE_FSS))
     {
-        IB_SQLtimeformat(dbh, imp_dbh->timeformat, valuesv);
-        if (!set_frmts) return TRUE;
+        STRLEN chars = ib_utf8_length((U8 *) var->sqldata, used);
+
+        /* the buffer is blank filled past the text */
+        if (chars < var->sqllen / bpc)
+            used += var->sqllen / bpc - chars;
+        return used;
     }
-    if (set_frmts || ((kl==18) && strEQ(key, "ib_timestampformat")))
+    return var->sqllen / bpc;
+}
+
+/*
+   A TIME/TIMESTAMP WITH TIME ZONE value in the ISO form fetch gives it,
+   with four fractional digits. buf needs 128 bytes. Returns the length,
+   or -1 on error.
+ */
+static int ib_tz_text(SV *sth, imp_dbh_t *imp_dbh, XSQLVAR *var, char *buf)
+{
+    short      dtype = var->sqltype & ~1;
+    struct tm  times;
+    ISC_SHORT  offset = 0;
+    ISC_USHORT zone_id = FB_TZ_GMT_ZONE;
+    IB_TZ_ZONE *zone;
+    ISC_DATE   ts_date = 0;
+    ISC_TIME   ts_time = 0;
+    long int   fpsec;
+    char       *p = buf;
+
+    Zero(&times, 1, struct tm);
+    ib_tz_fields(var, dtype, &ts_date, &ts_time, &zone_id, &offset);
+    fpsec = ts_time % ISC_TIME_SECONDS_PRECISION;
+    if (!ib_tz_local(sth, imp_dbh, dtype, zone_id, &ts_date, &ts_time,
+                     &offset, &zone))
+        return -1;
+
+    if (dtype == SQL_TIMESTAMP_TZ || dtype == SQL_TIMESTAMP_TZ_EX)
     {
-        IB_SQLtimeformat(dbh, imp_dbh->timestampformat, valuesv);
-        if (!set_frmts) return TRUE;
+        ib_decode_date(ts_date, &times);
+        p = ib_put_date(p, &times);
+        *p++ = ' ';
     }
-    /**************************************************************************/
+    ib_decode_time(ts_time, &times);
+    p = ib_put_time(p, &times, fpsec, 4);
+    *p++ = ' ';
 
-    if (set_frmts) return TRUE;
-    else return FALSE; /* not handled */
-}
+    if (zone)
+    {
+        STRLEN n = strlen(zone->name);
 
+        if (n > 127 - (STRLEN) (p - buf))
+            n = 127 - (p - buf);
+        memcpy(p, zone->name, n);
+        p += n;
+    }
+    else
+    {
+        int abs_off = offset < 0 ? -offset : offset;
 
-SV *dbd_db_FETCH_attrib(SV *dbh, imp_dbh_t *imp_dbh, SV *keysv)
-{
-    STRLEN  kl;
-    char *  key = SvPV(keysv, kl);
-    SV *    result = NULL;
+        *p++ = offset < 0 ? '-' : '+';
+        IB_PUT2(p, abs_off / 60);
+        *p++ = ':';
+        IB_PUT2(p, abs_off % 60);
+    }
+    return (int) (p - buf);
+}
 
-    DBI_TRACE_imp_xxh(imp_dbh, 2, (DBIc_LOGPIO(imp_dbh), "dbd_db_FETCH - %s\n", key));
+/*
+ * ib_export: rows written to a file handle as CSV, TSV or JSON lines,
+ * formatted from the fetch buffers without a Perl value per column.
+ * Text goes out in the connection character set.
+ */
 
-    if ((kl==10) && strEQ(key, "AutoCommit"))
-        result = boolSV(DBIc_has(imp_dbh, DBIcf_AutoCommit));
-    else if ((kl==13) && strEQ(key, "ib_softcommit"))
-        result = boolSV(imp_dbh->soft_commit);
-    else if ((kl==14) && strEQ(key, "ib_enable_utf8"))
-        result = boolSV(imp_dbh->ib_enable_utf8);
-    else if ((kl==13) && strEQ(key, "ib_dateformat"))
-        result = newSVpvn(imp_dbh->dateformat, strlen(imp_dbh->dateformat));
-    else if ((kl==13) && strEQ(key, "ib_timeformat"))
-        result = newSVpvn(imp_dbh->timeformat, strlen(imp_dbh->timeformat));
-    else if ((kl==18) && strEQ(key, "ib_timestampformat"))
-        result = newSVpvn(imp_dbh->timestampformat,
-                          strlen(imp_dbh->timestampformat));
-    else if ((kl==11) && strEQ(key, "ib_embedded"))
-#ifdef EMBEDDED
-        result = &PL_sv_yes;
-#else
-        result = &PL_sv_no;
-#endif
+typedef struct
+{
+    PerlIO  *io;
+    char    *buf;
+    size_t  len;
+    size_t  size;
+    int     error;
+    Off_t   written;    /* bytes flushed so far */
+    const IB_XLAT *xlat;    /* JSONL text to UTF-8, NULL if it is UTF-8 */
+} IB_OUT;
+
+static void ib_out_flush(IB_OUT *o)
+{
+    if (o->len && PerlIO_write(o->io, o->buf, o->len) != (SSize_t) o->len)
+        o->error = 1;
+    o->written += o->len;
+    o->len = 0;
+}
 
-    if (result == NULL)
-        return Nullsv;
-    else
+static void ib_out_put(IB_OUT *o, const char *s, size_t n)
+{
+    while (n > o->size - o->len)
     {
-        if ((result == &PL_sv_yes) || (result == &PL_sv_no))
-            return result;
-        else
-            return sv_2mortal(result);
+        size_t k = o->size - o->len;
+
+        memcpy(o->buf + o->len, s, k);
+        o->len += k;
+        s += k;
+        n -= k;
+        ib_out_flush(o);
     }
+    memcpy(o->buf + o->len, s, n);
+    o->len += n;
 }
 
+#define IB_OUT_C(o, c) \
+    do { if ((o)->len == (o)->size) ib_out_flush(o); \
+         (o)->buf[(o)->len++] = (c); } while (0)
 
-void dbd_preparse(SV *sth, imp_sth_t *imp_sth, char *statement)
+/* s escaped for the format, without the quotes around it */
+static void ib_out_text(IB_OUT *o, int format, const char *s, STRLEN n)
 {
-    ISC_STATUS status[ISC_STATUS_LENGTH];
+    const char *run = s, *end = s + n;
+    char  u[8];
 
-    DBI_TRACE_imp_xxh(imp_sth, 2, (DBIc_LOGPIO(imp_sth), "Enter dbd_preparse\n"));
+    for (; s < end; s++)
+    {
+        unsigned char c = (unsigned char) *s;
+        const char *esc = NULL;
+        STRLEN esc_len = 0;
 
-    isc_dsql_describe_bind(status, &(imp_sth->stmt), 1, imp_sth->in_sqlda);
+        switch (format)
+        {
+            case IB_EXPORT_CSV:
+                if (c == '"')
+                    esc = "\"\"";
+                break;
 
-    if (ib_error_check(sth, status))
+            case IB_EXPORT_TSV:
+                esc = c == '\t' ? "\\t" : c == '\n' ? "\\n"
+                    : c == '\r' ? "\\r" : c == '\\' ? "\\\\" : NULL;
+                break;
+
+            case IB_EXPORT_JSONL:
+                if (c == '"')
+                    esc = "\\\"";
+                else if (c == '\\')
+                    esc = "\\\\";
+                else if (c < 0x20)
+                {
+                    esc = c == '\n' ? "\\n" : c == '\r' ? "\\r"
+                        : c == '\t' ? "\\t" : u;
+                    snprintf(u, sizeof(u), "\\u%04x", c);
+                }
+                else if (c >= 0x80 && o->xlat)
+                {
+                    esc     = (const char *) o->xlat->utf8[c] + 1;
+                    esc_len = o->xlat->utf8[c][0];
+                }
+                break;
+        }
+
+        if (esc)
+        {
+            ib_out_put(o, run, s - run);
+            ib_out_put(o, esc, esc_len ? esc_len : strlen(esc));
+            run = s + 1;
+        }
+    }
+    ib_out_put(o, run, end - run);
+}
+
+/* binary values in JSON, as hex digits */
+static void ib_out_hex(IB_OUT *o, const char *s, STRLEN n)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    for (; n; n--, s++)
     {
-        ib_cleanup_st_prepare(imp_sth);
-        return;
+        IB_OUT_C(o, hex[(unsigned char) *s >> 4]);
+        IB_OUT_C(o, hex[*s & 0x0f]);
     }
+}
 
-    /* realloc in_sqlda and rebind if not enough XSQLVAR for bind params */
-    if (imp_sth->in_sqlda->sqld > imp_sth->in_sqlda->sqln)
+/* CSV fields are quoted when they must be; empty ones always, or they read as NULL */
+static int ib_csv_quote(const char *s, STRLEN n, char sep)
+{
+    const char *end = s + n;
+
+    if (!n)
+        return TRUE;
+    for (; s < end; s++)
+        if (*s == sep || *s == '"' || *s == '\n' || *s == '\r')
+            return TRUE;
+    return FALSE;
+}
+
+static void ib_out_string(IB_OUT *o, const IB_EXPORT_OPT *opt,
+                          const char *s, STRLEN n, int binary)
+{
+    if (opt->format == IB_EXPORT_JSONL)
     {
-        IB_alloc_sqlda(imp_sth->in_sqlda, imp_sth->in_sqlda->sqld);
-        if (imp_sth->in_sqlda == NULL)
-        {
-            do_error(sth, 1, "Fail to reallocate in_slqda");
-            ib_cleanup_st_prepare(imp_sth);
-            return;
-        }
+        IB_OUT_C(o, '"');
+        if (binary)
+            ib_out_hex(o, s, n);
         else
-        {
-            isc_dsql_describe_bind(status, &(imp_sth->stmt), 1, imp_sth->in_sqlda);
-            if (ib_error_check(sth, status))
-            {
-                ib_cleanup_st_prepare(imp_sth);
-                return;
-            }
-        }
+            ib_out_text(o, opt->format, s, n);
+        IB_OUT_C(o, '"');
+    }
+    else if (opt->format == IB_EXPORT_CSV && ib_csv_quote(s, n, opt->sep))
+    {
+        IB_OUT_C(o, '"');
+        ib_out_text(o, opt->format, s, n);
+        IB_OUT_C(o, '"');
     }
+    else
+        ib_out_text(o, opt->format, s, n);
+}
+
+/* numbers are bare in JSON; NaN and Infinity are not JSON numbers */
+static void ib_out_number(IB_OUT *o, const IB_EXPORT_OPT *opt,
+                          const char *s, STRLEN n)
+{
+    if (opt->format != IB_EXPORT_JSONL)
+        ib_out_string(o, opt, s, n, FALSE);
+    else if (isDIGIT(s[*s == '-']))
+        ib_out_put(o, s, n);
+    else
+        ib_out_string(o, opt, s, n, FALSE);
+}
 
-    DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "dbd_preparse: describe_bind passed.\n"
-                  "dbd_preparse: exit; in_sqlda: sqld: %d, sqln: %d.\n",
-                      imp_sth->in_sqlda->sqld, imp_sth->in_sqlda->sqln));
+static void ib_out_double(IB_OUT *o, const IB_EXPORT_OPT *opt, double d,
+                          int digits)
+{
+    char buf[40];
 
-    DBIc_NUM_PARAMS(imp_sth) = imp_sth->in_sqlda->sqld;
+    if (opt->format == IB_EXPORT_JSONL && (Perl_isnan(d) || Perl_isinf(d)))
+        ib_out_put(o, "null", 4);
+    else
+        ib_out_number(o, opt, buf, snprintf(buf, sizeof(buf), "%.*g", digits, d));
 }
 
+static void ib_out_null(IB_OUT *o, const IB_EXPORT_OPT *opt)
+{
+    if (opt->format == IB_EXPORT_JSONL)
+        ib_out_put(o, "null", 4);
+    else
+        ib_out_put(o, opt->null, opt->null_len);
+}
 
-int dbd_st_prepare(SV *sth, imp_sth_t *imp_sth, char *statement, SV *attribs)
+/*
+   Passes a BLOB to put segment by segment; LongReadLen does not apply.
+   Returns FALSE on error.
+ */
+static int ib_blob_each(SV *sth, imp_sth_t *imp_sth, XSQLVAR *var,
+                        void (*put)(void *ctx, const char *s, STRLEN n),
+                        void *ctx)
 {
     D_imp_dbh_from_sth;
-    ISC_STATUS  status[ISC_STATUS_LENGTH];
-    int         i;
-    short       dtype;
-    static char stmt_info[1];
-    char        info_buffer[20], count_item;
-    XSQLVAR     *var;
-
-    DBI_TRACE_imp_xxh(imp_sth, 2, (DBIc_LOGPIO(imp_sth), "Enter dbd_st_prepare\n"));
+    ISC_STATUS      status[ISC_STATUS_LENGTH];
+    isc_blob_handle blob_handle = 0;
+    char            segment[BLOB_SEGMENT];
+    unsigned short  seg_length;
 
-    if (!DBIc_ACTIVE(imp_dbh))
-    {
-        do_error(sth, -1, "Database disconnected");
+    isc_open_blob2(status, &(imp_dbh->db), &(imp_dbh->tr), &blob_handle,
+                   (ISC_QUAD *) var->sqldata,
+#if defined(INCLUDE_FB_TYPES_H) || defined(INCLUDE_TYPES_PUB_H) || defined(FIREBIRD_IMPL_TYPES_PUB_H)
+                   (ISC_USHORT) 0, (ISC_UCHAR *) NULL);
+#else
+                   (short) 0, (char *) NULL);
+#endif
+    if (ib_error_check(sth, status))
         return FALSE;
-    }
 
-    /* init values */
-    count_item = 0;
-    imp_sth->count_item  = 0;
-    imp_sth->affected    = -1;
-    imp_sth->in_sqlda    = NULL;
-    imp_sth->out_sqlda   = NULL;
-    imp_sth->cursor_name = NULL;
-
-    imp_sth->dateformat      = NULL;
-    imp_sth->timestampformat = NULL;
-    imp_sth->timeformat      = NULL;
-
-    /* double linked list */
-    imp_sth->prev_sth = NULL;
-    imp_sth->next_sth = NULL;
-
-    if (attribs)
+    while (1)
     {
-        SV **svp;
+        isc_get_segment(status, &blob_handle, &seg_length,
+                        (short) BLOB_SEGMENT, segment);
 
-        if ((svp = DBD_ATTRIB_GET_SVP(attribs, "ib_time_all", 11)) != NULL)
+        if (status[1] == isc_segstr_eof)
+            break;
+        if (status[1] != isc_segment && ib_error_check(sth, status))
         {
-            IB_SQLtimeformat(sth, imp_sth->dateformat, *svp);
-            IB_SQLtimeformat(sth, imp_sth->timestampformat, *svp);
-            IB_SQLtimeformat(sth, imp_sth->timeformat, *svp);
+            isc_cancel_blob(status, &blob_handle);
+            return FALSE;
         }
+        put(ctx, segment, seg_length);
+    }
 
+    isc_close_blob(status, &blob_handle);
+    return !ib_error_check(sth, status);
+}
 
-        if ((svp = DBD_ATTRIB_GET_SVP(attribs, "ib_dateformat", 13)) != NULL)
-            IB_SQLtimeformat(sth, imp_sth->dateformat, *svp);
+/* text BLOBs carry their character set in sqlscale */
+#define IB_BLOB_BINARY(var) \
+    ((var)->sqlsubtype != isc_blob_text || ((var)->sqlscale & 0xff) == IB_CS_OCTETS)
 
-        if ((svp = DBD_ATTRIB_GET_SVP(attribs, "ib_timestampformat", 18)) != NULL)
-            IB_SQLtimeformat(sth, imp_sth->timestampformat, *svp);
+typedef struct
+{
+    IB_OUT              *o;
+    const IB_EXPORT_OPT *opt;
+    int                 binary;
+} IB_OUT_BLOB;
 
-        if ((svp = DBD_ATTRIB_GET_SVP(attribs, "ib_timeformat", 13)) != NULL)
-            IB_SQLtimeformat(sth, imp_sth->timeformat, *svp);
-    }
+static void ib_out_segment(void *ctx, const char *s, STRLEN n)
+{
+    IB_OUT_BLOB *b = (IB_OUT_BLOB *) ctx;
 
+    if (b->binary && b->opt->format == IB_EXPORT_JSONL)
+        ib_out_hex(b->o, s, n);
+    else
+        ib_out_text(b->o, b->opt->format, s, n);
+}
 
-    /* allocate 1 XSQLVAR to in_sqlda */
-    IB_alloc_sqlda(imp_sth->in_sqlda, 1);
-    if (imp_sth->in_sqlda == NULL)
-    {
-        do_error(sth, 2, "Fail to allocate in_sqlda");
-        return FALSE;
-    }
+static int ib_out_blob(SV *sth, imp_sth_t *imp_sth, IB_OUT *o,
+                       const IB_EXPORT_OPT *opt, XSQLVAR *var)
+{
+    IB_OUT_BLOB b;
+    int         quote = opt->format == IB_EXPORT_JSONL
+                        || opt->format == IB_EXPORT_CSV;
+    int         ok;
+
+    b.o      = o;
+    b.opt    = opt;
+    b.binary = IB_BLOB_BINARY(var);
+
+    /* the length is not known up front: CSV quotes every BLOB */
+    if (quote)
+        IB_OUT_C(o, '"');
+    ok = ib_blob_each(sth, imp_sth, var, ib_out_segment, &b);
+    if (quote)
+        IB_OUT_C(o, '"');
+    return ok;
+}
 
-    /* allocate 1 XSQLVAR to out_sqlda */
-    IB_alloc_sqlda(imp_sth->out_sqlda, 1);
-    if (imp_sth->out_sqlda == NULL)
-    {
-        do_error(sth, 2, "Fail to allocate out_sqlda");
-        ib_cleanup_st_prepare(imp_sth);
-        return FALSE;
-    }
+static int ib_out_var(SV *sth, imp_sth_t *imp_sth, IB_OUT *o,
+                      const IB_EXPORT_OPT *opt, XSQLVAR *var)
+{
+    D_imp_dbh_from_sth;
+    short dtype = var->sqltype & ~1;
+    char  buf[128], *p;
 
-    /* init statement handle */
-    isc_dsql_alloc_statement2(status, &(imp_dbh->db), &(imp_sth->stmt));
-    if (ib_error_check(sth, status))
+    if ((var->sqltype & 1) && *(var->sqlind) == -1)
     {
-        ib_cleanup_st_prepare(imp_sth);
-        return FALSE;
+        ib_out_null(o, opt);
+        return TRUE;
     }
 
-    DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "dbd_st_prepare: sqldialect: %d.\n", imp_dbh->sqldialect));
-
-    if (!imp_dbh->tr)
+    switch (dtype)
     {
-        /* start a new transaction using current TPB */
-        if (!ib_start_transaction(sth, imp_dbh))
+#ifdef SQL_BOOLEAN
+        case SQL_BOOLEAN:
         {
-            ib_cleanup_st_prepare(imp_sth);
-            return FALSE;
+            int b = *(FB_BOOLEAN *) var->sqldata == FB_TRUE;
+
+            if (opt->format == IB_EXPORT_JSONL)
+                ib_out_put(o, b ? "true" : "false", b ? 4 : 5);
+            else
+                IB_OUT_C(o, b ? '1' : '0');
+            break;
         }
-    }
+#endif
 
-    DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "dbd_st_prepare: statement: %s.\n", statement));
+        case SQL_SHORT:
+            ib_out_number(o, opt, buf,
+                ib_exact_format(*(short *) var->sqldata, var->sqlscale, buf));
+            break;
 
-    isc_dsql_prepare(status, &(imp_dbh->tr), &(imp_sth->stmt), 0, statement,
-                     imp_dbh->sqldialect, imp_sth->out_sqlda);
+        case SQL_LONG:
+            ib_out_number(o, opt, buf,
+                ib_exact_format(*(ISC_LONG *) var->sqldata, var->sqlscale, buf));
+            break;
 
-    if (ib_error_check(sth, status))
-    {
-        ib_cleanup_st_prepare(imp_sth);
-        return FALSE;
-    }
+#ifdef SQL_INT64
+        case SQL_INT64:
+            ib_out_number(o, opt, buf,
+                ib_exact_format(*(ISC_INT64 *) var->sqldata, var->sqlscale, buf));
+            break;
+#endif
 
-    DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "dbd_st_prepare: isc_dsql_prepare succeed..\n"));
+        case SQL_INT128:
+        {
+            IB_DECIMAL d;
 
-    stmt_info[0] = isc_info_sql_stmt_type;
-    isc_dsql_sql_info(status, &(imp_sth->stmt), sizeof (stmt_info), stmt_info,
-                      sizeof (info_buffer), info_buffer);
+            ib_int128_unpack((FB_I128 *) var->sqldata, var->sqlscale, &d);
+            ib_out_number(o, opt, buf, ib_dec_format(&d, TRUE, buf));
+            break;
+        }
 
-    if (ib_error_check(sth, status))
-    {
-        ib_cleanup_st_prepare(imp_sth);
-        return FALSE;
-    }
+        case SQL_DEC16:
+        case SQL_DEC34:
+        {
+            IB_DECIMAL d;
 
-    {
-        short l = (short) isc_vax_integer((char *) info_buffer + 1, 2);
-        imp_sth->type = isc_vax_integer((char *) info_buffer + 3, l);
-    }
+            ib_decfloat_unpack((ISC_UINT64 *) var->sqldata,
+                               dtype == SQL_DEC34, &d);
+            ib_out_number(o, opt, buf, ib_dec_format(&d, FALSE, buf));
+            break;
+        }
 
-    /* sanity check of statement type */
-    DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "dbd_st_prepare: statement type: %ld.\n", imp_sth->type));
+        case SQL_FLOAT:
+            ib_out_double(o, opt, *(float *) var->sqldata, 7);
+            break;
 
-    switch (imp_sth->type)
-    {
-        /* Implemented statement types. */
-        case isc_info_sql_stmt_select:
-        case isc_info_sql_stmt_select_for_upd:
-            /*
-             * Unfortunately, select count item doesn't work
-             * in current versions of Firebird.
-             * isql does it literally by fetching everything
-             * and counting the number of rows it fetched.
-             * Firebird doesn't seem to be able to estimate
-             * the number of rows before the client app
-             * fetches them all.
-             */
-             //count_item = isc_info_req_select_count;
-             break;
+        case SQL_DOUBLE:
+        {
+            double d = *(double *) var->sqldata;
+            double x = d * IB_POW10(-var->sqlscale);
 
-        case isc_info_sql_stmt_insert:
-            count_item = isc_info_req_insert_count;
+            /* dialect 1: the double holds the value, round it */
+            if (var->sqlscale && x > -9.2e18 && x < 9.2e18)
+                ib_out_number(o, opt, buf, ib_exact_format(
+                    (ISC_INT64) (x < 0 ? x - 0.5 : x + 0.5), var->sqlscale, buf));
+            else
+                ib_out_double(o, opt, d, 15);
             break;
+        }
 
-        case isc_info_sql_stmt_update:
-            count_item = isc_info_req_update_count;
+        case SQL_TEXT:
+            ib_out_string(o, opt, var->sqldata, ib_char_len(sth, imp_sth, var),
+                          (var->sqlsubtype & 0xff) == IB_CS_OCTETS);
             break;
 
-        case isc_info_sql_stmt_delete:
-            count_item = isc_info_req_delete_count;
+        case SQL_VARYING:
+        {
+            DBD_VARY *vary = (DBD_VARY *) var->sqldata;
+
+            ib_out_string(o, opt, vary->vary_string, vary->vary_length,
+                          (var->sqlsubtype & 0xff) == IB_CS_OCTETS);
             break;
+        }
 
-        case isc_info_sql_stmt_ddl:
-        case isc_info_sql_stmt_set_generator:
-        case isc_info_sql_stmt_exec_procedure:
-        case isc_info_sql_stmt_savepoint:
-        case isc_info_sql_stmt_start_trans:
-        case isc_info_sql_stmt_commit:
-        case isc_info_sql_stmt_rollback:
-            /* no count_item to gather */
+        case SQL_TIMESTAMP:
+        case SQL_TYPE_DATE:
+        case SQL_TYPE_TIME:
+        {
+            struct tm times;
+
+            Zero(&times, 1, struct tm);
+            p = buf;
+            if (dtype == SQL_TIMESTAMP)
+            {
+                ib_decode_date(((ISC_TIMESTAMP *) var->sqldata)->timestamp_date, &times);
+                ib_decode_time(((ISC_TIMESTAMP *) var->sqldata)->timestamp_time, &times);
+                p = ib_put_date(p, &times);
+                *p++ = ' ';
+                p = ib_put_time(p, &times, TIMESTAMP_FPSECS(var->sqldata), 4);
+            }
+            else if (dtype == SQL_TYPE_DATE)
+            {
+                ib_decode_date(*(ISC_DATE *) var->sqldata, &times);
+                p = ib_put_date(p, &times);
+            }
+            else
+            {
+                ib_decode_time(*(ISC_TIME *) var->sqldata, &times);
+                p = ib_put_time(p, &times, TIME_FPSECS(var->sqldata), 4);
+            }
+            ib_out_string(o, opt, buf, p - buf, FALSE);
             break;
+        }
 
-        /*
-         * Unimplemented statement types. Some may be implemented in the future.
-         */
-        case isc_info_sql_stmt_get_segment:
-        case isc_info_sql_stmt_put_segment:
-        default:
-            do_error(sth, 10, "Statement type is not implemented in this version of DBD::Firebird");
-            return FALSE;
+        case SQL_TIMESTAMP_TZ:
+        case SQL_TIMESTAMP_TZ_EX:
+        case SQL_TIME_TZ:
+        case SQL_TIME_TZ_EX:
+        {
+            int n = ib_tz_text(sth, imp_dbh, var, buf);
+
+            if (n < 0)
+                return FALSE;
+            ib_out_string(o, opt, buf, n, FALSE);
             break;
-    }
+        }
 
-    imp_sth->count_item = count_item;
+        case SQL_BLOB:
+            return ib_out_blob(sth, imp_sth, o, opt, var);
 
-    /* scan statement for '?', ':1' and/or ':foo' style placeholders    */
-    /* realloc in_sqlda where needed */
-    dbd_preparse(sth, imp_sth, statement);
+        default:
+            /* ARRAY, and whatever comes next */
+            ib_out_null(o, opt);
+    }
+    return TRUE;
+}
 
-    DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "dbd_st_prepare: dbd_describe passed.\n"
-                            "out_sqlda: sqld: %d, sqln: %d.\n",
-                            imp_sth->out_sqlda->sqld, imp_sth->out_sqlda->sqln));
+/*
+ * Fetches the remaining rows of the statement into io. Returns the number
+ * of rows written, or -1 on error.
+ */
+long ib_st_export(SV *sth, imp_sth_t *imp_sth, PerlIO *io,
+                  const IB_EXPORT_OPT *opt)
+{
+    D_imp_dbh_from_sth;
+    IB_OUT  o;
+    AV      *keys = NULL;
+    XSQLVAR *var;
+    long    rows = 0;
+    int     i, n, rc;
+    char    sep = opt->format == IB_EXPORT_TSV ? '\t' : opt->sep;
 
-    /* enough output parameter block ? */
-    if (imp_sth->out_sqlda->sqld > imp_sth->out_sqlda->sqln)
+    DBI_TRACE_imp_xxh(imp_sth, 2, (DBIc_LOGPIO(imp_sth), "ib_st_export\n"));
+
+    if (!imp_sth->out_sqlda || !imp_sth->out_sqlda->sqld)
     {
-        DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "dbd_st_prepare: realloc out_sqlda..\n"));
+        do_error(sth, 0, "ib_export: statement returns no rows");
+        return -1;
+    }
+    n = imp_sth->out_sqlda->sqld;
 
-        IB_alloc_sqlda(imp_sth->out_sqlda, imp_sth->out_sqlda->sqld);
+    if (!DBIc_ACTIVE(imp_sth))
+    {
+        do_error(sth, 0, "no statement executing (perhaps you need to call execute first)\n");
+        return -1;
+    }
 
-        if (imp_sth->out_sqlda == NULL)
+    if (opt->format == IB_EXPORT_JSONL || opt->header)
+    {
+        keys = ib_st_hash_keys(sth, imp_sth);
+        if (!keys)
         {
-            do_error(sth, IB_ALLOC_FAIL, "Fail to reallocate out_sqlda");
-            ib_cleanup_st_prepare(imp_sth);
-            return FALSE;
+            do_error(sth, 0, "ib_export: no column names");
+            return -1;
         }
-        else
+    }
+
+    o.io      = io;
+    o.size    = opt->buffer_size;
+    o.len     = 0;
+    o.error   = 0;
+    o.written = 0;
+    o.xlat    = NULL;
+
+    /* JSON is UTF-8: single-byte character sets are transcoded */
+    if (opt->format == IB_EXPORT_JSONL
+        && !(imp_dbh->ib_charset && (strEQ(imp_dbh->ib_charset, "UTF8")
+                                     || strEQ(imp_dbh->ib_charset, "UNICODE_FSS")))
+        && (o.xlat = ib_xlat_find(imp_dbh->ib_charset)) == NULL)
+    {
+        char errmsg[160];
+        snprintf(errmsg, sizeof(errmsg),
+                 "ib_export: jsonl requires ib_charset=UTF8, WIN1251 or ISO8859_1 in DSN (you gave %s)",
+                 imp_dbh->ib_charset ? imp_dbh->ib_charset : "<nothing>");
+        do_error(sth, 2, errmsg);
+        return -1;
+    }
+
+    Newx(o.buf, o.size, char);
+
+    if (opt->header && opt->format != IB_EXPORT_JSONL)
+    {
+        for (i = 0; i < n; i++)
         {
-            DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "dbd_st_prepare: calling isc_dsql_describe again..\n"));
+            STRLEN len;
+            char   *name = SvPV(AvARRAY(keys)[i], len);
 
-            isc_dsql_describe(status, &(imp_sth->stmt), 1, imp_sth->out_sqlda);
-            if (ib_error_check(sth, status))
+            if (i)
+                IB_OUT_C(&o, sep);
+            ib_out_string(&o, opt, name, len, FALSE);
+        }
+        IB_OUT_C(&o, '\n');
+    }
+
+    while ((rc = ib_st_fetch_row(sth, imp_sth)) > 0)
+    {
+        if (opt->format == IB_EXPORT_JSONL)
+            IB_OUT_C(&o, '{');
+
+        var = imp_sth->out_sqlda->sqlvar;
+        for (i = 0; i < n; i++, var++)
+        {
+            if (opt->format == IB_EXPORT_JSONL)
             {
-                ib_cleanup_st_prepare(imp_sth);
-                return FALSE;
+                STRLEN          len;
+                SV              *key = AvARRAY(keys)[i];
+                char            *name = SvPV(key, len);
+                const IB_XLAT   *xlat = o.xlat;
+
+                if (i)
+                    IB_OUT_C(&o, ',');
+                if (SvUTF8(key))    /* decoded by ib_enable_utf8 */
+                    o.xlat = NULL;
+                ib_out_string(&o, opt, name, len, FALSE);
+                o.xlat = xlat;
+                IB_OUT_C(&o, ':');
             }
+            else if (i)
+                IB_OUT_C(&o, sep);
 
-            DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "dbd_st_prepare: success calling isc_dsql_describe.\n"));
+            if (!ib_out_var(sth, imp_sth, &o, opt, var))
+            {
+                rc = -1;
+                break;
+            }
         }
+        if (rc < 0)
+            break;
+
+        if (opt->format == IB_EXPORT_JSONL)
+            IB_OUT_C(&o, '}');
+        IB_OUT_C(&o, '\n');
+
+        imp_sth->affected += 1;
+        rows++;
+
+        if (o.error)
+            break;
     }
-    else if (imp_sth->out_sqlda->sqld == 0) /* not a select statement */
+
+    ib_out_flush(&o);
+    Safefree(o.buf);
+
+    if (o.error)
     {
-        Safefree(imp_sth->out_sqlda);
-        imp_sth->out_sqlda = NULL;
+        do_error(sth, 1, "ib_export: write error");
+        return -1;
     }
+    return rc < 0 ? -1 : rows;
+}
 
-    if (imp_sth->out_sqlda)
-    {
-        for (i = 0, var = imp_sth->out_sqlda->sqlvar;
-             i < imp_sth->out_sqlda->sqld;
-             i++, var++)
-        {
-            dtype = (var->sqltype & ~1);
-            var->sqlind = NULL;
 
-            DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "dbd_st_prepare: field type: %d.\n", dtype));
+/*
+ * ib_fetch_arrow: the result set as an Apache Arrow IPC stream, that is a
+ * schema message, a record batch message per batch_rows rows and the end
+ * of stream marker. The columns are built from the fetch buffers; the
+ * flatbuffers metadata is written front to back by the helpers below,
+ * each parent before the tables, vectors and strings it points to.
+ */
 
-            /* Alloc space for sqldata */
-            Newx(var->sqldata,
-                 var->sqllen + (dtype == SQL_VARYING ? sizeof(short) : 0),
-                 ISC_SCHAR);
+/* members of the Type union of Arrow's Schema.fbs */
+#define IB_ARROW_NULL       1
+#define IB_ARROW_INT        2
+#define IB_ARROW_FLOAT      3
+#define IB_ARROW_BINARY     4
+#define IB_ARROW_UTF8       5
+#define IB_ARROW_BOOL       6
+#define IB_ARROW_DECIMAL    7
+#define IB_ARROW_DATE       8
+#define IB_ARROW_TIME       9
+#define IB_ARROW_TIMESTAMP  10
+
+/* MessageHeader union */
+#define IB_ARROW_SCHEMA     1
+#define IB_ARROW_BATCH      3
+
+typedef struct
+{
+    char    *p;
+    size_t  len;
+    size_t  size;
+} IB_BUF;
 
-            /* Nullable? */
-            if (var->sqltype & 1)
-                Newx(var->sqlind, 1, short);
-        }
+static char *ib_buf_room(IB_BUF *b, size_t n)
+{
+    if (b->len + n > b->size)
+    {
+        b->size = (b->len + n) * 2;
+        Renew(b->p, b->size, char);
     }
+    return b->p + b->len;
+}
 
+static void ib_buf_put(IB_BUF *b, const void *s, size_t n)
+{
+    memcpy(ib_buf_room(b, n), s, n);
+    b->len += n;
+}
 
-    /* statment is valid -> insert into linked list (at begin) */
-    imp_sth->next_sth = imp_dbh->first_sth;
+static void ib_buf_zero(IB_BUF *b, size_t n)
+{
+    Zero(ib_buf_room(b, n), n, char);
+    b->len += n;
+}
 
-    if (imp_dbh->first_sth == NULL)
-        imp_dbh->last_sth = imp_sth;
-    else
-        imp_dbh->first_sth->prev_sth = imp_sth;
+/* zero bytes until len % align == rem */
+static void ib_buf_align(IB_BUF *b, size_t align, size_t rem)
+{
+    while (b->len % align != rem)
+        ib_buf_zero(b, 1);
+}
 
-    imp_dbh->first_sth = imp_sth;
+static void ib_buf_segment(void *ctx, const char *s, STRLEN n)
+{
+    ib_buf_put((IB_BUF *) ctx, s, n);
+}
 
-    DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "dbd_st_prepare: sth inserted into linked list.\n"));
+/* flatbuffers scalars are little endian whatever the machine */
+static void ib_fb_set(IB_BUF *b, size_t pos, ISC_UINT64 v, int size)
+{
+    int i;
 
-    /* tell DBI that we have a real statement handle now */
-    DBIc_IMPSET_on(imp_sth);
-    return TRUE;
+    for (i = 0; i < size; i++, v >>= 8)
+        b->p[pos + i] = (char) (v & 0xff);
 }
 
-int dbd_st_finish_internal(SV *sth, imp_sth_t *imp_sth, int honour_auto_commit)
+static size_t ib_fb_add(IB_BUF *b, ISC_UINT64 v, int size)
 {
-    D_imp_dbh_from_sth;
-    ISC_STATUS status[ISC_STATUS_LENGTH];
-
-    DBI_TRACE_imp_xxh(imp_sth, 2, (DBIc_LOGPIO(imp_sth), "dbd_st_finish\n"));
+    size_t pos = b->len;
 
-    if (!DBIc_ACTIVE(imp_sth)) /* already finished */
-    {
-        DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "dbd_st_finish: nothing to do (not active)\n"));
-        return TRUE;
-    }
+    ib_buf_zero(b, size);
+    ib_fb_set(b, pos, v, size);
+    return pos;
+}
 
-    /* Close the cursor, not drop the statement! */
-    if (imp_sth->type != isc_info_sql_stmt_exec_procedure) {
-        isc_dsql_free_statement(status, (isc_stmt_handle *)&(imp_sth->stmt), DSQL_close);
+/* points the offset at slot to target, which comes after it */
+static void ib_fb_link(IB_BUF *b, size_t slot, size_t target)
+{
+    ib_fb_set(b, slot, target - slot, 4);
+}
 
-        /* Ignore errors when closing already closed cursor (sqlcode -501).
-           May happen when closing "select * from sample" statement, which was
-           closed by the server because of a "drop table sample" statement.
-           There is no point to error-out here, since nothing bad has happened --
-           the statement is closed, just without we knowing. There is no resource
-           leak and the user can't and needs not do anything.
-         */
-        if ((status[0] == 1) && (status[1] > 0)) {
-            long sqlcode = isc_sqlcode(status);
+typedef struct
+{
+    int         size;   /* 1, 2, 4 or 8, 0 if absent; offsets are 4 */
+    ISC_INT64   value;
+    size_t      pos;    /* set by ib_fb_table */
+} IB_FB_FIELD;
 
-            if (sqlcode != -501) {
-                if (ib_error_check(sth, status))
-                    return FALSE;
-            }
-            else
+/*
+   A table, preceded by its vtable. The fields are laid out largest first
+   from a table start 4 bytes short of 8 byte alignment, which aligns each
+   of them. Returns the position of the table.
+ */
+static size_t ib_fb_table(IB_BUF *b, IB_FB_FIELD *f, int n)
+{
+    static const int sizes[] = { 8, 4, 2, 1 };
+    int    off[8];
+    int    i, k, size = 4;
+    size_t vt, tab;
+
+    for (k = 0; k < 4; k++)
+        for (i = 0; i < n; i++)
+            if (f[i].size == sizes[k])
             {
-                DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "dbd_st_finish: ignoring error -501 from isc_dsql_free_statement.\n"));
+                off[i] = size;
+                size += f[i].size;
             }
-        }
 
-        DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "dbd_st_finish: isc_dsql_free_statement passed.\n"));
+    ib_buf_align(b, 2, 0);
+    vt = b->len;
+    ib_fb_add(b, 4 + 2 * n, 2);
+    ib_fb_add(b, size, 2);
+    for (i = 0; i < n; i++)
+        ib_fb_add(b, f[i].size ? off[i] : 0, 2);
+
+    ib_buf_align(b, 8, 4);
+    tab = b->len;
+    ib_fb_add(b, tab - vt, 4);
+    ib_buf_zero(b, size - 4);
+    for (i = 0; i < n; i++)
+    {
+        if (!f[i].size)
+            continue;
+        f[i].pos = tab + off[i];
+        ib_fb_set(b, f[i].pos, (ISC_UINT64) f[i].value, f[i].size);
     }
+    return tab;
+}
 
-    /* set statement to inactive - must be before ib_commit_transaction 'cos
-       commit can call dbd_st_finish function again */
-    DBIc_ACTIVE_off(imp_sth);
-
-    if ( imp_sth->param_values != NULL )
-        hv_clear(imp_sth->param_values);
+static size_t ib_fb_string(IB_BUF *b, const char *s, STRLEN n)
+{
+    size_t pos;
 
-    /* if AutoCommit on */
-    if (DBIc_has(imp_dbh, DBIcf_AutoCommit) && honour_auto_commit)
-    {
-        DBI_TRACE_imp_xxh(imp_sth, 4, (DBIc_LOGPIO(imp_sth), "dbd_st_finish: Trying to call ib_commit_transaction.\n"));
+    ib_buf_align(b, 4, 0);
+    pos = ib_fb_add(b, n, 4);
+    ib_buf_put(b, s, n);
+    ib_buf_zero(b, 1);
+    return pos;
+}
 
-        if (!ib_commit_transaction(sth, imp_dbh))
-        {
-            DBI_TRACE_imp_xxh(imp_sth, 4, (DBIc_LOGPIO(imp_sth), "dbd_st_finish: Call ib_commit_transaction finished returned FALSE.\n"));
-            return FALSE;
-        }
-        DBI_TRACE_imp_xxh(imp_sth, 4, (DBIc_LOGPIO(imp_sth), "dbd_st_finish: Call ib_commit_transaction succeeded.\n"));
-    }
+/* a zero filled vector; element i is at pos + 4 + i * size */
+static size_t ib_fb_vector(IB_BUF *b, size_t n, int size)
+{
+    size_t pos;
 
-    return TRUE;
+    ib_buf_align(b, size >= 8 ? 8 : 4, size >= 8 ? 4 : 0);
+    pos = ib_fb_add(b, n, 4);
+    ib_buf_zero(b, n * size);
+    return pos;
 }
 
-int dbd_st_finish(SV *sth, imp_sth_t *imp_sth)
+/* starts a metadata buffer with its Message table, returns the header slot */
+static size_t ib_arrow_message(IB_BUF *b, int header_type, ISC_INT64 body_len)
 {
-    return dbd_st_finish_internal(sth, imp_sth, TRUE);
+    IB_FB_FIELD f[4];
+
+    Zero(f, 4, IB_FB_FIELD);
+    f[0].size = 2; f[0].value = 4;              /* version: V5 */
+    f[1].size = 1; f[1].value = header_type;
+    f[2].size = 4;                              /* header */
+    f[3].size = 8; f[3].value = body_len;
+
+    b->len = 0;
+    ib_fb_add(b, 0, 4);
+    ib_fb_link(b, 0, ib_fb_table(b, f, 4));
+    return f[2].pos;
 }
 
-
-int dbd_st_execute(SV *sth, imp_sth_t *imp_sth)
+typedef struct
 {
-    D_imp_dbh_from_sth;
-    ISC_STATUS status[ISC_STATUS_LENGTH];
-    int        result = -2;
-    int        row_count = 0;
+    char    type;       /* IB_ARROW_* */
+    char    width;      /* bytes per value, 0 for the variable length types */
+    int     bits;       /* Int bitWidth, FloatingPoint precision */
+    int     precision;  /* Decimal */
+    int     scale;
+    int     utc;        /* Timestamp of the time zone types */
+    IB_BUF  valid;      /* validity bitmap */
+    IB_BUF  values;     /* values, offsets of the variable length types */
+    IB_BUF  data;       /* bytes of the variable length types */
+    long    nulls;
+} IB_ARROW_COL;
+
+static void ib_arrow_col_type(XSQLVAR *var, IB_ARROW_COL *c)
+{
+    short dtype = var->sqltype & ~1;
 
-    if (DBIc_ACTIVE(imp_sth))
-        dbd_st_finish_internal( sth, imp_sth, TRUE);
+    c->type = IB_ARROW_UTF8;
+    switch (dtype)
+    {
+        case SQL_SHORT:
+        case SQL_LONG:
+#ifdef SQL_INT64
+        case SQL_INT64:
+#endif
+        {
+            int bytes = dtype == SQL_SHORT ? 2 : dtype == SQL_LONG ? 4 : 8;
 
-    DBI_TRACE_imp_xxh(imp_sth, 2, (DBIc_LOGPIO(imp_sth), "dbd_st_execute\n"));
+            if (var->sqlscale)
+            {
+                c->type      = IB_ARROW_DECIMAL;
+                c->width     = 16;
+                c->precision = bytes == 2 ? 5 : bytes == 4 ? 10 : 19;
+                c->scale     = -var->sqlscale;
+            }
+            else
+            {
+                c->type  = IB_ARROW_INT;
+                c->width = bytes;
+                c->bits  = bytes * 8;
+            }
+            break;
+        }
 
-    if (DBIc_ACTIVE(imp_sth))
-	dbd_st_finish_internal(sth, imp_sth, TRUE);
+        case SQL_INT128:
+            c->type      = IB_ARROW_DECIMAL;
+            c->width     = 16;
+            c->precision = 38;
+            c->scale     = -var->sqlscale;
+            break;
 
-    /* if not already done: start new transaction */
-    if (!imp_dbh->tr)
-        if (!ib_start_transaction(sth, imp_dbh))
-            return result;
+        case SQL_FLOAT:
+            c->type  = IB_ARROW_FLOAT;
+            c->width = 4;
+            c->bits  = 1;   /* SINGLE */
+            break;
 
-    DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "dbd_st_execute: statement type: %ld.\n", imp_sth->type));
+        case SQL_DOUBLE:
+            c->type  = IB_ARROW_FLOAT;
+            c->width = 8;
+            c->bits  = 2;   /* DOUBLE */
+            break;
 
-    /* we count DDL statments */
-    if (imp_sth->type == isc_info_sql_stmt_ddl)
-        imp_dbh->sth_ddl++;
+#ifdef SQL_BOOLEAN
+        case SQL_BOOLEAN:
+            c->type = IB_ARROW_BOOL;
+            break;
+#endif
 
+        case SQL_TEXT:
+        case SQL_VARYING:
+            if ((var->sqlsubtype & 0xff) == IB_CS_OCTETS)
+                c->type = IB_ARROW_BINARY;
+            break;
 
-    /* exec procedure statement */
-    if (imp_sth->type == isc_info_sql_stmt_exec_procedure)
+        case SQL_BLOB:
+            if (IB_BLOB_BINARY(var))
+                c->type = IB_ARROW_BINARY;
+            break;
+
+        case SQL_TYPE_DATE:
+            c->type  = IB_ARROW_DATE;
+            c->width = 4;
+            break;
+
+        case SQL_TYPE_TIME:
+            c->type  = IB_ARROW_TIME;
+            c->width = 8;
+            break;
+
+        case SQL_TIMESTAMP_TZ:
+        case SQL_TIMESTAMP_TZ_EX:
+            c->utc = 1;
+            /* FALLTHROUGH */
+        case SQL_TIMESTAMP:
+            c->type  = IB_ARROW_TIMESTAMP;
+            c->width = 8;
+            break;
+
+        case SQL_TIME_TZ:
+        case SQL_TIME_TZ_EX:
+        case SQL_DEC16:
+        case SQL_DEC34:
+            /* no Arrow type keeps them whole: text as fetch gives it */
+            break;
+
+        default:
+            c->type = IB_ARROW_NULL;
+    }
+}
+
+/* the type table of a column, for the Field at slot */
+static void ib_arrow_type_table(IB_BUF *b, size_t slot, IB_ARROW_COL *c)
+{
+    IB_FB_FIELD f[3];
+    int         n = 0;
+    size_t      tab;
+
+    Zero(f, 3, IB_FB_FIELD);
+    switch (c->type)
     {
-        DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "dbd_st_execute: calling isc_dsql_execute2 (exec procedure)..\n"));
+        case IB_ARROW_INT:
+            f[0].size = 4; f[0].value = c->bits;        /* bitWidth */
+            f[1].size = 1; f[1].value = 1;              /* is_signed */
+            n = 2;
+            break;
 
-        isc_dsql_execute2(status, &(imp_dbh->tr), &(imp_sth->stmt),
-                          imp_dbh->sqldialect,
-                          (imp_sth->in_sqlda && (imp_sth->in_sqlda->sqld > 0))?
-                           imp_sth->in_sqlda: NULL,
-                          (imp_sth->out_sqlda && (imp_sth->out_sqlda->sqld > 0))?
-                           imp_sth->out_sqlda: NULL);
+        case IB_ARROW_FLOAT:
+            f[0].size = 2; f[0].value = c->bits;        /* precision */
+            n = 1;
+            break;
 
-        if (ib_error_check(sth, status))
-        {
-            ib_cleanup_st_execute(imp_sth);
-            return result;
-        }
+        case IB_ARROW_DECIMAL:
+            f[0].size = 4; f[0].value = c->precision;
+            f[1].size = 4; f[1].value = c->scale;
+            f[2].size = 4; f[2].value = 128;            /* bitWidth */
+            n = 3;
+            break;
 
-        DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "dbd_st_execute: isc_dsql_execute2 succeed.\n"));
+        case IB_ARROW_DATE:
+            f[0].size = 2; f[0].value = 0;              /* DAY */
+            n = 1;
+            break;
 
-        result = row_count = imp_sth->affected = 0;
+        case IB_ARROW_TIME:
+            f[0].size = 2; f[0].value = 2;              /* MICROSECOND */
+            f[1].size = 4; f[1].value = 64;             /* bitWidth */
+            n = 2;
+            break;
+
+        case IB_ARROW_TIMESTAMP:
+            f[0].size = 2; f[0].value = 2;              /* MICROSECOND */
+            f[1].size = c->utc ? 4 : 0;                 /* timezone */
+            n = 2;
+            break;
     }
-    else /* all other types of SQL statements */
+
+    tab = ib_fb_table(b, f, n);
+    ib_fb_link(b, slot, tab);
+    if (c->type == IB_ARROW_TIMESTAMP && c->utc)
+        ib_fb_link(b, f[1].pos, ib_fb_string(b, "UTC", 3));
+}
+
+static int ib_arrow_write(SV *sth, PerlIO *io, const char *s, size_t n)
+{
+    if (n && PerlIO_write(io, s, n) != (SSize_t) n)
     {
-        DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "dbd_st_execute: calling isc_dsql_execute..\n"));
+        do_error(sth, 1, "ib_fetch_arrow: write error");
+        return FALSE;
+    }
+    return TRUE;
+}
 
-        /* check for valid in_sqlda */
-        if (!imp_sth->in_sqlda)
-            return FALSE;
+/* a message: continuation marker, metadata length, metadata, body */
+static int ib_arrow_frame(SV *sth, PerlIO *io, IB_BUF *meta)
+{
+    IB_BUF head = { NULL, 0, 0 };
+    int    ok;
+
+    ib_buf_align(meta, 8, 0);
+    ib_fb_add(&head, 0xFFFFFFFF, 4);
+    ib_fb_add(&head, meta->len, 4);
+    ok = ib_arrow_write(sth, io, head.p, head.len)
+         && ib_arrow_write(sth, io, meta->p, meta->len);
+    Safefree(head.p);
+    return ok;
+}
 
-        isc_dsql_execute(status, &(imp_dbh->tr), &(imp_sth->stmt),
-                         imp_dbh->sqldialect,
-                         imp_sth->in_sqlda->sqld > 0 ? imp_sth->in_sqlda: NULL);
+static int ib_arrow_schema(SV *sth, PerlIO *io, IB_BUF *b, XSQLDA *sqlda,
+                           IB_ARROW_COL *cols, AV *keys)
+{
+    IB_FB_FIELD s[2], f[6];
+    size_t      slot, fields;
+    int         i, n = sqlda->sqld;
 
-        if (ib_error_check(sth, status))
-        {
-            ib_cleanup_st_execute(imp_sth);
+    Zero(s, 2, IB_FB_FIELD);
+#if BYTEORDER == 0x4321 || BYTEORDER == 0x87654321
+    s[0].size = 2; s[0].value = 1;              /* endianness: Big */
+#else
+    s[0].size = 2; s[0].value = 0;              /* endianness: Little */
+#endif
+    s[1].size = 4;                              /* fields */
 
-            /* rollback any active transaction */
-            if (DBIc_has(imp_dbh, DBIcf_AutoCommit) && imp_dbh->tr)
-                ib_commit_transaction(sth, imp_dbh);
+    slot = ib_arrow_message(b, IB_ARROW_SCHEMA, 0);
+    ib_fb_link(b, slot, ib_fb_table(b, s, 2));
+    fields = ib_fb_vector(b, n, 4);
+    ib_fb_link(b, s[1].pos, fields);
 
-            return result;
-        }
+    for (i = 0; i < n; i++)
+    {
+        STRLEN len;
+        char   *name = SvPV(AvARRAY(keys)[i], len);
+
+        Zero(f, 6, IB_FB_FIELD);
+        f[0].size = 4;                                  /* name */
+        f[1].size = 1; f[1].value = (sqlda->sqlvar[i].sqltype & 1)
+                                    || cols[i].type == IB_ARROW_NULL;
+        f[2].size = 1; f[2].value = cols[i].type;       /* type_type */
+        f[3].size = 4;                                  /* type */
+        f[5].size = 4;                                  /* children */
+
+        ib_fb_link(b, fields + 4 + 4 * i, ib_fb_table(b, f, 6));
+        ib_fb_link(b, f[0].pos, ib_fb_string(b, name, len));
+        ib_arrow_type_table(b, f[3].pos, &cols[i]);
+        ib_fb_link(b, f[5].pos, ib_fb_vector(b, 0, 4));
+    }
+
+    return ib_arrow_frame(sth, io, b);
+}
 
-        DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "dbd_st_execute: isc_dsql_execute succeed.\n"));
-    }
+/* the buffers of a column in Arrow's order; NULL for an empty one */
+static int ib_arrow_col_buffers(IB_ARROW_COL *c, IB_BUF **bufs)
+{
+    if (c->type == IB_ARROW_NULL)
+        return 0;
+
+    bufs[0] = c->nulls ? &c->valid : NULL;
+    bufs[1] = &c->values;
+    if (c->type != IB_ARROW_UTF8 && c->type != IB_ARROW_BINARY)
+        return 2;
+    bufs[2] = &c->data;
+    return 3;
+}
 
-    if (imp_sth->count_item)
+static int ib_arrow_batch(SV *sth, PerlIO *io, IB_BUF *b, IB_ARROW_COL *cols,
+                          int n, long rows)
+{
+    IB_FB_FIELD r[3];
+    IB_BUF      *bufs[3];
+    size_t      slot, nodes, buffers, offset = 0;
+    int         i, k, m, nbufs = 0;
+
+    for (i = 0; i < n; i++)
     {
-        //PerlIO_printf(PerlIO_stderr(), "calculating row count\n");
-        row_count = ib_rows(sth, &(imp_sth->stmt), imp_sth->count_item);
-        if (row_count <= -2)
-            ib_cleanup_st_execute(imp_sth);
-        else
-            result = imp_sth->affected = row_count;
+        m = ib_arrow_col_buffers(&cols[i], bufs);
+        nbufs += m;
+        for (k = 0; k < m; k++)
+            offset += bufs[k] ? (bufs[k]->len + 7) & ~(size_t) 7 : 0;
     }
-    else if (imp_sth->type == isc_info_sql_stmt_select)
-        result = row_count = imp_sth->affected = 0;
-    else
-        result = -1;
 
-    /* Jika AutoCommit On, commit_transaction() (bukan retaining),
-     * dan reset imp_dbh->tr == 0L
-     * For SELECT statement, commit_transaction() is called after fetch,
-     * or within finish()
-     */
-    if (DBIc_has(imp_dbh, DBIcf_AutoCommit)
-        && imp_sth->type != isc_info_sql_stmt_select
-        && imp_sth->type != isc_info_sql_stmt_select_for_upd
-        && imp_sth->type != isc_info_sql_stmt_exec_procedure)
+    Zero(r, 3, IB_FB_FIELD);
+    r[0].size = 8; r[0].value = rows;           /* length */
+    r[1].size = 4;                              /* nodes */
+    r[2].size = 4;                              /* buffers */
+
+    slot = ib_arrow_message(b, IB_ARROW_BATCH, offset);
+    ib_fb_link(b, slot, ib_fb_table(b, r, 3));
+    nodes = ib_fb_vector(b, n, 16);
+    ib_fb_link(b, r[1].pos, nodes);
+    buffers = ib_fb_vector(b, nbufs, 16);
+    ib_fb_link(b, r[2].pos, buffers);
+
+    offset = 0;
+    nbufs  = 0;
+    for (i = 0; i < n; i++)
     {
-        DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "dbd_st_execute: calling ib_commit_transaction..\n"));
+        ib_fb_set(b, nodes + 4 + 16 * i, rows, 8);
+        ib_fb_set(b, nodes + 12 + 16 * i,
+                  cols[i].type == IB_ARROW_NULL ? rows : cols[i].nulls, 8);
 
-        if (!ib_commit_transaction(sth, imp_dbh))
+        m = ib_arrow_col_buffers(&cols[i], bufs);
+        for (k = 0; k < m; k++, nbufs++)
         {
-            ib_cleanup_st_execute(imp_sth);
-            return result;
-        }
+            size_t len = bufs[k] ? bufs[k]->len : 0;
 
-        DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "dbd_st_execute: ib_commit_transaction succeed.\n"));
+            ib_fb_set(b, buffers + 4 + 16 * nbufs, offset, 8);
+            ib_fb_set(b, buffers + 12 + 16 * nbufs, len, 8);
+            offset += (len + 7) & ~(size_t) 7;
+        }
     }
 
-    /* Declare a unique cursor for this query */
-    if (imp_sth->type == isc_info_sql_stmt_select_for_upd)
+    if (!ib_arrow_frame(sth, io, b))
+        return FALSE;
+
+    /* the body: each buffer padded to 8 bytes */
+    for (i = 0; i < n; i++)
     {
-        /* We free the cursor_name buffer in dbd_st_destroy. */
-        if (!create_cursor_name(sth, imp_sth))
+        m = ib_arrow_col_buffers(&cols[i], bufs);
+        for (k = 0; k < m; k++)
         {
-            ib_cleanup_st_execute(imp_sth);
-            return result;
+            if (!bufs[k])
+                continue;
+            ib_buf_align(bufs[k], 8, 0);
+            if (!ib_arrow_write(sth, io, bufs[k]->p, bufs[k]->len))
+                return FALSE;
         }
     }
+    return TRUE;
+}
 
+static void ib_arrow_reset(IB_ARROW_COL *cols, int n)
+{
+    ISC_LONG zero = 0;
+    int      i;
 
-    switch (imp_sth->type)
+    for (i = 0; i < n; i++)
     {
-        case isc_info_sql_stmt_select:
-        case isc_info_sql_stmt_select_for_upd:
-        case isc_info_sql_stmt_exec_procedure:
-            DBIc_NUM_FIELDS(imp_sth) = (imp_sth->out_sqlda)?
-                                        imp_sth->out_sqlda->sqld: 0;
-            DBIc_ACTIVE_on(imp_sth);
-            break;
+        cols[i].valid.len = cols[i].values.len = cols[i].data.len = 0;
+        cols[i].nulls = 0;
+        if (cols[i].type == IB_ARROW_UTF8 || cols[i].type == IB_ARROW_BINARY)
+            ib_buf_put(&cols[i].values, &zero, 4);
     }
-
-    DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "dbd_st_execute: row count: %d.\n"
-                            "dbd_st_execute: count_item: %d.\n",
-                            row_count, imp_sth->count_item));
-
-    return result;
 }
 
-unsigned get_charset_bytes_per_char(const ISC_SHORT subtype, SV *sth);
+/* the timestamp in microseconds since 1970-01-01 */
+static ISC_INT64 ib_arrow_micros(ISC_DATE date, ISC_TIME time)
+{
+    return ((ISC_INT64) (date - IB_MJD_UNIX_EPOCH) * IB_DAY_TICKS + time)
+           * (1000000 / ISC_TIME_SECONDS_PRECISION);
+}
 
-/* from out_sqlda to AV */
-AV *dbd_st_fetch(SV *sth, imp_sth_t *imp_sth)
+/* appends the value of var as row of the batch */
+static int ib_arrow_put(SV *sth, imp_sth_t *imp_sth, IB_ARROW_COL *c,
+                        XSQLVAR *var, long row)
 {
-    D_imp_dbh_from_sth;     /* declare imp_dbh from sth */
-    ISC_STATUS  fetch = 0;
-    ISC_STATUS  status[ISC_STATUS_LENGTH];
-    int         chopBlanks; /* chopBlanks ?             */
-    AV          *av;        /* array buffer             */
-    SV          *sv, **svp; /* buffers */
-    XSQLVAR     *var;       /* working pointer XSQLVAR  */
-    int         i;          /* loop */
-    short       dtype;
+    D_imp_dbh_from_sth;
+    short    dtype = var->sqltype & ~1;
+    int      null = (var->sqltype & 1) && *(var->sqlind) == -1;
+    ISC_LONG end;
+    char     buf[128];
 
-    DBI_TRACE_imp_xxh(imp_sth, 2, (DBIc_LOGPIO(imp_sth), "dbd_st_fetch\n"));
+    if (c->type == IB_ARROW_NULL)
+        return TRUE;
 
-    if (!DBIc_ACTIVE(imp_sth))
+    if (row % 8 == 0)
     {
-        do_error(sth, 0, "no statement executing (perhaps you need to call execute first)\n");
-        return Nullav;
+        ib_buf_zero(&c->valid, 1);
+        if (c->type == IB_ARROW_BOOL)
+            ib_buf_zero(&c->values, 1);
     }
 
-    chopBlanks = DBIc_is(imp_sth, DBIcf_ChopBlanks);
-
-    av = DBIS->get_fbav(imp_sth);
-    svp = AvARRAY(av);
+    if (null)
+    {
+        c->nulls++;
+        if (c->width)
+            ib_buf_zero(&c->values, c->width);
+        else if (c->type != IB_ARROW_BOOL)
+        {
+            /* an empty value: the offset it starts at again */
+            memcpy(&end, c->values.p + c->values.len - 4, 4);
+            ib_buf_put(&c->values, &end, 4);
+        }
+        return TRUE;
+    }
+    c->valid.p[row / 8] |= 1 << (row % 8);
 
-    /*
-     * if it's an execute procedure, we've already got the
-     * output from the isc_dsql_execute2() call in dbd_st_execute().
-     */
-    if (imp_sth->type != isc_info_sql_stmt_exec_procedure)
+    switch (dtype)
     {
-        fetch = isc_dsql_fetch(status, &(imp_sth->stmt), imp_dbh->sqldialect,
-                               imp_sth->out_sqlda);
+#ifdef SQL_BOOLEAN
+        case SQL_BOOLEAN:
+            if (*(FB_BOOLEAN *) var->sqldata == FB_TRUE)
+                c->values.p[row / 8] |= 1 << (row % 8);
+            return TRUE;
+#endif
 
-        if (ib_error_check(sth, status))
-            return Nullav;
+        case SQL_SHORT:
+        case SQL_LONG:
+#ifdef SQL_INT64
+        case SQL_INT64:
+#endif
+            if (c->type == IB_ARROW_DECIMAL)
+            {
+                ISC_INT64 v = dtype == SQL_SHORT ? *(short *) var->sqldata
+                            : dtype == SQL_LONG ? *(ISC_LONG *) var->sqldata
+                            : *(ISC_INT64 *) var->sqldata;
+                ISC_INT64 d[2];
+
+                d[IB_W128_LO] = v;
+                d[IB_W128_HI] = v < 0 ? -1 : 0;
+                ib_buf_put(&c->values, d, 16);
+            }
+            else
+                ib_buf_put(&c->values, var->sqldata, c->width);
+            return TRUE;
 
-        /*
-         * Code 100 means we've reached the end of the set
-         * of rows that the SELECT will return.
-         */
+        case SQL_TYPE_DATE:
+        {
+            ISC_LONG days = *(ISC_DATE *) var->sqldata - IB_MJD_UNIX_EPOCH;
 
-        DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "dbd_st_fetch: fetch result: %ld\n", fetch));
+            ib_buf_put(&c->values, &days, 4);
+            return TRUE;
+        }
 
-        if (imp_sth->affected < 0)
-            imp_sth->affected = 0;
+        case SQL_TYPE_TIME:
+        {
+            ISC_INT64 us = ib_arrow_micros(IB_MJD_UNIX_EPOCH,
+                                           *(ISC_TIME *) var->sqldata);
 
-        if (fetch == 100)
+            ib_buf_put(&c->values, &us, 8);
+            return TRUE;
+        }
+
+        case SQL_TIMESTAMP:
         {
-            /* close the cursor */
-            isc_dsql_free_statement(status, &(imp_sth->stmt), DSQL_close);
+            ISC_INT64 us = ib_arrow_micros(
+                ((ISC_TIMESTAMP *) var->sqldata)->timestamp_date,
+                ((ISC_TIMESTAMP *) var->sqldata)->timestamp_time);
 
-            if (ib_error_check(sth, status))
-                return Nullav;
+            ib_buf_put(&c->values, &us, 8);
+            return TRUE;
+        }
 
-            DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "isc_dsql_free_statement succeed.\n"));
+        case SQL_TIMESTAMP_TZ:
+        case SQL_TIMESTAMP_TZ_EX:
+        {
+            ISC_DATE   date = 0;
+            ISC_TIME   time = 0;
+            ISC_USHORT zone_id = FB_TZ_GMT_ZONE;
+            ISC_SHORT  offset = 0;
+            ISC_INT64  us;
+
+            ib_tz_fields(var, dtype, &date, &time, &zone_id, &offset);
+            us = ib_arrow_micros(date, time);
+            ib_buf_put(&c->values, &us, 8);
+            return TRUE;
+        }
 
-            DBIc_ACTIVE_off(imp_sth); /* dbd_st_finish is no longer needed */
+        case SQL_TEXT:
+            ib_buf_put(&c->data, var->sqldata, ib_char_len(sth, imp_sth, var));
+            break;
 
-            /* if AutoCommit on XXX. what to return if fails? */
-            if (DBIc_has(imp_dbh, DBIcf_AutoCommit))
-            {
-                if (!ib_commit_transaction(sth, imp_dbh))
-                    return Nullav;
+        case SQL_VARYING:
+            ib_buf_put(&c->data, ((DBD_VARY *) var->sqldata)->vary_string,
+                       ((DBD_VARY *) var->sqldata)->vary_length);
+            break;
 
-                DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "fetch ends: ib_commit_transaction succeed.\n"));
-            }
+        case SQL_BLOB:
+            if (!ib_blob_each(sth, imp_sth, var, ib_buf_segment, &c->data))
+                return FALSE;
+            break;
 
-            return Nullav;
+        case SQL_TIME_TZ:
+        case SQL_TIME_TZ_EX:
+        {
+            int n = ib_tz_text(sth, imp_dbh, var, buf);
+
+            if (n < 0)
+                return FALSE;
+            ib_buf_put(&c->data, buf, n);
+            break;
         }
-        else if (fetch != 0) /* something bad */
-        {   do_error(sth, 0, "Fetch error");
-            DBIc_ACTIVE_off(imp_sth);
-            return Nullav;
+
+        case SQL_DEC16:
+        case SQL_DEC34:
+        {
+            IB_DECIMAL d;
+
+            ib_decfloat_unpack((ISC_UINT64 *) var->sqldata, dtype == SQL_DEC34, &d);
+            ib_buf_put(&c->data, buf, ib_dec_format(&d, FALSE, buf));
+            break;
         }
-    } /* !exec_procedure */
-    else
+
+        default:
+            /* INT128, FLOAT and DOUBLE are as Arrow keeps them */
+            ib_buf_put(&c->values, var->sqldata, c->width);
+            return TRUE;
+    }
+
+    /* the variable length types end with their offset */
+    if (c->data.len > 0x7fffffff)
     {
-        /* we only fetch one row for exec procedure */
-        if (imp_sth->affected)
-            return Nullav;
+        do_error(sth, 0, "ib_fetch_arrow: batch over 2GB, lower batch_rows");
+        return FALSE;
+    }
+    end = (ISC_LONG) c->data.len;
+    ib_buf_put(&c->values, &end, 4);
+    return TRUE;
+}
+
+/*
+ * Fetches the remaining rows of the statement into io as an Arrow IPC
+ * stream. Returns the number of rows written, or -1 on error.
+ */
+long ib_st_fetch_arrow(SV *sth, imp_sth_t *imp_sth, PerlIO *io, long batch_rows)
+{
+    IB_ARROW_COL *cols;
+    IB_BUF  meta = { NULL, 0, 0 };
+    AV      *keys;
+    XSQLVAR *var;
+    long    rows = 0, batch = 0;
+    int     i, n, rc;
+
+    DBI_TRACE_imp_xxh(imp_sth, 2, (DBIc_LOGPIO(imp_sth), "ib_st_fetch_arrow\n"));
+
+    if (!imp_sth->out_sqlda || !imp_sth->out_sqlda->sqld)
+    {
+        do_error(sth, 0, "ib_fetch_arrow: statement returns no rows");
+        return -1;
     }
+    n = imp_sth->out_sqlda->sqld;
 
-    var = imp_sth->out_sqlda->sqlvar;
-    for (i = 0; i < imp_sth->out_sqlda->sqld; i++, var++)
+    if (!DBIc_ACTIVE(imp_sth))
+    {
+        do_error(sth, 0, "no statement executing (perhaps you need to call execute first)\n");
+        return -1;
+    }
+
+    keys = ib_st_hash_keys(sth, imp_sth);
+    if (!keys)
+    {
+        do_error(sth, 0, "ib_fetch_arrow: no column names");
+        return -1;
+    }
+
+    Newxz(cols, n, IB_ARROW_COL);
+    for (i = 0; i < n; i++)
+        ib_arrow_col_type(&imp_sth->out_sqlda->sqlvar[i], &cols[i]);
+    ib_arrow_reset(cols, n);
+
+    rc = ib_arrow_schema(sth, io, &meta, imp_sth->out_sqlda, cols, keys) ? 1 : -1;
+
+    while (rc > 0 && (rc = ib_st_fetch_row(sth, imp_sth)) > 0)
     {
-        sv = svp[i];
-        dtype = var->sqltype & ~1;
+        var = imp_sth->out_sqlda->sqlvar;
+        for (i = 0; i < n; i++, var++)
+            if (!ib_arrow_put(sth, imp_sth, &cols[i], var, batch))
+                rc = -1;
+        if (rc < 0)
+            break;
+
+        imp_sth->affected += 1;
+        rows++;
 
-        if ((var->sqltype & 1) && (*(var->sqlind) == -1))
-        /* if nullable field */
+        if (++batch == batch_rows)
         {
-            /* isNULL */
-            SvOK_off(sv);
+            if (!ib_arrow_batch(sth, io, &meta, cols, n, batch))
+                rc = -1;
+            ib_arrow_reset(cols, n);
+            batch = 0;
         }
-        else
-        {
-            /*
-             * Got a non-null field.  Got to pass it back to the
-             * application, which means some datatype dependant code.
-             */
-            switch (dtype)
-            {
-#ifdef SQL_BOOLEAN
-                case SQL_BOOLEAN: 
-                    {
-                       FB_BOOLEAN b = (*((FB_BOOLEAN *) (var->sqldata)));
-#ifdef sv_set_bool
-                       sv_set_bool(sv, b == FB_TRUE);
-#else
-#ifdef sv_setbool
-                       sv_setbool(sv, b == FB_TRUE);
-#else
-                       sv_setiv(sv, (b == FB_TRUE) ? 1 : 0);
-#endif
-#endif
-                    } 
-                    break;
-#endif
+    }
 
-                case SQL_SHORT:
-                    if (var->sqlscale) /* handle NUMERICs */
-                    {
-                        double numeric;
+    if (rc == 0 && batch && !ib_arrow_batch(sth, io, &meta, cols, n, batch))
+        rc = -1;
 
-                        numeric = ((double) (*(short *) var->sqldata)) /
-                                   pow(10.0, (double) -var->sqlscale);
-                        sv_setnv(sv, numeric);
-                    }
-                    else
-                        sv_setiv(sv, *(short *) (var->sqldata));
-                    break;
+    /* end of stream: a continuation marker and an empty metadata length */
+    if (rc == 0)
+    {
+        meta.len = 0;
+        ib_fb_add(&meta, 0xFFFFFFFF, 4);
+        ib_fb_add(&meta, 0, 4);
+        if (!ib_arrow_write(sth, io, meta.p, meta.len))
+            rc = -1;
+    }
 
-                case SQL_LONG:
-                    if (var->sqlscale) /* handle NUMERICs */
-                    {
-                        double numeric;
+    for (i = 0; i < n; i++)
+    {
+        Safefree(cols[i].valid.p);
+        Safefree(cols[i].values.p);
+        Safefree(cols[i].data.p);
+    }
+    Safefree(cols);
+    Safefree(meta.p);
 
-                        numeric = ((double) (*(ISC_LONG *) var->sqldata)) /
-                                   pow(10.0, (double) -var->sqlscale);
-                        sv_setnv(sv, numeric);
-                    }
-                    else
-                        sv_setiv(sv, *(ISC_LONG *) (var->sqldata));
-                    break;
-#ifdef SQL_INT64
-                case SQL_INT64:
-                /*
-                 * This seemed difficult at first to return
-                 * a 64-bit scaled numeric to Perl through the
-                 * SV interface.  But as luck would have it,
-                 * Perl treats strings and numerics identically.
-                 * I can return this numeric as a string and
-                 * nobody has a problem with it.
-                 */
-                {
-                    static ISC_INT64 const scales[] = { 1LL,
-                                                        10LL,
-                                                        100LL,
-                                                        1000LL,
-                                                        10000LL,
-                                                        100000LL,
-                                                        1000000LL,
-                                                        10000000LL,
-                                                        100000000LL,
-                                                        1000000000LL,
-                                                        10000000000LL,
-                                                        100000000000LL,
-                                                        1000000000000LL,
-                                                        10000000000000LL,
-                                                        100000000000000LL,
-                                                        1000000000000000LL,
-                                                        10000000000000000LL,
-                                                        100000000000000000LL };
-                    ISC_INT64 i; /* significand */
-                    char buf[22]; /* NUMERIC(18,2) = -92233720368547758.08 + '\0' */
-
-                    i = *((ISC_INT64 *) (var->sqldata));
-
-                    /* We use the system snprintf(3) and system-specific
-                     * format codes. :(  On my perl, I was unable to
-                     * persuade sv_setpvf to handle INT64 values with
-                     * IVdf (and there is no I64f).
-                     *  - MJP 2010-03-25
-                     */
-#if defined(_MSC_VER)        /* Microsoft C compiler/library */
-#  define DBD_IB_INT64f "I64d"
-#elif defined (__FreeBSD__)  /* FreeBSD */
-#  define DBD_IB_INT64f "qd"
-#else                        /* others: linux, various unices */
-#  define DBD_IB_INT64f "lld"
-#endif
-                    if (var->sqlscale == 0) {
-                        snprintf(buf, sizeof(buf), "%"DBD_IB_INT64f, i);
-                        sv_setpvn(sv, buf, strlen(buf));
-                    } else {
-                        bool sign = ( i < 0 );
-                        ISC_INT64 divisor, remainder;
-                        divisor   = scales[-var->sqlscale];
-                        if (sign) divisor = -divisor;
-                        remainder = (i%divisor);
-                        if (remainder < 0) remainder = -remainder;
-
-                        snprintf(buf+1, sizeof(buf)-1,
-                                "%"DBD_IB_INT64f".%0*"DBD_IB_INT64f,
-                                i/divisor, -var->sqlscale, remainder);
-			DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "-------------->SQLINT64=%"DBD_IB_INT64f".%0*"DBD_IB_INT64f,i/divisor, -var->sqlscale, remainder ));
+    return rc < 0 ? -1 : rows;
+}
+
+/*
+ * ib_fetchall_mmap: the remaining rows of a statement spilled to a file,
+ * read back one row or one value at a time. The file is
+ *
+ *   header      "FBSPILL1", the column count (32 bits, then 32 bits of
+ *               padding), the row count and the offset of the row index
+ *               (64 bits each)
+ *   rows        a NULL bitmap, then each value that is not NULL: the
+ *               fetch buffer bytes, VARCHARs as length and bytes, CHARs
+ *               and BLOBs as a 32 bit length and the bytes, without the
+ *               trailing blanks of CHARs
+ *   row index   the offset of each row (64 bits), then that of the index
+ *
+ * in the byte order of the machine. Values are decoded by the code fetch
+ * uses, from a copy of the column's XSQLVAR pointing at the stored bytes.
+ */
+
+#define IB_SPILL_MAGIC      "FBSPILL1"
+#define IB_SPILL_HEADER     32
+
+/* the stored size of a value that is not NULL */
+static size_t ib_spill_size(XSQLVAR *var, const char *p)
+{
+    U32 len;
+    U16 vlen;
+
+    switch (var->sqltype & ~1)
+    {
+        case SQL_TEXT:
+        case SQL_BLOB:
+            memcpy(&len, p, 4);
+            return 4 + len;
+
+        case SQL_VARYING:
+            memcpy(&vlen, p, 2);
+            return 2 + vlen;
+
+        case SQL_ARRAY:
+            return 0;
 
-                        if (sign) {
-                            *buf = '-';
-                            sv_setpvn(sv, buf, strlen(buf));
-                        }
-                        else {
-                            sv_setpvn(sv, buf+1, strlen(buf+1));
-                        }
-                    }
+        default:
+            return var->sqllen;
+    }
+}
+
+static int ib_spill_put_row(SV *sth, imp_sth_t *imp_sth, IB_OUT *o, IB_BUF *blob)
+{
+    XSQLDA  *sqlda = imp_sth->out_sqlda;
+    XSQLVAR *var;
+    char    nulls[32];
+    char    *bitmap = nulls;
+    int     i, n = sqlda->sqld, nbytes = (n + 7) / 8;
+    U32     len;
+
+    if (nbytes > (int) sizeof(nulls))
+        Newx(bitmap, nbytes, char);
+    Zero(bitmap, nbytes, char);
+    for (i = 0, var = sqlda->sqlvar; i < n; i++, var++)
+        if ((var->sqltype & 1) && *(var->sqlind) == -1)
+            bitmap[i / 8] |= 1 << (i % 8);
+    ib_out_put(o, bitmap, nbytes);
+
+    for (i = 0, var = sqlda->sqlvar; i < n; i++, var++)
+    {
+        if (bitmap[i / 8] & (1 << (i % 8)))
+            continue;
+
+        switch (var->sqltype & ~1)
+        {
+            case SQL_TEXT:
+                len = (U32) ib_rtrim_len(var->sqldata, var->sqllen);
+                ib_out_put(o, (char *) &len, 4);
+                ib_out_put(o, var->sqldata, len);
+                break;
+
+            case SQL_VARYING:
+                ib_out_put(o, var->sqldata,
+                           2 + ((DBD_VARY *) var->sqldata)->vary_length);
+                break;
+
+            case SQL_BLOB:
+                blob->len = 0;
+                if (!ib_blob_each(sth, imp_sth, var, ib_buf_segment, blob))
+                {
+                    if (bitmap != nulls)
+                        Safefree(bitmap);
+                    return FALSE;
                 }
+                len = (U32) blob->len;
+                ib_out_put(o, (char *) &len, 4);
+                ib_out_put(o, blob->p, blob->len);
                 break;
-#endif
 
-                case SQL_FLOAT:
-                    sv_setnv(sv, (double)(*(float *) (var->sqldata)));
-                    break;
+            case SQL_ARRAY:
+                break;
 
-                case SQL_DOUBLE:
-                    if (var->sqlscale) /* handle NUMERICs */
-                    {
-                        double d = *(double *)var->sqldata;
-                        short  q = -var->sqlscale;
-
-                        sv_setnv(sv, d > 0?
-                                 floor(d * pow(10.0, (double) q)) /
-                                       pow(10.0, (double) q):
-                                 ceil(d * pow(10.0, (double) q)) /
-                                       pow(10.0, (double) q));
-                    }
-                    else
-                        sv_setnv(sv, *(double *) (var->sqldata));
-                    break;
+            default:
+                ib_out_put(o, var->sqldata, var->sqllen);
+        }
+    }
 
-                case SQL_TEXT:
-                /*
-                 * Thanks to DAM for pointing out that I
-                 * don't need to null-terminate this
-                 * buffer, and in fact it's a buffer
-                 * overrun if I do!
-                 */
+    if (bitmap != nulls)
+        Safefree(bitmap);
+    return TRUE;
+}
 
-                    DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "Fill in TEXT type..\nLength: %d\n", var->sqllen));
+/* reads n bytes at off, from the mapping when there is one */
+static int ib_spill_read(IB_SPILL *s, Off_t off, char *buf, size_t n)
+{
+    if (s->map)
+    {
+        memcpy(buf, s->map + off, n);
+        return TRUE;
+    }
+    return PerlIO_seek(s->io, off, SEEK_SET) == 0
+           && PerlIO_read(s->io, buf, n) == (SSize_t) n;
+}
 
-                    if (chopBlanks && (var->sqllen > 0))
-                    {
-                        short len = var->sqllen;
-                        char *p = (char*)(var->sqldata);
-                        while (len && (p[len-1] == ' ')) len--;
-                        sv_setpvn(sv, p, len);
-                        maybe_upgrade_to_utf8(imp_dbh, sv);
-                    }
-                    else
-                    {
-                        /* we need to shrink the string for multy-byte character
-                           sets. the padding spaces are too many in this case
-                           */
-                        unsigned bpc = get_charset_bytes_per_char(
-                                var->sqlsubtype, sth);
-                        unsigned len = var->sqllen;
-                        sv_setpvn(sv, var->sqldata, len);
-                        maybe_upgrade_to_utf8(imp_dbh, sv);
-                        SvCUR_set(sv, len/bpc);
-                    }
-                    break;
+/*
+ * Fetches the remaining rows of the statement into the file at path, or
+ * into a temporary file when path is NULL, and fills in s for reading
+ * them. Returns the number of rows, or -1 on error.
+ */
+long ib_spill_write(SV *sth, imp_sth_t *imp_sth, IB_SPILL *s, const char *path)
+{
+    IB_OUT  o;
+    IB_BUF  blob = { NULL, 0, 0 };
+    IB_BUF  index = { NULL, 0, 0 };
+    char    header[IB_SPILL_HEADER];
+    U32     ncols;
+    ISC_UINT64  rows = 0, off;
+    int     rc, i;
 
-                case SQL_VARYING:
-                {
-                    DBD_VARY *vary = (DBD_VARY *) var->sqldata;
-                    sv_setpvn(sv, vary->vary_string, vary->vary_length);
-                    /* Note that sqllen for VARCHARs is the max length */
-                    maybe_upgrade_to_utf8(imp_dbh, sv);
-                    break;
-                }
+    DBI_TRACE_imp_xxh(imp_sth, 2, (DBIc_LOGPIO(imp_sth), "ib_spill_write\n"));
 
+    Zero(s, 1, IB_SPILL);
 
-                /*
-                 * If user specifies a TimestampFormat, TimeFormat, or
-                 * DateFormat property of the Statement class, then that
-                 * string is the format string for strftime().
-                 *
-                 * If the user doesn't specify an XxxFormat, then format
-                 * is %c, defined in /usr/lib/locale/<locale>/LC_TIME/time,
-                 * where <locale> is the host's chosen locale.
-                 */
-                case SQL_TIMESTAMP:
-                case SQL_TYPE_DATE:
-                case SQL_TYPE_TIME:
-                {
-                    char     *format = NULL, buf[100];
-                    struct tm times;
-                    long int  fpsec = 0;
+    if (!imp_sth->out_sqlda || !imp_sth->out_sqlda->sqld)
+    {
+        do_error(sth, 0, "ib_fetchall_mmap: statement returns no rows");
+        return -1;
+    }
+    if (!DBIc_ACTIVE(imp_sth))
+    {
+        do_error(sth, 0, "no statement executing (perhaps you need to call execute first)\n");
+        return -1;
+    }
 
-                    switch (dtype)
-                    {
-                        case SQL_TIMESTAMP:
-                            isc_decode_timestamp((ISC_TIMESTAMP *) var->sqldata, &times);
-                            format = imp_sth->timestampformat ?
-                                imp_sth->timestampformat :
-                                imp_dbh->timestampformat;
-                            fpsec = TIMESTAMP_FPSECS(var->sqldata);
-                            break;
+    s->io = path ? PerlIO_open(path, "w+b") : PerlIO_tmpfile();
+    if (!s->io)
+    {
+        do_error(sth, 1, "ib_fetchall_mmap: cannot create the file");
+        return -1;
+    }
+    if (path)
+        s->path = savepv(path);
 
-                        case SQL_TYPE_DATE:
-                            isc_decode_sql_date((ISC_DATE *) var->sqldata, &times);
-                            format = imp_sth->dateformat ?
-                                imp_sth->dateformat :
-                                imp_dbh->dateformat;
-                            break;
+    o.io      = s->io;
+    o.size    = 1024 * 1024;
+    o.len     = 0;
+    o.error   = 0;
+    o.written = 0;
+    Newx(o.buf, o.size, char);
 
-                        case SQL_TYPE_TIME:
-                            isc_decode_sql_time((ISC_TIME *) var->sqldata, &times);
-                            format = imp_sth->timeformat ?
-                                imp_sth->timeformat :
-                                imp_dbh->timeformat;
-                            fpsec = TIME_FPSECS(var->sqldata);
-                            break;
-                    }
+    Zero(header, IB_SPILL_HEADER, char);
+    ib_out_put(&o, header, IB_SPILL_HEADER);
 
-                    DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "Decode passed.\n"));
+    while ((rc = ib_st_fetch_row(sth, imp_sth)) > 0)
+    {
+        off = (ISC_UINT64) (o.written + o.len);
+        ib_buf_put(&index, &off, 8);
+        if (!ib_spill_put_row(sth, imp_sth, &o, &blob))
+        {
+            rc = -1;
+            break;
+        }
 
+        imp_sth->affected += 1;
+        rows++;
 
-                    /* hardcoded output format.... */
-                    if (strEQ(format, "iso") || strEQ(format, "ISO"))
-                    {
-                        switch (dtype)
-                        {
-                            case SQL_TIMESTAMP:
-                                snprintf(buf, sizeof(buf), "%04d-%02d-%02d %02d:%02d:%02d.%04ld",
-                                        times.tm_year + 1900,
-                                        times.tm_mon  + 1,
-                                        times.tm_mday,
-                                        times.tm_hour,
-                                        times.tm_min,
-                                        times.tm_sec,
-                                        fpsec);
-                                break;
-                            case SQL_TYPE_DATE:
-                                snprintf(buf, sizeof(buf), "%04d-%02d-%02d",
-                                        times.tm_year + 1900,
-                                        times.tm_mon  + 1,
-                                        times.tm_mday);
-                                break;
-
-                            case SQL_TYPE_TIME:
-                                snprintf(buf, sizeof(buf), "%02d:%02d:%02d.%04ld",
-                                        times.tm_hour,
-                                        times.tm_min,
-                                        times.tm_sec,
-                                        fpsec);
-                                break;
-                        }
+        if (o.error)
+            break;
+    }
 
-                        sv_setpvn(sv, buf, strlen(buf));
-                        break;
-                    }
+    /* the row index, ending with its own offset */
+    off = (ISC_UINT64) (o.written + o.len);
+    ib_buf_put(&index, &off, 8);
+    ib_out_put(&o, index.p, index.len);
+    ib_out_flush(&o);
+
+    s->ncols = imp_sth->out_sqlda->sqld;
+    s->rows  = rows;
+    s->index = off;
+    s->size  = (size_t) (o.written);
+
+    ncols = (U32) s->ncols;
+    memcpy(header, IB_SPILL_MAGIC, 8);
+    memcpy(header + 8, &ncols, 4);
+    memcpy(header + 16, &rows, 8);
+    memcpy(header + 24, &off, 8);
+    if (rc >= 0 && !o.error)
+    {
+        if (PerlIO_seek(s->io, 0, SEEK_SET) != 0
+            || PerlIO_write(s->io, header, IB_SPILL_HEADER) != IB_SPILL_HEADER
+            || PerlIO_flush(s->io) != 0)
+            o.error = 1;
+    }
 
+    Safefree(o.buf);
+    Safefree(blob.p);
+    Safefree(index.p);
 
-                    /* output as array like perl's localtime? */
-                    if (strEQ(format, "tm") || strEQ(format, "TM"))
-                    {
-                        AV *list = newAV();
-
-                        av_push(list, newSViv(times.tm_sec));
-                        av_push(list, newSViv(times.tm_min));
-                        av_push(list, newSViv(times.tm_hour));
-                        av_push(list, newSViv(times.tm_mday));
-                        av_push(list, newSViv(times.tm_mon));
-                        av_push(list, newSViv(times.tm_year));
-                        av_push(list, newSViv(times.tm_wday));
-                        av_push(list, newSViv(times.tm_yday));
-                        av_push(list, newSViv(times.tm_isdst));
-
-                        /* value returned is a reference to the array */
-                        sv_setsv(sv, sv_2mortal(newRV_noinc((SV *) list)));
-                        break;
-                    }
+    if (o.error)
+        do_error(sth, 1, "ib_fetchall_mmap: write error");
+    if (rc < 0 || o.error)
+    {
+        ib_spill_close(s);
+        return -1;
+    }
 
-#ifndef WIN32
-                    /*
-                     * may be we must here copy additional fields needed on
-                     * some platforms for some strftime formats. copy from a
-                     * dummy struct passed to mktime(). calling mktime()
-                     * directly with &times is wrong.
-                     */
-
-                    /* struct tm has 9 fields plus may be some more */
-                    if (sizeof(struct tm) > (9*sizeof(int)))
-                    {
-                        struct tm dummy;
-                        Zero(&dummy, 1, struct tm);
-                        mktime(&dummy);
-                        memcpy(((char *)&times) + 9*sizeof(int),
-                               ((char *)&dummy) + 9*sizeof(int),
-                               sizeof(struct tm) - (9*sizeof(int)));
-                    }
+#ifdef HAS_MMAP
+    s->map = (char *) mmap(NULL, s->size, PROT_READ, MAP_SHARED,
+                           PerlIO_fileno(s->io), 0);
+    if (s->map == (char *) MAP_FAILED)
+        s->map = NULL;  /* read with PerlIO instead */
 #endif
 
-                    strftime(buf, sizeof(buf), format, &times);
-                    sv_setpvn(sv, buf, strlen(buf));
-                    break;
-                }
+    /* room for the largest value, aligned for any of the fetch types */
+    for (i = 0; i < s->ncols; i++)
+        if ((size_t) imp_sth->out_sqlda->sqlvar[i].sqllen + 2 > s->value_size)
+            s->value_size = imp_sth->out_sqlda->sqlvar[i].sqllen + 2;
+    Newx(s->value, (s->value_size + 7) / 8, ISC_UINT64);
 
-                /*
-                 * Firebird 4.0+: TIME WITH TIME ZONE and TIMESTAMP WITH TIME ZONE
-                 *
-                 * These types store the value in UTC plus a timezone identifier.
-                 * The timezone identifier is either:
-                 *   - An offset zone ID (0..2878): displacement = time_zone - FB_TZ_ONE_DAY_OFFSET
-                 *   - FB_TZ_GMT_ZONE (65535): UTC, displacement = 0
-                 *   - A named zone ID (> 2878 and < 65535): requires ICU timezone DB to decode
-                 *
-                 * We apply the offset (if available) to convert UTC to local time,
-                 * and format the result with the timezone offset appended.
-                 * For named zones, we display UTC with offset "+00:00".
-                 *
-                 * The *_EX variants (SQL_TIMESTAMP_TZ_EX, SQL_TIME_TZ_EX) carry
-                 * an explicit signed-minute offset in the ext_offset field.
-                 */
-                case SQL_TIMESTAMP_TZ:
-                case SQL_TIMESTAMP_TZ_EX:
-                case SQL_TIME_TZ:
-                case SQL_TIME_TZ_EX:
-                {
-                    char     *format = NULL, buf[128];
-                    struct tm times;
-                    long int  fpsec = 0;
-                    ISC_SHORT offset_minutes = 0;
+    return (long) rows;
+}
 
-                    Zero(&times, 1, struct tm);
+/*
+ * Decodes column col of row into out[0], or every column into out[] when
+ * col is -1. Returns FALSE on error.
+ */
+int ib_spill_decode(SV *sth, imp_sth_t *imp_sth, IB_SPILL *s, ISC_UINT64 row,
+                    int col, SV **out)
+{
+    D_imp_dbh_from_sth;
+    XSQLVAR     *var;
+    ISC_UINT64  at[2];
+    char        *p;
+    int         i, nbytes = (s->ncols + 7) / 8;
 
-                    switch (dtype)
-                    {
-                        case SQL_TIMESTAMP_TZ_EX:
-                        {
-                            ISC_TIMESTAMP_TZ_EX *ts = (ISC_TIMESTAMP_TZ_EX *) var->sqldata;
-                            isc_decode_timestamp(&ts->utc_timestamp, &times);
-                            fpsec = ts->utc_timestamp.timestamp_time % ISC_TIME_SECONDS_PRECISION;
-                            offset_minutes = ts->ext_offset;
-                            break;
-                        }
-                        case SQL_TIMESTAMP_TZ:
-                        {
-                            ISC_TIMESTAMP_TZ *ts = (ISC_TIMESTAMP_TZ *) var->sqldata;
-                            isc_decode_timestamp(&ts->utc_timestamp, &times);
-                            fpsec = ts->utc_timestamp.timestamp_time % ISC_TIME_SECONDS_PRECISION;
-                            if (ts->time_zone == FB_TZ_GMT_ZONE)
-                                offset_minutes = 0;
-                            else if (ts->time_zone <= FB_TZ_MAX_OFFSET_ZONE)
-                                offset_minutes = (ISC_SHORT)((int)ts->time_zone - FB_TZ_ONE_DAY_OFFSET);
-                            /* else named zone: use UTC (offset_minutes stays 0) */
-                            break;
-                        }
-                        case SQL_TIME_TZ_EX:
-                        {
-                            ISC_TIME_TZ_EX *t = (ISC_TIME_TZ_EX *) var->sqldata;
-                            isc_decode_sql_time(&t->utc_time, &times);
-                            fpsec = t->utc_time % ISC_TIME_SECONDS_PRECISION;
-                            offset_minutes = t->ext_offset;
-                            break;
-                        }
-                        case SQL_TIME_TZ:
-                        {
-                            ISC_TIME_TZ *t = (ISC_TIME_TZ *) var->sqldata;
-                            isc_decode_sql_time(&t->utc_time, &times);
-                            fpsec = t->utc_time % ISC_TIME_SECONDS_PRECISION;
-                            if (t->time_zone == FB_TZ_GMT_ZONE)
-                                offset_minutes = 0;
-                            else if (t->time_zone <= FB_TZ_MAX_OFFSET_ZONE)
-                                offset_minutes = (ISC_SHORT)((int)t->time_zone - FB_TZ_ONE_DAY_OFFSET);
-                            /* else named zone: use UTC (offset_minutes stays 0) */
-                            break;
-                        }
-                    }
+    if (!imp_sth->out_sqlda || imp_sth->out_sqlda->sqld != s->ncols)
+    {
+        do_error(sth, 0, "ib_fetchall_mmap: the statement no longer matches the rows");
+        return FALSE;
+    }
+    var = imp_sth->out_sqlda->sqlvar;
 
-                    /* Apply timezone offset: convert UTC to local time.
-                     * Handle day boundary crossings by normalizing tm_mday,
-                     * tm_mon, and tm_year to account for month/year rollover. */
-                    {
-#define FB_TZ_IS_LEAP_YEAR(y) (((y)%4==0 && (y)%100!=0) || (y)%400==0)
-#define FB_TZ_DAYS_IN_MONTH(m, y) \
-    ((m)==1 ? (FB_TZ_IS_LEAP_YEAR(y) ? 29 : 28) : \
-    ((m)<7) ? (((m)%2==0) ? 31 : 30) : (((m)%2==0) ? 30 : 31))
-
-                        int total_min = times.tm_hour * 60 + times.tm_min + (int)offset_minutes;
-                        if (total_min < 0) {
-                            total_min += 24 * 60;
-                            times.tm_mday -= 1;
-                            if (times.tm_mday < 1) {
-                                times.tm_mon -= 1;
-                                if (times.tm_mon < 0) {
-                                    times.tm_mon = 11;
-                                    times.tm_year -= 1;
-                                }
-                                times.tm_mday = FB_TZ_DAYS_IN_MONTH(
-                                    times.tm_mon, times.tm_year + 1900);
-                            }
-                        } else if (total_min >= 24 * 60) {
-                            total_min -= 24 * 60;
-                            times.tm_mday += 1;
-                            if (times.tm_mday >
-                                FB_TZ_DAYS_IN_MONTH(times.tm_mon, times.tm_year + 1900))
-                            {
-                                times.tm_mday = 1;
-                                times.tm_mon += 1;
-                                if (times.tm_mon > 11) {
-                                    times.tm_mon = 0;
-                                    times.tm_year += 1;
-                                }
-                            }
-                        }
-                        times.tm_hour = total_min / 60;
-                        times.tm_min  = total_min % 60;
-#undef FB_TZ_IS_LEAP_YEAR
-#undef FB_TZ_DAYS_IN_MONTH
-                    }
+    if (!ib_spill_read(s, s->index + 8 * row, (char *) at, 16))
+    {
+        do_error(sth, 1, "ib_fetchall_mmap: read error");
+        return FALSE;
+    }
 
-                    /* Determine format string */
-                    if (dtype == SQL_TIMESTAMP_TZ || dtype == SQL_TIMESTAMP_TZ_EX)
-                        format = imp_sth->timestampformat ?
-                            imp_sth->timestampformat : imp_dbh->timestampformat;
-                    else
-                        format = imp_sth->timeformat ?
-                            imp_sth->timeformat : imp_dbh->timeformat;
+    if (s->map)
+        p = s->map + at[0];
+    else
+    {
+        if (at[1] - at[0] > s->row_size)
+        {
+            s->row_size = (size_t) (at[1] - at[0]);
+            Renew(s->row, s->row_size, char);
+        }
+        if (!ib_spill_read(s, at[0], s->row, at[1] - at[0]))
+        {
+            do_error(sth, 1, "ib_fetchall_mmap: read error");
+            return FALSE;
+        }
+        p = s->row;
+    }
 
-                    DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth),
-                        "Decode TZ type passed, offset=%d minutes.\n", (int)offset_minutes));
+    {
+        const char *bitmap = p;
 
-                    /* ISO format: YYYY-MM-DD HH:MM:SS.NNNN +HH:MM */
-                    if (!format || strEQ(format, "iso") || strEQ(format, "ISO"))
-                    {
-                        int abs_off = offset_minutes < 0 ? -offset_minutes : offset_minutes;
-                        char tz_str[10];
-                        snprintf(tz_str, sizeof(tz_str), " %c%02d:%02d",
-                                 offset_minutes < 0 ? '-' : '+',
-                                 abs_off / 60, abs_off % 60);
-
-                        if (dtype == SQL_TIMESTAMP_TZ || dtype == SQL_TIMESTAMP_TZ_EX)
-                            snprintf(buf, sizeof(buf),
-                                     "%04d-%02d-%02d %02d:%02d:%02d.%04ld%s",
-                                     times.tm_year + 1900, times.tm_mon + 1,
-                                     times.tm_mday, times.tm_hour, times.tm_min,
-                                     times.tm_sec, fpsec, tz_str);
-                        else
-                            snprintf(buf, sizeof(buf), "%02d:%02d:%02d.%04ld%s",
-                                     times.tm_hour, times.tm_min, times.tm_sec,
-                                     fpsec, tz_str);
+        p += nbytes;
+        for (i = 0; i < s->ncols; i++, var++)
+        {
+            int     null = bitmap[i / 8] & (1 << (i % 8));
+            int     rep = imp_sth->col_rep ? imp_sth->col_rep[i] : IB_COL_DEFAULT;
+            size_t  size = null ? 0 : ib_spill_size(var, p);
+            SV      *sv;
+            XSQLVAR v;
+            ISC_SHORT ind = null ? -1 : 0;
+            U32     len;
+
+            if (col >= 0 && i != col)
+            {
+                p += size;
+                continue;
+            }
+            sv = out[col >= 0 ? 0 : i];
 
-                        sv_setpvn(sv, buf, strlen(buf));
-                        break;
-                    }
+            v = *var;
+            v.sqltype |= 1;
+            v.sqlind = &ind;
+            v.sqldata = (char *) s->value;
 
-                    /* TM format: return as reference to array (like localtime()),
-                     * with two extra elements: fractional seconds and offset minutes */
-                    if (strEQ(format, "tm") || strEQ(format, "TM"))
-                    {
-                        AV *list = newAV();
-                        av_push(list, newSViv(times.tm_sec));
-                        av_push(list, newSViv(times.tm_min));
-                        av_push(list, newSViv(times.tm_hour));
-                        av_push(list, newSViv(times.tm_mday));
-                        av_push(list, newSViv(times.tm_mon));
-                        av_push(list, newSViv(times.tm_year));
-                        av_push(list, newSViv(times.tm_wday));
-                        av_push(list, newSViv(times.tm_yday));
-                        av_push(list, newSViv(times.tm_isdst));
-                        av_push(list, newSViv(fpsec));
-                        av_push(list, newSViv((IV)offset_minutes));
-                        sv_setsv(sv, sv_2mortal(newRV_noinc((SV *) list)));
+            if (!null)
+            {
+                switch (var->sqltype & ~1)
+                {
+                    case SQL_TEXT:
+                        /* the blanks come back for CHAR(n) */
+                        memcpy(&len, p, 4);
+                        memset(v.sqldata, ' ', var->sqllen);
+                        memcpy(v.sqldata, p + 4, len);
                         break;
-                    }
 
-                    /* strftime() format - no timezone info in output */
-                    strftime(buf, sizeof(buf), format, &times);
-                    sv_setpvn(sv, buf, strlen(buf));
-                    break;
+                    case SQL_BLOB:
+                        /* stored whole, not as a BLOB id */
+                        memcpy(&len, p, 4);
+                        sv_setpvn(sv, p + 4, len);
+                        if (IB_COL_REP(rep) != IB_COL_RAW
+                            && var->sqlsubtype == isc_blob_text)
+                            maybe_upgrade_to_utf8(imp_dbh, sv, var->sqlscale & 0xff);
+                        p += size;
+                        if (col >= 0)
+                            return TRUE;
+                        continue;
+
+                    default:
+                        memcpy(v.sqldata, p, size);
                 }
+            }
 
-                case SQL_BLOB:
-                {
-                    isc_blob_handle blob_handle = 0;
-                    int blob_stat;
-                    char blob_info_buffer[32], *p,
-                         blob_segment_buffer[BLOB_SEGMENT];
-                    char blob_info_items[] =
-                    {
-                        isc_info_blob_type,
-                        isc_info_blob_max_segment,
-                        isc_info_blob_total_length
-                    };
-                    long max_segment = -1L, total_length = -1L, t;
-                    unsigned short seg_length;
-                    short blob_type = -1;
-
-                    /* Open the Blob according to the Blob id. */
-                    isc_open_blob2(status, &(imp_dbh->db), &(imp_dbh->tr),
-                                   &blob_handle, (ISC_QUAD *) var->sqldata,
-#if defined(INCLUDE_FB_TYPES_H) || defined(INCLUDE_TYPES_PUB_H) || defined(FIREBIRD_IMPL_TYPES_PUB_H)
-                                   (ISC_USHORT) 0,
-                                   (ISC_UCHAR *) NULL);
-#else
-                                   (short) 0,       /* no Blob filter */
-                                   (char *) NULL);  /* no Blob filter */
-#endif
-
-                    if (ib_error_check(sth, status))
-                        return FALSE;
-
-                    /* query blob information to find out the segment size */
-                    isc_blob_info(status, &blob_handle, sizeof(blob_info_items),
-                                  blob_info_items, sizeof(blob_info_buffer),
-                                  blob_info_buffer);
-
-                    if (ib_error_check(sth, status))
-                    {
-                        isc_cancel_blob(status, &blob_handle);
-                        return FALSE;
-                    }
+            if (!ib_st_decode_var(sth, imp_sth, &v, rep, sv))
+                return FALSE;
+            p += size;
+            if (col >= 0)
+                return TRUE;
+        }
+    }
+    return TRUE;
+}
 
-                    /* Get the information out of the info buffer. */
-                    for (p = blob_info_buffer; *p != isc_info_end; )
-                    {
-                        short length;
-                        char  datum = *p++;
+void ib_spill_close(IB_SPILL *s)
+{
+#ifdef HAS_MMAP
+    if (s->map)
+        munmap(s->map, s->size);
+#endif
+    s->map = NULL;
+    if (s->io)
+        PerlIO_close(s->io);
+    s->io = NULL;
+    if (s->path)
+    {
+        if (!s->keep)
+            PerlLIO_unlink(s->path);
+        Safefree(s->path);
+    }
+    Safefree(s->value);
+    Safefree(s->row);
+}
 
-                        length = (short) isc_vax_integer(p, 2);
-                        p += 2;
-                        switch (datum)
-                        {
-                          case isc_info_blob_max_segment:
-                              max_segment = isc_vax_integer(p, length);
-                              break;
-                          case isc_info_blob_total_length:
-                              total_length = isc_vax_integer(p, length);
-                              break;
-                          case isc_info_blob_type:
-                              blob_type = isc_vax_integer(p, length);
-                              break;
-                          default:
-                              croak("Unknown parameter %d", (int)datum);
-                        }
-                        p += length;
-                    }
+/*
+ * ib_fetch_lazy: a row kept as a copy of the fetch buffers, each column
+ * decoded by ib_st_decode_var the first time it is read.
+ */
 
-                    DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth),
-                                  "dbd_st_fetch: BLOB info - max_segment: %ld, total_length: %ld, type: %d\n",
-                                  max_segment, total_length, blob_type));
+/* the bytes of var in the fetch buffer, aligned for the next column */
+static size_t ib_lazy_size(XSQLVAR *var)
+{
+    size_t n = var->sqllen + ((var->sqltype & ~1) == SQL_VARYING ? 2 : 0);
 
-                    if (max_segment == -1L || total_length == -1L || blob_type == -1)
-                    {
-                        isc_cancel_blob(status, &blob_handle);
-                        do_error(sth, 1, "Cannot determine Blob dimensions or type.");
-                        return FALSE;
-                        break;
-                    }
+    return (n + 7) & ~(size_t) 7;
+}
 
-                    /* if maximum segment size is zero, don't pass it to isc_get_segment()  */
-                    if (max_segment == 0)
-                    {
-                        sv_setpv(sv, "");
-                        isc_cancel_blob(status, &blob_handle);
-                        if (ib_error_check(sth, status))
-                            return FALSE;
-                        break;
-                    }
+/*
+ * Fetches the next row into r. Returns 1 for a row, 0 at the end of the
+ * result set and -1 on error.
+ */
+int ib_st_fetch_lazy(SV *sth, imp_sth_t *imp_sth, IB_LAZY_ROW *r)
+{
+    XSQLVAR *var;
+    size_t  size = 0, off = 0;
+    int     i, rc;
 
-                    if ((DBIc_LongReadLen(imp_sth) < (unsigned long) total_length) &&
-                        (! DBIc_is(imp_dbh, DBIcf_LongTruncOk)))
-                    {
-                        isc_close_blob(status, &blob_handle);
-                        do_error(sth, 1, "Not enough LongReadLen buffer.");
-                        return FALSE;
-                        break;
-                    }
+    DBI_TRACE_imp_xxh(imp_sth, 3, (DBIc_LOGPIO(imp_sth), "ib_st_fetch_lazy\n"));
 
-                    /* Create a zero-length string. */
-                    sv_setpv(sv, "");
+    Zero(r, 1, IB_LAZY_ROW);
 
-                    t = total_length;
-                    while (1)
-                    {
-                        blob_stat = isc_get_segment(status, &blob_handle,
-                                                    &seg_length,
-                                                    (short) BLOB_SEGMENT,
-                                                    blob_segment_buffer);
+    if (!imp_sth->out_sqlda || !imp_sth->out_sqlda->sqld)
+    {
+        do_error(sth, 0, "ib_fetch_lazy: statement returns no rows");
+        return -1;
+    }
 
-                        if (status[1] == isc_segstr_eof)
-                            break;
+    rc = ib_st_fetch_row(sth, imp_sth);
+    if (rc <= 0)
+        return rc;
 
-                        if (status[1] != isc_segment)
-                            if (ib_error_check(sth, status))
-                            {
-                                isc_cancel_blob(status, &blob_handle);
-                                return FALSE;
-                            }
+    r->ncols = imp_sth->out_sqlda->sqld;
+    for (i = 0, var = imp_sth->out_sqlda->sqlvar; i < r->ncols; i++, var++)
+        size += ib_lazy_size(var);
 
-                        if (seg_length > DBIc_LongReadLen(imp_sth))
-                             break;
+    /* the values as ISC_UINT64 for their alignment */
+    Newx(r->image, size / 8, ISC_UINT64);
+    Newx(r->ind, r->ncols, ISC_SHORT);
+    Newxz(r->memo, r->ncols, SV *);
 
-    /*
-     * As long as the fetch was successful, concatenate the segment we fetched
-     * into the growing Perl scalar.
-     */
+    for (i = 0, var = imp_sth->out_sqlda->sqlvar; i < r->ncols; i++, var++)
+    {
+        size_t n = var->sqllen + ((var->sqltype & ~1) == SQL_VARYING ? 2 : 0);
 
-                        sv_catpvn(sv, blob_segment_buffer, seg_length);
-                        t -= seg_length;
+        memcpy((char *) r->image + off, var->sqldata, n);
+        r->ind[i] = (var->sqltype & 1) ? *(var->sqlind) : 0;
+        off += ib_lazy_size(var);
+    }
 
-                        if (t <= 0) break;
-                        if (blob_stat == 100) break;
-                    }
+    imp_sth->affected += 1;
+    return 1;
+}
 
-                    /* Clean up after ourselves. */
-                    isc_close_blob(status, &blob_handle);
-                    if (ib_error_check(sth, status))
-                        return FALSE;
+/*
+ * Returns the value of column col, decoding it the first time, or NULL on
+ * error.
+ */
+SV *ib_lazy_column(SV *sth, imp_sth_t *imp_sth, IB_LAZY_ROW *r, int col)
+{
+    XSQLVAR *var, v;
+    size_t  off = 0;
+    int     i;
 
-                    if ( blob_type == isc_blob_text
-                            || var->sqlsubtype == isc_blob_text )
-                        maybe_upgrade_to_utf8(imp_dbh, sv);
+    if (r->memo[col])
+        return r->memo[col];
 
-                    break;
-                }
+    if (!imp_sth->out_sqlda || imp_sth->out_sqlda->sqld != r->ncols)
+    {
+        do_error(sth, 0, "ib_fetch_lazy: the statement no longer matches the row");
+        return NULL;
+    }
 
-                case SQL_ARRAY:
-#ifdef ARRAY_SUPPORT
-            !!! NOT IMPLEMENTED YET !!!
-#else
-                    sv_setpvn(sv, "** array **", 11);
-#endif
-                    break;
+    var = imp_sth->out_sqlda->sqlvar;
+    for (i = 0; i < col; i++)
+        off += ib_lazy_size(var + i);
 
-                default:
-                    sv_setpvn(sv, "** unknown **", 13);
-            }
+    v = var[col];
+    v.sqldata = (char *) r->image + off;
+    v.sqlind  = r->ind + col;
 
-        /*
-         * I use the column's alias name because in the absence
-         * of an alias, it contains the column name anyway.
-         * Only if the alias AND the column names are zero-length
-         * do I want to use a generic "COLUMN%d" header.
-         * This happens, for example, when the column is a
-         * computed field and the query doesn't use an AS clause
-         * to label the column.
-         */
-/*
-            if (var->aliasname_length > 0)
-            {
-                sv_setpvn(sv, var->aliasname, var->aliasname_length));
-            }
-            else
-            {
-                char s[20];
-                snprintf(s, sizeof(s), "COLUMN%d", i);
-                sv_setpvn(sv, s, strlen(s));
-            }
-*/
-        }
+    r->memo[col] = newSV(0);
+    if (!ib_st_decode_var(sth, imp_sth, &v,
+                          imp_sth->col_rep ? imp_sth->col_rep[col] : IB_COL_DEFAULT,
+                          r->memo[col]))
+    {
+        SvREFCNT_dec(r->memo[col]);
+        r->memo[col] = NULL;
+        return NULL;
     }
-    imp_sth->affected += 1;
-    return av;
+    return r->memo[col];
 }
 
+void ib_lazy_free(IB_LAZY_ROW *r)
+{
+    int i;
+
+    if (r->memo)
+        for (i = 0; i < r->ncols; i++)
+            SvREFCNT_dec(r->memo[i]);
+    Safefree(r->memo);
+    Safefree(r->ind);
+    Safefree(r->image);
+}
 
 
 void dbd_st_destroy(SV *sth, imp_sth_t *imp_sth)
@@ -2081,8 +7779,23 @@ void dbd_st_destroy(SV *sth, imp_sth_t *imp_sth)
 
     DBI_TRACE_imp_xxh(imp_dbh, 2, (DBIc_LOGPIO(imp_dbh), "dbd_st_destroy\n"));
 
+    ib_async_abandon(sth, imp_dbh, imp_sth);
+    ib_pipe_stop(imp_sth);
+
     /* freeing cursor name */
     FREE_SETNULL(imp_sth->cursor_name);
+    FREE_SETNULL(imp_sth->col_rep);
+
+    if (imp_sth->col_keys)
+    {
+        SvREFCNT_dec((SV*)imp_sth->col_keys);
+        imp_sth->col_keys = NULL;
+    }
+    if (imp_sth->hash_keys)
+    {
+        SvREFCNT_dec((SV*)imp_sth->hash_keys);
+        imp_sth->hash_keys = NULL;
+    }
 
     if ( imp_sth->param_values != NULL ) {
         hv_undef(imp_sth->param_values);
@@ -2232,26 +7945,14 @@ SV* dbd_st_FETCH_attrib(SV *sth, imp_sth_t *imp_sth, SV *keysv)
     {
         AV *av;
 
-        if (!imp_sth->in_sqlda || !imp_sth->out_sqlda)
+        if (!imp_sth->in_sqlda || !imp_sth->out_sqlda || !imp_sth->col_keys)
             return Nullsv;
 
+        /* copies of shared-key SVs share the HEK too */
         av = newAV();
         result = newRV_inc(sv_2mortal((SV*)av));
         while(--i >= 0)
-        {
-            if (imp_sth->out_sqlda->sqlvar[i].aliasname_length > 0)
-            {
-                av_store(av, i,
-                         newSVpvn(imp_sth->out_sqlda->sqlvar[i].aliasname,
-                         imp_sth->out_sqlda->sqlvar[i].aliasname_length));
-            }
-            else
-            {
-                char s[20];
-                snprintf(s, sizeof(s), "COLUMN%d", i);
-                av_store(av, i, newSVpvn(s, strlen(s)));
-            }
-        }
+            av_store(av, i, newSVsv(AvARRAY(imp_sth->col_keys)[i]));
     }
     /**************************************************************************/
     else if (kl==8 && strEQ(key, "NULLABLE"))
@@ -2280,6 +7981,29 @@ SV* dbd_st_FETCH_attrib(SV *sth, imp_sth_t *imp_sth, SV *keysv)
             return Nullsv;
 	result = newRV_inc((SV*)imp_sth->param_values);
     }
+    /**************************************************************************/
+    else if (kl==13 && strEQ(key, "ib_bound_only"))
+    {
+        result = newSViv(imp_sth->bound_only ? 1 : 0);
+        cacheit = FALSE;
+    }
+    else if (kl==13 && strEQ(key, "ib_timeout_ms"))
+    {
+        D_imp_dbh_from_sth;
+        result = newSVuv(imp_sth->timeout_set ? imp_sth->timeout_ms
+                                              : imp_dbh->timeout_ms);
+        cacheit = FALSE;
+    }
+    else if (kl==11 && strEQ(key, "ib_pipeline"))
+    {
+        result = newSVuv(imp_sth->pipe_rows);
+        cacheit = FALSE;
+    }
+    else if (kl==17 && strEQ(key, "ib_pipeline_bytes"))
+    {
+        result = newSVuv(imp_sth->pipe_bytes);
+        cacheit = FALSE;
+    }
     else
         return Nullsv;
 
@@ -2301,6 +8025,30 @@ int dbd_st_STORE_attrib(SV *sth, imp_sth_t *imp_sth, SV *keysv, SV *valuesv)
 
     DBI_TRACE_imp_xxh(imp_sth, 2, (DBIc_LOGPIO(imp_sth), "dbd_st_STORE - %s\n", key));
 
+    if ((kl==13) && strEQ(key, "ib_bound_only"))
+    {
+        imp_sth->bound_only = SvTRUE(valuesv);
+        return TRUE;
+    }
+    else if ((kl==13) && strEQ(key, "ib_timeout_ms"))
+    {
+        /* undef goes back to the dbh's value */
+        imp_sth->timeout_set = SvOK(valuesv);
+        imp_sth->timeout_ms  = ib_timeout_value(valuesv);
+        return TRUE;
+    }
+    else if ((kl==11) && strEQ(key, "ib_pipeline"))
+    {
+        /* from the next execute on */
+        imp_sth->pipe_rows = ib_pipe_value(valuesv, "ib_pipeline");
+        return TRUE;
+    }
+    else if ((kl==17) && strEQ(key, "ib_pipeline_bytes"))
+    {
+        imp_sth->pipe_bytes = ib_pipe_value(valuesv, "ib_pipeline_bytes");
+        return TRUE;
+    }
+
     return FALSE;
 }
 
@@ -2351,6 +8099,12 @@ int ib_blob_write(SV *sth, imp_sth_t *imp_sth, XSQLVAR *var, SV *value)
 
     is_text_blob = (var->sqlsubtype == isc_bpb_type_stream)? 1: 0; /* SUBTYPE TEXT */
 
+    if (is_text_blob && (value = ib_xlat_param(sth, imp_dbh, value)) == NULL)
+    {
+        isc_cancel_blob(status, &handle);
+        return FALSE;
+    }
+
     /* get length, pointer to data */
     string = SvPV(value, total_length);
 
@@ -2411,6 +8165,7 @@ int ib_blob_write(SV *sth, imp_sth_t *imp_sth, XSQLVAR *var, SV *value)
 static int ib_fill_isqlda(SV *sth, imp_sth_t *imp_sth, SV *param, SV *value,
                           IV sql_type)
 {
+    D_imp_dbh_from_sth;
     STRLEN     len;
     XSQLVAR    *ivar;
     int        retval;
@@ -2496,8 +8251,9 @@ static int ib_fill_isqlda(SV *sth, imp_sth_t *imp_sth, SV *param, SV *value,
     /* workaround for date problem (bug #429820) */
     if (dtype == SQL_TEXT)
     {
-        if (ivar->sqlsubtype == 0x77)
-            dtype = SQL_TIMESTAMP;
+        int described = ib_datetime_from_text_subtype(ivar->sqlsubtype);
+        if (described)
+            dtype = described;
     }
 
     switch (dtype)
@@ -2509,6 +8265,11 @@ static int ib_fill_isqlda(SV *sth, imp_sth_t *imp_sth, SV *param, SV *value,
             char *string;
             STRLEN len;
 
+            if ((value = ib_xlat_param(sth, imp_dbh, value)) == NULL)
+            {
+                retval = FALSE;
+                break;
+            }
             string = SvPV(value, len);
 
             if (len > ivar->sqllen) {
@@ -2532,6 +8293,11 @@ static int ib_fill_isqlda(SV *sth, imp_sth_t *imp_sth, SV *param, SV *value,
             char *string;
             STRLEN len;
 
+            if ((value = ib_xlat_param(sth, imp_dbh, value)) == NULL)
+            {
+                retval = FALSE;
+                break;
+            }
             string = SvPV(value, len);
 
             if (len > ivar->sqllen) {
@@ -2791,6 +8557,55 @@ static int ib_fill_isqlda(SV *sth, imp_sth_t *imp_sth, SV *param, SV *value,
         }
 #endif
 
+        /**********************************************************************/
+        /*
+         * INT128 and DECFLOAT values are parsed from their text, so no
+         * digits are lost on the way; with ib_fast_int, a plain integer
+         * goes straight into an INT128 without a scale.
+         */
+        case SQL_INT128:
+        case SQL_DEC16:
+        case SQL_DEC34:
+            DBI_TRACE_imp_xxh(imp_sth, 1, (DBIc_LOGPIO(imp_sth), "ib_fill_isqlda: INT128/DECFLOAT type %d\n", dtype));
+
+        {
+            IB_DECIMAL d;
+            char       *svalue;
+
+            if (!(ivar->sqldata))
+                Newxc(ivar->sqldata, ivar->sqllen, char, ISC_SCHAR);
+
+            if (dtype == SQL_INT128 && !ivar->sqlscale && imp_dbh->fast_int
+                && SvIOK(value) && !SvPOK(value))
+            {
+                FB_I128 *v = (FB_I128 *) ivar->sqldata;
+                IV      iv = SvIVX(value);
+
+                v->fb_data[IB_W128_LO] = (ISC_UINT64) iv;
+                v->fb_data[IB_W128_HI] = (iv < 0 && !SvIsUV(value)) ? ~(ISC_UINT64) 0 : 0;
+                break;
+            }
+
+            svalue = SvPV(value, len);
+            if (!ib_dec_parse(svalue, len, &d)
+                || !(dtype == SQL_INT128
+                     ? ib_int128_pack(&d, ivar->sqlscale, (FB_I128 *) ivar->sqldata)
+                     : ib_decfloat_pack(&d, dtype == SQL_DEC34, (ISC_UINT64 *) ivar->sqldata)))
+            {
+                char err[ERRBUFSIZE];
+
+                if (dtype == SQL_INT128)
+                    snprintf(err, sizeof(err), "Cannot convert '%.40s' to NUMERIC(38,%d)",
+                             svalue, -ivar->sqlscale);
+                else
+                    snprintf(err, sizeof(err), "Cannot convert '%.40s' to DECFLOAT(%d)",
+                             svalue, dtype == SQL_DEC34 ? 34 : 16);
+                do_error(sth, 2, err);
+                retval = FALSE;
+            }
+            break;
+        }
+
         /**********************************************************************/
         case SQL_FLOAT:
             DBI_TRACE_imp_xxh(imp_sth, 1, (DBIc_LOGPIO(imp_sth), "ib_fill_isqlda: SQL_FLOAT\n"));
@@ -2813,49 +8628,56 @@ static int ib_fill_isqlda(SV *sth, imp_sth_t *imp_sth, SV *param, SV *value,
             break;
 
         /**********************************************************************/
+        /*
+         * Date/time values are encoded by the driver from
+         *   - ISO 8601 strings: '2020-02-03 20:00:00.0000', '20:00',
+         *     '2020-02-03T20:00:00Z', '2020-02-03 20:00:00 -05:00'
+         *   - numbers: seconds since 1970-01-01 00:00:00 UTC
+         *   - localtime() style array refs (not for the TZ types)
+         * so the parameter keeps its described type. Other strings, like
+         * '2020-02-03 20:00:00 America/New_York', 'NOW' or '3.2.2020',
+         * are coerced to CHAR and parsed by the server.
+         *
+         * Firebird 4.0+ TIMESTAMP/TIME WITH TIME ZONE need an explicit zone
+         * in the string, as the session time zone is only known to the
+         * server. Numbers are bound as GMT.
+         */
         case SQL_TIMESTAMP:
         case SQL_TYPE_TIME:
         case SQL_TYPE_DATE:
-            if (SvPOK(value) || SvTYPE(value) == SVt_PVMG)
-            {
-                /*
-                 * Coerce the date literal into a CHAR string, so as
-                 * to allow Firebird's internal date-string parsing
-                 * to interpret the date.
-                 */
-                char *datestring = SvPV(value, len);
-
-                ivar->sqltype = SQL_TEXT | (ivar->sqltype & 1);
-
-                /* prevent overflow */
-                if (len > 100) {
-                    do_error(sth, 2, "DATE input parameter too long, but will try...\n");
-                    len = 100;
-                }
+        case SQL_TIMESTAMP_TZ:
+        case SQL_TIMESTAMP_TZ_EX:
+        case SQL_TIME_TZ:
+        case SQL_TIME_TZ_EX:
+        {
+            ISC_DATE date = 0;
+            ISC_TIME time = 0;
+            int      parts = 0, offset = 0, native = 0, from_epoch = 0;
+            int      with_tz = (dtype == SQL_TIMESTAMP_TZ || dtype == SQL_TIMESTAMP_TZ_EX
+                                || dtype == SQL_TIME_TZ || dtype == SQL_TIME_TZ_EX);
+            char     *datestring = NULL;
 
-                /* workaround for date problem (bug #429820) */
-                ivar->sqlsubtype = 0x77; /* (0x77 is a random value) */
+            DBI_TRACE_imp_xxh(imp_sth, 1, (DBIc_LOGPIO(imp_sth),
+                "ib_fill_isqlda: date/time type %d\n", dtype));
 
-                ivar->sqllen = len;
-                /*
-                 * I should not allocate based on len, I should allocate
-                 * a fixed length based on the max date/time string.
-                 * For now let's just call it 100.  Okay, 101.
-                 */
-                if (!(ivar->sqldata))
-                    Newx(ivar->sqldata, 101, ISC_SCHAR);
-                Copy(datestring, ivar->sqldata, len, ISC_SCHAR);
-                ivar->sqldata[len] = '\0';
-            }
-            else if (SvROK(value))
+            if (SvROK(value))
             {
-                struct tm times;               /* unix time struct    */
                 AV *list = (AV *) SvRV(value); /* AV with time items  */
                 SV **svp = AvARRAY(list);      /* AV as a C array     */
                 int items = av_len(list) + 1;  /* item count in array */
 
+                if (with_tz || SvTYPE(list) != SVt_PVAV)
+                {
+                    do_error(sth, 2,
+                        "TIMESTAMP/TIME WITH TIME ZONE binding requires a string value "
+                        "(e.g. '2020-02-03 20:00:00.0000 -05:00' or "
+                        "'2020-02-03 20:00:00.0000 America/New_York') or a number");
+                    retval = FALSE;
+                    break;
+                }
+
                 /* check if we have enough items in the list */
-                if (items < 5) /* we ignore wday, yday, isdst */
+                if (items < 6) /* we ignore wday, yday, isdst */
                 {
                     do_error(sth, 2, "Cannot bind date/time value. Not enough"
                                      "items in localtime() style array");
@@ -2863,119 +8685,170 @@ static int ib_fill_isqlda(SV *sth, imp_sth_t *imp_sth, SV *param, SV *value,
                     break;
                 }
 
-                /* fill in struct tm fields */
-                times.tm_sec  = SvIV(svp[0]);
-                times.tm_min  = SvIV(svp[1]);
-                times.tm_hour = SvIV(svp[2]);
-                times.tm_mday = SvIV(svp[3]);
-                times.tm_mon  = SvIV(svp[4]);
-                times.tm_year = SvIV(svp[5]);
-
-                /* free ivar->sqldata (prior call wasn't necessary an localtimes
-                 * style list) */
-                if (ivar->sqldata)
-                    Safefree(ivar->sqldata);
+                /* sec, min, hour, mday, mon, year [, wday, yday, isdst, fpsec] */
+                date = (ISC_DATE) (ib_days_from_civil(SvIV(svp[5]) + 1900,
+                                                      (int) SvIV(svp[4]) + 1,
+                                                      (int) SvIV(svp[3]))
+                                   + IB_MJD_UNIX_EPOCH);
+                time = (ISC_TIME) ((SvIV(svp[2]) * 3600 + SvIV(svp[1]) * 60
+                                    + SvIV(svp[0])) * ISC_TIME_SECONDS_PRECISION);
+                if (items >= 10)
+                    time += SvIV(svp[9]) % ISC_TIME_SECONDS_PRECISION;
+
+                native = 1;
+            }
+            else if (SvPOK(value) || SvTYPE(value) == SVt_PVMG)
+            {
+                datestring = SvPV(value, len);
+                parts = ib_parse_iso(datestring, len, &date, &time, &offset);
 
-                /* encode for firebird/interbase, store value*/
-                switch (dtype)
+                if (parts < 0)
                 {
-                    case SQL_TIMESTAMP:
-                    {
-                        ISC_TIMESTAMP timestamp;
-                        isc_encode_timestamp(&times, &timestamp);
-
-                        Newxc(ivar->sqldata, 1, ISC_TIMESTAMP, ISC_SCHAR);
-
-                        if (items >= 10)
-                            TIMESTAMP_ADD_FPSECS(&timestamp, SvIV(svp[9]));
+                    do_error(sth, 2, "Cannot bind date/time value. "
+                                     "'T' is not followed by a time");
+                    retval = FALSE;
+                    break;
+                }
+                if (!parts && imp_dbh->bind_epoch && looks_like_number(value))
+                    from_epoch = 1;
+            }
+            else if (SvNIOK(value))
+            {
+                /* numbers are only epoch seconds when asked for */
+                if (imp_dbh->bind_epoch)
+                    from_epoch = 1;
+                else
+                    datestring = SvPV(value, len);
+            }
 
-                        *(ISC_TIMESTAMP *) ivar->sqldata = timestamp;
+            if (from_epoch)
+            {
+                ib_epoch_to_timestamp(value, &date, &time);
+                native = 1;
+            }
+            else if (parts)
+            {
+                int zone = parts & (IB_ISO_OFFSET | IB_ISO_UTC);
 
+                switch (dtype)
+                {
+                    case SQL_TYPE_DATE:
+                        native = parts == IB_ISO_DATE;
                         break;
-                    }
-
                     case SQL_TYPE_TIME:
-                    {
-                        ISC_TIME sql_time;
-                        isc_encode_sql_time(&times, &sql_time);
-
-                        Newxc(ivar->sqldata, 1, ISC_TIME, ISC_SCHAR);
-
-                        if (items >= 10)
-                            TIME_ADD_FPSECS(&sql_time, SvIV(svp[9]));
-
-                        *(ISC_TIME *) ivar->sqldata = sql_time;
-
+                        native = parts == IB_ISO_TIME;
                         break;
-                    }
-
-                    case SQL_TYPE_DATE:
-                    {
-                        ISC_DATE sql_date;
-                        isc_encode_sql_date(&times, &sql_date);
-
-                        Newxc(ivar->sqldata, 1, ISC_DATE, ISC_SCHAR);
-                        *(ISC_DATE *) ivar->sqldata = sql_date;
-
+                    case SQL_TIMESTAMP:
+                        native = (parts & IB_ISO_DATE) && !zone;
+                        break;
+                    case SQL_TIME_TZ:
+                    case SQL_TIME_TZ_EX:
+                        native = !(parts & IB_ISO_DATE) && zone;
+                        break;
+                    default: /* SQL_TIMESTAMP_TZ */
+                        native = (parts & IB_ISO_DATE) && zone;
                         break;
-                    }
                 }
             }
-            break;
-
-
-        /**********************************************************************/
-        /*
-         * Firebird 4.0+: TIMESTAMP WITH TIME ZONE and TIME WITH TIME ZONE
-         *
-         * Binding is done by converting the column type to SQL_TEXT and
-         * letting Firebird's server-side parser interpret the string literal.
-         * Accepted string formats (examples):
-         *   TIMESTAMP: '2020-02-03 20:00:00.0000 America/New_York'
-         *              '2020-02-03 20:00:00.0000 -05:00'
-         *   TIME:      '20:00:00.0000 America/New_York'
-         *              '20:00:00.0000 -05:00'
-         */
-        case SQL_TIMESTAMP_TZ:
-        case SQL_TIMESTAMP_TZ_EX:
-        case SQL_TIME_TZ:
-        case SQL_TIME_TZ_EX:
-            DBI_TRACE_imp_xxh(imp_sth, 1, (DBIc_LOGPIO(imp_sth),
-                "ib_fill_isqlda: SQL_TIMESTAMP_TZ/SQL_TIME_TZ\n"));
 
-            if (SvPOK(value) || SvTYPE(value) == SVt_PVMG)
+            if (!native && datestring)
             {
                 /*
-                 * Coerce to CHAR string, letting Firebird parse the
-                 * timezone literal (e.g. "2020-02-03 20:00:00 -05:00").
+                 * Coerce the date literal into a CHAR string, so as
+                 * to allow Firebird's internal date-string parsing
+                 * to interpret the date.
                  */
-                char *datestring = SvPV(value, len);
-
-                ivar->sqltype = SQL_TEXT | (ivar->sqltype & 1);
-
-                /* prevent overflow: TZ strings can be longer than plain timestamps */
                 if (len > MAX_DATETIME_CHAR_LEN) {
-                    do_error(sth, 2, "TIMESTAMP/TIME WITH TIME ZONE input too long\n");
+                    do_error(sth, 2, "Date/time input parameter too long\n");
                     retval = FALSE;
                     break;
                 }
 
-                ivar->sqlsubtype = 0x77; /* workaround for date problem (bug #429820) */
-                ivar->sqllen = len;
+                ivar->sqltype    = SQL_TEXT | (ivar->sqltype & 1);
+                ivar->sqlsubtype = ib_datetime_text_subtype(dtype);
+                ivar->sqllen     = len;
+
                 if (!(ivar->sqldata))
                     Newx(ivar->sqldata, MAX_DATETIME_CHAR_LEN + 1, ISC_SCHAR);
                 Copy(datestring, ivar->sqldata, len, ISC_SCHAR);
                 ivar->sqldata[len] = '\0';
+                break;
             }
-            else
+
+            if (!native)
             {
-                do_error(sth, 2,
-                    "TIMESTAMP/TIME WITH TIME ZONE binding requires a string value "
-                    "(e.g. '2020-02-03 20:00:00.0000 -05:00' or "
-                    "'2020-02-03 20:00:00.0000 America/New_York')");
+                do_error(sth, 2, "Cannot bind date/time value. Expected a "
+                                 "string, a number or a localtime() style array");
                 retval = FALSE;
+                break;
+            }
+
+            /* back to the described type if the last value went as text */
+            ivar->sqltype    = dtype | (ivar->sqltype & 1);
+            ivar->sqlsubtype = 0;
+
+            /* one buffer fits both the text and the binary forms */
+            if (!(ivar->sqldata))
+                Newx(ivar->sqldata, MAX_DATETIME_CHAR_LEN + 1, ISC_SCHAR);
+
+            switch (dtype)
+            {
+                case SQL_TIMESTAMP:
+                    ((ISC_TIMESTAMP *) ivar->sqldata)->timestamp_date = date;
+                    ((ISC_TIMESTAMP *) ivar->sqldata)->timestamp_time = time;
+                    ivar->sqllen = sizeof(ISC_TIMESTAMP);
+                    break;
+
+                case SQL_TYPE_DATE:
+                    *(ISC_DATE *) ivar->sqldata = date;
+                    ivar->sqllen = sizeof(ISC_DATE);
+                    break;
+
+                case SQL_TYPE_TIME:
+                    *(ISC_TIME *) ivar->sqldata = time;
+                    ivar->sqllen = sizeof(ISC_TIME);
+                    break;
+
+                case SQL_TIMESTAMP_TZ:
+                case SQL_TIMESTAMP_TZ_EX:
+                case SQL_TIME_TZ:
+                case SQL_TIME_TZ_EX:
+                {
+                    /* the value is local to its zone, store it as UTC */
+                    ISC_USHORT zone = FB_TZ_GMT_ZONE;
+
+                    if (parts & IB_ISO_OFFSET)
+                    {
+                        ib_shift_timestamp(&date, &time, -offset);
+                        zone = (ISC_USHORT) (offset + FB_TZ_ONE_DAY_OFFSET);
+                    }
+
+                    if (dtype == SQL_TIME_TZ || dtype == SQL_TIME_TZ_EX)
+                    {
+                        ISC_TIME_TZ_EX *t = (ISC_TIME_TZ_EX *) ivar->sqldata;
+                        t->utc_time  = time;
+                        t->time_zone = zone;
+                        if (dtype == SQL_TIME_TZ_EX)
+                            t->ext_offset = (ISC_SHORT) offset;
+                        ivar->sqllen = dtype == SQL_TIME_TZ_EX ?
+                            sizeof(ISC_TIME_TZ_EX) : sizeof(ISC_TIME_TZ);
+                    }
+                    else
+                    {
+                        ISC_TIMESTAMP_TZ_EX *ts = (ISC_TIMESTAMP_TZ_EX *) ivar->sqldata;
+                        ts->utc_timestamp.timestamp_date = date;
+                        ts->utc_timestamp.timestamp_time = time;
+                        ts->time_zone = zone;
+                        if (dtype == SQL_TIMESTAMP_TZ_EX)
+                            ts->ext_offset = (ISC_SHORT) offset;
+                        ivar->sqllen = dtype == SQL_TIMESTAMP_TZ_EX ?
+                            sizeof(ISC_TIMESTAMP_TZ_EX) : sizeof(ISC_TIMESTAMP_TZ);
+                    }
+                    break;
+                }
             }
             break;
+        }
 
 
         /**********************************************************************/
@@ -3039,6 +8912,66 @@ int dbd_bind_ph(SV *sth, imp_sth_t *imp_sth, SV *param, SV *value,
 }
 
 
+/*
+   Makes profile (a compiled TPB, or NULL for tpb_buffer) the one of the
+   transactions that follow. Inside the transaction begun with an
+   ib_profile, it is the one selected when that transaction ends.
+ */
+void ib_select_tx_profile(imp_dbh_t *imp_dbh, SV *profile)
+{
+    SV **slot = imp_dbh->tx_profile_once ? &imp_dbh->tx_profile_prev
+                                         : &imp_dbh->tx_profile;
+
+    if (*slot)
+        SvREFCNT_dec(*slot);
+    *slot = profile ? SvREFCNT_inc(profile) : NULL;
+}
+
+
+/*
+   begin_work with an ib_profile: the transaction it starts must use the
+   profile. A transaction still open under AutoCommit, as ib_softcommit
+   keeps one, has nothing left to commit, so it is committed for real for
+   the next one to start with the profile; this would close an open cursor,
+   which is refused. The commit and rollback ending the transaction are
+   hard ones too, and then the profile selected before comes back.
+ */
+int ib_begin_tx_profile(SV *h, imp_dbh_t *imp_dbh, SV *profile)
+{
+    if (imp_dbh->tr)
+    {
+        imp_sth_t *sth;
+        int ok;
+
+        for (sth = imp_dbh->first_sth; sth != NULL; sth = sth->next_sth)
+        {
+            if (DBIc_ACTIVE(sth))
+            {
+                do_error(h, 2, "begin_work: ib_profile cannot be applied while "
+                               "a statement is being fetched");
+                return FALSE;
+            }
+        }
+
+        if (ib_async_busy(h, imp_dbh))
+            return FALSE;
+
+        imp_dbh->tx_profile_once = 1;
+        ok = ib_commit_transaction(h, imp_dbh);
+        imp_dbh->tx_profile_once = 0;
+        if (!ok)
+            return FALSE;
+    }
+
+    ib_end_tx_profile(imp_dbh);
+    imp_dbh->tx_profile_prev = imp_dbh->tx_profile;
+    imp_dbh->tx_profile      = SvREFCNT_inc(profile);
+    imp_dbh->tx_profile_once = 1;
+
+    return TRUE;
+}
+
+
 int ib_start_transaction(SV *h, imp_dbh_t *imp_dbh)
 {
     ISC_STATUS status[ISC_STATUS_LENGTH];
@@ -3052,18 +8985,70 @@ int ib_start_transaction(SV *h, imp_dbh_t *imp_dbh)
     /* MUST initialized to 0, before it is used */
     imp_dbh->tr = 0L;
 
-    isc_start_transaction(status, &(imp_dbh->tr), 1, &(imp_dbh->db),
-                          imp_dbh->tpb_length, imp_dbh->tpb_buffer);
+    if (imp_dbh->tx_profile)
+    {
+        /* precompiled by ib_define_tx_profile() */
+        isc_start_transaction(status, &(imp_dbh->tr), 1, &(imp_dbh->db),
+                              (unsigned short) SvCUR(imp_dbh->tx_profile),
+                              SvPVX(imp_dbh->tx_profile));
+    }
+    else
+        isc_start_transaction(status, &(imp_dbh->tr), 1, &(imp_dbh->db),
+                              imp_dbh->tpb_length, imp_dbh->tpb_buffer);
 
     if (ib_error_check(h, status))
         return FALSE;
 
+    imp_dbh->tr_started      = time(NULL);
+    imp_dbh->tr_soft_commits = 0;
+
     DBI_TRACE_imp_xxh(imp_dbh, 3, (DBIc_LOGPIO(imp_dbh), "ib_start_transaction: transaction started.\n"));
 
     return TRUE;
 }
 
 
+/*
+   Has the transaction kept open by soft commits reached one of the
+   ib_softcommit_max_* limits? A retaining transaction pins the oldest
+   interesting transaction, so from time to time it must be committed for
+   real. This is only done while no cursor is open, as a hard commit would
+   close it; the check is simply repeated on the next commit.
+ */
+static int ib_softcommit_expired(imp_dbh_t *imp_dbh)
+{
+    imp_sth_t *sth;
+    int expired = 0;
+
+    if (imp_dbh->softcommit_max_commits
+        && imp_dbh->tr_soft_commits + 1 >= imp_dbh->softcommit_max_commits)
+        expired = 1;
+
+    if (imp_dbh->softcommit_max_age
+        && time(NULL) - imp_dbh->tr_started >= (time_t) imp_dbh->softcommit_max_age)
+        expired = 1;
+
+    if (!expired)
+        return FALSE;
+
+    for (sth = imp_dbh->first_sth; sth != NULL; sth = sth->next_sth)
+    {
+        if (DBIc_ACTIVE(sth))
+        {
+            DBI_TRACE_imp_xxh(imp_dbh, 3, (DBIc_LOGPIO(imp_dbh),
+                "ib_softcommit_expired: limit reached, but a cursor is open.\n"));
+            return FALSE;
+        }
+    }
+
+    DBI_TRACE_imp_xxh(imp_dbh, 3, (DBIc_LOGPIO(imp_dbh),
+        "ib_softcommit_expired: %u soft commits, %ld seconds old, forcing hard commit.\n",
+        imp_dbh->tr_soft_commits, (long)(time(NULL) - imp_dbh->tr_started)));
+
+    return TRUE;
+}
+
+
 int ib_commit_transaction(SV *h, imp_dbh_t *imp_dbh)
 {
     ISC_STATUS status[ISC_STATUS_LENGTH];
@@ -3084,7 +9069,8 @@ int ib_commit_transaction(SV *h, imp_dbh_t *imp_dbh)
     }
 
     /* do commit */
-    if ((imp_dbh->sth_ddl == 0) && (imp_dbh->soft_commit))
+    if ((imp_dbh->sth_ddl == 0) && (imp_dbh->soft_commit)
+        && !imp_dbh->tx_profile_once && !ib_softcommit_expired(imp_dbh))
     {
         DBI_TRACE_imp_xxh(imp_dbh, 2, (DBIc_LOGPIO(imp_dbh), "try isc_commit_retaining\n"));
 
@@ -3093,12 +9079,16 @@ int ib_commit_transaction(SV *h, imp_dbh_t *imp_dbh)
 
         if (ib_error_check(h, status))
             return FALSE;
+
+        imp_dbh->tr_soft_commits++;
     }
     else
     {
         /* close all open statement handles */
         /* if ((imp_dbh->sth_ddl > 0) || !(DBIc_has(imp_dbh, DBIcf_AutoCommit))) */
         /* remark: only necessary when we have DDL statement(s) */
+        int had_ddl = imp_dbh->sth_ddl > 0;
+
         if (imp_dbh->sth_ddl > 0)
         {
             while (imp_dbh->first_sth != NULL)
@@ -3121,6 +9111,10 @@ int ib_commit_transaction(SV *h, imp_dbh_t *imp_dbh)
             return FALSE;
 
         imp_dbh->tr = 0L;
+
+        /* the new metadata is visible to everyone now */
+        if (had_ddl)
+            ib_db_cache_ddl(imp_dbh);
     }
 
     DBI_TRACE_imp_xxh(imp_dbh, 2, (DBIc_LOGPIO(imp_dbh), "ib_commit_transaction succeed.\n"));
@@ -3145,7 +9139,8 @@ int ib_rollback_transaction(SV *h, imp_dbh_t *imp_dbh)
     }
 
 /* no isc_rollback_retaining in IB prior to 6 */
-    if ((imp_dbh->sth_ddl == 0) && (imp_dbh->soft_commit))
+    if ((imp_dbh->sth_ddl == 0) && (imp_dbh->soft_commit)
+        && !imp_dbh->tx_profile_once)
     {
         DBI_TRACE_imp_xxh(imp_dbh, 2, (DBIc_LOGPIO(imp_dbh), "try isc_rollback_retaining\n"));
 
@@ -3254,12 +9249,29 @@ unsigned get_charset_bytes_per_char(const ISC_SHORT subtype, SV *sth)
         isc_stmt_handle stmt = 0;
         ISC_STATUS status[ISC_STATUS_LENGTH];
         char sql[] = "SELECT RDB$CHARACTER_SET_ID, RDB$BYTES_PER_CHARACTER FROM RDB$CHARACTER_SETS";
-        int fetch_stat;
+        int fetch_stat = 0;
         unsigned i;
+        IB_DB_CACHE *c = ib_db_cache(imp_dbh);
 
         Newxz( imp_dbh->charset_bytes_per_char, 256, unsigned char );
         p = imp_dbh->charset_bytes_per_char;
 
+        /* another connection to this database may have read it already */
+        if (c)
+        {
+            int shared = 0;
+
+            IB_DB_CACHE_LOCK;
+            if (c->charset_bytes_per_char)
+            {
+                Copy(c->charset_bytes_per_char, p, 256, unsigned char);
+                shared = 1;
+            }
+            IB_DB_CACHE_UNLOCK;
+            if (shared)
+                return p[ subtype & 0xff ];
+        }
+
         IB_alloc_sqlda(out, 2);
         if (out == NULL)
         {
@@ -3309,6 +9321,18 @@ unsigned get_charset_bytes_per_char(const ISC_SHORT subtype, SV *sth)
             p[cs_id] = bpc;
             //warn("CS %d has %d bytes/char", cs_id, bpc);
         }
+
+        /* character sets never change, share them for good */
+        if (fetch_stat == 100 && c)
+        {
+            IB_DB_CACHE_LOCK;
+            if (!c->charset_bytes_per_char)
+            {
+                Newx(c->charset_bytes_per_char, 256, unsigned char);
+                Copy(p, c->charset_bytes_per_char, 256, unsigned char);
+            }
+            IB_DB_CACHE_UNLOCK;
+        }
 cleanup:
         isc_dsql_free_statement(status, &stmt, DSQL_drop);
 
@@ -79,6 +79,12 @@ static const int DBI_SQL_BOOLEAN    = SQL_BOOLEAN;
 #endif
 #include <time.h>
 
+/* ib_execute_async and friends run the client call on a POSIX thread */
+#if !defined(WIN32) && !defined(_WIN32) && !defined(IB_NO_ASYNC)
+#define IB_HAVE_ASYNC
+#include <pthread.h>
+#endif
+
 /* defines */
 
 /* Firebird API 20 */
@@ -131,11 +137,44 @@ typedef struct {
 
 #endif /* SQL_TIMESTAMP_TZ */
 
+/*
+ * Firebird 4.0+ INT128 (NUMERIC/DECIMAL with 19 to 38 digits) and
+ * DECFLOAT(16), DECFLOAT(34), defined here for older client headers
+ * the same way.
+ */
+#ifndef SQL_INT128
+#  define SQL_INT128           32752
+#  define SQL_DEC16            32760
+#  define SQL_DEC34            32762
+
+typedef struct { ISC_UINT64 fb_data[1]; } FB_DEC16;
+typedef struct { ISC_UINT64 fb_data[2]; } FB_DEC34;
+typedef struct { ISC_UINT64 fb_data[2]; } FB_I128;
+
+#endif /* SQL_INT128 */
+
 /* Timezone decoding constants (from Firebird TimeZoneUtil.cpp) */
 #define FB_TZ_ONE_DAY_OFFSET  1439  /* 24*60 - 1, base for offset zone IDs */
 #define FB_TZ_GMT_ZONE        65535 /* ISC_USHORT max = UTC */
 #define FB_TZ_MAX_OFFSET_ZONE 2878  /* ONE_DAY_OFFSET * 2 */
 
+/* Named time zone cache, filled from RDB$TIME_ZONES and
+ * RDB$TIME_ZONE_UTIL.TRANSITIONS on first use (see ib_tz_offset()) */
+typedef struct ib_tz_range
+{
+    ISC_INT64       start;              /* UTC, ticks since 1858-11-17 */
+    ISC_INT64       end;                /* inclusive */
+    ISC_SHORT       offset;             /* minutes east of UTC */
+} IB_TZ_RANGE;
+
+typedef struct ib_tz_zone
+{
+    char            *name;
+    IB_TZ_RANGE     *ranges;            /* sorted by start, non-overlapping */
+    unsigned int    count;
+    unsigned int    alloc;
+} IB_TZ_ZONE;
+
 #ifndef SQLDA_CURRENT_VERSION
 #  define SQLDA_OK_VERSION SQLDA_VERSION1
 #else
@@ -151,6 +190,54 @@ typedef struct {
  */
 #define MAX_DATETIME_CHAR_LEN 100
 
+/* RDB$CHARACTER_SETS ids */
+#define IB_CS_OCTETS          1
+#define IB_CS_UNICODE_FSS     3
+#define IB_CS_UTF8            4
+
+/* ib_export formats */
+#define IB_EXPORT_CSV   1
+#define IB_EXPORT_TSV   2
+#define IB_EXPORT_JSONL 3
+
+typedef struct
+{
+    int         format;     /* IB_EXPORT_* */
+    char        sep;        /* CSV separator */
+    int         header;     /* column names first, CSV/TSV */
+    const char  *null;      /* NULL in CSV/TSV */
+    STRLEN      null_len;
+    size_t      buffer_size;
+} IB_EXPORT_OPT;
+
+/* rows spilled to a file by ib_fetchall_mmap */
+typedef struct
+{
+    SV          *sth;       /* the statement, kept for decoding */
+    PerlIO      *io;
+    char        *map;       /* the whole file, or NULL to read it with PerlIO */
+    size_t      size;
+    char        *path;      /* NULL for an anonymous temporary file */
+    int         keep;       /* path is not removed when done */
+    int         ncols;
+    ISC_UINT64  rows;
+    ISC_UINT64  index;      /* offset of the row index */
+    ISC_UINT64  *value;     /* one value, aligned for decoding */
+    size_t      value_size;
+    char        *row;       /* one row, when there is no mapping */
+    size_t      row_size;
+} IB_SPILL;
+
+/* a row of ib_fetch_lazy */
+typedef struct
+{
+    SV          *sth;       /* the statement, kept for decoding */
+    int         ncols;
+    ISC_UINT64  *image;     /* the fetch buffers, each 8 byte aligned */
+    ISC_SHORT   *ind;       /* the NULL indicators */
+    SV          **memo;     /* the columns decoded so far */
+} IB_LAZY_ROW;
+
 #ifndef ISC_STATUS_LENGTH
 #  define ISC_STATUS_LENGTH 20
 #endif
@@ -292,6 +379,25 @@ typedef struct
     char            exec_cb;
 } IB_EVENT;
 
+/* single-byte charset tables, see ib_xlat_init() */
+typedef struct ib_xlat IB_XLAT;
+
+/* process-wide per-database cache, see ib_db_cache() */
+typedef struct ib_db_cache IB_DB_CACHE;
+
+/* worker thread of a connection, see ib_execute_async() */
+typedef struct ib_async IB_ASYNC;
+
+/* cancelling thread of a connection, see ib_cancel_after() */
+typedef struct ib_watchdog IB_WATCHDOG;
+
+/* read-ahead thread of a statement, see ib_pipe_start() */
+typedef struct ib_pipe IB_PIPE;
+
+/* operations of the worker, as ib_async_collect() returns them */
+#define IB_ASYNC_EXECUTE    1
+#define IB_ASYNC_FETCH      2
+
 /* Define driver handle data structure */
 struct imp_drh_st
 {
@@ -306,10 +412,24 @@ struct imp_dbh_st
     isc_tr_handle   tr;
     char ISC_FAR    *tpb_buffer;        /* transaction parameter buffer */
     unsigned short  tpb_length;         /* length of tpb_buffer */
+    HV              *tx_profiles;       /* name => compiled TPB */
+    SV              *tx_profile;        /* TPB in use instead of tpb_buffer */
+    SV              *tx_profile_prev;   /* tx_profile after begin_work's */
+    char            tx_profile_once;    /* in begin_work's ib_profile transaction */
     unsigned short  sqldialect;         /* default sql dialect */
     char            soft_commit;        /* use soft commit ? */
+    unsigned int    softcommit_max_age;     /* hard commit after N seconds */
+    unsigned int    softcommit_max_commits; /* hard commit every N commits */
+    time_t          tr_started;         /* when tr was started */
+    unsigned int    tr_soft_commits;    /* commit_retaining calls on tr */
+    ISC_STATUS      tx_conflict;        /* gds code of the last lock conflict */
+    unsigned long   tx_conflicts;       /* ib_txn_stats counters */
+    unsigned long   tx_retries;
+    double          tx_wasted;          /* seconds spent in retried ib_txn */
     char            *ib_charset;
     bool            ib_enable_utf8;
+    bool            ib_trust_utf8;      /* flag UTF8 columns without scanning */
+    const IB_XLAT   *ib_xlat;           /* ib_enable_utf8 on a single-byte charset */
 
     unsigned int    sth_ddl;            /* number of open DDL statments */
     imp_sth_t       *first_sth;         /* pointer to first statement */
@@ -325,8 +445,36 @@ struct imp_dbh_st
     char            *timeformat;
 
     unsigned char   *charset_bytes_per_char;
+    IB_DB_CACHE     *db_cache;          /* shared with other connections */
+    char            cache_metadata;     /* ib_cache_metadata */
+
+    IB_TZ_ZONE      *tz_zones;          /* indexed by zone id - tz_first_id */
+    unsigned int    tz_zone_count;
+    ISC_USHORT      tz_first_id;
+    char            tz_epoch;           /* fetch TZ values as UTC epoch */
+    char            bind_epoch;         /* ib_bind_epoch: numbers are epoch seconds */
+    char            exact_numeric;      /* ib_exact_numeric, IB_EXACT_* */
+    char            fast_int;           /* ib_fast_int: INT128/DECFLOAT as IVs */
+
+    IB_ASYNC        *async;             /* started by the first async call */
+    IB_WATCHDOG     *watchdog;          /* started by ib_cancel_after */
+    ISC_ULONG       timeout_ms;         /* ib_timeout_ms, 0 for none */
 };
 
+/* ib_exact_numeric: scaled NUMERIC values as NVs, exact text or minor units */
+#define IB_EXACT_OFF    0
+#define IB_EXACT_STRING 1
+#define IB_EXACT_MINOR  2
+
+/* bind_col: representation asked for with TYPE, and whether it is bound */
+#define IB_COL_DEFAULT  0
+#define IB_COL_IV       1
+#define IB_COL_NV       2
+#define IB_COL_STR      3
+#define IB_COL_RAW      4
+#define IB_COL_BOUND    0x10
+#define IB_COL_REP(c)   ((c) & 0x0f)
+
 /* Define sth implementor data structure */
 struct imp_sth_st
 {
@@ -345,8 +493,23 @@ struct imp_sth_st
     imp_sth_t       *prev_sth;                /* pointer to prev statement */
     imp_sth_t       *next_sth;                /* pointer to next statement */
     HV              *param_values;      /* For storing the ParamValues attribute */
+    char            *col_rep;           /* per column IB_COL_*, from bind_col */
+    char            bound_only;         /* ib_bound_only */
+    AV              *col_keys;          /* column names as shared-key SVs */
+    AV              *hash_keys;         /* keys used by ib_fetch_into_hash */
+    char            hash_key_case;      /* FetchHashKeyName hash_keys is for */
+    char            async_fetched;      /* out_sqlda holds a row from ib_fetch_async */
+    char            timeout_set;        /* ib_timeout_ms set, not the dbh's */
+    ISC_ULONG       timeout_ms;
+    ISC_ULONG       timeout_applied;    /* as last given to fb_dsql_set_timeout */
+    IB_PIPE         *pipe;              /* reading ahead, see ib_pipeline */
+    unsigned long   pipe_rows;          /* ib_pipeline, 0 for off */
+    unsigned long   pipe_bytes;         /* ib_pipeline_bytes */
 };
 
+/* default ib_pipeline_bytes */
+#define IB_PIPE_BYTES   (4UL << 20)
+
 
 /* newer header file defines the struct already */
 typedef struct dbd_vary
@@ -377,6 +540,7 @@ typedef struct dbd_vary
 #define dbd_st_blob_read    ib_st_blob_read
 #define dbd_st_STORE_attrib ib_st_STORE_attrib
 #define dbd_st_FETCH_attrib ib_st_FETCH_attrib
+#define dbd_st_bind_col     ib_st_bind_col
 #define dbd_bind_ph         ib_bind_ph
 
 void    do_error _((SV *h, int rc, char *what));
@@ -388,12 +552,43 @@ int     dbd_db_ping   (SV *dbh);
 
 char* ib_error_decode(const ISC_STATUS *status);
 int ib_error_check(SV *h, ISC_STATUS *status);
+ISC_STATUS ib_error_conflict(const ISC_STATUS *status);
+IB_DB_CACHE *ib_db_cache(imp_dbh_t *imp_dbh);
+int ib_db_cache_tag(imp_dbh_t *imp_dbh, SV **key, unsigned long *generation);
 
 int ib_start_transaction   (SV *h, imp_dbh_t *imp_dbh);
 int ib_commit_transaction  (SV *h, imp_dbh_t *imp_dbh);
 int ib_rollback_transaction(SV *h, imp_dbh_t *imp_dbh);
+void ib_select_tx_profile  (imp_dbh_t *imp_dbh, SV *profile);
+int ib_begin_tx_profile    (SV *h, imp_dbh_t *imp_dbh, SV *profile);
 long ib_rows(SV *xxh, isc_stmt_handle *h_stmt, char count_type);
 void ib_cleanup_st_prepare (imp_sth_t *imp_sth);
+AV* ib_st_hash_keys(SV *sth, imp_sth_t *imp_sth);
+
+int  ib_async_busy   (SV *h, imp_dbh_t *imp_dbh);
+void ib_async_abandon(SV *sth, imp_dbh_t *imp_dbh, imp_sth_t *imp_sth);
+void ib_async_stop   (imp_dbh_t *imp_dbh);
+int  ib_async_fd     (SV *dbh, imp_dbh_t *imp_dbh);
+int  ib_execute_async(SV *sth, imp_sth_t *imp_sth);
+int  ib_fetch_async  (SV *sth, imp_sth_t *imp_sth);
+int  ib_async_collect(SV *sth, imp_sth_t *imp_sth, int *retval);
+int  ib_cancel       (SV *dbh, imp_dbh_t *imp_dbh);
+int  ib_cancel_after (SV *dbh, imp_dbh_t *imp_dbh, double seconds);
+void ib_watchdog_stop(imp_dbh_t *imp_dbh);
+void ib_bulk_load_fh (SV *self, PerlIO *io, int tsv, char sep, int header,
+                      int utf8, int async);
+void ib_pipe_start   (SV *sth, imp_sth_t *imp_sth);
+void ib_pipe_stop    (imp_sth_t *imp_sth);
+long ib_st_export    (SV *sth, imp_sth_t *imp_sth, PerlIO *io,
+                      const IB_EXPORT_OPT *opt);
+long ib_st_fetch_arrow(SV *sth, imp_sth_t *imp_sth, PerlIO *io, long batch_rows);
+long ib_spill_write   (SV *sth, imp_sth_t *imp_sth, IB_SPILL *s, const char *path);
+int  ib_spill_decode  (SV *sth, imp_sth_t *imp_sth, IB_SPILL *s, ISC_UINT64 row,
+                       int col, SV **out);
+void ib_spill_close   (IB_SPILL *s);
+int  ib_st_fetch_lazy (SV *sth, imp_sth_t *imp_sth, IB_LAZY_ROW *r);
+SV  *ib_lazy_column   (SV *sth, imp_sth_t *imp_sth, IB_LAZY_ROW *r, int col);
+void ib_lazy_free     (IB_LAZY_ROW *r);
 
 SV* dbd_db_quote(SV* dbh, SV* str, SV* type);
 
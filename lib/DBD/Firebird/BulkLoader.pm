@@ -0,0 +1,358 @@
+package DBD::Firebird::BulkLoader;
+
+# Loads rows into a table over several attachments at once. Each attachment
+# has its own prepared INSERT, executed on the worker thread of the
+# connection (see ib_execute_async), so the server round trips of the
+# workers overlap while the rows are bound on the Perl thread. Files are
+# read, parsed and handed out by _load_fh in dbdimp.c; _done and _progress
+# are its way back for failed rows and progress reports.
+
+use strict;
+use warnings;
+
+use Carp;
+use IO::Select;
+use Time::HiRes ();
+
+sub new {
+    my ($class, $dbh, %opt) = @_;
+
+    my $table = $opt{table}
+        or croak "DBD::Firebird::BulkLoader: table is required";
+    ref($opt{columns}) eq 'ARRAY' and @{ $opt{columns} }
+        or croak "DBD::Firebird::BulkLoader: columns must be a non-empty array ref";
+
+    my $n = defined $opt{workers} ? $opt{workers} : 4;
+    $n =~ /^\d+$/ and $n >= 1
+        or croak "DBD::Firebird::BulkLoader: workers must be a positive integer";
+
+    my $self = bless {
+        commit_every   => $opt{commit_every}   || 10_000,
+        progress_every => $opt{progress_every} || 100_000,
+        on_progress    => $opt{on_progress},
+        on_error       => $opt{on_error},
+        workers        => [],
+        next_worker    => 0,
+        rows           => 0,
+        errors         => 0,
+        started        => Time::HiRes::time(),
+    }, $class;
+
+    my @columns = @{ $opt{columns} };
+    my $sql = sprintf 'INSERT INTO %s (%s) VALUES (%s)',
+        $table, join(', ', @columns), join(', ', ('?') x @columns);
+
+    my $ok = eval {
+        for (1 .. $n) {
+            my $c = $dbh->clone({ AutoCommit => 0, RaiseError => 1, PrintError => 0 });
+            my $w = { dbh => $c, rows => 0, errors => 0, commits => 0, uncommitted => 0 };
+            push @{ $self->{workers} }, $w;
+
+            # failed rows are counted, not raised
+            $w->{sth} = $c->prepare($sql);
+            $w->{sth}{RaiseError} = 0;
+
+            my $fd = eval { $c->ib_async_fd };
+            if (defined $fd) {
+                $w->{fd} = $fd;
+                $self->{by_fd}{$fd} = $w;
+                ($self->{select} ||= IO::Select->new)->add($fd);
+            }
+        }
+        1;
+    };
+    unless ($ok) {
+        my $error = $@;
+        $self->_close;
+        croak $error;
+    }
+
+    # all or none of the attachments have worker threads
+    delete $self->{select} if $self->{select}
+        and $self->{select}->count != @{ $self->{workers} };
+
+    return $self;
+}
+
+# Loads rows from an array ref of rows, a code ref returning array refs of
+# rows until it returns undef, or a CSV/TSV file.
+sub load {
+    my ($self, $source, %opt) = @_;
+
+    if (ref($source) eq 'ARRAY') {
+        $self->_queue($source);
+    }
+    elsif (ref($source) eq 'CODE') {
+        while (my $batch = $source->()) {
+            $self->_queue($batch);
+        }
+    }
+    elsif (defined $source and !ref $source) {
+        $self->_load_file($source, %opt);
+    }
+    else {
+        croak "DBD::Firebird::BulkLoader: unknown row source";
+    }
+
+    $self->_collect($_) for @{ $self->{workers} };
+    return $self->{rows};
+}
+
+sub _queue {
+    my ($self, $batch) = @_;
+    $self->_send($self->_idle, $_) for @$batch;
+}
+
+sub _load_file {
+    my ($self, $path, %opt) = @_;
+
+    my $format = $opt{format} || ($path =~ /\.tsv$/i ? 'tsv' : 'csv');
+    $format eq 'csv' or $format eq 'tsv'
+        or croak "DBD::Firebird::BulkLoader: unknown file format $format";
+
+    open my $fh, '<', $path
+        or croak "DBD::Firebird::BulkLoader: cannot open $path: $!";
+    binmode $fh, $opt{encoding} ? ":encoding($opt{encoding})" : ':raw';
+
+    my $sep = defined $opt{sep_char} ? $opt{sep_char} : ',';
+    $sep =~ /^[ -~\t]\z/ && $sep ne '"'
+        or croak "DBD::Firebird::BulkLoader: sep_char must be one ASCII character";
+
+    # parsed, bound and handed to the workers in C
+    $self->_load_fh($fh, $format eq 'tsv' ? 1 : 0, $sep, $opt{header} ? 1 : 0,
+        $opt{encoding} ? 1 : 0, $self->{select} ? 1 : 0);
+    close $fh;
+}
+
+# Returns a worker free to take a row, collecting finished inserts while
+# all of them are busy.
+sub _idle {
+    my $self = shift;
+    my $workers = $self->{workers};
+
+    while (1) {
+        for (1 .. @$workers) {
+            my $w = $workers->[ $self->{next_worker}++ % @$workers ];
+            return $w unless $w->{busy};
+        }
+        $self->_collect($self->{by_fd}{$_}) for $self->{select}->can_read;
+    }
+}
+
+sub _send {
+    my ($self, $w, $row) = @_;
+
+    unless ($self->{select}) {
+        $self->_done($w, $row, $w->{sth}->execute(@$row));
+        return;
+    }
+
+    if ($w->{sth}->ib_execute_async(@$row)) {
+        $w->{busy} = $row;
+    }
+    else {
+        $self->_done($w, $row, undef);
+    }
+}
+
+sub _collect {
+    my ($self, $w) = @_;
+
+    my $row = delete $w->{busy} or return;
+    $self->_done($w, $row, $w->{sth}->ib_async_result);
+}
+
+sub _done {
+    my ($self, $w, $row, $ok) = @_;
+
+    unless ($ok) {
+        $w->{errors}++;
+        $self->{errors}++;
+        $self->{on_error}->($row, $w->{sth}->errstr, $self->_index($w))
+            if $self->{on_error};
+        return;
+    }
+
+    $w->{rows}++;
+    if (++$w->{uncommitted} >= $self->{commit_every}) {
+        $w->{dbh}->commit;
+        $w->{commits}++;
+        $w->{uncommitted} = 0;
+    }
+
+    $self->_progress
+        if ++$self->{rows} % $self->{progress_every} == 0 and $self->{on_progress};
+}
+
+sub _progress {
+    my $self = shift;
+    $self->{on_progress}->($self->stats);
+}
+
+sub _index {
+    my ($self, $w) = @_;
+    my $workers = $self->{workers};
+    return (grep { $workers->[$_] == $w } 0 .. $#$workers)[0];
+}
+
+sub stats {
+    my $self = shift;
+
+    my $elapsed = Time::HiRes::time() - $self->{started};
+    return {
+        rows         => $self->{rows},
+        errors       => $self->{errors},
+        elapsed      => $elapsed,
+        rows_per_sec => $elapsed > 0 ? $self->{rows} / $elapsed : 0,
+        workers      => [
+            map { +{ rows => $_->{rows}, errors => $_->{errors},
+                    commits => $_->{commits} } } @{ $self->{workers} }
+        ],
+    };
+}
+
+# Waits for the inserts in flight, commits and closes the attachments.
+sub finish {
+    my $self = shift;
+
+    my $ok = eval {
+        for my $w (@{ $self->{workers} }) {
+            $self->_collect($w);
+            next unless $w->{uncommitted};
+            $w->{dbh}->commit;
+            $w->{commits}++;
+            $w->{uncommitted} = 0;
+        }
+        1;
+    };
+    my $error = $@;
+    my $stats = $self->stats;
+    $self->_close;
+    croak $error unless $ok;
+
+    return $stats;
+}
+
+sub _close {
+    my $self = shift;
+
+    for my $w (@{ $self->{workers} }) {
+        eval {
+            # cancels an insert still in flight, which would make the
+            # connection refuse the rollback
+            $w->{sth}->finish if $w->{sth};
+            $w->{dbh}->rollback;
+            $w->{dbh}->disconnect;
+        };
+    }
+    @{ $self->{workers} } = ();
+    delete $self->{select};
+}
+
+sub DESTROY {
+    my $self = shift;
+    local ($@, $!);
+    $self->_close if @{ $self->{workers} };
+}
+
+1;
+
+__END__
+
+=head1 NAME
+
+DBD::Firebird::BulkLoader - load rows into a table over several connections
+
+=head1 SYNOPSIS
+
+  use DBD::Firebird::BulkLoader;
+
+  my $loader = DBD::Firebird::BulkLoader->new($dbh,
+      table        => 'ORDERS',
+      columns      => [qw(ID CUSTOMER AMOUNT)],
+      workers      => 8,
+      commit_every => 20_000,
+      on_progress  => sub {
+          my $s = shift;
+          printf "%d rows, %.0f rows/s\n", $s->{rows}, $s->{rows_per_sec};
+      },
+  );
+
+  $loader->load(\@rows);
+  $loader->load(sub { next_batch() });
+  $loader->load('orders.csv', header => 1);
+
+  my $stats = $loader->finish;
+
+=head1 DESCRIPTION
+
+The loader opens C<workers> (default 4) new connections with C<clone>,
+prepares the INSERT on each of them, and hands out the rows to whichever
+connection is free. The inserts are executed asynchronously (see
+L<DBD::Firebird/ASYNCHRONOUS EXECUTE AND FETCH>), so the server works on
+the inserts of all the connections at once, while the values are bound on
+the calling thread. Files are read, parsed, bound and handed out by the
+driver's C code, which runs no Perl code for a row unless it fails or a
+progress report is due. Where asynchronous operations are not available,
+the inserts are executed one after another.
+
+Each connection commits after C<commit_every> (default 10000) rows. Rows
+committed on one connection are not rolled back if another fails.
+
+=head1 METHODS
+
+=over 4
+
+=item C<new>
+
+  $loader = DBD::Firebird::BulkLoader->new($dbh, %options);
+
+Besides C<table>, C<columns>, C<workers> and C<commit_every>, the options
+are:
+
+=over 4
+
+=item C<on_progress>
+
+Called with the result of C<stats> every C<progress_every> (default 100000)
+loaded rows.
+
+=item C<on_error>
+
+Called with the row, the error message and the worker number for each row
+that could not be inserted. Failed rows do not stop the load.
+
+=back
+
+=item C<load>
+
+  $loader->load(\@rows);
+  $loader->load(sub { return \@batch or undef });
+  $loader->load($path, format => 'tsv', header => 1);
+
+Loads an array ref of rows, the batches returned by a code ref until it
+returns undef, or a file. Files are C<csv> or C<tsv> (guessed from the
+extension); C<header> skips the first line, C<sep_char> changes the CSV
+separator (a single ASCII character) and C<encoding> decodes the file. In CSV, an empty field is NULL
+unless it is quoted; in TSV, C<\N> is NULL and C<\t>, C<\n>, C<\r> and
+C<\\> are a tab, line breaks and a backslash. Files written by
+L<DBD::Firebird/ib_export> load back as they were.
+
+Returns once all the rows are inserted, with the number of rows loaded so
+far.
+
+=item C<stats>
+
+Returns a hash ref with C<rows>, C<errors>, C<elapsed> (seconds),
+C<rows_per_sec>, and C<workers>, an array of hash refs with the C<rows>,
+C<errors> and C<commits> of each connection.
+
+=item C<finish>
+
+Waits for the inserts still running, commits, closes the connections and
+returns the final C<stats>. A loader destroyed before C<finish> rolls back
+the rows not yet committed.
+
+=back
+
+=cut
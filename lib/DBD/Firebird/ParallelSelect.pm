@@ -0,0 +1,245 @@
+package DBD::Firebird::ParallelSelect;
+
+# Implementation of $dbh->ib_parallel_select: one query split by key ranges
+# over several attachments that share one snapshot (Firebird 4.0+), each
+# partition executed and fetched on the worker thread of its attachment.
+
+use strict;
+use warnings;
+
+use Carp;
+use IO::Select;
+use Scalar::Util qw(looks_like_number);
+
+sub new {
+    my ($class, $dbh, $sql, %opt) = @_;
+
+    my $n = defined $opt{partitions} ? $opt{partitions} : 4;
+    $n =~ /^\d+$/ and $n >= 1
+        or croak "ib_parallel_select: partitions must be a positive integer";
+
+    my $key = $opt{key};
+    defined $key and $key =~ /\A(?:\w+|"[^"]+")\z/
+        or croak "ib_parallel_select: key must be a column name";
+
+    my $self = bless {
+        dbh       => $dbh,
+        raise     => $opt{on_row} ? 0 : $dbh->FETCH('RaiseError'),
+        parts     => [],
+        ready     => [],
+        active    => 0,
+        rows      => 0,
+        partition => undef,
+    }, $class;
+
+    my $ok = eval {
+        $self->_open($sql, $key, $n, $opt{bind} || []);
+        1;
+    };
+    return $self if $ok;
+
+    my $error = $@;
+    $self->finish;
+    chomp $error;
+    $dbh->set_err($DBI::stderr, "ib_parallel_select: $error");
+    return undef;
+}
+
+sub _attach {
+    my ($self, $snapshot) = @_;
+
+    my $c = $self->{dbh}->clone(
+        { AutoCommit => 0, RaiseError => 1, PrintError => 0 });
+    $c->func(
+        -access_mode     => 'read_only',
+        -isolation_level => 'snapshot',
+        ($snapshot ? (-at_snapshot_number => $snapshot) : ()),
+        'ib_set_tx_param'
+    );
+    push @{ $self->{parts} }, { dbh => $c };
+    return $c;
+}
+
+sub _open {
+    my ($self, $sql, $key, $n, $bind) = @_;
+
+    # the first attachment starts the snapshot the others join
+    my $lead = $self->_attach;
+    my ($lo, $hi) = $lead->selectrow_array(
+        "SELECT MIN(P.$key), MAX(P.$key) FROM ($sql) P", undef, @$bind);
+
+    my @bounds;
+    if (!defined $lo) {
+        $n = 1;
+    }
+    elsif (!looks_like_number($lo) or !looks_like_number($hi)) {
+        die "key $key is not numeric\n";
+    }
+    elsif ($lo =~ /^-?\d+$/ and $hi =~ /^-?\d+$/) {
+        my $span = $hi - $lo + 1;
+        $n = $span if $span < $n;
+        @bounds = map { $lo + int($span * $_ / $n) } 1 .. $n - 1;
+    }
+    else {
+        @bounds = map { $lo + ($hi - $lo) * $_ / $n } 1 .. $n - 1;
+    }
+
+    if ($n > 1) {
+        my $snapshot = $lead->func('ib_tx_info')->{snapshot_number}
+            or die "a shared snapshot needs Firebird 4.0 or newer\n";
+        $self->_attach($snapshot) for 2 .. $n;
+    }
+
+    # NULL keys go to the first partition
+    my @ranges = $n == 1 ? ([ '', [] ]) : (
+        [ "P.$key < ? OR P.$key IS NULL", [ $bounds[0] ] ],
+        (map { [ "P.$key >= ? AND P.$key < ?", [ @bounds[$_ - 1, $_] ] ] }
+            1 .. $n - 2),
+        [ "P.$key >= ?", [ $bounds[-1] ] ],
+    );
+
+    my $async = defined eval { $lead->ib_async_fd };
+    $self->{select} = IO::Select->new if $async;
+
+    for my $i (0 .. $n - 1) {
+        my $part = $self->{parts}[$i];
+        my ($where, $values) = @{ $ranges[$i] };
+        my $sth = $part->{sth} = $part->{dbh}->prepare(
+            $where ? "SELECT P.* FROM ($sql) P WHERE $where" : $sql);
+
+        if ($async) {
+            $part->{fd} = $part->{dbh}->ib_async_fd;
+            $self->{by_fd}{ $part->{fd} } = $i;
+            $self->{select}->add($part->{fd});
+            $sth->ib_execute_async(@$bind, @$values);
+            $part->{busy} = 'execute';
+        }
+        else {
+            $sth->execute(@$bind, @$values);
+        }
+        $self->{active}++;
+    }
+}
+
+# Waits for at least one partition to come up with a row or to end, and
+# queues its row. Without asynchronous support the partitions are read one
+# after another.
+sub _poll {
+    my $self = shift;
+
+    unless ($self->{select}) {
+        my ($i) = grep { !$self->{parts}[$_]{done} } 0 .. $#{ $self->{parts} };
+        my $row = $self->{parts}[$i]{sth}->fetchrow_arrayref;
+        $row ? push @{ $self->{ready} }, [ $i, $row ] : $self->_done($i);
+        return;
+    }
+
+    for my $fd ($self->{select}->can_read) {
+        my $i    = $self->{by_fd}{$fd};
+        my $part = $self->{parts}[$i];
+        my $op   = delete $part->{busy} or next;
+        my $res  = $part->{sth}->ib_async_result;
+
+        if ($op eq 'fetch' and !$res) {
+            $self->_done($i);
+            next;
+        }
+        push @{ $self->{ready} }, [ $i, $res ] if $op eq 'fetch';
+
+        # the next row is fetched while the caller deals with this one
+        $part->{sth}->ib_fetch_async;
+        $part->{busy} = 'fetch';
+    }
+}
+
+sub _done {
+    my ($self, $i) = @_;
+    my $part = $self->{parts}[$i];
+
+    $part->{done} = 1;
+    $self->{active}--;
+    $self->{select}->remove($part->{fd}) if $self->{select};
+}
+
+sub _next {
+    my $self = shift;
+
+    while (!@{ $self->{ready} }) {
+        unless ($self->{active}) {
+            $self->finish;
+            return;
+        }
+        my $ok = eval { $self->_poll; 1 };
+        next if $ok;
+
+        my $error = $@;
+        $self->finish;
+        chomp $error;
+        $self->{dbh}->set_err($DBI::stderr, "ib_parallel_select: $error");
+        croak $self->{dbh}->errstr if $self->{raise};
+        return;
+    }
+
+    my ($i, $row) = @{ shift @{ $self->{ready} } };
+    $self->{partition} = $i;
+    $self->{rows}++;
+    return ($i, $row);
+}
+
+sub next {
+    my $self = shift;
+    my ($i, $row) = $self->_next or return undef;
+
+    # the fetch buffer of the partition is reused for its next row
+    return [ @$row ];
+}
+
+sub run {
+    my ($self, $code) = @_;
+
+    my $ok = eval {
+        while (my ($i, $row) = $self->_next) {
+            $code->($row, $i);
+        }
+        1;
+    };
+    unless ($ok) {
+        my $error = $@;
+        $self->finish;
+        die $error;
+    }
+    return undef if $self->{dbh}->err;
+    return $self->{rows} || '0E0';
+}
+
+sub partition { $_[0]{partition} }
+
+sub rows { $_[0]{rows} }
+
+sub finish {
+    my $self = shift;
+
+    for my $part (@{ $self->{parts} }) {
+        my $c = $part->{dbh} or next;
+        eval {
+            # cancels an execute or fetch still in flight, which would
+            # make the connection refuse the rollback
+            $part->{sth}->finish if $part->{sth};
+            $c->rollback;
+            $c->disconnect;
+        };
+    }
+    @{ $self->{parts} } = ();
+    @{ $self->{ready} } = ();
+    $self->{active} = 0;
+    delete $self->{select};
+    return 1;
+}
+
+sub DESTROY {
+    my $self = shift;
+    local ($@, $!);
+    $self->finish if @{ $self->{parts} };
+}
+
+1;
@@ -0,0 +1,72 @@
+package DBD::Firebird::Row;
+
+# A row of $sth->ib_fetch_lazy: a copy of the fetch buffers, each column
+# decoded the first time it is read. count, col, sth, _decoded and DESTROY
+# are in Firebird.xs; the object also reads as an array ref and as a hash ref
+# keyed by column name.
+
+use strict;
+use warnings;
+
+use overload
+    '@{}'    => sub { tie my @cols, 'DBD::Firebird::Row::Array', shift; \@cols },
+    '%{}'    => sub { tie my %cols, 'DBD::Firebird::Row::Hash', shift; \%cols },
+    fallback => 1;
+
+# the index of a column name, as given or in upper case
+sub _index {
+    my ($self, $name) = @_;
+    my $sth = $self->sth;
+
+    my $i = $sth->FETCH('NAME_hash')->{$name};
+    $i = $sth->FETCH('NAME_uc_hash')->{uc $name} unless defined $i;
+    return $i;
+}
+
+sub get {
+    my ($self, $name) = @_;
+
+    my $i = $self->_index($name);
+    return defined $i ? $self->col($i) : undef;
+}
+
+sub names {
+    my $self = shift;
+    return $self->sth->FETCH('NAME');
+}
+
+package DBD::Firebird::Row::Array;
+
+use Carp;
+
+sub TIEARRAY  { my ($class, $row) = @_; bless [ $row ], $class }
+sub FETCH     { $_[0][0]->col($_[1]) }
+sub FETCHSIZE { $_[0][0]->count }
+sub EXISTS    { $_[1] < $_[0][0]->count }
+sub EXTEND    { }
+
+sub STORE     { croak "ib_fetch_lazy: the row is read only" }
+{
+    no strict 'refs';
+    *$_ = \&STORE for qw(STORESIZE CLEAR PUSH POP SHIFT UNSHIFT SPLICE DELETE);
+}
+
+package DBD::Firebird::Row::Hash;
+
+use Carp;
+
+sub TIEHASH  { my ($class, $row) = @_; bless [ $row, 0 ], $class }
+sub FETCH    { $_[0][0]->get($_[1]) }
+sub EXISTS   { defined $_[0][0]->_index($_[1]) }
+sub SCALAR   { $_[0][0]->count }
+
+sub FIRSTKEY { $_[0][1] = 0; $_[0]->NEXTKEY }
+sub NEXTKEY  { $_[0][0]->names->[ $_[0][1]++ ] }
+
+sub STORE    { croak "ib_fetch_lazy: the row is read only" }
+{
+    no strict 'refs';
+    *$_ = \&STORE for qw(DELETE CLEAR);
+}
+
+1;
@@ -0,0 +1,37 @@
+package DBD::Firebird::Spill;
+
+# The result of $sth->ib_fetchall_mmap: rows spilled to a file by the C
+# fetch loop, decoded one row or one value at a time. rows, row, cell, sth
+# and DESTROY are in Firebird.xs; the object also reads as an array ref of
+# rows.
+
+use strict;
+use warnings;
+
+use overload
+    '@{}'    => sub { tie my @rows, 'DBD::Firebird::Spill::Rows', shift; \@rows },
+    fallback => 1;
+
+sub names {
+    my $self = shift;
+    return $self->sth->FETCH('NAME');
+}
+
+package DBD::Firebird::Spill::Rows;
+
+use Carp;
+
+sub TIEARRAY  { my ($class, $spill) = @_; bless [ $spill ], $class }
+sub FETCH     { $_[0][0]->row($_[1]) }
+sub FETCHSIZE { $_[0][0]->rows }
+sub EXISTS    { $_[1] < $_[0][0]->rows }
+
+sub EXTEND    { }
+
+sub STORE     { croak "ib_fetchall_mmap: the rows are read only" }
+{
+    no strict 'refs';
+    *$_ = \&STORE for qw(STORESIZE CLEAR PUSH POP SHIFT UNSHIFT SPLICE DELETE);
+}
+
+1;
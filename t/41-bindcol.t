@@ -0,0 +1,114 @@
+#!/usr/bin/perl
+#
+#   Test bind_col with a TYPE, and the ib_bound_only statement attribute
+#
+
+use strict;
+use warnings;
+use utf8;
+BEGIN {
+    binmode(STDERR, ':utf8');
+    binmode(STDOUT, ':utf8');
+};
+
+use B ();
+use Encode ();
+use Test::More;
+use DBI qw(:sql_types);
+use lib 't','.';
+
+use TestFirebird;
+my $T = TestFirebird->new;
+
+plan tests => 28;
+
+my $dsn = $T->{tdsn};
+$dsn =~ s/(?<=ib_charset=)[^;]+/UTF8/;
+my $dbh = DBI->connect( $dsn, $T->{user}, $T->{pass},
+    { RaiseError => 1, PrintError => 0, AutoCommit => 1, ChopBlanks => 1 } );
+ok( $dbh, 'Connected' );
+ok( $dbh->{ib_enable_utf8} = 1, 'Set ib_enable_utf8' );
+
+sub flags { B::svref_2object( \$_[0] )->FLAGS }
+sub is_int { ( flags( $_[0] ) & B::SVf_IOK ) && !( flags( $_[0] ) & B::SVf_POK ) }
+sub is_num { ( flags( $_[0] ) & B::SVf_NOK ) && !( flags( $_[0] ) & B::SVf_POK ) }
+sub is_str { ( flags( $_[0] ) & B::SVf_POK ) && !( flags( $_[0] ) & ( B::SVf_IOK | B::SVf_NOK ) ) }
+
+my $table = find_new_table($dbh);
+ok( $table, qq{Table is '$table'} );
+
+ok( $dbh->do(<<"DEF"), qq{CREATE TABLE '$table'} );
+CREATE TABLE $table (
+    ID   INTEGER,
+    N    NUMERIC(9,2),
+    D    DOUBLE PRECISION,
+    BI   BIGINT,
+    V    VARCHAR(20) CHARACTER SET UTF8,
+    B    BLOB SUB_TYPE TEXT CHARACTER SET UTF8
+)
+DEF
+
+ok( $dbh->do( "INSERT INTO $table VALUES (?, ?, ?, ?, ?, ?)",
+        undef, 7, '12.34', 2.75, '1234567890123', 'Værčàr', 'blob €' ),
+    'INSERT' );
+ok( $dbh->do( "INSERT INTO $table VALUES (?, ?, ?, ?, ?, ?)",
+        undef, 8, '12.00', 1e300, '-5', 'x', 'y' ),
+    'INSERT integral and out of range values' );
+
+my $sql = "SELECT ID, N, D, BI, V, B FROM $table WHERE ID = 7";
+
+#
+#   typed columns
+#
+my $sth = $dbh->prepare($sql);
+ok( $sth->execute, 'EXECUTE' );
+
+my ( $id, $n, $d, $bi, $v, $b );
+$sth->bind_col( 1, \$id, { TYPE => SQL_VARCHAR } );
+$sth->bind_col( 2, \$n,  { TYPE => SQL_INTEGER } );
+$sth->bind_col( 3, \$d,  { TYPE => SQL_INTEGER } );
+$sth->bind_col( 4, \$bi, { TYPE => SQL_DOUBLE } );
+$sth->bind_col( 5, \$v,  { TYPE => SQL_VARBINARY } );
+$sth->bind_col( 6, \$b );
+ok( $sth->fetch, 'FETCH' );
+
+is( $id, '7', 'INTEGER as a string' );
+ok( is_str($id), '... with no number in it' );
+is( $n, '12.34', 'fractional NUMERIC(9,2) not cut to an integer' );
+ok( !is_int($n), '... no IV' );
+is( $d, 2.75, 'fractional DOUBLE PRECISION not cut to an integer' );
+is( $bi, 1234567890123, 'BIGINT as a double' );
+ok( is_num($bi), '... an NV' );
+ok( !utf8::is_utf8($v), 'VARBINARY gives raw bytes' );
+is( $v, Encode::encode_utf8('Værčàr'), '... the UTF-8 octets' );
+is( $b, 'blob €', 'untyped column decoded as usual' );
+$sth->finish;
+
+$sth = $dbh->prepare("SELECT N, D FROM $table WHERE ID = 8");
+$sth->execute;
+$sth->bind_col( 1, \$n, { TYPE => SQL_INTEGER } );
+$sth->bind_col( 2, \$d, { TYPE => SQL_INTEGER } );
+ok( $sth->fetch, 'FETCH integral and out of range values' );
+is( $n, 12, 'integral NUMERIC(9,2) as an integer' );
+ok( is_int($n), '... an IV' );
+is( $d, 1e300, 'DOUBLE PRECISION out of the IV range kept' );
+ok( !is_int($d), '... no IV' );
+$sth->finish;
+
+#
+#   ib_bound_only
+#
+$sth = $dbh->prepare( $sql, { ib_bound_only => 1 } );
+ok( $sth->{ib_bound_only}, 'ib_bound_only from prepare' );
+$sth->execute;
+$sth->bind_col( 2, \$n );
+my $row = $sth->fetch;
+is( $n, '12.34', 'bound column fetched' );
+is_deeply( [ @$row[ 0, 2 .. 5 ] ], [ (undef) x 5 ], 'unbound columns skipped' );
+$sth->finish;
+
+$sth->{ib_bound_only} = 0;
+ok( !$sth->{ib_bound_only}, 'ib_bound_only switched off' );
+
+ok( $dbh->do("DROP TABLE $table"), "DROP TABLE '$table'" );
+$dbh->disconnect;
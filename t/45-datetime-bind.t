@@ -0,0 +1,180 @@
+#!/usr/bin/perl
+#
+#   Test for binding date/time parameters from ISO 8601 strings, epoch
+#   numbers and localtime() style arrays
+#
+
+use strict;
+use warnings;
+
+use Test::More;
+
+use lib 't','.';
+
+use TestFirebird;
+my $T = TestFirebird->new;
+
+my ( $dbh, $error_str ) = $T->connect_to_database();
+
+if ($error_str) {
+    BAIL_OUT("Unknown: $error_str!");
+}
+
+unless ( $dbh->isa('DBI::db') ) {
+    plan skip_all => 'Connection to database failed, cannot continue testing';
+}
+else {
+    plan tests => 31;
+}
+
+ok($dbh, 'Connected to the database');
+
+my $table = find_new_table($dbh);
+ok($table, "TABLE is '$table'");
+
+ok( $dbh->do(<<"DEF"), qq{CREATE TABLE '$table'} );
+CREATE TABLE $table (
+    ID           INTEGER,
+    A_TIMESTAMP  TIMESTAMP,
+    A_DATE       DATE,
+    A_TIME       TIME
+)
+DEF
+
+my $insert = $dbh->prepare("INSERT INTO $table VALUES (?, ?, ?, ?)");
+my $select = $dbh->prepare(
+    "SELECT A_TIMESTAMP, A_DATE, A_TIME FROM $table WHERE ID = ?",
+    { ib_time_all => 'ISO' });
+
+sub roundtrip {
+    my ($id, @values) = @_;
+    $insert->execute($id, @values);
+    return $dbh->selectrow_array($select, undef, $id);
+}
+
+my @r = roundtrip(1, '2020-02-03 20:01:02.1234', '2020-02-03', '20:01:02.5');
+is_deeply(\@r, [ '2020-02-03 20:01:02.1234', '2020-02-03', '20:01:02.5000' ],
+    'ISO strings');
+
+@r = roundtrip(2, '2020-02-03T20:01', '  2020-02-03 ', '20:01');
+is_deeply(\@r, [ '2020-02-03 20:01:00.0000', '2020-02-03', '20:01:00.0000' ],
+    'T separator, no seconds, blanks');
+
+@r = roundtrip(3, '2020-02-03', '2000-02-29', '23:59:59.99999');
+is_deeply(\@r, [ '2020-02-03 00:00:00.0000', '2000-02-29', '23:59:59.9999' ],
+    'date only timestamp, leap day, extra digits dropped');
+
+# numbers are text for the server unless ib_bind_epoch is on
+{
+    local $insert->{RaiseError} = 1;
+    local $insert->{PrintError} = 0;
+
+    ok(!eval { $insert->execute(4, '1580760062', undef, undef); 1 },
+        'numeric string not taken as epoch by default');
+    ok(!eval { $insert->execute(4, '2020-02-03T', undef, undef); 1 },
+        'T without a time refused');
+}
+
+$dbh->{ib_bind_epoch} = 1;
+ok($dbh->{ib_bind_epoch}, 'ib_bind_epoch on');
+
+@r = roundtrip(4, 1580760062.25, 1580760062, 72062);
+is_deeply(\@r, [ '2020-02-03 20:01:02.2500', '2020-02-03', '20:01:02.0000' ],
+    'epoch numbers');
+
+@r = roundtrip(5, -0.5, -1, -1);
+is_deeply(\@r, [ '1969-12-31 23:59:59.5000', '1969-12-31', '23:59:59.0000' ],
+    'epoch before 1970');
+
+@r = roundtrip(6, '1580760062', '1580760062', '72062');
+is_deeply(\@r, [ '2020-02-03 20:01:02.0000', '2020-02-03', '20:01:02.0000' ],
+    'epoch numbers as strings');
+
+my @tm = (2, 1, 20, 3, 1, 120, 0, 0, 0, 1234);
+@r = roundtrip(7, \@tm, \@tm, \@tm);
+is_deeply(\@r, [ '2020-02-03 20:01:02.1234', '2020-02-03', '20:01:02.1234' ],
+    'localtime() style arrays');
+
+# what the driver does not parse is still left to the server
+@r = roundtrip(8, '3.2.2020 20:01', '3.2.2020', '8:01:02');
+is_deeply(\@r, [ '2020-02-03 20:01:00.0000', '2020-02-03', '08:01:02.0000' ],
+    'other formats parsed by the server');
+
+# ... and switching between both kinds keeps the parameter types right
+@r = roundtrip(9, '2020-02-03 20:01:02', '2020-02-03', '20:01:02');
+is_deeply(\@r, [ '2020-02-03 20:01:02.0000', '2020-02-03', '20:01:02.0000' ],
+    'back to client side encoding');
+
+ok($insert->execute(10, 'NOW', 'TODAY', 'NOW'), 'NOW/TODAY literals');
+@r = roundtrip(11, 0, 0, 0);
+is_deeply(\@r, [ '1970-01-01 00:00:00.0000', '1970-01-01', '00:00:00.0000' ],
+    'epoch after server parsed literals');
+
+@r = roundtrip(12, undef, undef, undef);
+is_deeply(\@r, [ undef, undef, undef ], 'NULLs');
+
+# invalid values
+{
+    local $insert->{RaiseError} = 1;
+    local $insert->{PrintError} = 0;
+
+    ok(!eval { $insert->execute(13, '2021-02-29', undef, undef); 1 },
+        'no Feb 29 in 2021');
+    ok(!eval { $insert->execute(13, undef, undef, '24:00'); 1 },
+        'no hour 24');
+    ok(!eval { $insert->execute(13, undef, { a => 1 }, undef); 1 },
+        'hash ref refused');
+}
+
+ok( $dbh->do("DROP TABLE $table"), "DROP TABLE '$table'" );
+
+SKIP: {
+    my $orig_ver = $dbh->func( version => 'ib_database_info' )->{version};
+    ( my $ver = $orig_ver ) =~ s/.*\bFirebird\s*//;
+
+    skip 'TIME ZONE types need Firebird 4.0+', 8
+        unless $ver =~ /^(\d+)/ and $1 >= 4;
+
+    $table = find_new_table($dbh);
+    ok( $dbh->do(<<"DEF"), qq{CREATE TABLE '$table'} );
+CREATE TABLE $table (
+    ID      INTEGER,
+    A_TS    TIMESTAMP WITH TIME ZONE,
+    A_TIME  TIME WITH TIME ZONE
+)
+DEF
+
+    $insert = $dbh->prepare("INSERT INTO $table VALUES (?, ?, ?)");
+    $select = $dbh->prepare(
+        "SELECT A_TS, A_TIME FROM $table WHERE ID = ?",
+        { ib_time_all => 'ISO' });
+
+    @r = roundtrip(1, '2020-02-03 20:00:00.0000 -05:00', '20:00:00 +05:30');
+    is_deeply(\@r, [ '2020-02-03 20:00:00.0000 -05:00', '20:00:00.0000 +05:30' ],
+        'offsets');
+
+    @r = roundtrip(2, '2020-02-03T20:00:00Z', '23:30Z');
+    is_deeply(\@r, [ '2020-02-03 20:00:00.0000 +00:00', '23:30:00.0000 +00:00' ],
+        'Z suffix');
+
+    @r = roundtrip(3, 1580760000, 72000);
+    is_deeply(\@r, [ '2020-02-03 20:00:00.0000 +00:00', '20:00:00.0000 +00:00' ],
+        'epoch numbers are UTC');
+
+    @r = roundtrip(4, '2020-02-03 00:30 +02:00', '00:30 +02:00');
+    is_deeply(\@r, [ '2020-02-03 00:30:00.0000 +02:00', '00:30:00.0000 +02:00' ],
+        'offset across midnight');
+
+    @r = $dbh->selectrow_array(
+        "SELECT A_TS, A_TIME FROM $table WHERE ID = ?",
+        { ib_time_all => 'epoch' }, 4);
+    is_deeply(\@r, [ 1580682600, 81000 ], 'stored as UTC');
+
+    @r = roundtrip(5, '2020-02-03 20:00:00 America/New_York', '20:00:00 +05:30');
+    is($r[0], '2020-02-03 20:00:00.0000 America/New_York', 'named zone parsed by the server')
+        or diag "got $r[0]";
+
+    ok( $dbh->do("DROP TABLE $table"), "DROP TABLE '$table'" );
+}
+
+ok( $dbh->disconnect );
@@ -0,0 +1,109 @@
+#!/usr/bin/perl
+#
+#   Test for the numeric date/time output modes: epoch, epoch_ms, julian
+#
+
+use strict;
+use warnings;
+
+use Test::More;
+
+use lib 't','.';
+
+use TestFirebird;
+my $T = TestFirebird->new;
+
+my ( $dbh, $error_str ) = $T->connect_to_database();
+
+if ($error_str) {
+    BAIL_OUT("Unknown: $error_str!");
+}
+
+unless ( $dbh->isa('DBI::db') ) {
+    plan skip_all => 'Connection to database failed, cannot continue testing';
+}
+else {
+    plan tests => 22;
+}
+
+ok($dbh, 'Connected to the database');
+
+my $table = find_new_table($dbh);
+ok($table, "TABLE is '$table'");
+
+ok( $dbh->do(<<"DEF"), qq{CREATE TABLE '$table'} );
+CREATE TABLE $table (
+    ID           INTEGER,
+    A_TIMESTAMP  TIMESTAMP,
+    A_DATE       DATE,
+    A_TIME       TIME
+)
+DEF
+
+ok( $dbh->do(<<"SQL"), 'insert' );
+INSERT INTO $table VALUES (1, '2000-01-01 12:00:00.5000', '2000-01-01', '12:00:00.2500')
+SQL
+ok( $dbh->do(<<"SQL"), 'insert before 1970' );
+INSERT INTO $table VALUES (2, '1969-12-31 23:59:59.9995', '1969-12-31', '00:00:00.0001')
+SQL
+
+sub fetch_as {
+    my ($sql, $format, @bind) = @_;
+    return $dbh->selectrow_array($sql, { ib_time_all => $format }, @bind);
+}
+
+my $sel = "SELECT A_TIMESTAMP, A_DATE, A_TIME FROM $table WHERE ID = ?";
+
+my @r = fetch_as($sel, 'epoch', 1);
+is_deeply(\@r, [ 946728000.5, 946684800, 43200.25 ], 'epoch');
+
+@r = fetch_as($sel, 'epoch_ms', 1);
+is_deeply(\@r, [ 946728000500, 946684800000, 43200250 ], 'epoch_ms');
+
+@r = fetch_as($sel, 'julian', 1);
+ok(abs($r[0] - 2451545.0000057870) < 1e-8, 'julian timestamp');
+is($r[1], 2451544.5, 'julian date');
+ok(abs($r[2] - 43200.25 / 86400) < 1e-12, 'julian time is a day fraction');
+
+@r = fetch_as($sel, 'epoch_ms', 2);
+is($r[0], -1, 'epoch_ms rounds down before 1970');
+is($r[1], -86400000, 'epoch_ms date before 1970');
+is($r[2], 0, 'epoch_ms time');
+
+@r = fetch_as($sel, 'epoch', 2);
+ok(abs($r[0] + 0.0005) < 1e-9, 'negative epoch keeps the fraction');
+
+# per format attribute, mixed with the others
+@r = $dbh->selectrow_array($sel,
+    { ib_timestampformat => 'EPOCH', ib_dateformat => 'iso' }, 1);
+is($r[0], 946728000.5, 'EPOCH via ib_timestampformat');
+is($r[1], '2000-01-01', 'ISO date alongside');
+
+ok( $dbh->do("DROP TABLE $table"), "DROP TABLE '$table'" );
+
+SKIP: {
+    my $orig_ver = $dbh->func( version => 'ib_database_info' )->{version};
+    ( my $ver = $orig_ver ) =~ s/.*\bFirebird\s*//;
+
+    skip 'TIME ZONE types need Firebird 4.0+', 4
+        unless $ver =~ /^(\d+)/ and $1 >= 4;
+
+    my $tz_sel = <<'SQL';
+SELECT CAST('2000-01-01 12:00:00.5000 +02:00' AS TIMESTAMP WITH TIME ZONE),
+       CAST('12:00:00 -03:30' AS TIME WITH TIME ZONE)
+  FROM RDB$DATABASE
+SQL
+
+    @r = fetch_as($tz_sel, 'epoch');
+    is($r[0], 946720800.5, 'epoch of TIMESTAMP WITH TIME ZONE is UTC');
+    is($r[1], 55800, 'epoch of TIME WITH TIME ZONE is UTC');
+
+    @r = fetch_as($tz_sel, 'epoch_ms');
+    is($r[0], 946720800500, 'epoch_ms with time zone');
+
+    @r = fetch_as($tz_sel, 'julian');
+    ok(abs($r[0] - (2451545.0 - 2 / 24 + 0.5 / 86400)) < 1e-8,
+        'julian with time zone');
+}
+
+ok( $dbh->disconnect );
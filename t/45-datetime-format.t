@@ -0,0 +1,127 @@
+#!/usr/bin/perl
+#
+#   Test for the date/time output formats: ISO with fractional digits,
+#   strftime() patterns and TM, over a range of dates.
+#
+
+use strict;
+use warnings;
+
+use Test::More;
+use POSIX qw(strftime);
+
+use lib 't','.';
+
+use TestFirebird;
+my $T = TestFirebird->new;
+
+my ( $dbh, $error_str ) = $T->connect_to_database();
+
+if ($error_str) {
+    BAIL_OUT("Unknown: $error_str!");
+}
+
+unless ( $dbh->isa('DBI::db') ) {
+    plan skip_all => 'Connection to database failed, cannot continue testing';
+}
+
+my @values = (
+    [ 1,    1,  1,  0,  0,  0,    0 ],
+    [ 99,   6,  15, 1,  2,  3,    4 ],
+    [ 999,  12, 31, 23, 0,  0,    0 ],
+    [ 1858, 11, 16, 23, 59, 59, 9999 ],
+    [ 1858, 11, 17, 0,  0,  0,    1 ],
+    [ 1899, 12, 31, 12, 30, 15, 1230 ],
+    [ 1968, 12, 31, 0,  0,  0,    0 ],
+    [ 1969, 1,  1,  0,  0,  0,    0 ],
+    [ 1970, 1,  1,  0,  0,  0,    0 ],
+    [ 2000, 2,  29, 8,  5,  3,  500 ],
+    [ 2024, 12, 31, 23, 59, 58, 4321 ],
+    [ 2068, 12, 31, 23, 59, 59,    0 ],
+    [ 2069, 1,  1,  0,  0,  0,    0 ],
+    [ 9999, 12, 31, 23, 59, 59, 9999 ],
+);
+
+plan tests => 5 + 10 * @values;
+
+ok($dbh, 'Connected to the database');
+
+my $table = find_new_table($dbh);
+ok($table, "TABLE is '$table'");
+
+ok( $dbh->do(<<"DEF"), qq{CREATE TABLE '$table'} );
+CREATE TABLE $table (
+    ID           INTEGER,
+    A_TIMESTAMP  TIMESTAMP,
+    A_DATE       DATE,
+    A_TIME       TIME
+)
+DEF
+
+my $insert = $dbh->prepare("INSERT INTO $table VALUES (?, ?, ?, ?)");
+for my $i (0 .. $#values) {
+    my ($y, $m, $d, $hh, $mm, $ss, $frac) = @{ $values[$i] };
+    my $date = sprintf('%04d-%02d-%02d', $y, $m, $d);
+    my $time = sprintf('%02d:%02d:%02d.%04d', $hh, $mm, $ss, $frac);
+    $insert->execute($i, "$date $time", $date, $time);
+}
+
+sub fetch_as {
+    my ($id, $format) = @_;
+    return $dbh->selectrow_array(
+        "SELECT A_TIMESTAMP, A_DATE, A_TIME FROM $table WHERE ID = ?",
+        { ib_time_all => $format }, $id);
+}
+
+for my $i (0 .. $#values) {
+    my ($y, $m, $d, $hh, $mm, $ss, $frac) = @{ $values[$i] };
+    my $date = sprintf('%04d-%02d-%02d', $y, $m, $d);
+    my $time = sprintf('%02d:%02d:%02d', $hh, $mm, $ss);
+    my $f4   = sprintf('%04d', $frac);
+
+    my @r = fetch_as($i, 'ISO');
+    is_deeply(\@r, [ "$date $time.$f4", $date, "$time.$f4" ], "$date ISO");
+
+    @r = fetch_as($i, 'iso0');
+    is_deeply(\@r, [ "$date $time", $date, $time ], "$date iso0");
+
+    my $f2 = substr($f4, 0, 2);
+    @r = fetch_as($i, 'iso2');
+    is_deeply(\@r, [ "$date $time.$f2", $date, "$time.$f2" ], "$date iso2");
+
+    # %Y as glibc: no padding below 1000
+    @r = fetch_as($i, '%Y-%m-%d %H:%M:%S');
+    is_deeply(\@r, [
+            strftime('%Y-%m-%d %H:%M:%S', $ss, $mm, $hh, $d, $m - 1, $y - 1900),
+            strftime('%Y-%m-%d %H:%M:%S', 0, 0, 0, $d, $m - 1, $y - 1900),
+            "1900-01-00 $time" ],
+        "$date %Y-%m-%d %H:%M:%S");
+
+    my ($tm) = fetch_as($i, 'TM');
+    is_deeply([ @$tm[0..5] ], [ $ss, $mm, $hh, $d, $m - 1, $y - 1900 ],
+        "$date TM fields");
+
+    # wday/yday checked against the C library
+    my $libc = strftime('%w %j', 0, 0, 0, $d, $m - 1, $y - 1900);
+    my $want = join ' ', @$tm[6], sprintf('%03d', $tm->[7] + 1);
+    is($want, $libc, "$date TM wday/yday");
+
+    ($r[0]) = fetch_as($i, '%j|%e|%u|%y');
+    my $expect = strftime('%j|%e|%u|%y', $ss, $mm, $hh, $d, $m - 1, $y - 1900);
+    is($r[0], $expect, "$date %j|%e|%u|%y");
+
+    ($r[0]) = fetch_as($i, '%F %T|%D|%R %%');
+    $expect = strftime('%F %T|%D|%R %%', $ss, $mm, $hh, $d, $m - 1, $y - 1900);
+    is($r[0], $expect, "$date %F %T|%D|%R");
+
+    # locale dependent conversions go through strftime()
+    ($r[0]) = fetch_as($i, '%A %B');
+    $expect = strftime('%A %B', $ss, $mm, $hh, $d, $m - 1, $y - 1900);
+    is($r[0], $expect, "$date %A %B");
+
+    ($r[0]) = fetch_as($i, 'day %d of %Y');
+    is($r[0], sprintf('day %02d of %d', $d, $y), "$date literal text");
+}
+
+ok( $dbh->do("DROP TABLE $table"), "DROP TABLE '$table'" );
+ok( $dbh->disconnect );
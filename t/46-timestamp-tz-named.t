@@ -0,0 +1,126 @@
+#!/usr/bin/perl
+#
+#   Test for TIMESTAMP/TIME WITH TIME ZONE values in named (region) zones,
+#   decoded through the per-connection zone cache (Firebird 4.0+), and for
+#   the ib_tz_epoch attribute.
+#
+
+use strict;
+use warnings;
+
+use Test::More;
+use DBI qw(:sql_types);
+
+use lib 't', '.';
+
+use TestFirebird;
+my $T = TestFirebird->new;
+
+my ( $dbh, $error_str ) = $T->connect_to_database( { ChopBlanks => 1 } );
+
+if ($error_str) {
+    BAIL_OUT("Unknown: $error_str!");
+}
+
+unless ( $dbh->isa('DBI::db') ) {
+    plan skip_all => 'Connection to database failed, cannot continue testing';
+}
+
+my $orig_ver = $dbh->func( version => 'ib_database_info' )->{version};
+( my $ver = $orig_ver ) =~ s/.*\bFirebird\s*//;
+
+if ( $ver =~ /^(\d+)\.(\d+)/ ) {
+    my ( $major, $minor ) = ( $1, $2 );
+    if ( $major < 4 ) {
+        plan skip_all =>
+            "Firebird $major.$minor does not support TIMESTAMP/TIME WITH TIME ZONE (requires 4.0+)";
+    }
+}
+else {
+    plan skip_all =>
+        "Unable to determine Firebird version from '$orig_ver'. Assuming no TIMESTAMP WITH TIME ZONE support";
+}
+
+plan tests => 22;
+
+ok( $dbh, 'Connected to the database' );
+
+my $table = find_new_table($dbh);
+ok( $table, "TABLE is '$table'" );
+
+ok( $dbh->do(<<"DEF"), qq{CREATE TABLE '$table'} );
+CREATE TABLE $table (
+    ID              INTEGER,
+    A_TIMESTAMP_TZ  TIMESTAMP WITH TIME ZONE,
+    A_TIME_TZ       TIME WITH TIME ZONE,
+    A_TIMESTAMP     TIMESTAMP
+)
+DEF
+
+# winter and summer time in the same zone, and a value from another decade
+# so the transitions are fetched for a second window
+my @rows = (
+    [ 1, '2020-01-15 12:00:00 Europe/Berlin', '12:00:00 Europe/Berlin' ],
+    [ 2, '2020-07-15 12:00:00 Europe/Berlin', '12:00:00 Europe/Berlin' ],
+    [ 3, '1995-06-01 12:00:00 Europe/Berlin', '12:00:00 America/New_York' ],
+    [ 4, '2020-07-15 12:00:00 +02:00',        '12:00:00 +02:00' ],
+);
+for my $r (@rows) {
+    ok( $dbh->do(
+            "INSERT INTO $table VALUES (?, CAST(? AS TIMESTAMP WITH TIME ZONE),"
+                . " CAST(? AS TIME WITH TIME ZONE), TIMESTAMP '2020-01-01 00:00:00')",
+            undef, @$r
+        ),
+        "INSERT row $r->[0]"
+    );
+}
+
+my $sql = "SELECT A_TIMESTAMP_TZ, A_TIME_TZ, A_TIMESTAMP FROM $table ORDER BY ID";
+
+my $res = $dbh->selectall_arrayref( $sql, { ib_time_all => 'ISO' } );
+is_deeply(
+    [ map { $_->[0] } @$res ],
+    [   '2020-01-15 12:00:00.0000 Europe/Berlin',
+        '2020-07-15 12:00:00.0000 Europe/Berlin',
+        '1995-06-01 12:00:00.0000 Europe/Berlin',
+        '2020-07-15 12:00:00.0000 +02:00',
+    ],
+    'named zones shown in local time with the zone name'
+);
+is( $res->[0][1], '12:00:00.0000 Europe/Berlin',    'TIME in a named zone' );
+is( $res->[2][1], '12:00:00.0000 America/New_York', 'TIME in another named zone' );
+
+my $tm = $dbh->selectall_arrayref( $sql, { ib_time_all => 'TM' } );
+is( $tm->[0][0][10], 60,  'winter offset is +60 minutes' );
+is( $tm->[1][0][10], 120, 'summer offset is +120 minutes' );
+is( $tm->[2][0][10], 120, 'summer offset in 1995' );
+is( $tm->[1][0][2],  12,  'hour is local' );
+is( $tm->[2][1][10], -300, 'TIME offset taken on 2020-01-01' );
+
+my $ep = $dbh->selectall_arrayref( $sql, { ib_time_all => 'epoch' } );
+is_deeply(
+    [ map { $_->[0] } @$ep ],
+    [ 1579086000, 1594807200, 802000800, 1594807200 ],
+    'epoch format gives the UTC instant'
+);
+
+#
+# ib_tz_epoch: only the zoned columns become numbers
+#
+ok( !$dbh->{ib_tz_epoch}, 'ib_tz_epoch is off by default' );
+$dbh->{ib_tz_epoch} = 1;
+ok( $dbh->{ib_tz_epoch}, 'ib_tz_epoch switched on' );
+
+$res = $dbh->selectall_arrayref( $sql, { ib_time_all => 'ISO' } );
+is_deeply(
+    [ map { $_->[0] } @$res ],
+    [ 1579086000, 1594807200, 802000800, 1594807200 ],
+    'TIMESTAMP WITH TIME ZONE normalized to UTC epoch'
+);
+is( $res->[0][2], '2020-01-01 00:00:00.0000', 'plain TIMESTAMP keeps its format' );
+
+$dbh->{ib_tz_epoch} = 0;
+
+ok( $dbh->do("DROP TABLE $table"), "DROP TABLE '$table'" );
+
+ok( $dbh->disconnect, 'DISCONNECT' );
@@ -0,0 +1,71 @@
+#!/usr/bin/perl
+#
+#   Test $sth->ib_fetch_into_hash and the shared column name keys
+#
+
+use strict;
+use warnings;
+
+use Test::More;
+use lib 't','.';
+
+use TestFirebird;
+my $T = TestFirebird->new;
+
+my ($dbh, $error_str) = $T->connect_to_database({ChopBlanks => 1});
+
+if ($error_str) {
+    BAIL_OUT("Unknown: $error_str!");
+}
+
+unless ( $dbh->isa('DBI::db') ) {
+    plan skip_all => 'Connection to database failed, cannot continue testing';
+}
+else {
+    plan tests => 18;
+}
+
+ok($dbh, 'Connected to the database');
+
+my $table = find_new_table($dbh);
+ok($table, "TABLE is '$table'");
+
+ok($dbh->do("CREATE TABLE $table (ID INTEGER NOT NULL, NAME VARCHAR(20))"),
+    "CREATE TABLE '$table'");
+
+my @rows = ( [ 1, 'one' ], [ 2, undef ], [ 3, 'three' ] );
+ok($dbh->do("INSERT INTO $table VALUES (?, ?)", undef, @$_),
+    "INSERT row $_->[0]")
+    for @rows;
+
+my $sth = $dbh->prepare("SELECT ID, NAME, ID * 2 FROM $table ORDER BY ID");
+ok($sth, 'prepare');
+is_deeply($sth->{NAME}, [ 'ID', 'NAME', 'COLUMN2' ], 'NAME');
+is($sth->{NAME}, $sth->{NAME}, 'NAME is cached');
+
+ok($sth->execute, 'execute');
+
+my %row = ( extra => 'kept' );
+my @got;
+while (my $h = $sth->ib_fetch_into_hash(\%row)) {
+    is($h, \%row, 'returns the same hash') if !@got;
+    push @got, [ $row{ID}, $row{NAME}, $row{COLUMN2} ];
+}
+is_deeply(\@got,
+    [ [ 1, 'one', 2 ], [ 2, undef, 4 ], [ 3, 'three', 6 ] ],
+    'rows fetched into the hash');
+is($row{extra}, 'kept', 'other keys left alone');
+ok(!$sth->ib_fetch_into_hash(\%row), 'undef after the last row');
+
+$sth->{FetchHashKeyName} = 'NAME_lc';
+ok($sth->execute, 'execute again');
+%row = ();
+$sth->ib_fetch_into_hash(\%row);
+is_deeply(\%row, { id => 1, name => 'one', column2 => 2 },
+    'keys follow FetchHashKeyName');
+$sth->finish;
+
+eval { $sth->ib_fetch_into_hash([]) };
+like($@, qr/must be a hash reference/, 'array reference refused');
+
+ok($dbh->do("DROP TABLE $table"), "DROP TABLE '$table'");
@@ -0,0 +1,92 @@
+#!/usr/bin/perl
+#
+#   Test the ib_exact_numeric attribute: scaled NUMERIC/DECIMAL values as
+#   exact strings or as integers in minor units
+#
+
+use strict;
+use warnings;
+
+use Test::More;
+use DBI;
+
+use lib 't','.';
+
+use TestFirebird;
+my $T = TestFirebird->new;
+
+my ( $dbh, $error_str ) = $T->connect_to_database( { AutoCommit => 1 } );
+
+if ($error_str) {
+    BAIL_OUT("Unknown: $error_str!");
+}
+
+unless ( $dbh->isa('DBI::db') ) {
+    plan skip_all => 'Connection to database failed, cannot continue testing';
+}
+else {
+    plan tests => 16;
+}
+
+ok( $dbh, 'Connected to the database' );
+
+my $table = find_new_table($dbh);
+ok( $table, "TABLE is '$table'" );
+
+# SMALLINT, INTEGER and BIGINT storage
+ok( $dbh->do(<<"DEF"), qq{CREATE TABLE '$table'} );
+CREATE TABLE $table (
+    ID   INTEGER,
+    N4   NUMERIC(4,2),
+    N9   NUMERIC(9,2),
+    N18  NUMERIC(18,2),
+    I    INTEGER
+)
+DEF
+
+my @rows = (
+    [ 1, '0.29',   '0.29',        '0.29',                 7 ],
+    [ 2, '-12.30', '-1234567.89', '-92233720368547758.08', -7 ],
+    [ 3, '-0.05',  '0.00',        '92233720368547758.07', 0 ],
+);
+ok( $dbh->do( "INSERT INTO $table VALUES (?, ?, ?, ?, ?)", undef, @$_ ),
+    "INSERT row $_->[0]" )
+    for @rows;
+
+my $sql = "SELECT N4, N9, N18, I FROM $table ORDER BY ID";
+
+ok( !$dbh->{ib_exact_numeric}, 'ib_exact_numeric is off by default' );
+my $res = $dbh->selectall_arrayref($sql);
+is( $res->[0][0], 0.29, 'SMALLINT NUMERIC as a number' );
+is( $res->[1][1], -1234567.89, 'INTEGER NUMERIC as a number' );
+
+$dbh->{ib_exact_numeric} = 1;
+ok( $dbh->{ib_exact_numeric}, 'ib_exact_numeric switched on' );
+$res = $dbh->selectall_arrayref($sql);
+is_deeply(
+    $res,
+    [   [ '0.29',   '0.29',        '0.29',                  7 ],
+        [ '-12.30', '-1234567.89', '-92233720368547758.08', -7 ],
+        [ '-0.05',  '0.00',        '92233720368547758.07',  0 ],
+    ],
+    'exact strings with all the decimals'
+);
+
+$dbh->{ib_exact_numeric} = 'minor';
+is( $dbh->{ib_exact_numeric}, 'minor', 'minor units mode' );
+$res = $dbh->selectall_arrayref($sql);
+is_deeply(
+    $res,
+    [   [ 29,    29,        29,                   7 ],
+        [ -1230, -123456789, '-9223372036854775808', -7 ],
+        [ -5,    0,          '9223372036854775807',  0 ],
+    ],
+    'integers in hundredths'
+);
+
+$dbh->{ib_exact_numeric} = 0;
+ok( !$dbh->{ib_exact_numeric}, 'ib_exact_numeric switched off' );
+
+ok( $dbh->do("DROP TABLE $table"), "DROP TABLE '$table'" );
+
+ok( $dbh->disconnect, 'DISCONNECT' );
@@ -0,0 +1,80 @@
+#!/usr/bin/perl
+#
+#   Test CHAR(n) padding and ChopBlanks on UTF8 columns: without
+#   ChopBlanks a CHAR(n) value is exactly n characters long
+#
+
+use strict;
+use warnings;
+
+use utf8;
+BEGIN {
+    binmode(STDERR, ':utf8');
+    binmode(STDOUT, ':utf8');
+};
+use Test::More;
+use lib 't','.';
+
+use Encode ();
+use TestFirebird;
+my $T = TestFirebird->new;
+
+plan tests => 15;
+
+my $dsn = $T->{tdsn};
+$dsn =~ s/(?<=ib_charset=)[^;]+/UTF8/;
+my $dbh = DBI->connect( $dsn, $T->{user}, $T->{pass},
+    { RaiseError => 1, PrintError => 0, AutoCommit => 1, ChopBlanks => 0 } );
+ok( $dbh, 'Connected' );
+ok( $dbh->{ib_enable_utf8} = 1, 'Set ib_enable_utf8' );
+
+my $table = find_new_table($dbh);
+ok($table, qq{Table is '$table'});
+
+ok( $dbh->do(<<"DEF"), qq{CREATE TABLE '$table'} );
+CREATE TABLE $table (
+    id   INTEGER PRIMARY KEY,
+    c10  CHAR(10) CHARACTER SET UTF8,
+    c100 CHAR(100) CHARACTER SET UTF8
+)
+DEF
+
+my @values = (
+    [ 1, 'abc',        'x' x 60 ],
+    [ 2, 'Værчàr €',   '€' x 99 ],
+    [ 3, '😀 ñ',        ' lead' ],
+    [ 4, '0123456789', '' ],
+);
+ok( $dbh->do( "INSERT INTO $table VALUES (?, ?, ?)", {}, @$_ ),
+    "INSERT row $_->[0]" )
+    for @values;
+
+my $res = $dbh->selectall_arrayref("SELECT c10, c100 FROM $table ORDER BY id");
+is_deeply(
+    [ map { $_->[0] } @$res ],
+    [ map { sprintf '%-10s', $_->[1] } @values ],
+    'CHAR(10) padded to 10 characters'
+);
+is_deeply(
+    [ map { $_->[1] } @$res ],
+    [ map { sprintf '%-100s', $_->[2] } @values ],
+    'CHAR(100) padded to 100 characters'
+);
+is( length( $res->[1][1] ), 100, 'multibyte value is 100 characters' );
+
+$dbh->{ChopBlanks} = 1;
+$res = $dbh->selectall_arrayref("SELECT c10, c100 FROM $table ORDER BY id");
+is_deeply(
+    [ map { [ @$_ ] } @$res ],
+    [ map { [ $_->[1], $_->[2] ] } @values ],
+    'ChopBlanks strips the padding'
+);
+
+$dbh->{ChopBlanks} = 0;
+$dbh->{ib_enable_utf8} = 0;
+my ($raw) = $dbh->selectrow_array("SELECT c10 FROM $table WHERE id = 2");
+is( length($raw), length( Encode::encode_utf8('Værчàr €') ) + 2,
+    'padding counted in characters on raw bytes too' );
+
+ok( $dbh->do("DROP TABLE $table"), "DROP TABLE '$table'" );
+ok( $dbh->disconnect );
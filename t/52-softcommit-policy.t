@@ -0,0 +1,72 @@
+#!/usr/bin/perl
+# test for ib_softcommit_max_commits / ib_softcommit_max_age
+
+use strict;
+use warnings;
+
+use Test::More;
+use lib 't','.';
+
+use TestFirebird;
+my $T = TestFirebird->new;
+
+my ($dbh, $error_str) = $T->connect_to_database({AutoCommit => 0});
+
+if ($error_str) {
+    BAIL_OUT("Unknown: $error_str!");
+}
+
+unless ( $dbh->isa('DBI::db') ) {
+    plan skip_all => 'Connection to database failed, cannot continue testing';
+}
+else {
+    plan tests => 20;
+}
+
+ok($dbh, 'Connected to the database');
+
+is($dbh->{ib_softcommit_max_commits}, 0, 'max_commits defaults to 0');
+is($dbh->{ib_softcommit_max_age}, 0, 'max_age defaults to 0');
+
+$dbh->{ib_softcommit} = 1;
+$dbh->{ib_softcommit_max_commits} = 3;
+is($dbh->{ib_softcommit_max_commits}, 3, 'max_commits set');
+
+sub tx_info {
+    $dbh->selectall_arrayref(q{SELECT COUNT(1) FROM RDB$DATABASE});
+    return $dbh->func('ib_tx_info');
+}
+
+my $info = tx_info();
+my $id   = $info->{id};
+ok($id, 'transaction started');
+is($info->{retained_commits}, 0, 'no soft commits yet');
+
+ok($dbh->commit, 'first commit');
+$info = tx_info();
+is($info->{id}, $id, 'transaction retained');
+is($info->{retained_commits}, 1, 'one soft commit');
+
+ok($dbh->commit, 'second commit');
+$info = tx_info();
+is($info->{id}, $id, 'transaction still retained');
+is($info->{retained_commits}, 2, 'two soft commits');
+ok($info->{retained_age} >= 0, 'retained_age reported');
+
+ok($dbh->commit, 'third commit');
+$info = tx_info();
+isnt($info->{id}, $id, 'limit reached, new transaction');
+is($info->{retained_commits}, 0, 'soft commit counter reset');
+
+# age limit
+$dbh->{ib_softcommit_max_commits} = 0;
+$dbh->{ib_softcommit_max_age} = 1;
+$id = tx_info()->{id};
+sleep 2;
+ok($dbh->commit, 'commit after max_age');
+isnt(tx_info()->{id}, $id, 'aged transaction was hard committed');
+
+eval { $dbh->{ib_softcommit_max_age} = -1 };
+ok($@, 'negative max_age refused');
+
+ok($dbh->disconnect);
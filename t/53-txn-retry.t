@@ -0,0 +1,114 @@
+#!/usr/bin/perl
+# test for ib_txn() and ib_txn_stats
+
+use strict;
+use warnings;
+
+use Test::More;
+use lib 't','.';
+
+use TestFirebird;
+my $T = TestFirebird->new;
+
+my ($dbh1, $error_str) = $T->connect_to_database();
+
+if ($error_str) {
+    BAIL_OUT("Unknown: $error_str!");
+}
+
+unless ( $dbh1->isa('DBI::db') ) {
+    plan skip_all => 'Connection to database failed, cannot continue testing';
+}
+else {
+    plan tests => 25;
+}
+
+ok($dbh1, 'Connected to the database (1)');
+
+my ($dbh2) = $T->connect_to_database();
+ok($dbh2, 'Connected to the database (2)');
+
+my $table = find_new_table($dbh1);
+ok($table, qq{Table is '$table'});
+
+ok($dbh1->do(
+    "CREATE TABLE $table (id INTEGER NOT NULL PRIMARY KEY, val INTEGER)"),
+    "CREATE TABLE '$table'");
+ok($dbh1->do("INSERT INTO $table VALUES (1, 0)"), 'insert row');
+
+# conflicts are reported at once without waiting for the other transaction
+ok($dbh2->func(-lock_resolution => 'no_wait', 'ib_set_tx_param'),
+    'no_wait on the second connection');
+
+my $stats = $dbh2->{ib_txn_stats};
+is_deeply($stats, { conflicts => 0, retries => 0, wasted => 0 },
+    'stats start at zero');
+
+# plain success, context is passed through
+my @list = $dbh2->ib_txn(sub { return (1, 2, 3) });
+is_deeply(\@list, [1, 2, 3], 'list context result');
+is(scalar $dbh2->ib_txn(sub { 42 }), 42, 'scalar context result');
+ok($dbh2->{AutoCommit}, 'AutoCommit restored');
+
+my $handle;
+$dbh2->ib_txn(sub { $handle = shift });
+is($handle, $dbh2, 'the code gets the outer handle');
+
+# an open transaction is not taken over
+{
+    my $ran = 0;
+    local $dbh2->{RaiseError} = 0;
+    local $dbh2->{PrintError} = 0;
+
+    $dbh2->begin_work;
+    ok(!defined $dbh2->ib_txn(sub { $ran++ }), 'refused with AutoCommit off');
+    like($dbh2->errstr, qr/AutoCommit is off/, '...with an error');
+    is($ran, 0, '...without running the code');
+    $dbh2->rollback;
+}
+
+# hold a lock on the row with the first connection
+$dbh1->begin_work;
+$dbh1->do("UPDATE $table SET val = val + 1 WHERE id = 1");
+
+my $runs = 0;
+my @seen;
+my $val = $dbh2->ib_txn(
+    sub {
+        my $dbh = shift;
+        $runs++;
+        $dbh->do("UPDATE $table SET val = val + 10 WHERE id = 1");
+        return $dbh->selectrow_array("SELECT val FROM $table WHERE id = 1");
+    },
+    retries => 3,
+    backoff => sub {
+        my ($n, $kind) = @_;
+        push @seen, $kind;
+        $dbh1->commit if $n == 1;    # release the lock
+        return 0.01;
+    },
+);
+
+is($runs, 2, 'transaction was run twice');
+is($val, 11, 'second run saw the committed update');
+is(scalar @seen, 1, 'backoff called once');
+like($seen[0], qr/^(update_conflict|lock_conflict|deadlock)$/,
+    "conflict classified as '$seen[0]'");
+
+$stats = $dbh2->{ib_txn_stats};
+ok($stats->{conflicts} >= 1, 'conflict counted');
+is($stats->{retries}, 1, 'retry counted');
+ok($stats->{wasted} > 0, 'wasted time recorded');
+
+# errors that are not conflicts are not retried
+$runs = 0;
+eval { $dbh2->ib_txn(sub { $runs++; die "boom\n" }, retries => 5) };
+is($@, "boom\n", 'other errors are rethrown');
+is($runs, 1, '...without retrying');
+is_deeply([ @{ $dbh2->{ib_txn_stats} }{qw(retries wasted)} ],
+    [ @$stats{qw(retries wasted)} ], '...nor counted as wasted');
+
+ok($dbh1->do("DROP TABLE $table"), "DROP TABLE '$table'");
+
+$dbh2->disconnect;
+$dbh1->disconnect;
@@ -0,0 +1,143 @@
+#!/usr/bin/perl
+# test for ib_define_tx_profile() and ib_use_tx_profile()
+
+use strict;
+use warnings;
+
+use Test::More;
+use lib 't','.';
+
+use TestFirebird;
+my $T = TestFirebird->new;
+
+my ($dbh, $error_str) = $T->connect_to_database({AutoCommit => 0});
+
+if ($error_str) {
+    BAIL_OUT("Unknown: $error_str!");
+}
+
+unless ( $dbh->isa('DBI::db') ) {
+    plan skip_all => 'Connection to database failed, cannot continue testing';
+}
+else {
+    plan tests => 31;
+}
+
+ok($dbh, 'Connected to the database');
+
+ok($dbh->ib_define_tx_profile(
+        report => {
+            access_mode     => 'read_only',
+            isolation_level => ['read_committed', 'record_version'],
+        },
+        booking => {
+            access_mode     => 'read_write',
+            isolation_level => 'snapshot',
+            lock_timeout    => 3,
+        },
+    ),
+    'profiles defined');
+
+sub tx_info {
+    $dbh->commit;
+    $dbh->selectall_arrayref(q{SELECT COUNT(1) FROM RDB$DATABASE});
+    return $dbh->func('ib_tx_info');
+}
+
+ok($dbh->ib_use_tx_profile('report'), 'use report profile');
+my $info = tx_info();
+is($info->{access}, 'readonly', 'report is read only');
+is_deeply($info->{isolation}, { read_committed => 'rec_version' },
+    'report is read committed');
+
+ok($dbh->ib_use_tx_profile('booking'), 'use booking profile');
+$info = tx_info();
+is($info->{access}, 'readwrite', 'booking is read write');
+is($info->{isolation}, 'snapshot (concurrency)', 'booking is snapshot');
+is($info->{lock_timeout}, 3, 'booking lock timeout');
+
+# switch back and forth, the compiled buffers are reused
+for (1..3) {
+    $dbh->ib_use_tx_profile('report');
+    $dbh->ib_use_tx_profile('booking');
+}
+is(tx_info()->{access}, 'readwrite', 'still booking after switching');
+
+ok($dbh->ib_use_tx_profile(undef), 'drop profile');
+$info = tx_info();
+is($info->{access}, 'readwrite', 'default is read write');
+is($info->{isolation}, 'snapshot (concurrency)', 'default is snapshot');
+
+# ib_set_tx_param drops the selected profile
+$dbh->ib_use_tx_profile('report');
+ok($dbh->func(-access_mode => 'read_write', 'ib_set_tx_param'),
+    'ib_set_tx_param');
+is(tx_info()->{access}, 'readwrite', 'profile replaced by ib_set_tx_param');
+
+{
+    local $dbh->{RaiseError} = 0;
+    ok(!$dbh->ib_use_tx_profile('no such profile'), 'unknown profile fails');
+}
+
+eval { $dbh->ib_define_tx_profile(bad => { access_mode => 'sideways' }) };
+ok($@, 'invalid profile is refused');
+
+eval { $dbh->ib_define_tx_profile(bad => { lock_timeout => 5, lock_resolution => 'no_wait' }) };
+like($@, qr/lock_timeout conflicts with lock_resolution/, 'conflicting lock keys refused');
+eval { $dbh->ib_define_tx_profile(bad => { read_consistency => 1, isolation_level => 'snapshot' }) };
+like($@, qr/read_consistency conflicts with isolation_level/, 'conflicting isolation keys refused');
+
+# switching profiles leaves the open transaction and its statements alone
+$dbh->commit;
+$dbh->{AutoCommit} = 1;
+{
+    my $sth = $dbh->prepare(q{SELECT RDB$RELATION_ID FROM RDB$RELATIONS});
+    $sth->execute;
+    $sth->fetch;
+    $dbh->ib_use_tx_profile('booking');
+    ok($sth->{Active} && $sth->fetch, 'open cursor survives a profile switch');
+    $sth->finish;
+}
+$dbh->{AutoCommit} = 0;
+
+# begin_work with a profile
+$dbh->commit;
+$dbh->{AutoCommit} = 1;
+ok($dbh->begin_work({ ib_profile => 'report' }), 'begin_work with profile');
+$dbh->selectall_arrayref(q{SELECT COUNT(1) FROM RDB$DATABASE});
+is($dbh->func('ib_tx_info')->{access}, 'readonly',
+    'begin_work transaction uses the profile');
+ok($dbh->commit, 'commit');
+$dbh->selectall_arrayref(q{SELECT COUNT(1) FROM RDB$DATABASE});
+is($dbh->func('ib_tx_info')->{access}, 'readwrite',
+    'the profile before begin_work is used again');
+
+# the transaction ib_softcommit keeps open is replaced by one with the profile
+$dbh->{ib_softcommit} = 1;
+$dbh->selectall_arrayref(q{SELECT COUNT(1) FROM RDB$DATABASE});
+ok($dbh->begin_work({ ib_profile => 'report' }),
+    'begin_work with profile under ib_softcommit');
+$dbh->selectall_arrayref(q{SELECT COUNT(1) FROM RDB$DATABASE});
+is($dbh->func('ib_tx_info')->{access}, 'readonly',
+    '... the transaction uses the profile');
+ok($dbh->rollback, 'rollback');
+$dbh->selectall_arrayref(q{SELECT COUNT(1) FROM RDB$DATABASE});
+is($dbh->func('ib_tx_info')->{access}, 'readwrite',
+    '... and the next one the profile before');
+
+# an open cursor would be closed by the commit
+{
+    local $dbh->{RaiseError} = 0;
+    local $dbh->{PrintError} = 0;
+    my $sth = $dbh->prepare(q{SELECT RDB$RELATION_ID FROM RDB$RELATIONS});
+    $sth->execute;
+    $sth->fetch;
+    ok(!$dbh->begin_work({ ib_profile => 'report' }),
+        'begin_work with profile refused while fetching');
+    like($dbh->errstr, qr/being fetched/, '... with an error');
+    ok($dbh->{AutoCommit} && $sth->{Active}, '... leaving things as they were');
+    $sth->finish;
+}
+$dbh->{ib_softcommit} = 0;
+
+$dbh->disconnect;
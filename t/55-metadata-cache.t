@@ -0,0 +1,78 @@
+#!/usr/bin/perl
+# test for the process-wide database cache and ib_cache_metadata
+
+use strict;
+use warnings;
+
+use Test::More;
+use lib 't','.';
+
+use TestFirebird;
+my $T = TestFirebird->new;
+
+my ($dbh, $error_str) = $T->connect_to_database({AutoCommit => 1});
+
+if ($error_str) {
+    BAIL_OUT("Unknown: $error_str!");
+}
+
+unless ( $dbh->isa('DBI::db') ) {
+    plan skip_all => 'Connection to database failed, cannot continue testing';
+}
+else {
+    plan tests => 18;
+}
+
+ok($dbh, 'Connected to the database');
+
+my $dbh2 = DBI->connect( $T->{tdsn}, $T->{user}, $T->{pass},
+    { RaiseError => 1, PrintError => 0, AutoCommit => 1 } );
+ok($dbh2, 'second connection');
+
+my ($id1, $gen1) = DBD::Firebird::db::_db_cache_tag($dbh);
+my ($id2, $gen2) = DBD::Firebird::db::_db_cache_tag($dbh2);
+ok(defined $id1, 'database identified');
+is($id1, $id2, 'both connections share the cache entry');
+
+ok(!$dbh->{ib_cache_metadata}, 'ib_cache_metadata is off by default');
+$dbh->{ib_cache_metadata} = $dbh2->{ib_cache_metadata} = 1;
+ok($dbh->{ib_cache_metadata}, 'ib_cache_metadata switched on');
+
+my $table = find_new_table($dbh);
+ok($table, "TABLE is '$table'");
+ok($dbh->do("CREATE TABLE $table (ID INTEGER NOT NULL PRIMARY KEY, V CHAR(5))"),
+    "CREATE TABLE '$table'");
+
+my (undef, $gen3) = DBD::Firebird::db::_db_cache_tag($dbh2);
+cmp_ok($gen3, '>', $gen1, 'committed DDL moves the generation on');
+
+sub pk_cols {
+    my $h = shift;
+    my $sth = $h->primary_key_info(undef, undef, $table) or return;
+    [ map { $_->{COLUMN_NAME} } @{ $sth->fetchall_arrayref({}) } ];
+}
+
+is_deeply(pk_cols($dbh),  ['ID'], 'primary key read');
+is_deeply(pk_cols($dbh2), ['ID'], 'primary key from the cache');
+is_deeply(pk_cols($dbh2), ['ID'], 'cached rows are not used up');
+
+sub tables {
+    my $h = shift;
+    my $sth = $h->table_info(undef, undef, 'TEST%', 'TABLE');
+    [ sort map { $_->{TABLE_NAME} } @{ $sth->fetchall_arrayref({}) } ];
+}
+
+my $before = tables($dbh);
+ok((grep { $_ eq $table } @$before), 'table listed');
+is_deeply(tables($dbh2), $before, 'same list from the cache');
+
+# DDL on one connection is seen by the other
+my $other = find_new_table($dbh);
+ok($dbh->do("CREATE TABLE $other (ID INTEGER)"), "CREATE TABLE '$other'");
+ok((grep { $_ eq $other } @{ tables($dbh2) }), 'cache dropped after DDL');
+
+ok($dbh->do("DROP TABLE $other"), "DROP TABLE '$other'");
+ok($dbh->do("DROP TABLE $table"), "DROP TABLE '$table'");
+
+$dbh2->disconnect;
+$dbh->disconnect;
@@ -0,0 +1,112 @@
+#!/usr/bin/perl
+#
+#   Test ib_execute_async, ib_fetch_async, ib_async_fd, ib_async_result
+#   and ib_cancel
+#
+
+use strict;
+use warnings;
+
+use Test::More;
+use IO::Select;
+use lib 't','.';
+
+use TestFirebird;
+my $T = TestFirebird->new;
+
+plan skip_all => 'Asynchronous execution is not supported on Windows'
+    if $^O eq 'MSWin32';
+
+my ($dbh, $error_str) = $T->connect_to_database({AutoCommit => 1});
+
+if ($error_str) {
+    BAIL_OUT("Unknown: $error_str!");
+}
+
+unless ( $dbh->isa('DBI::db') ) {
+    plan skip_all => 'Connection to database failed, cannot continue testing';
+}
+else {
+    plan tests => 30;
+}
+
+ok($dbh, 'Connected to the database');
+
+my $table = find_new_table($dbh);
+ok($table, "TABLE is '$table'");
+ok($dbh->do("CREATE TABLE $table (ID INTEGER NOT NULL, NAME VARCHAR(20))"),
+    "CREATE TABLE '$table'");
+
+my $fd = $dbh->ib_async_fd;
+ok(defined $fd && $fd >= 0, 'ib_async_fd');
+is($dbh->ib_async_fd, $fd, 'same descriptor every time');
+
+open my $wakeup, '<&=', $fd or die "fdopen: $!";
+my $sel = IO::Select->new($wakeup);
+
+my $ins = $dbh->prepare("INSERT INTO $table VALUES (?, ?)");
+ok($ins->ib_execute_async(1, 'one'), 'INSERT started');
+ok($sel->can_read(30), 'descriptor readable when done');
+is($ins->ib_async_result, 1, 'INSERT row count');
+ok($ins->ib_execute_async(2, 'two'), 'second INSERT started');
+is($ins->ib_async_result, 1, 'result waited for');
+
+my $sth = $dbh->prepare("SELECT ID, NAME FROM $table ORDER BY ID");
+ok($sth->ib_execute_async, 'SELECT started');
+
+{
+    local $dbh->{PrintError} = 0;
+    ok(!defined $dbh->do("DELETE FROM $table"),
+        'connection busy while the SELECT runs');
+    like($dbh->errstr, qr/asynchronous operation is in progress/, 'busy error');
+}
+
+is($sth->ib_async_result, '0E0', 'SELECT executed');
+
+my @rows;
+while (1) {
+    $sth->ib_fetch_async or last;
+    $sel->can_read(30);
+    my $row = $sth->ib_async_result or last;
+    push @rows, [@$row];
+}
+is_deeply(\@rows, [ [ 1, 'one' ], [ 2, 'two' ] ], 'rows fetched asynchronously');
+ok(!$sth->{Active}, 'cursor closed at the end');
+
+{
+    local $sth->{PrintError} = 0;
+    ok(!defined $sth->ib_async_result, 'nothing to collect');
+}
+
+# executes finished without being collected
+ok($sth->ib_execute_async, 'SELECT started again');
+ok($sth->{Active}, 'active while in flight');
+$sel->can_read(30);
+ok($sth->finish, 'uncollected SELECT finished');
+ok(!$sth->{Active}, 'not active after finish');
+is_deeply($dbh->selectall_arrayref($sth), [ [ 1, 'one' ], [ 2, 'two' ] ],
+    'cursor closed by finish, statement executes again');
+
+ok($ins->ib_execute_async(3, 'three'), 'third INSERT started');
+$sel->can_read(30);
+$ins->finish;
+is($dbh->selectrow_array("SELECT COUNT(*) FROM $table WHERE ID = 3"), 1,
+    'uncollected INSERT committed by finish');
+
+ok(!$dbh->ib_cancel, 'nothing to cancel');
+
+# a long fetch, cancelled from the Perl thread
+my $slow = $dbh->prepare(<<'SQL');
+SELECT COUNT(*) FROM RDB$FIELDS A, RDB$FIELDS B, RDB$FIELDS C, RDB$FIELDS D
+SQL
+ok($slow->execute, 'slow query executed');
+ok($slow->ib_fetch_async, 'slow fetch started');
+select(undef, undef, undef, 0.5);
+ok($dbh->ib_cancel, 'fetch cancelled');
+{
+    local $slow->{PrintError} = 0;
+    ok(!defined $slow->ib_async_result, 'cancelled fetch fails');
+}
+$slow->finish;
+
+ok($dbh->do("DROP TABLE $table"), "DROP TABLE '$table'");
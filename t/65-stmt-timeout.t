@@ -0,0 +1,113 @@
+#!/usr/bin/perl
+#
+#   Test ib_timeout_ms (Firebird 4.0+), ib_cancel_after and the errors of
+#   timed out and cancelled statements
+#
+
+use strict;
+use warnings;
+
+use Test::More;
+use lib 't','.';
+
+use TestFirebird;
+my $T = TestFirebird->new;
+
+my ($dbh, $error_str) = $T->connect_to_database({AutoCommit => 1});
+
+if ($error_str) {
+    BAIL_OUT("Unknown: $error_str!");
+}
+
+unless ( $dbh->isa('DBI::db') ) {
+    plan skip_all => 'Connection to database failed, cannot continue testing';
+}
+
+my $orig_ver = $dbh->func( version => 'ib_database_info' )->{version};
+( my $ver = $orig_ver ) =~ s/.*\bFirebird\s*//;
+
+if ( $ver =~ /^(\d+)\.(\d+)/ ) {
+    my ( $major, $minor ) = ( $1, $2 );
+    if ( $major < 4 ) {
+        plan skip_all =>
+            "Firebird $major.$minor does not support statement timeouts (requires 4.0+)";
+    }
+}
+else {
+    plan skip_all =>
+        "Unable to determine Firebird version from '$orig_ver'. Assuming no statement timeouts";
+}
+
+plan skip_all => 'Client library older than Firebird 4.0'
+    if DBD::Firebird->fb_api_ver < 40;
+
+plan tests => 18;
+
+# a query that runs for much longer than any timeout below
+my $slow_sql = <<'SQL';
+SELECT COUNT(*) FROM RDB$FIELDS A, RDB$FIELDS B, RDB$FIELDS C, RDB$FIELDS D
+SQL
+
+is($dbh->{ib_timeout_ms}, 0, 'no timeout by default');
+$dbh->{ib_timeout_ms} = 1000;
+is($dbh->{ib_timeout_ms}, 1000, 'ib_timeout_ms set');
+
+eval { $dbh->{ib_timeout_ms} = -1 };
+like($@, qr/must not be negative/, 'negative timeout refused');
+
+my $sth = $dbh->prepare($slow_sql);
+is($sth->{ib_timeout_ms}, 1000, 'statement follows the dbh');
+
+{
+    local $sth->{PrintError} = 0;
+    local $sth->{RaiseError} = 0;
+    my $row = $sth->execute && $sth->fetchrow_arrayref;
+    ok(!$row, 'slow query timed out');
+    is($sth->state, 'HYT00', 'timeout state');
+}
+$sth->finish;
+
+my ($one) = $dbh->selectrow_array('SELECT 1 FROM RDB$DATABASE');
+is($one, 1, 'connection usable after the timeout');
+
+my $fast = $dbh->prepare('SELECT 1 FROM RDB$DATABASE', { ib_timeout_ms => 0 });
+is($fast->{ib_timeout_ms}, 0, 'statement value given to prepare');
+$fast->{ib_timeout_ms} = 500;
+is($fast->{ib_timeout_ms}, 500, 'statement value set');
+$fast->{ib_timeout_ms} = undef;
+is($fast->{ib_timeout_ms}, 1000, 'undef goes back to the dbh value');
+
+$sth->{ib_timeout_ms} = 0;
+$dbh->{ib_timeout_ms} = 0;
+
+{
+    local $dbh->{PrintError} = 0;
+    local $dbh->{RaiseError} = 0;
+    $dbh->{ib_timeout_ms} = 500;
+    ok(!defined $dbh->do("EXECUTE BLOCK AS DECLARE I INT = 0; BEGIN"
+                 . " WHILE (1 = 1) DO I = I + 1; END"), 'do timed out');
+    is($dbh->state, 'HYT00', 'do timeout state');
+    $dbh->{ib_timeout_ms} = 0;
+}
+
+#
+#   ib_cancel_after, the watchdog thread
+#
+eval { $dbh->ib_cancel_after(-1) };
+like($@, qr/must not be negative/, 'negative delay refused');
+
+SKIP: {
+    skip 'no watchdog thread on Windows', 5 if $^O eq 'MSWin32';
+
+    local $sth->{PrintError} = 0;
+    local $sth->{RaiseError} = 0;
+    ok($dbh->ib_cancel_after(1), 'watchdog armed');
+    my $row = $sth->execute && $sth->fetchrow_arrayref;
+    $dbh->ib_cancel_after(0);
+    ok(!$row, 'slow query cancelled');
+    is($sth->state, 'HY008', 'cancelled state');
+    ok($sth->finish, 'statement finished');
+
+    ($one) = $dbh->selectrow_array('SELECT 1 FROM RDB$DATABASE');
+    is($one, 1, 'connection usable after the cancel');
+}
@@ -0,0 +1,92 @@
+#!/usr/bin/perl
+#
+#   Test ib_pipeline, fetching ahead on a thread of the statement
+#
+
+use strict;
+use warnings;
+
+use Test::More;
+use lib 't','.';
+
+use TestFirebird;
+my $T = TestFirebird->new;
+
+plan skip_all => 'ib_pipeline is not available on Windows'
+    if $^O eq 'MSWin32';
+
+my ($dbh, $error_str) = $T->connect_to_database({AutoCommit => 1, ChopBlanks => 1});
+
+if ($error_str) {
+    BAIL_OUT("Unknown: $error_str!");
+}
+
+unless ( $dbh->isa('DBI::db') ) {
+    plan skip_all => 'Connection to database failed, cannot continue testing';
+}
+else {
+    plan tests => 18;
+}
+
+ok($dbh, 'Connected to the database');
+
+my $table = find_new_table($dbh);
+ok($table, "TABLE is '$table'");
+ok($dbh->do(<<"DEF"), "CREATE TABLE '$table'");
+CREATE TABLE $table (
+    ID   INTEGER NOT NULL,
+    NAME VARCHAR(30),
+    AMT  NUMERIC(15,2),
+    TXT  BLOB SUB_TYPE TEXT
+)
+DEF
+
+my $rows = 1000;
+{
+    $dbh->{AutoCommit} = 0;
+    my $ins = $dbh->prepare("INSERT INTO $table VALUES (?, ?, ?, ?)");
+    $ins->execute($_, ($_ % 7 ? "name $_" : undef), $_ / 4, "text $_")
+        for 1 .. $rows;
+    $dbh->commit;
+    $dbh->{AutoCommit} = 1;
+}
+pass("$rows rows inserted");
+
+my $sql = "SELECT ID, NAME, AMT, TXT FROM $table ORDER BY ID";
+my $plain = $dbh->selectall_arrayref($sql);
+is(scalar @$plain, $rows, 'rows fetched without ib_pipeline');
+
+my $sth = $dbh->prepare($sql, { ib_pipeline => 64 });
+is($sth->{ib_pipeline}, 64, 'ib_pipeline given to prepare');
+is($sth->{ib_pipeline_bytes}, 4 << 20, 'default ib_pipeline_bytes');
+
+ok($sth->execute, 'execute');
+is_deeply($sth->fetchall_arrayref, $plain, 'same rows with ib_pipeline');
+ok(!$sth->{Active}, 'cursor closed at the end');
+
+# only a few rows fit
+$sth->{ib_pipeline_bytes} = 200;
+ok($sth->execute, 'execute with a small ring');
+is_deeply($sth->fetchall_arrayref, $plain, 'same rows with a small ring');
+
+# finishing early stops the thread
+ok($sth->execute, 'execute again');
+my $first = $sth->fetchrow_arrayref;
+is($first->[0], 1, 'first row');
+ok($sth->finish, 'finish while reading ahead');
+
+undef $sth;
+
+# disconnecting stops the thread of a statement still reading ahead
+my $dbh2 = $dbh->clone;
+my $sth2 = $dbh2->prepare($sql, { ib_pipeline => 64 });
+$sth2->execute;
+$sth2->fetchrow_arrayref;
+{
+    local $SIG{__WARN__} = sub { };    # "disconnect invalidates ..."
+    ok($dbh2->disconnect, 'disconnect while reading ahead');
+}
+undef $sth2;
+pass('statement destroyed after the disconnect');
+
+ok($dbh->do("DROP TABLE $table"), "DROP TABLE '$table'");
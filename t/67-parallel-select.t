@@ -0,0 +1,145 @@
+#!/usr/bin/perl
+#
+#   Test ib_parallel_select, a query read over several attachments sharing
+#   one snapshot (Firebird 4.0+), and -at_snapshot_number
+#
+
+use strict;
+use warnings;
+
+use Test::More;
+use lib 't','.';
+
+use TestFirebird;
+my $T = TestFirebird->new;
+
+my ($dbh, $error_str) = $T->connect_to_database({AutoCommit => 1, ChopBlanks => 1});
+
+if ($error_str) {
+    BAIL_OUT("Unknown: $error_str!");
+}
+
+unless ( $dbh->isa('DBI::db') ) {
+    plan skip_all => 'Connection to database failed, cannot continue testing';
+}
+
+my $orig_ver = $dbh->func( version => 'ib_database_info' )->{version};
+( my $ver = $orig_ver ) =~ s/.*\bFirebird\s*//;
+
+if ( $ver =~ /^(\d+)\.(\d+)/ ) {
+    plan skip_all => "Firebird $1.$2 cannot share a snapshot (requires 4.0+)"
+        if $1 < 4;
+}
+else {
+    plan skip_all =>
+        "Unable to determine Firebird version from '$orig_ver'. Assuming no shared snapshots";
+}
+
+plan tests => 22;
+
+ok($dbh, 'Connected to the database');
+
+my $table = find_new_table($dbh);
+ok($table, "TABLE is '$table'");
+ok($dbh->do("CREATE TABLE $table (ID INTEGER, NAME VARCHAR(20))"),
+    "CREATE TABLE '$table'");
+
+my $rows = 1000;
+{
+    $dbh->{AutoCommit} = 0;
+    my $ins = $dbh->prepare("INSERT INTO $table VALUES (?, ?)");
+    $ins->execute($_, "name $_") for 1 .. $rows;
+    $ins->execute(undef, 'no key') for 1 .. 3;
+    $dbh->commit;
+    $dbh->{AutoCommit} = 1;
+}
+
+#
+#   snapshot numbers
+#
+{
+    $dbh->func(-isolation_level => 'snapshot', 'ib_set_tx_param');
+    $dbh->begin_work;
+    $dbh->selectrow_array("SELECT COUNT(*) FROM $table");
+    my $snapshot = $dbh->func('ib_tx_info')->{snapshot_number};
+    ok($snapshot, 'ib_tx_info reports the snapshot number');
+
+    my $other = $dbh->clone({ AutoCommit => 0 });
+    ok($other->func(-at_snapshot_number => $snapshot, 'ib_set_tx_param'),
+        '-at_snapshot_number accepted');
+    $dbh->do("INSERT INTO $table VALUES (-1, 'unseen')");
+    my ($n) = $other->selectrow_array("SELECT COUNT(*) FROM $table");
+    is($n, $rows + 3, 'second attachment sees the shared snapshot');
+    is($other->func('ib_tx_info')->{snapshot_number}, $snapshot,
+        'same snapshot number');
+    $other->rollback;
+    $other->disconnect;
+    $dbh->rollback;
+    $dbh->func('ib_set_tx_param');
+}
+
+#
+#   iterator
+#
+my $it = $dbh->ib_parallel_select("SELECT ID, NAME FROM $table",
+    partitions => 4, key => 'ID');
+ok($it, 'ib_parallel_select returns an iterator');
+
+# committed after the snapshot was taken: not seen
+$dbh->do("INSERT INTO $table VALUES (5000, 'late')");
+
+my (@ids, %parts, $nulls);
+while (my $row = $it->next) {
+    defined $row->[0] ? push @ids, $row->[0] : $nulls++;
+    $parts{ $it->partition }++;
+}
+ok(!$dbh->err, 'no error');
+is_deeply([ sort { $a <=> $b } @ids ], [ 1 .. $rows ], 'every keyed row once');
+is($nulls, 3, 'rows with a NULL key');
+is($it->rows, $rows + 3, 'rows counted');
+is_deeply([ sort keys %parts ], [ 0 .. 3 ], 'rows came from all partitions');
+ok(!defined $it->next, 'iterator stays at the end');
+
+#
+#   callbacks
+#
+my (%seen, $count);
+my $rv = $dbh->ib_parallel_select("SELECT ID, NAME FROM $table WHERE ID <= ?",
+    partitions => 3, key => 'ID', bind => [ 100 ],
+    on_row => sub {
+        my ($row, $partition) = @_;
+        $seen{$partition}++;
+        $count++ if $row->[1] eq "name $row->[0]";
+    });
+is($rv, 100, 'on_row: number of rows returned');
+is($count, 100, 'on_row: rows passed');
+is(scalar keys %seen, 3, 'on_row: partition numbers passed');
+
+#
+#   small ranges and single partitions
+#
+$it = $dbh->ib_parallel_select("SELECT ID FROM $table WHERE ID BETWEEN 1 AND 2",
+    partitions => 8, key => 'ID');
+my @small;
+while (my $row = $it->next) { push @small, $row->[0] }
+is_deeply([ sort @small ], [ 1, 2 ], 'more partitions than keys');
+
+$it = $dbh->ib_parallel_select("SELECT ID FROM $table WHERE ID > 10000",
+    partitions => 4, key => 'ID');
+ok($it && !defined $it->next, 'empty result');
+
+#
+#   errors
+#
+eval {
+    local $dbh->{RaiseError} = 1;
+    local $dbh->{PrintError} = 0;
+    $dbh->ib_parallel_select("SELECT NAME FROM $table", key => 'NAME');
+};
+like($@, qr/key NAME is not numeric/, 'non-numeric key refused');
+
+eval { $dbh->ib_parallel_select("SELECT ID FROM $table", key => 'ID; DROP') };
+like($@, qr/key must be a column name/, 'key must be a column name');
+
+ok($dbh->do("DROP TABLE $table"), "DROP TABLE '$table'");
+ok($dbh->disconnect, 'DISCONNECT');
@@ -0,0 +1,127 @@
+#!/usr/bin/perl
+#
+#   Test DBD::Firebird::BulkLoader, loading over several connections
+#
+
+use strict;
+use warnings;
+
+use Test::More;
+use File::Temp ();
+use lib 't','.';
+
+use TestFirebird;
+my $T = TestFirebird->new;
+
+my ($dbh, $error_str) = $T->connect_to_database({AutoCommit => 1, ChopBlanks => 1});
+
+if ($error_str) {
+    BAIL_OUT("Unknown: $error_str!");
+}
+
+unless ( $dbh->isa('DBI::db') ) {
+    plan skip_all => 'Connection to database failed, cannot continue testing';
+}
+else {
+    plan tests => 25;
+}
+
+use_ok('DBD::Firebird::BulkLoader');
+
+my $table = find_new_table($dbh);
+ok($table, "TABLE is '$table'");
+ok($dbh->do(<<"DEF"), "CREATE TABLE '$table'");
+CREATE TABLE $table (
+    ID   INTEGER NOT NULL PRIMARY KEY,
+    NAME VARCHAR(20),
+    AMT  NUMERIC(10,2)
+)
+DEF
+
+my (@progress, @errors);
+my $loader = DBD::Firebird::BulkLoader->new($dbh,
+    table          => $table,
+    columns        => [qw(ID NAME AMT)],
+    workers        => 3,
+    commit_every   => 100,
+    progress_every => 250,
+    on_progress    => sub { push @progress, shift },
+    on_error       => sub { push @errors, [@_] },
+);
+ok($loader, 'loader created');
+
+#
+#   array of rows, and batches from a callback
+#
+is($loader->load([ map { [ $_, "name $_", $_ / 4 ] } 1 .. 500 ]), 500,
+    'rows from an array ref');
+
+my $next = 501;
+is($loader->load(sub {
+        return if $next > 1000;
+        my @batch = map { [ $_, "name $_", $_ / 4 ] } $next .. $next + 99;
+        $next += 100;
+        return \@batch;
+    }), 1000, 'batches from a code ref');
+
+#
+#   failed rows are counted and reported
+#
+$loader->load([ [ 1, 'duplicate', 0 ], [ 'x', 'not a number', 0 ] ]);
+my $stats = $loader->stats;
+is($stats->{errors}, 2, 'two failed rows');
+is(scalar @errors, 2, 'on_error called for each');
+ok((grep { $_->[1] =~ /violation|unique|duplicate/i } @errors),
+    'error message passed');
+ok(!(grep { !defined $_->[2] } @errors), 'worker number passed');
+
+#
+#   files
+#
+my $csv = File::Temp->new(SUFFIX => '.csv');
+print $csv qq{ID,NAME,AMT\n};
+print $csv qq{2001,"comma, inside",1.5\n};
+print $csv qq{2002,"quote ""inside""",\n};
+print $csv qq{2003,,2\n};
+close $csv;
+is($loader->load("$csv", header => 1), 1003, 'rows from a CSV file');
+
+my $tsv = File::Temp->new(SUFFIX => '.tsv');
+print $tsv "3001\ttab\t\\N\n3002\t\t0.25\n3003\ta\\tb\\\\c\t1\r\n";
+close $tsv;
+is($loader->load("$tsv"), 1006, 'rows from a TSV file');
+
+my $semi = File::Temp->new(SUFFIX => '.csv');
+print $semi qq{4001;"two\nlines";1\n4002;too few\n};
+close $semi;
+is($loader->load("$semi", sep_char => ';'), 1007,
+    'sep_char, a quoted field over two lines');
+is($loader->stats->{errors}, 3, 'a line with too few fields fails');
+eval { $loader->load("$semi", sep_char => '"') };
+like($@, qr/sep_char/, 'a quote is no separator');
+
+$stats = $loader->finish;
+is($stats->{rows}, 1007, 'finish: rows');
+is($stats->{errors}, 3, 'finish: errors');
+is(scalar @{ $stats->{workers} }, 3, 'finish: one entry per worker');
+my $sum = 0;
+$sum += $_->{rows} for @{ $stats->{workers} };
+is($sum, 1007, 'worker rows add up');
+ok($stats->{rows_per_sec} > 0, 'rows per second');
+is(scalar @progress, 4, 'progress reported every 250 rows');
+
+#
+#   what arrived
+#
+my ($count) = $dbh->selectrow_array("SELECT COUNT(*) FROM $table");
+is($count, 1007, 'all rows committed');
+is_deeply(
+    $dbh->selectall_arrayref("SELECT NAME, AMT FROM $table WHERE ID > 2000 ORDER BY ID"),
+    [ [ 'comma, inside', '1.50' ], [ 'quote "inside"', undef ],
+      [ undef, '2.00' ], [ 'tab', undef ], [ '', '0.25' ],
+      [ "a\tb\\c", '1.00' ], [ "two\nlines", '1.00' ] ],
+    'file values, NULLs and quoting'
+);
+
+ok($dbh->do("DROP TABLE $table"), "DROP TABLE '$table'");
+ok($dbh->disconnect, 'DISCONNECT');
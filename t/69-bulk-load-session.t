@@ -0,0 +1,140 @@
+#!/usr/bin/perl
+#
+#   Test ib_bulk_load, ib_bulk_load_begin and ib_bulk_load_end, deferring
+#   index maintenance and triggers while loading
+#
+
+use strict;
+use warnings;
+
+use Test::More;
+use lib 't','.';
+
+use TestFirebird;
+my $T = TestFirebird->new;
+
+my ($dbh, $error_str) = $T->connect_to_database({AutoCommit => 1, ChopBlanks => 1});
+
+if ($error_str) {
+    BAIL_OUT("Unknown: $error_str!");
+}
+
+unless ( $dbh->isa('DBI::db') ) {
+    plan skip_all => 'Connection to database failed, cannot continue testing';
+}
+else {
+    plan tests => 32;
+}
+
+ok($dbh, 'Connected to the database');
+
+my $table = find_new_table($dbh);
+ok($table, "TABLE is '$table'");
+ok($dbh->do("CREATE TABLE $table (ID INTEGER NOT NULL PRIMARY KEY, K INTEGER, V INTEGER)"),
+    "CREATE TABLE '$table'");
+ok($dbh->do("CREATE INDEX ${table}_K ON $table (K)"), 'CREATE INDEX');
+ok($dbh->do("CREATE UNIQUE INDEX ${table}_V ON $table (V)"), 'CREATE UNIQUE INDEX');
+ok($dbh->do(<<"DEF"), 'CREATE TRIGGER');
+CREATE TRIGGER ${table}_BI FOR $table BEFORE INSERT AS
+BEGIN
+  NEW.V = COALESCE(NEW.V, -NEW.ID);
+END
+DEF
+
+sub inactive {
+    my $rows = $dbh->selectcol_arrayref(<<'SQL', undef, uc $table);
+SELECT RDB$INDEX_NAME FROM RDB$INDICES
+WHERE RDB$RELATION_NAME = ? AND RDB$INDEX_INACTIVE = 1
+SQL
+    return [ sort map { s/\s+$//; $_ } @$rows ];
+}
+
+sub trigger_inactive {
+    my ($flag) = $dbh->selectrow_array(
+        'SELECT RDB$TRIGGER_INACTIVE FROM RDB$TRIGGERS WHERE RDB$TRIGGER_NAME = ?',
+        undef, uc "${table}_BI");
+    return $flag;
+}
+
+#
+#   a load, with the table trigger off
+#
+my $load = $dbh->ib_bulk_load_begin($table, triggers => 0);
+is($load, $dbh, 'loading through the same connection');
+is_deeply(inactive(), [ uc "${table}_K", uc "${table}_V" ],
+    'plain indexes deactivated, primary key kept');
+ok(trigger_inactive(), 'trigger deactivated');
+
+ok(!eval { local $dbh->{PrintError} = 0; $dbh->ib_bulk_load_begin($table) },
+    'only one bulk load at a time');
+
+my $ins = $load->prepare("INSERT INTO $table (ID, K, V) VALUES (?, ?, ?)");
+$ins->execute($_, $_ % 10, $_) for 1 .. 500;
+$ins->execute(501, 1, undef);
+
+my $times = $dbh->ib_bulk_load_end;
+ok($times, 'ib_bulk_load_end');
+is_deeply([ sort keys %$times ],
+    [qw(activate deactivate indexes load statistics triggers)], 'phases timed');
+is_deeply([ sort @{ $times->{indexes} } ], [ uc "${table}_K", uc "${table}_V" ],
+    'deactivated indexes reported');
+is_deeply($times->{triggers}, [ uc "${table}_BI" ], 'deactivated triggers reported');
+is_deeply(inactive(), [], 'indexes active again');
+ok(!trigger_inactive(), 'trigger active again');
+
+my ($v) = $dbh->selectrow_array("SELECT V FROM $table WHERE ID = 501");
+ok(!defined $v, 'trigger did not fire during the load');
+
+my ($selectivity) = $dbh->selectrow_array(
+    'SELECT RDB$STATISTICS FROM RDB$INDICES WHERE RDB$INDEX_NAME = ?',
+    undef, uc "${table}_K");
+ok($selectivity > 0 && $selectivity < 1, 'selectivity recomputed');
+
+ok(!eval { local $dbh->{PrintError} = 0; $dbh->ib_bulk_load_end },
+    'no bulk load in progress');
+
+#
+#   an index that cannot come back does not keep the others inactive
+#
+$load = $dbh->ib_bulk_load_begin($table);
+$load->do("INSERT INTO $table (ID, K, V) VALUES (1000, 1, 1)");
+{
+    local $dbh->{PrintError} = 0;
+    local $dbh->{RaiseError} = 0;
+    ok(!$dbh->ib_bulk_load_end, 'duplicate keys reported');
+}
+like($dbh->errstr, qr/ib_bulk_load_end/, 'error message');
+is_deeply(inactive(), [ uc "${table}_V" ], 'only the unique index stays inactive');
+
+ok($dbh->do("DELETE FROM $table WHERE ID = 1000"), 'duplicate removed');
+ok($dbh->do(qq{ALTER INDEX ${table}_V ACTIVE}), 'unique index back');
+
+#
+#   loading over a connection without database triggers
+#
+$load = $dbh->ib_bulk_load_begin($table, no_db_triggers => 1);
+isnt($load, $dbh, 'separate loading connection');
+$dbh->ib_bulk_load_end;
+
+#
+#   ib_bulk_load restores the table however the load ends
+#
+ok(!eval {
+    $dbh->ib_bulk_load($table, sub {
+        is_deeply(inactive(), [ uc "${table}_K", uc "${table}_V" ],
+            'indexes deactivated inside the code');
+        die "load failed\n";
+    }, triggers => 0);
+    1;
+}, 'error of the code raised');
+is($@, "load failed\n", 'with its message');
+is_deeply(inactive(), [], 'indexes active again after the failed load');
+ok(!trigger_inactive(), 'trigger active again after the failed load');
+
+$times = $dbh->ib_bulk_load($table, sub {
+    shift->do("INSERT INTO $table (ID, K, V) VALUES (2000, 2, 2000)");
+});
+is_deeply([ sort @{ $times->{indexes} } ], [ uc "${table}_K", uc "${table}_V" ],
+    'ib_bulk_load returns what ib_bulk_load_end does');
+
+ok($dbh->do("DROP TABLE $table"), "DROP TABLE '$table'");
@@ -0,0 +1,185 @@
+#!/usr/bin/perl
+#
+#   Test ib_export, rows written to a file handle as CSV, TSV or JSON lines
+#
+
+use strict;
+use warnings;
+
+use Test::More;
+use File::Temp ();
+use JSON::PP ();
+use lib 't','.';
+
+use TestFirebird;
+my $T = TestFirebird->new;
+
+my ($dbh, $error_str) = $T->connect_to_database({AutoCommit => 1, ChopBlanks => 1});
+
+if ($error_str) {
+    BAIL_OUT("Unknown: $error_str!");
+}
+
+unless ( $dbh->isa('DBI::db') ) {
+    plan skip_all => 'Connection to database failed, cannot continue testing';
+}
+else {
+    plan tests => 27;
+}
+
+ok($dbh, 'Connected to the database');
+
+my $table = find_new_table($dbh);
+ok($table, "TABLE is '$table'");
+ok($dbh->do(<<"DEF"), "CREATE TABLE '$table'");
+CREATE TABLE $table (
+    ID   INTEGER NOT NULL,
+    NAME VARCHAR(30),
+    AMT  NUMERIC(10,2),
+    D    DATE,
+    TS   TIMESTAMP,
+    C    CHAR(5),
+    B    BLOB SUB_TYPE TEXT
+)
+DEF
+
+my $ins = $dbh->prepare("INSERT INTO $table VALUES (?, ?, ?, ?, ?, ?, ?)");
+ok($ins->execute(1, 'plain', 12.3, '2024-02-29', '2024-02-29 13:45:01.5', 'ab',
+    'text blob'), 'row 1');
+ok($ins->execute(2, qq{comma, "q"\ttab}, -0.05, undef, undef, undef,
+    "line1\nline2"), 'row 2');
+ok($ins->execute(3, '', undef, undef, undef, undef, undef), 'row 3');
+
+my $select = "SELECT ID, NAME, AMT, D, TS, C, B FROM $table ORDER BY ID";
+
+sub export {
+    my ($sql, %opt) = @_;
+
+    my $sth = $dbh->prepare($sql);
+    $sth->execute;
+    open my $fh, '>', \my $out or die $!;
+    my $rv = $sth->ib_export(fh => $fh, %opt);
+    close $fh;
+    return ($rv, $out, $sth);
+}
+
+#
+#   CSV
+#
+my ($rv, $out, $sth) = export($select);
+is($rv, 3, 'csv: rows written');
+is($sth->rows, 3, 'csv: rows counted');
+is($out, <<"CSV", 'csv: quoting, NULLs, exact numbers, ISO dates');
+ID,NAME,AMT,D,TS,C,B
+1,plain,12.30,2024-02-29,2024-02-29 13:45:01.5000,ab,"text blob"
+2,"comma, ""q""\ttab",-0.05,,,,"line1
+line2"
+3,"",,,,,
+CSV
+
+($rv, $out) = export("SELECT ID, AMT FROM $table WHERE ID < 3 ORDER BY ID",
+    sep_char => ';', header => 0, null => 'NULL');
+is($out, "1;12.30\n2;-0.05\n", 'csv: separator, no header');
+
+($rv, $out) = export("SELECT ID, D FROM $table WHERE ID = 3", null => 'NULL');
+is($out, "ID,D\n3,NULL\n", 'csv: NULL text');
+
+#
+#   TSV
+#
+($rv, $out) = export($select, format => 'tsv', header => 0);
+is($out,
+    "1\tplain\t12.30\t2024-02-29\t2024-02-29 13:45:01.5000\tab\ttext blob\n"
+  . "2\tcomma, \"q\"\\ttab\t-0.05\t\\N\t\\N\t\\N\tline1\\nline2\n"
+  . "3\t\t\\N\t\\N\t\\N\t\\N\t\\N\n",
+    'tsv: escapes and \\N');
+
+#
+#   JSON lines
+#
+$dbh->{FetchHashKeyName} = 'NAME_lc';
+$sth = $dbh->prepare($select);
+$sth->execute;
+open my $jfh, '>', \my $json or die $!;
+is($sth->ib_export(fh => $jfh, format => 'jsonl'), 3, 'jsonl: rows written');
+close $jfh;
+$dbh->{FetchHashKeyName} = 'NAME';
+
+my @lines = split /\n/, $json;
+is(scalar @lines, 3, 'jsonl: one line per row');
+is($lines[0],
+    '{"id":1,"name":"plain","amt":12.30,"d":"2024-02-29",'
+  . '"ts":"2024-02-29 13:45:01.5000","c":"ab","b":"text blob"}',
+    'jsonl: numbers bare, text quoted');
+my @rows = map { JSON::PP->new->decode($_) } @lines;
+is($rows[1]{name}, qq{comma, "q"\ttab}, 'jsonl: escapes');
+is($rows[1]{b}, "line1\nline2", 'jsonl: BLOB text');
+ok(!defined $rows[2]{amt} && $rows[2]{name} eq '', 'jsonl: null and empty');
+
+# JSON is UTF-8 whatever the connection character set
+for my $cs (qw(ISO8859_1 NONE)) {
+    (my $dsn = $T->{tdsn}) =~ s/(?<=ib_charset=)[^;]+/$cs/;
+    my $c = DBI->connect($dsn, $T->{user}, $T->{pass},
+        { RaiseError => 1, PrintError => 0, AutoCommit => 1 });
+    my $sth = $c->prepare(
+        'SELECT CAST(? AS VARCHAR(10) CHARACTER SET ISO8859_1) AS V FROM RDB$DATABASE');
+    $sth->execute("caf\xe9");
+    open my $fh, '>', \my $out or die $!;
+    my $rv = eval { $sth->ib_export(fh => $fh, format => 'jsonl') };
+    close $fh;
+    $sth->finish;
+    if ($cs eq 'NONE') {
+        like($@, qr/jsonl requires ib_charset=UTF8/, 'jsonl: refused without a known charset');
+    }
+    else {
+        is($out, qq{{"V":"caf\xc3\xa9"}\n}, 'jsonl: ISO8859_1 text transcoded');
+    }
+    $c->disconnect;
+}
+
+#
+#   empty results and errors
+#
+($rv, $out) = export("SELECT ID FROM $table WHERE ID > 10");
+is($rv, '0E0', 'no rows: 0E0');
+is($out, "ID\n", 'no rows: header only');
+
+eval { export($select, format => 'xml') };
+like($@, qr/unknown format xml/, 'unknown format refused');
+
+eval { $dbh->prepare($select)->ib_export(format => 'csv') };
+like($@, qr/fh is required/, 'fh is required');
+
+{
+    local $dbh->{PrintError} = 0;
+    open my $fh, '>', \my $none or die $!;
+    ok(!defined $dbh->prepare($select)->ib_export(fh => $fh),
+        'not executed: undef');
+}
+
+#
+#   loads back with DBD::Firebird::BulkLoader
+#
+{
+    require DBD::Firebird::BulkLoader;
+    my $file = File::Temp->new(SUFFIX => '.tsv');
+    my $sth = $dbh->prepare($select);
+    $sth->execute;
+    $sth->ib_export(fh => $file, format => 'tsv', header => 0);
+    close $file;
+
+    $dbh->do("DELETE FROM $table");
+    my $loader = DBD::Firebird::BulkLoader->new($dbh, table => $table,
+        columns => [qw(ID NAME AMT D TS C B)], workers => 1);
+    $loader->load("$file");
+    $loader->finish;
+
+    my $back = $dbh->selectall_arrayref("SELECT ID, NAME, AMT, B FROM $table ORDER BY ID");
+    is_deeply($back,
+        [ [ 1, 'plain', '12.30', 'text blob' ],
+          [ 2, qq{comma, "q"\ttab}, '-0.05', "line1\nline2" ],
+          [ 3, '', undef, undef ] ],
+        'tsv round trip');
+}
+
+ok($dbh->do("DROP TABLE $table"), "DROP TABLE '$table'");
@@ -0,0 +1,176 @@
+#!/usr/bin/perl
+#
+#   Test ib_fetch_arrow, result sets written as an Arrow IPC stream
+#
+#   The stream is also read back with pyarrow (pip install pyarrow) when
+#   the python3 found in PATH, or $PYTHON, has it.
+#
+
+use strict;
+use warnings;
+
+use Test::More;
+use File::Temp qw(tempfile);
+use lib 't','.';
+
+use TestFirebird;
+my $T = TestFirebird->new;
+
+my ($dbh, $error_str) = $T->connect_to_database({AutoCommit => 1, ChopBlanks => 1});
+
+if ($error_str) {
+    BAIL_OUT("Unknown: $error_str!");
+}
+
+unless ( $dbh->isa('DBI::db') ) {
+    plan skip_all => 'Connection to database failed, cannot continue testing';
+}
+else {
+    plan tests => 21;
+}
+
+# The messages of a stream, as [ header type, metadata, body ], or undef
+# when the stream does not end with the end of stream marker. Only the
+# Message table is read: header type 1 is a schema, 3 a record batch.
+sub messages {
+    my $stream = shift;
+    my ($pos, @msgs) = (0);
+
+    while ($pos < length $stream) {
+        my ($marker, $len) = unpack 'l< l<', substr($stream, $pos, 8);
+        return unless $marker == -1;
+        $pos += 8;
+        return \@msgs unless $len;
+
+        my $meta   = substr($stream, $pos, $len);
+        my $table  = unpack 'V', $meta;
+        my $vtable = $table - unpack('l<', substr($meta, $table, 4));
+        my @field  = unpack 'v*', substr($meta, $vtable + 4,
+            unpack('v', substr($meta, $vtable, 2)) - 4);
+        my $type   = unpack 'C', substr($meta, $table + $field[1], 1);
+        my $body   = $field[3] ? unpack('q<', substr($meta, $table + $field[3], 8)) : 0;
+
+        $pos += $len;
+        push @msgs, [ $type, $meta, substr($stream, $pos, $body) ];
+        $pos += $body;
+    }
+    return;
+}
+
+sub arrow {
+    my ($sql, @opt) = @_;
+
+    my $sth = $dbh->prepare($sql);
+    $sth->execute;
+    open my $fh, '>:raw', \my $out or die $!;
+    my $rv = $sth->ib_fetch_arrow($fh, @opt);
+    close $fh;
+    return ($rv, $out, $sth);
+}
+
+ok($dbh, 'Connected to the database');
+
+my $table = find_new_table($dbh);
+ok($table, "TABLE is '$table'");
+ok($dbh->do(<<"DEF"), "CREATE TABLE '$table'");
+CREATE TABLE $table (
+    ID   INTEGER NOT NULL,
+    NAME VARCHAR(20),
+    AMT  NUMERIC(18,2),
+    D    DATE,
+    TS   TIMESTAMP
+)
+DEF
+
+{
+    my $ins = $dbh->prepare("INSERT INTO $table VALUES (?, ?, ?, ?, ?)");
+    $ins->execute($_, $_ % 3 ? "name $_" : undef, $_ * 1.25, '2024-02-29',
+        '2024-02-29 13:45:01.5') for 1 .. 10;
+}
+
+#
+#   stream layout
+#
+my ($rv, $out, $sth) = arrow("SELECT * FROM $table ORDER BY ID", batch_rows => 4);
+is($rv, 10, 'rows written');
+is($sth->rows, 10, 'rows counted');
+
+my $msgs = messages($out);
+ok($msgs, 'stream ends with the end of stream marker');
+is_deeply([ map { $_->[0] } @$msgs ], [ 1, 3, 3, 3 ],
+    'a schema, then a record batch per 4 rows');
+like($msgs->[0][1], qr/ID.*NAME.*AMT.*D.*TS/s, 'column names in the schema');
+
+#
+#   columns
+#
+# columns without NULLs have no validity bitmap: their values open the body
+is_deeply([ unpack 'l<4', $msgs->[1][2] ], [ 1 .. 4 ], 'int32 values');
+is_deeply([ unpack 'l<2', $msgs->[3][2] ], [ 9, 10 ], 'last, short batch');
+
+($rv, $out) = arrow("SELECT AMT FROM $table WHERE ID = 2");
+$msgs = messages($out);
+my ($lo, $hi) = unpack 'q< q<', $msgs->[1][2];
+is_deeply([ $lo, $hi ], [ 250, 0 ], 'NUMERIC as decimal128 of the scaled value');
+
+($rv, $out) = arrow("SELECT D FROM $table WHERE ID = 1");
+$msgs = messages($out);
+is(unpack('l<', $msgs->[1][2]), 19782, 'DATE as days since 1970');
+
+# validity bitmap, offsets and bytes, each padded to 8 bytes
+($rv, $out) = arrow("SELECT NAME FROM $table WHERE ID IN (1, 3) ORDER BY ID");
+$msgs = messages($out);
+is(ord $msgs->[1][2], 0b01, 'validity bitmap: second row NULL');
+is_deeply([ unpack('l<3', substr($msgs->[1][2], 8)), substr($msgs->[1][2], 24, 6) ],
+    [ 0, 6, 6, 'name 1' ], 'utf8 offsets and bytes');
+
+#
+#   read back by pyarrow, when it is installed
+#
+SKIP: {
+    my $python = $ENV{PYTHON} || 'python3';
+    skip 'pyarrow is not installed', 2
+        unless system("$python -c 'import pyarrow' 2>/dev/null") == 0;
+
+    my ($fh, $file) = tempfile(UNLINK => 1);
+    binmode $fh;
+    my $sth = $dbh->prepare("SELECT * FROM $table ORDER BY ID");
+    $sth->execute;
+    $sth->ib_fetch_arrow($fh, batch_rows => 4);
+    close $fh;
+
+    my @rows = `$python -c '
+import sys, pyarrow.ipc
+t = pyarrow.ipc.open_stream(open(sys.argv[1], "rb")).read_all()
+print(t.num_rows)
+for r in t.to_pylist():
+    print("|".join(str(r[c]) for c in ("ID", "NAME", "AMT", "D", "TS")))
+' $file`;
+    chomp @rows;
+
+    is(shift @rows, 10, 'pyarrow: rows');
+    is_deeply(\@rows, [ map {
+        sprintf '%d|%s|%.2f|2024-02-29|2024-02-29 13:45:01.500000',
+            $_, $_ % 3 ? "name $_" : 'None', $_ * 1.25
+    } 1 .. 10 ], 'pyarrow: values');
+}
+
+#
+#   empty results and errors
+#
+($rv, $out) = arrow("SELECT ID FROM $table WHERE ID > 100");
+is($rv, '0E0', 'no rows: 0E0');
+is_deeply([ map { $_->[0] } @{ messages($out) || [] } ], [ 1 ],
+    'no rows: schema only');
+
+eval { arrow("SELECT ID FROM $table", batch_rows => 0) };
+like($@, qr/batch_rows must be a positive number/, 'batch_rows checked');
+
+{
+    local $dbh->{PrintError} = 0;
+    open my $fh, '>', \my $none or die $!;
+    ok(!defined $dbh->prepare("SELECT ID FROM $table")->ib_fetch_arrow($fh),
+        'not executed: undef');
+}
+
+ok($dbh->do("DROP TABLE $table"), "DROP TABLE '$table'");
@@ -0,0 +1,107 @@
+#!/usr/bin/perl
+#
+#   Test ib_fetchall_mmap, rows spilled to a file and decoded when read
+#
+
+use strict;
+use warnings;
+
+use Test::More;
+use File::Temp ();
+use lib 't','.';
+
+use TestFirebird;
+my $T = TestFirebird->new;
+
+my ($dbh, $error_str) = $T->connect_to_database({AutoCommit => 1, ChopBlanks => 1});
+
+if ($error_str) {
+    BAIL_OUT("Unknown: $error_str!");
+}
+
+unless ( $dbh->isa('DBI::db') ) {
+    plan skip_all => 'Connection to database failed, cannot continue testing';
+}
+else {
+    plan tests => 22;
+}
+
+ok($dbh, 'Connected to the database');
+
+my $table = find_new_table($dbh);
+ok($table, "TABLE is '$table'");
+ok($dbh->do(<<"DEF"), "CREATE TABLE '$table'");
+CREATE TABLE $table (
+    ID   INTEGER NOT NULL,
+    NAME VARCHAR(20),
+    AMT  NUMERIC(18,2),
+    C    CHAR(5),
+    D    DATE,
+    B    BLOB SUB_TYPE TEXT
+)
+DEF
+
+{
+    my $ins = $dbh->prepare("INSERT INTO $table VALUES (?, ?, ?, ?, ?, ?)");
+    $ins->execute($_, $_ % 3 ? "name $_" : undef, $_ * 1.25, 'ab', '2024-02-29',
+        $_ == 2 ? 'x' x 10_000 : "blob $_") for 1 .. 100;
+}
+
+my $select = "SELECT ID, NAME, AMT, C, D, B FROM $table ORDER BY ID";
+
+#
+#   rows and values
+#
+my $sth = $dbh->prepare($select);
+$sth->execute;
+my $rows = $sth->ib_fetchall_mmap;
+ok($rows, 'ib_fetchall_mmap');
+isa_ok($rows, 'DBD::Firebird::Spill');
+is($rows->rows, 100, 'row count');
+is($sth->rows, 100, 'rows counted');
+is_deeply($rows->names, [qw(ID NAME AMT C D B)], 'column names');
+
+is_deeply($rows->row(0), [ 1, 'name 1', '1.25', 'ab', '2024-02-29', 'blob 1' ],
+    'first row, as fetch gives it');
+is_deeply($rows->row(2), [ 3, undef, '3.75', 'ab', '2024-02-29', 'blob 3' ],
+    'NULL');
+is(length $rows->cell(1, 5), 10_000, 'BLOB stored whole');
+is($rows->cell(99, 0), 100, 'single value');
+ok(!defined $rows->row(100), 'past the end: undef');
+
+#
+#   as an array ref
+#
+is(scalar @$rows, 100, 'array size');
+is($rows->[-1][1], 'name 100', 'negative index');
+is_deeply([ map { $_->[0] } @$rows[10 .. 12] ], [ 11, 12, 13 ], 'slice');
+eval { push @$rows, [] };
+like($@, qr/read only/, 'read only');
+
+#
+#   same decoding as fetch
+#
+$dbh->{LongReadLen} = 20_000;
+is_deeply([ map { $rows->row($_) } 0 .. 99 ], $dbh->selectall_arrayref($select),
+    'rows match fetchall_arrayref');
+
+#
+#   named file
+#
+{
+    my $dir = File::Temp->newdir;
+    my $path = "$dir/rows";
+
+    $sth->execute;
+    my $kept = $sth->ib_fetchall_mmap(path => $path);
+    ok(-s $path, 'file written to path');
+    undef $kept;
+    ok(!-e $path, 'file removed when done');
+}
+
+{
+    local $dbh->{PrintError} = 0;
+    ok(!defined $dbh->prepare($select)->ib_fetchall_mmap, 'not executed: undef');
+}
+
+ok($dbh->do("DROP TABLE $table"), "DROP TABLE '$table'");
@@ -0,0 +1,86 @@
+#!/usr/bin/perl
+#
+#   Test ib_fetch_lazy, rows decoded column by column when read
+#
+
+use strict;
+use warnings;
+
+use Test::More;
+use Scalar::Util qw(refaddr);
+use lib 't','.';
+
+use TestFirebird;
+my $T = TestFirebird->new;
+
+my ($dbh, $error_str) = $T->connect_to_database({AutoCommit => 0, ChopBlanks => 1});
+
+if ($error_str) {
+    BAIL_OUT("Unknown: $error_str!");
+}
+
+unless ( $dbh->isa('DBI::db') ) {
+    plan skip_all => 'Connection to database failed, cannot continue testing';
+}
+else {
+    plan tests => 22;
+}
+
+ok($dbh, 'Connected to the database');
+
+my $table = find_new_table($dbh);
+ok($table, "TABLE is '$table'");
+ok($dbh->do(<<"DEF"), "CREATE TABLE '$table'");
+CREATE TABLE $table (
+    ID   INTEGER NOT NULL,
+    NAME VARCHAR(20),
+    AMT  NUMERIC(18,2),
+    TS   TIMESTAMP,
+    B    BLOB SUB_TYPE TEXT
+)
+DEF
+$dbh->commit;
+
+{
+    my $ins = $dbh->prepare("INSERT INTO $table VALUES (?, ?, ?, ?, ?)");
+    $ins->execute($_, $_ == 2 ? undef : "name $_", $_ * 1.25,
+        '2024-02-29 13:45:01.5', "blob $_") for 1 .. 3;
+    $dbh->commit;
+}
+
+my $select = "SELECT ID, NAME, AMT, TS, B FROM $table ORDER BY ID";
+
+#
+#   access by index and by name
+#
+my $sth = $dbh->prepare($select);
+$sth->execute;
+my $row = $sth->ib_fetch_lazy;
+ok($row, 'ib_fetch_lazy');
+isa_ok($row, 'DBD::Firebird::Row');
+is($row->count, 5, 'column count');
+ok(!(grep { $row->_decoded($_) } 0 .. 4), 'nothing decoded before access');
+is($row->col(0), 1, 'by index');
+ok($row->_decoded(0) && !$row->_decoded(1), 'only the column read is decoded');
+is(refaddr(\$row->col(0)), refaddr(\$row->col(0)),
+    'a second read returns the cached value');
+is($row->col(-4), 'name 1', 'negative index');
+is($row->get('AMT'), '1.25', 'by name');
+is($row->get('amt'), '1.25', 'by name, any case');
+is($row->{B}, 'blob 1', 'hash ref');
+is_deeply([ @$row ], $dbh->selectrow_arrayref("$select ROWS 1"),
+    'array ref, same values as fetch');
+is_deeply([ keys %$row ], [qw(ID NAME AMT TS B)], 'keys in column order');
+ok(!defined $row->get('NOPE'), 'unknown column: undef');
+
+my $second = $sth->ib_fetch_lazy;
+ok(!defined $second->get('NAME'), 'NULL');
+is($row->col(1), 'name 1', 'earlier row kept its own values');
+
+$sth->ib_fetch_lazy;
+ok(!defined $sth->ib_fetch_lazy, 'end of rows: undef');
+is($sth->rows, 3, 'rows counted');
+
+$dbh->commit;
+ok($dbh->do("DROP TABLE $table"), "DROP TABLE '$table'");
+$dbh->commit;
@@ -0,0 +1,96 @@
+#!/usr/bin/perl
+#
+#   Test the ib_trust_utf8 attribute and the UTF-8 check of ib_enable_utf8
+#
+
+use strict;
+use warnings;
+
+use utf8;
+BEGIN {
+    binmode(STDERR, ':utf8');
+    binmode(STDOUT, ':utf8');
+};
+use Test::More;
+use lib 't','.';
+
+use TestFirebird;
+my $T = TestFirebird->new;
+
+eval "use Test::Exception; 1"
+    or plan skip_all => 'Test::Exception needed for this test';
+plan tests => 22;
+
+my $dsn = $T->{tdsn};
+$dsn =~ s/(?<=ib_charset=)[^;]+/ASCII/;
+my $attr
+    = { RaiseError => 1, PrintError => 0, AutoCommit => 1, ChopBlanks => 1 };
+my $dbh = DBI->connect( $dsn, $T->{user}, $T->{pass}, $attr );
+
+dies_ok(
+   sub { $dbh->{ib_trust_utf8} = 1 },
+   'Setting ib_trust_utf8 on charset ASCII db throws');
+
+$dbh->disconnect;
+
+$dsn =~ s/(?<=ib_charset=)[^;]+/UTF8/;
+$dbh = DBI->connect( $dsn, $T->{user}, $T->{pass}, $attr );
+
+ok( $dbh->{ib_enable_utf8} = 1, 'Set ib_enable_utf8' );
+ok( !$dbh->{ib_trust_utf8}, 'ib_trust_utf8 is off by default' );
+
+# ------- TESTS ------------------------------------------------------------- #
+
+my $table = find_new_table($dbh);
+ok($table, qq{Table is '$table'});
+
+ok( $dbh->do(<<"DEF"), qq{CREATE TABLE '$table'} );
+CREATE TABLE $table (
+    id     INTEGER PRIMARY KEY,
+    varchr VARCHAR(100) CHARACTER SET UTF8,
+    blb    BLOB SUB_TYPE TEXT CHARACTER SET UTF8,
+    octets VARCHAR(10) CHARACTER SET OCTETS
+)
+DEF
+
+my $long = ( 'ascii ' x 10 ) . 'Værчàr €÷∞';
+ok( $dbh->do(
+        "INSERT INTO $table VALUES (1, 'plain ascii', 'plain ascii', x'C3A9')") );
+ok( $dbh->do(
+        "INSERT INTO $table VALUES (2, ?, ?, x'FFFE')", {}, $long, $long ) );
+
+ok( my $cursor = $dbh->prepare("SELECT varchr, blb, octets FROM $table WHERE id = ?"),
+    'SELECT' );
+
+#
+#   Scanning: ASCII stays bytes, valid UTF-8 is flagged, garbage is not
+#
+my $row = $dbh->selectrow_arrayref( $cursor, {}, 1 );
+ok( !utf8::is_utf8( $row->[0] ), 'ASCII varchar not flagged' );
+ok( !utf8::is_utf8( $row->[1] ), 'ASCII blob not flagged' );
+ok( utf8::is_utf8( $row->[2] ),  'valid UTF-8 in OCTETS flagged' );
+
+$row = $dbh->selectrow_arrayref( $cursor, {}, 2 );
+is( $row->[0], $long, 'long varchar with ASCII run' );
+is( $row->[1], $long, 'long blob with ASCII run' );
+ok( !utf8::is_utf8( $row->[2] ), 'invalid UTF-8 in OCTETS not flagged' );
+
+#
+#   Trusting: UTF8 columns are flagged as they are, others still scanned
+#
+ok( $dbh->{ib_trust_utf8} = 1, 'Set ib_trust_utf8' );
+ok( $dbh->{ib_trust_utf8}, 'Get ib_trust_utf8' );
+
+$row = $dbh->selectrow_arrayref( $cursor, {}, 1 );
+ok( utf8::is_utf8( $row->[0] ), 'ASCII varchar flagged' );
+is( $row->[0], 'plain ascii', 'ASCII varchar value' );
+
+$row = $dbh->selectrow_arrayref( $cursor, {}, 2 );
+is( $row->[0], $long, 'UTF8 varchar value' );
+ok( !utf8::is_utf8( $row->[2] ), 'OCTETS still scanned' );
+
+$dbh->{ib_trust_utf8} = 0;
+
+ok($dbh->do("DROP TABLE $table"), "DROP TABLE '$table'");
+
+ok($dbh->disconnect());
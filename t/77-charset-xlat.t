@@ -0,0 +1,128 @@
+#!/usr/bin/perl
+#
+#   Test ib_enable_utf8 on single-byte connection character sets
+#   (WIN1251, ISO8859_1), transliterated by the driver
+#
+
+use strict;
+use warnings;
+
+use utf8;
+BEGIN {
+    binmode(STDERR, ':utf8');
+    binmode(STDOUT, ':utf8');
+};
+use Test::More;
+use lib 't','.';
+
+use Encode qw(encode);
+
+use TestFirebird;
+my $T = TestFirebird->new;
+
+eval "use Test::Exception; 1"
+    or plan skip_all => 'Test::Exception needed for this test';
+plan tests => 27;
+
+my $attr
+    = { RaiseError => 1, PrintError => 0, AutoCommit => 1, ChopBlanks => 1 };
+
+my $dsn = $T->{tdsn};
+$dsn =~ s/(?<=ib_charset=)[^;]+/WIN1251/;
+my $dbh = DBI->connect( $dsn, $T->{user}, $T->{pass}, $attr );
+
+ok( $dbh->{ib_enable_utf8} = 1, 'Set ib_enable_utf8 on WIN1251' );
+
+my $table = find_new_table($dbh);
+ok($table, qq{Table is '$table'});
+
+ok( $dbh->do(<<"DEF"), qq{CREATE TABLE '$table'} );
+CREATE TABLE $table (
+    id     INTEGER PRIMARY KEY,
+    varchr VARCHAR(40) CHARACTER SET WIN1251,
+    chr    CHAR(10) CHARACTER SET WIN1251,
+    blb    BLOB SUB_TYPE TEXT CHARACTER SET WIN1251
+)
+DEF
+
+my $cyr = 'Привет, мир – №1 €';
+ok( $dbh->do( "INSERT INTO $table VALUES (1, ?, ?, ?)",
+        {}, $cyr, 'Ёлка', $cyr ),
+    'INSERT Perl character strings' );
+ok( $dbh->do("INSERT INTO $table VALUES (2, 'plain', 'plain', 'plain')"),
+    'INSERT ASCII' );
+
+ok( my $cursor = $dbh->prepare("SELECT varchr, chr, blb FROM $table WHERE id = ?"),
+    'SELECT' );
+
+my $row = $dbh->selectrow_arrayref( $cursor, {}, 1 );
+is( $row->[0], $cyr, 'varchar decoded' );
+ok( utf8::is_utf8( $row->[0] ), 'varchar flagged' );
+is( $row->[1], 'Ёлка', 'char decoded and trimmed' );
+is( $row->[2], $cyr, 'blob decoded' );
+
+$row = $dbh->selectrow_arrayref( $cursor, {}, 2 );
+is( $row->[0], 'plain', 'ASCII varchar' );
+ok( !utf8::is_utf8( $row->[0] ), 'ASCII varchar not flagged' );
+
+# one byte per character on the server side
+my ($octets) = $dbh->selectrow_array(
+    "SELECT OCTET_LENGTH(varchr) FROM $table WHERE id = 1");
+is( $octets, length($cyr), 'stored one byte per character' );
+
+throws_ok(
+    sub { $dbh->do( "INSERT INTO $table VALUES (3, ?, NULL, NULL)", {}, 'Ω' ) },
+    qr/Cannot transliterate character U\+03A9 to WIN1251/,
+    'untransliterable character'
+);
+
+#
+#   byte strings are sent as they are
+#
+ok( $dbh->do( "INSERT INTO $table VALUES (4, ?, NULL, NULL)",
+        {}, encode( 'cp1251', 'Дом' ) ),
+    'INSERT cp1251 bytes' );
+$row = $dbh->selectrow_arrayref( $cursor, {}, 4 );
+is( $row->[0], 'Дом', 'bytes decoded on fetch' );
+
+$dbh->{ib_enable_utf8} = 0;
+$row = $dbh->selectrow_arrayref( $cursor, {}, 1 );
+is( $row->[0], encode( 'cp1251', $cyr ), 'raw bytes with ib_enable_utf8 off' );
+
+ok($dbh->do("DROP TABLE $table"), "DROP TABLE '$table'");
+ok($dbh->disconnect());
+
+#
+#   ISO8859_1
+#
+$dsn =~ s/(?<=ib_charset=)[^;]+/ISO8859_1/;
+$dbh = DBI->connect( $dsn, $T->{user}, $T->{pass}, $attr );
+ok( $dbh->{ib_enable_utf8} = 1, 'Set ib_enable_utf8 on ISO8859_1' );
+
+ok( $dbh->do(<<"DEF"), qq{CREATE TABLE '$table'} );
+CREATE TABLE $table (
+    id     INTEGER PRIMARY KEY,
+    varchr VARCHAR(40) CHARACTER SET ISO8859_1
+)
+DEF
+
+my $latin = 'Ça va, garçon? Grüße';
+ok( $dbh->do( "INSERT INTO $table VALUES (1, ?)", {}, $latin ), 'INSERT Latin-1' );
+($row) = $dbh->selectrow_array("SELECT varchr FROM $table WHERE id = 1");
+is( $row, $latin, 'Latin-1 round trip' );
+
+throws_ok(
+    sub { $dbh->do( "INSERT INTO $table VALUES (2, ?)", {}, 'Привет' ) },
+    qr/Cannot transliterate/,
+    'Cyrillic does not fit ISO8859_1'
+);
+
+ok($dbh->do("DROP TABLE $table"), "DROP TABLE '$table'");
+ok($dbh->disconnect());
+
+$dsn =~ s/(?<=ib_charset=)[^;]+/ASCII/;
+$dbh = DBI->connect( $dsn, $T->{user}, $T->{pass}, $attr );
+dies_ok(
+   sub { $dbh->{ib_enable_utf8} = 1 },
+   'ib_enable_utf8 still refused on ASCII');
+$dbh->disconnect;
@@ -8,13 +8,16 @@
 # Look at bigdecimal_read.t for a variant that uses plain do() without
 # parameters for the insertion of the values.
 #
+# Firebird 4.0+ also has NUMERIC(38,x), stored as INT128, and DECFLOAT.
+#
 
 use strict;
 use warnings;
 
+use B ();
 use Math::BigFloat try => 'GMP';
 use Test::More;
-use DBI;
+use DBI qw(:sql_types);
 
 use lib 't','.';
 
@@ -31,7 +34,7 @@ unless ( $dbh->isa('DBI::db') ) {
     plan skip_all => 'Connection to database failed, cannot continue testing';
 }
 else {
-    plan tests => 21;
+    plan tests => 34;
 }
 
 ok($dbh, 'Connected to the database');
@@ -92,6 +95,72 @@ for (my $i = 0; $i < @$res; $i++) {
     }
 }
 
+#
+# NUMERIC(38,4) and DECFLOAT, Firebird 4.0+
+#
+SKIP: {
+    ( my $ver = $dbh->func( version => 'ib_database_info' )->{version} )
+        =~ s/.*\bFirebird\s*//;
+    skip 'NUMERIC(38,x) and DECFLOAT need Firebird 4.0+', 13
+        unless $ver =~ /^(\d+)\./ && $1 >= 4;
+
+    my $t4 = find_new_table($dbh);
+    ok( $dbh->do(<<"DEF"), qq{CREATE TABLE '$t4'} );
+CREATE TABLE $t4 (
+    ID   INTEGER,
+    N38  NUMERIC(38,4),
+    D16  DECFLOAT(16),
+    D34  DECFLOAT(34)
+)
+DEF
+
+    my @rows = (
+        [ 1, '-9999999999999999999999999999999999.9999',
+             '-9.999999999999999E+384', '1234567890.123456789012345678901234' ],
+        [ 2, '0.3',      '0.3', '-0.000' ],
+        [ 3, '12.34565', '1E+3', '1.5e-20' ],
+        [ 4, '7',        '42',   '-42' ],
+    );
+    ok( $dbh->do( "INSERT INTO $t4 VALUES (?, ?, ?, ?)", undef, @$_ ),
+        "INSERT row $_->[0]" ) for @rows;
+
+    my $sql = "SELECT N38, D16, D34, CAST(D16 AS VARCHAR(64)),"
+        . " CAST(D34 AS VARCHAR(64)) FROM $t4 ORDER BY ID";
+    my $got;
+
+    # the same values with and without the IV shortcut
+    for my $fast (1, 0) {
+        my $mode = $fast ? 'ib_fast_int' : 'text only';
+        local $dbh->{ib_fast_int} = $fast;
+        $got = $dbh->selectall_arrayref($sql);
+
+        my $iok = B::svref_2object(\$got->[3][1])->FLAGS & B::SVf_IOK;
+        ok( $fast ? $iok : !$iok, "$mode: whole DECFLOAT as an IV or not" );
+
+        is_deeply(
+            [ map { [ @$_[ 0 .. 2 ] ] } @$got ],
+            [   [   '-9999999999999999999999999999999999.9999',
+                    '-9.999999999999999E+384',
+                    '1234567890.123456789012345678901234' ],
+                [ '0.3000',  '0.3',  '-0.000' ],
+                [ '12.3457', '1E+3', '1.5E-20' ],
+                [ '7.0000',  '42',   '-42' ],
+            ],
+            "$mode: NUMERIC(38,4) and DECFLOAT values"
+        );
+    }
+    is_deeply(
+        [ map { [ @$_[ 1, 2 ] ] } @$got ],
+        [ map { [ @$_[ 3, 4 ] ] } @$got ],
+        'DECFLOAT text as the server writes it'
+    );
+
+    my $sth = $dbh->prepare("SELECT N38, D16 FROM $t4");
+    is_deeply( $sth->{TYPE}, [ SQL_NUMERIC, SQL_DECIMAL ], 'TYPE' );
+
+    ok( $dbh->do("DROP TABLE $t4"), "DROP TABLE '$t4'" );
+}
+
 # Drop the test table
 $dbh->{AutoCommit} = 1;
 
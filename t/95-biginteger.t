@@ -4,14 +4,16 @@
 # Playing with very big | small numbers
 # Smallest and biggest integer supported by Firebird:
 #   -9223372036854775808, 9223372036854775807
+# and, from Firebird 4.0 on, INT128
 #
 
 use strict;
 use warnings;
 
+use B ();
 use Math::BigFloat try => 'GMP';
 use Test::More;
-use DBI;
+use DBI qw(:sql_types);
 
 use lib 't','.';
 
@@ -28,7 +30,7 @@ unless ( $dbh->isa('DBI::db') ) {
     plan skip_all => 'Connection to database failed, cannot continue testing';
 }
 else {
-    plan tests => 12;
+    plan tests => 31;
 }
 
 ok($dbh, 'Connected to the database');
@@ -92,6 +94,59 @@ for (my $i = 0; $i < @$res; $i++) {
     }
 }
 
+#
+# INT128, Firebird 4.0+
+#
+SKIP: {
+    ( my $ver = $dbh->func( version => 'ib_database_info' )->{version} )
+        =~ s/.*\bFirebird\s*//;
+    skip 'INT128 needs Firebird 4.0+', 19
+        unless $ver =~ /^(\d+)\./ && $1 >= 4;
+
+    my $t128 = find_new_table($dbh);
+    ok( $dbh->do("CREATE TABLE $t128 (ID INTEGER, I INT128)"),
+        qq{CREATE TABLE '$t128'} );
+
+    my @big = (
+        '-170141183460469231731687303715884105728',
+        '170141183460469231731687303715884105727',
+        '9223372036854775808',
+        42,
+        -1,
+    );
+
+    # the same values with and without the IV shortcuts
+    for my $fast (1, 0) {
+        my $mode = $fast ? 'ib_fast_int' : 'text only';
+        local $dbh->{ib_fast_int} = $fast;
+
+        # fresh IVs, not stringified by an earlier test name
+        my @bind = map { /^-?\d{1,18}\z/ ? 0 + $_ : $_ } @big;
+
+        $dbh->do("DELETE FROM $t128");
+        ok( $dbh->do( "INSERT INTO $t128 VALUES (?, ?)", undef, $_, $bind[$_] ),
+            "$mode: INSERT $big[$_]" ) for 0 .. $#big;
+
+        my $got = $dbh->selectcol_arrayref("SELECT I FROM $t128 ORDER BY ID");
+        my $iok = B::svref_2object(\$got->[3])->FLAGS & B::SVf_IOK;
+        ok( $fast ? $iok : !$iok, "$mode: 42 fetched as an IV or not" );
+        is_deeply( $got, \@big, "$mode: INT128 values" );
+    }
+
+    my $sth = $dbh->prepare("SELECT I FROM $t128");
+    is( $sth->{TYPE}[0], SQL_NUMERIC, 'TYPE is SQL_NUMERIC' );
+
+    ok( !eval {
+            $dbh->do( "INSERT INTO $t128 VALUES (9, ?)", undef,
+                '170141183460469231731687303715884105728' );
+        },
+        'out of range value refused'
+    );
+    like( $dbh->errstr, qr/Cannot convert/, 'error message' );
+
+    ok( $dbh->do("DROP TABLE $t128"), "DROP TABLE '$t128'" );
+}
+
 # Drop the test table
 $dbh->{AutoCommit} = 1;
 